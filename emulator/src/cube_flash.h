@@ -33,6 +33,7 @@
 #include "cube_cpu.h"
 #include "cube_flash_model.h"
 #include "flash_storage.h"
+#include "cube_flash_pages.h"
 #include "tracer.h"
 
 namespace Cube {
@@ -62,8 +63,9 @@ class Flash {
         uint8_t   data_drv;   // OUT, active-high
     };
 
-    void init(FlashStorage::CubeRecord *_storage) {
+    void init(FlashStorage::CubeRecord *_storage, FlashPages *_pages) {
         storage = _storage;
+        pages = _pages;
         
         cycle_count = 0;
         write_count = 0;
@@ -86,6 +88,10 @@ class Flash {
         return storage;
     }
 
+    FlashPages *getPages() const {
+        return pages;
+    }
+
     uint32_t getCycleCount() {
         uint32_t c = cycle_count;
         cycle_count = 0;
@@ -266,7 +272,7 @@ class Flash {
         if (UNLIKELY(busy | buffer_counter))
             return status_byte;
 
-        return storage->ext[latched_addr];
+        return pages->read(latched_addr);
     }
 
  private:
@@ -288,8 +294,7 @@ class Flash {
 
     void erase(unsigned addr, unsigned size) {
         addr &= ~(size - 1);
-        ASSERT(addr + size <= sizeof storage->ext);
-        memset(storage->ext + addr, 0xFF, size);
+        pages->fill(addr, size, 0xFF);
 
         unsigned sBegin = addr / FlashModel::SECTOR_SIZE;
         unsigned sEnd = (addr + size) / FlashModel::SECTOR_SIZE;
@@ -357,7 +362,7 @@ class Flash {
          */
         for (unsigned i = 0; i < buffer_bytes; i++) {
             struct cmd_state *st = &cmd_fifo[(cmd_fifo_head - buffer_bytes + i) & CMD_FIFO_MASK];
-            storage->ext[st->addr] &= st->data;
+            pages->program(st->addr, st->data);
             status_byte = FlashModel::STATUS_DATA_INV & ~st->data;
         }
 
@@ -412,9 +417,9 @@ class Flash {
 
         } else if (matchCommand(FlashModel::cmd_byte_program)) {
             Tracer::log(cpu, "FLASH: programming addr [%06x], %02x -> %02x",
-                st->addr, storage->ext[st->addr], st->data);
+                st->addr, pages->read(st->addr), st->data);
 
-            storage->ext[st->addr] &= st->data;
+            pages->program(st->addr, st->data);
             status_byte = FlashModel::STATUS_DATA_INV & ~st->data;
             busy = BF_PROGRAM_BYTE;
             write_count++;
@@ -465,6 +470,7 @@ class Flash {
     };
 
     FlashStorage::CubeRecord *storage;
+    FlashPages *pages;
 
     // For clock speed / power metrics
     uint32_t cycle_count;
@@ -0,0 +1,370 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <map>
+#include "cube_flash_pages.h"
+#include "tinythread.h"
+
+namespace Cube {
+
+
+struct FlashPages::Pool {
+    tthread::mutex lock;
+    std::multimap<uint64_t, Page*> shared;
+    std::vector<Page*> retired;
+
+    // Pinned, so erasing never has to reallocate them
+    Page *erased;
+    Page *zeroed;
+
+    Pool() : erased(0), zeroed(0) {}
+};
+
+FlashPages::Pool &FlashPages::getPool()
+{
+    // Constructed on first use, so static FlashPages can rely on it
+    static Pool pool;
+    return pool;
+}
+
+static inline uint64_t rotl64(uint64_t x, unsigned r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t FlashPages::hashPage(const uint8_t *bytes)
+{
+    // One lane of MurmurHash3, as in LCDCapture::hashFrame()
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h = 0;
+
+    for (unsigned i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)) {
+        uint64_t k;
+        memcpy(&k, bytes + i, sizeof k);
+
+        k *= c1;
+        k = rotl64(k, 31);
+        k *= c2;
+
+        h ^= k;
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+FlashPages::Page *FlashPages::newPage(const uint8_t *bytes, bool inPlace)
+{
+    Page *p = new Page;
+
+    if (inPlace) {
+        p->bytes = const_cast<uint8_t*>(bytes);
+        p->owned = false;
+    } else {
+        p->bytes = new uint8_t[PAGE_SIZE];
+        p->owned = true;
+        memcpy(p->bytes, bytes, PAGE_SIZE);
+    }
+
+    p->hash = 0;
+    p->refs = 1;
+    p->shared = false;
+    p->written = false;
+    return p;
+}
+
+FlashPages::Page *FlashPages::findShared(const uint8_t *bytes, uint64_t hash)
+{
+    // Returns a new reference to a pooled page with these contents, if any
+
+    Pool &pool = getPool();
+    std::pair<std::multimap<uint64_t, Page*>::iterator,
+              std::multimap<uint64_t, Page*>::iterator>
+        range = pool.shared.equal_range(hash);
+
+    for (std::multimap<uint64_t, Page*>::iterator i = range.first; i != range.second; ++i) {
+        Page *p = i->second;
+        if (!memcmp(p->bytes, bytes, PAGE_SIZE)) {
+            p->refs++;
+            return p;
+        }
+    }
+
+    return 0;
+}
+
+void FlashPages::addShared(Page *p, uint64_t hash)
+{
+    p->hash = hash;
+    p->shared = true;
+    getPool().shared.insert(std::make_pair(hash, p));
+}
+
+FlashPages::Page *FlashPages::filledPage(uint8_t value)
+{
+    Pool &pool = getPool();
+    Page **pinned = value == 0xFF ? &pool.erased : value == 0x00 ? &pool.zeroed : 0;
+
+    if (pinned && *pinned) {
+        (*pinned)->refs++;
+        return *pinned;
+    }
+
+    uint8_t bytes[PAGE_SIZE];
+    memset(bytes, value, sizeof bytes);
+
+    uint64_t hash = hashPage(bytes);
+    Page *p = findShared(bytes, hash);
+    if (!p) {
+        p = newPage(bytes, false);
+        addShared(p, hash);
+    }
+
+    if (pinned) {
+        p->refs++;
+        *pinned = p;
+    }
+
+    return p;
+}
+
+void FlashPages::release(Page *p)
+{
+    Pool &pool = getPool();
+
+    if (p->shared) {
+        if (--p->refs)
+            return;
+
+        std::pair<std::multimap<uint64_t, Page*>::iterator,
+                  std::multimap<uint64_t, Page*>::iterator>
+            range = pool.shared.equal_range(p->hash);
+
+        for (std::multimap<uint64_t, Page*>::iterator i = range.first; i != range.second; ++i)
+            if (i->second == p) {
+                pool.shared.erase(i);
+                break;
+            }
+    }
+
+    // The simulation thread may still be looking at this page
+    pool.retired.push_back(p);
+}
+
+void FlashPages::freeRetired()
+{
+    Pool &pool = getPool();
+
+    for (unsigned i = 0; i < pool.retired.size(); ++i) {
+        Page *p = pool.retired[i];
+        if (p->owned)
+            delete [] p->bytes;
+        delete p;
+    }
+
+    pool.retired.clear();
+}
+
+FlashPages::FlashPages()
+{
+    Pool &pool = getPool();
+    tthread::lock_guard<tthread::mutex> guard(pool.lock);
+
+    for (unsigned i = 0; i < NUM_PAGES; ++i) {
+        table[i] = filledPage(0x00);
+        modified[i] = false;
+        listed[i] = false;
+    }
+}
+
+FlashPages::~FlashPages()
+{
+    Pool &pool = getPool();
+    tthread::lock_guard<tthread::mutex> guard(pool.lock);
+
+    for (unsigned i = 0; i < NUM_PAGES; ++i)
+        release(table[i]);
+    freeRetired();
+}
+
+void FlashPages::setPage(unsigned index, Page *p)
+{
+    Page *old = table[index];
+    table[index] = p;
+    release(old);
+    modified[index] = true;
+}
+
+FlashPages::Page *FlashPages::makePrivate(unsigned index)
+{
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    makePrivateLocked(index);
+    return table[index];
+}
+
+void FlashPages::makePrivateLocked(unsigned index)
+{
+    Page *p = table[index];
+    if (!p->shared)
+        return;
+
+    setPage(index, newPage(p->bytes, false));
+
+    if (!listed[index]) {
+        listed[index] = true;
+        privatePages.push_back(index);
+    }
+}
+
+void FlashPages::share()
+{
+    /*
+     * Look for private pages that haven't been programmed since last
+     * time, and fold them back into the pool. Pages still being written
+     * wait for the next pass, so we don't copy them over and over.
+     */
+
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    unsigned kept = 0;
+
+    for (unsigned i = 0; i < privatePages.size(); ++i) {
+        unsigned index = privatePages[i];
+        Page *p = table[index];
+
+        if (p->shared) {
+            // Replaced since it was listed
+            listed[index] = false;
+            continue;
+        }
+
+        if (p->written) {
+            p->written = false;
+            privatePages[kept++] = index;
+            continue;
+        }
+
+        uint64_t hash = hashPage(p->bytes);
+        Page *s = findShared(p->bytes, hash);
+        if (s) {
+            table[index] = s;
+            release(p);
+        } else {
+            addShared(p, hash);
+        }
+        listed[index] = false;
+    }
+
+    privatePages.resize(kept);
+    freeRetired();
+}
+
+void FlashPages::fill(unsigned addr, unsigned size, uint8_t value)
+{
+    ASSERT((addr & PAGE_MASK) == 0 && (size & PAGE_MASK) == 0);
+    ASSERT(addr + size <= FlashModel::SIZE);
+
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+
+    for (unsigned i = addr >> PAGE_SHIFT, e = (addr + size) >> PAGE_SHIFT; i != e; ++i)
+        setPage(i, filledPage(value));
+}
+
+uint8_t FlashPages::peek(unsigned addr)
+{
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    return read(addr);
+}
+
+void FlashPages::poke(unsigned addr, uint8_t value)
+{
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    makePrivateLocked(addr >> PAGE_SHIFT);
+
+    Page *p = table[addr >> PAGE_SHIFT];
+    p->bytes[addr & PAGE_MASK] = value;
+    p->written = true;
+    modified[addr >> PAGE_SHIFT] = true;
+}
+
+void FlashPages::pokeProgram(unsigned addr, uint8_t value)
+{
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    makePrivateLocked(addr >> PAGE_SHIFT);
+
+    Page *p = table[addr >> PAGE_SHIFT];
+    p->bytes[addr & PAGE_MASK] &= value;
+    p->written = true;
+    modified[addr >> PAGE_SHIFT] = true;
+}
+
+void FlashPages::load(const uint8_t *image, bool inPlace)
+{
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+
+    for (unsigned i = 0; i < NUM_PAGES; ++i) {
+        const uint8_t *bytes = image + (i << PAGE_SHIFT);
+        uint64_t hash = hashPage(bytes);
+
+        Page *p = findShared(bytes, hash);
+        if (!p) {
+            p = newPage(bytes, inPlace);
+            addShared(p, hash);
+        }
+
+        setPage(i, p);
+        modified[i] = false;
+    }
+}
+
+unsigned FlashPages::copyOut(uint8_t *image, bool modifiedOnly)
+{
+    // Returns the number of pages copied
+
+    tthread::lock_guard<tthread::mutex> guard(getPool().lock);
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < NUM_PAGES; ++i)
+        if (modified[i] || !modifiedOnly) {
+            memcpy(image + (i << PAGE_SHIFT), table[i]->bytes, PAGE_SIZE);
+            if (modifiedOnly)
+                modified[i] = false;
+            count++;
+        }
+
+    return count;
+}
+
+
+};  // namespace Cube
@@ -0,0 +1,142 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Copy-on-write storage for one cube's external NOR flash.
+ *
+ * Flash is split into 4 kB pages. Pages with identical contents are
+ * stored once, in a pool shared by every cube. A cube only gets a private
+ * copy of a page when it programs that page. Erasing maps pages back to
+ * the shared erased page, so it never allocates anything. Private pages
+ * that sit idle for a while are folded back into the pool by share().
+ *
+ * Shared pages can also point straight into a read-only base image, in
+ * which case every simulator instance using that image shares the same
+ * physical memory through the OS page cache.
+ *
+ * The simulation thread reads and programs without locking, as long as
+ * the page is already private. Everything that changes the page table
+ * holds a lock, and pages that are dropped aren't freed until the next
+ * share(), which also runs on the simulation thread. Other threads must
+ * use the peek/poke/copy functions.
+ */
+
+#ifndef _CUBE_FLASH_PAGES_H
+#define _CUBE_FLASH_PAGES_H
+
+#include <stdint.h>
+#include <vector>
+#include "macros.h"
+#include "cube_flash_model.h"
+
+namespace Cube {
+
+
+class FlashPages {
+ public:
+    static const unsigned PAGE_SHIFT = 12;
+    static const unsigned PAGE_SIZE = 1 << PAGE_SHIFT;
+    static const unsigned PAGE_MASK = PAGE_SIZE - 1;
+    static const unsigned NUM_PAGES = FlashModel::SIZE / PAGE_SIZE;
+
+    FlashPages();
+    ~FlashPages();
+
+    // Simulation thread only
+
+    ALWAYS_INLINE uint8_t read(unsigned addr) const {
+        return table[addr >> PAGE_SHIFT]->bytes[addr & PAGE_MASK];
+    }
+
+    ALWAYS_INLINE void program(unsigned addr, uint8_t data) {
+        unsigned index = addr >> PAGE_SHIFT;
+        Page *p = table[index];
+        if (UNLIKELY(p->shared))
+            p = makePrivate(index);
+        p->bytes[addr & PAGE_MASK] &= data;
+        p->written = true;
+        modified[index] = true;
+    }
+
+    void share();
+
+    // Any thread
+
+    void fill(unsigned addr, unsigned size, uint8_t value);
+    uint8_t peek(unsigned addr);
+    void poke(unsigned addr, uint8_t value);
+    void pokeProgram(unsigned addr, uint8_t value);
+
+    /*
+     * Replace everything with the contents of a full-size image. With
+     * 'inPlace', pages that aren't already pooled keep pointing into
+     * 'image', which must outlive every FlashPages.
+     */
+    void load(const uint8_t *image, bool inPlace = false);
+
+    /*
+     * Copy the whole image out, or only the pages changed since the last
+     * load() or modifiedOnly copy.
+     */
+    unsigned copyOut(uint8_t *image, bool modifiedOnly = false);
+
+ private:
+    struct Page {
+        uint8_t *bytes;
+        uint64_t hash;
+        unsigned refs;
+        bool shared;        // Pooled and read-only
+        bool owned;         // 'bytes' belongs to us
+        bool written;       // Programmed since the last share()
+    };
+
+    Page *table[NUM_PAGES];
+    bool modified[NUM_PAGES];
+    bool listed[NUM_PAGES];
+    std::vector<uint16_t> privatePages;
+
+    struct Pool;
+    static Pool &getPool();
+
+    Page *makePrivate(unsigned index);
+    void makePrivateLocked(unsigned index);
+    void setPage(unsigned index, Page *p);
+
+    // These all require the pool lock
+    static Page *newPage(const uint8_t *bytes, bool inPlace);
+    static Page *findShared(const uint8_t *bytes, uint64_t hash);
+    static void addShared(Page *p, uint64_t hash);
+    static Page *filledPage(uint8_t value);
+    static void release(Page *p);
+    static void freeRetired();
+
+    static uint64_t hashPage(const uint8_t *bytes);
+};
+
+
+};  // namespace Cube
+
+#endif
@@ -31,7 +31,7 @@
 namespace Cube {
 
 bool Hardware::init(VirtualTime *masterTimer, const char *firmwareFile,
-    FlashStorage::CubeRecord *flashStorage)
+    FlashStorage::CubeRecord *flashStorage, FlashPages *flashPages)
 {
     time = masterTimer;
     hwDeadline.init(time);
@@ -57,7 +57,7 @@ bool Hardware::init(VirtualTime *masterTimer, const char *firmwareFile,
         CPU::em8051_init_sbt(&cpu);
     }
 
-    flash.init(flashStorage);
+    flash.init(flashStorage, flashPages);
     spi.radio.init(&cpu);
     spi.init(&cpu);
     adc.init();
@@ -97,7 +97,7 @@ void Hardware::fullReset()
     // Reset the contents of flash memory as well
     FlashStorage::CubeRecord *rec = flash.getStorage();
     memset(rec->nvm, 0xFF, sizeof rec->nvm);
-    memset(rec->ext, 0xFF, sizeof rec->ext);
+    flash.getPages()->fill(0, FlashModel::SIZE, 0xFF);
     reset();
 }
 
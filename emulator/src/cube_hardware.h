@@ -97,7 +97,7 @@ class Hardware {
     RNG rng;
 
     bool init(VirtualTime *masterTimer, const char *firmwareFile,
-        FlashStorage::CubeRecord *flashStorage);
+        FlashStorage::CubeRecord *flashStorage, FlashPages *flashPages);
 
     void reset();
     void fullReset();
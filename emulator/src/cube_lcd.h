@@ -29,8 +29,10 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <algorithm>
 
 #include "vtime.h"
+#include "cube_lcd_capture.h"
 
 namespace Cube {
 
@@ -58,6 +60,61 @@ class LCD {
     /* 16-bit RGB 5-6-5 format */
     uint16_t fb_mem[FB_SIZE];
 
+    /* Optional recorder for completed frames. Survives init(). */
+    LCDCapture *capture;
+
+    /*
+     * Bounding box of the pixels that may have changed, in framebuffer
+     * coordinates. Inclusive on both ends, and empty when x0 > x1.
+     */
+    struct DirtyRect {
+        uint8_t x0, x1, y0, y1;
+
+        static DirtyRect empty() {
+            DirtyRect r = { 0xFF, 0, 0xFF, 0 };
+            return r;
+        }
+
+        static DirtyRect full() {
+            DirtyRect r = { 0, WIDTH - 1, 0, HEIGHT - 1 };
+            return r;
+        }
+
+        bool isEmpty() const {
+            return x0 > x1;
+        }
+
+        unsigned width() const {
+            return isEmpty() ? 0 : x1 - x0 + 1;
+        }
+
+        unsigned height() const {
+            return isEmpty() ? 0 : y1 - y0 + 1;
+        }
+
+        void add(const DirtyRect &o) {
+            x0 = std::min(x0, o.x0);
+            x1 = std::max(x1, o.x1);
+            y0 = std::min(y0, o.y0);
+            y1 = std::max(y1, o.y1);
+        }
+
+        uint32_t pack() const {
+            return x0 | (x1 << 8) | (y0 << 16) | (uint32_t(y1) << 24);
+        }
+
+        static DirtyRect unpack(uint32_t word) {
+            DirtyRect r = { uint8_t(word), uint8_t(word >> 8),
+                            uint8_t(word >> 16), uint8_t(word >> 24) };
+            return r;
+        }
+    };
+
+    LCD() : capture(0) {
+        dirty_word = DirtyRect::full().pack();
+        active_word = DirtyRect::empty().pack();
+    }
+
     void init() {
         // Framebuffer contents undefined. Simulate that...
         uint32_t i;
@@ -84,6 +141,9 @@ class LCD {
         
         frame_count = 0;
         pixel_count = 0;
+
+        markDirty(DirtyRect::full());
+        __sync_lock_test_and_set(&active_word, DirtyRect::empty().pack());
     }
 
     ALWAYS_INLINE void cycle(Pins *pins) {
@@ -132,6 +192,20 @@ class LCD {
         return mode_awake && mode_display_on;
     }
 
+    DirtyRect takeDirtyRect() {
+        /*
+         * Return everything written since the last call, for the GUI
+         * thread. Pixels may still be arriving in the current RAMWR
+         * window, so include that too. We'll report it again next time,
+         * after it has been retired into dirty_word.
+         */
+
+        DirtyRect r = DirtyRect::unpack(__sync_lock_test_and_set(&dirty_word,
+            DirtyRect::empty().pack()));
+        r.add(DirtyRect::unpack(__sync_fetch_and_or(&active_word, 0)));
+        return r;
+    }
+
     void pulseTE(TickDeadline &deadline) {
         if (mode_te) {
             // This runs on the GUI thread, use a lock-free timer.
@@ -170,9 +244,10 @@ class LCD {
         col = (flags & MADCTR_MX) ? (WIDTH - 1 - col) : col;
     }
 
-    void writePixel(uint16_t pixel) {
-        unsigned vRow = row;
-        unsigned vCol = col;
+    void mapPixel(unsigned row, unsigned col, unsigned &vRow, unsigned &vCol) {
+        // Convert controller coordinates to framebuffer coordinates
+        vRow = row;
+        vCol = col;
         uint8_t m = madctr ^ model.madctr_xor;
 
         if (model.order == model.MIRROR_BEFORE_SWAP)
@@ -186,6 +261,11 @@ class LCD {
 
         if (model.order == model.SWAP_BEFORE_MIRROR)
             applyMirroring(m, vRow, vCol);
+    }
+
+    void writePixel(uint16_t pixel) {
+        unsigned vRow, vCol;
+        mapPixel(row, col, vRow, vCol);
 
         unsigned addr = vCol + (vRow << FB_ROW_SHIFT);
         fb_mem[addr & FB_MASK] = pixel;
@@ -251,7 +331,50 @@ class LCD {
         }
     }
 
+    void markDirty(const DirtyRect &r) {
+        uint32_t oldWord, newWord;
+        do {
+            oldWord = dirty_word;
+            DirtyRect u = DirtyRect::unpack(oldWord);
+            u.add(r);
+            newWord = u.pack();
+        } while (!__sync_bool_compare_and_swap(&dirty_word, oldWord, newWord));
+    }
+
+    void beginWrite() {
+        /*
+         * Every pixel in a RAMWR lands inside the CASET/RASET window, so
+         * its corners bound the damage. Anything that wraps around the
+         * framebuffer is treated as a full-screen write.
+         */
+
+        unsigned r0, c0, r1, c1;
+        mapPixel(ys, xs, r0, c0);
+        mapPixel(ye, xe, r1, c1);
+
+        DirtyRect r;
+        if (std::max(r0, r1) >= HEIGHT || std::max(c0, c1) >= WIDTH) {
+            r = DirtyRect::full();
+        } else {
+            r.x0 = std::min(c0, c1);
+            r.x1 = std::max(c0, c1);
+            r.y0 = std::min(r0, r1);
+            r.y1 = std::max(r0, r1);
+        }
+
+        __sync_lock_test_and_set(&active_word, r.pack());
+    }
+
+    void endWrite() {
+        // Retire the RAMWR window before clearing it, so the GUI can't miss it
+        markDirty(DirtyRect::unpack(active_word));
+        __sync_lock_test_and_set(&active_word, DirtyRect::empty().pack());
+    }
+
     ALWAYS_INLINE void command(uint8_t op) {
+        if (current_cmd == CMD_RAMWR)
+            endWrite();
+
         current_cmd = op;
         cmd_bytecount = 0;
 
@@ -259,6 +382,7 @@ class LCD {
 
         case CMD_RAMWR:
             firstPixel();
+            beginWrite();
             break;
 
         case CMD_SWRESET:
@@ -288,6 +412,8 @@ class LCD {
              * like STAMP mode.
              */
             frame_count++;
+            if (capture)
+                capture->captureFrame(fb_mem);
             break;
 
         case CMD_TEOFF:
@@ -419,6 +545,13 @@ class LCD {
 
     uint32_t frame_count;
     uint32_t pixel_count;
+
+    /*
+     * Packed DirtyRects, shared with the GUI thread. Pixels from
+     * earlier writes, and the window of the RAMWR in progress.
+     */
+    volatile uint32_t dirty_word;
+    volatile uint32_t active_word;
     uint64_t te_timestamp;
 
     /* Hardware interface */
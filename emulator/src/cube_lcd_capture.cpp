@@ -0,0 +1,418 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "cube_lcd_capture.h"
+#include "lodepng.h"
+#include "color.h"
+
+namespace Cube {
+
+// Offset of the acTL chunk: PNG signature, then a 13-byte IHDR chunk
+static const unsigned ACTL_OFFSET = 8 + 12 + 13;
+
+// Used for the last frame of a video, which has no successor to time it by
+static const uint64_t LAST_FRAME_CLOCKS = VirtualTime::HZ / 60;
+
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void writeChunk(FILE *f, const char *type, const uint8_t *data, unsigned length)
+{
+    unsigned char *chunk = 0;
+    size_t chunkLength = 0;
+
+    if (!LodePNG_create_chunk(&chunk, &chunkLength, length, type, data))
+        fwrite(chunk, chunkLength, 1, f);
+    free(chunk);
+}
+
+static void writeAnimationControl(FILE *f, unsigned numFrames)
+{
+    uint8_t acTL[8];
+    put32(acTL + 0, numFrames);
+    put32(acTL + 4, 0);         // Loop forever
+    writeChunk(f, "acTL", acTL, sizeof acTL);
+}
+
+static inline uint64_t rotl64(uint64_t x, unsigned r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t LCDCapture::hashFrame(const uint16_t *fb)
+{
+    /*
+     * One lane of MurmurHash3, fed 64 bits at a time. Good enough to
+     * tell frames apart, and much cheaper than encoding them.
+     */
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(fb);
+    const unsigned numWords = FB_SIZE * sizeof *fb / sizeof(uint64_t);
+    uint64_t h = 0;
+
+    for (unsigned i = 0; i < numWords; ++i) {
+        uint64_t k;
+        memcpy(&k, bytes + i * sizeof k, sizeof k);
+
+        k *= c1;
+        k = rotl64(k, 31);
+        k *= c2;
+
+        h ^= k;
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+    }
+
+    h ^= FB_SIZE * sizeof *fb;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+LCDCapture::LCDCapture()
+    : encoderThread(0), running(false), time(0),
+      logFile(0), videoFile(0), encoderExiting(false),
+      videoFrames(0), videoSequence(0)
+{}
+
+LCDCapture::~LCDCapture()
+{
+    stop();
+}
+
+bool LCDCapture::start(const VirtualTime *time, const char *hashLog, const char *video)
+{
+    stop();
+
+    FILE *newLog = 0;
+    FILE *newVideo = 0;
+
+    if (hashLog) {
+        newLog = fopen(hashLog, "wb");
+        if (!newLog)
+            return false;
+
+        uint64_t magic = LOG_MAGIC;
+        fwrite(&magic, sizeof magic, 1, newLog);
+    }
+
+    if (video) {
+        newVideo = fopen(video, "wb");
+        if (!newVideo) {
+            if (newLog)
+                fclose(newLog);
+            return false;
+        }
+
+        static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        fwrite(signature, sizeof signature, 1, newVideo);
+
+        uint8_t ihdr[13];
+        put32(ihdr + 0, WIDTH);
+        put32(ihdr + 4, HEIGHT);
+        ihdr[8] = 8;            // Bit depth
+        ihdr[9] = 2;            // RGB
+        ihdr[10] = 0;           // Compression
+        ihdr[11] = 0;           // Filter
+        ihdr[12] = 0;           // No interlacing
+        writeChunk(newVideo, "IHDR", ihdr, sizeof ihdr);
+
+        // Frame count isn't known yet, we patch this in stop()
+        writeAnimationControl(newVideo, 0);
+    }
+
+    tthread::lock_guard<tthread::mutex> guard(mutex);
+
+    this->time = time;
+    hashes.clear();
+    logFile = newLog;
+    videoFile = newVideo;
+    videoFrames = 0;
+    videoSequence = 0;
+    encoderExiting = false;
+
+    if (videoFile)
+        encoderThread = new tthread::thread(encoderThreadFn, this);
+
+    running = true;
+    return true;
+}
+
+unsigned LCDCapture::stop()
+{
+    {
+        tthread::lock_guard<tthread::mutex> guard(mutex);
+
+        if (!running)
+            return hashes.size();
+        running = false;
+
+        if (logFile) {
+            fclose(logFile);
+            logFile = 0;
+        }
+
+        encoderExiting = true;
+        cond.notify_all();
+    }
+
+    if (encoderThread) {
+        encoderThread->join();
+        delete encoderThread;
+        encoderThread = 0;
+    }
+
+    if (videoFile) {
+        fseek(videoFile, ACTL_OFFSET, SEEK_SET);
+        writeAnimationControl(videoFile, videoFrames);
+        fseek(videoFile, 0, SEEK_END);
+        writeChunk(videoFile, "IEND", 0, 0);
+
+        fclose(videoFile);
+        videoFile = 0;
+    }
+
+    return hashes.size();
+}
+
+void LCDCapture::captureFrame(const uint16_t *fb)
+{
+    tthread::lock_guard<tthread::mutex> guard(mutex);
+
+    if (!running)
+        return;
+
+    uint64_t hash = hashFrame(fb);
+    hashes.push_back(hash);
+    if (logFile)
+        fwrite(&hash, sizeof hash, 1, logFile);
+
+    if (videoFile) {
+        while (queue.size() >= MAX_QUEUED_FRAMES)
+            cond.wait(mutex);
+
+        Frame *frame = new Frame;
+        memcpy(frame->pixels, fb, sizeof frame->pixels);
+        frame->clocks = time ? time->clocks : 0;
+
+        queue.push_back(frame);
+        cond.notify_all();
+    }
+}
+
+bool LCDCapture::compare(const char *goldenLog, unsigned &frame,
+    uint64_t &actual, uint64_t &expected)
+{
+    std::vector<uint64_t> ours;
+    {
+        tthread::lock_guard<tthread::mutex> guard(mutex);
+        ours = hashes;
+    }
+
+    FILE *f = fopen(goldenLog, "rb");
+    if (!f)
+        return false;
+
+    uint64_t magic;
+    if (fread(&magic, sizeof magic, 1, f) != 1 || magic != LOG_MAGIC) {
+        fclose(f);
+        return false;
+    }
+
+    /*
+     * Walk both sequences together. A frame missing from either side
+     * reads as a hash of zero, so a run that's too short or too long
+     * reports the first frame past the end of the shorter one.
+     */
+
+    frame = 0;
+    for (;;) {
+        uint64_t golden[512];
+        unsigned count = fread(golden, sizeof golden[0], 512, f);
+
+        for (unsigned i = 0; i < count; ++i, ++frame) {
+            if (frame >= ours.size() || ours[frame] != golden[i]) {
+                actual = frame < ours.size() ? ours[frame] : 0;
+                expected = golden[i];
+                fclose(f);
+                return true;
+            }
+        }
+
+        if (count < 512)
+            break;
+    }
+
+    fclose(f);
+
+    if (frame < ours.size()) {
+        actual = ours[frame];
+        expected = 0;
+    } else {
+        frame = ~0U;
+    }
+
+    return true;
+}
+
+void LCDCapture::encoderThreadFn(void *param)
+{
+    static_cast<LCDCapture*>(param)->encoderLoop();
+}
+
+void LCDCapture::encoderLoop()
+{
+    /*
+     * Each frame is shown until the next one arrives, so we hold one
+     * frame back until we know its duration.
+     */
+
+    Frame *prev = 0;
+    uint64_t delay = LAST_FRAME_CLOCKS;
+
+    for (;;) {
+        Frame *frame;
+        {
+            tthread::lock_guard<tthread::mutex> guard(mutex);
+
+            while (queue.empty() && !encoderExiting)
+                cond.wait(mutex);
+            if (queue.empty())
+                break;
+
+            frame = queue.front();
+            queue.pop_front();
+            cond.notify_all();
+        }
+
+        if (prev) {
+            delay = frame->clocks - prev->clocks;
+            encodeFrame(prev, delay);
+            delete prev;
+        }
+        prev = frame;
+    }
+
+    if (prev) {
+        encodeFrame(prev, delay);
+        delete prev;
+    }
+}
+
+void LCDCapture::encodeFrame(const Frame *frame, uint64_t delay)
+{
+    /*
+     * Encode the frame as a standalone PNG, then repackage its IDAT
+     * chunks for the animation. Every frame must use the colour type we
+     * declared in IHDR, so don't let the encoder pick its own.
+     */
+
+    std::vector<uint8_t> pixels;
+    pixels.reserve(FB_SIZE * 3);
+
+    for (unsigned i = 0; i < FB_SIZE; i++) {
+        RGB565 color = frame->pixels[i];
+        pixels.push_back(color.red());
+        pixels.push_back(color.green());
+        pixels.push_back(color.blue());
+    }
+
+    LodePNG::Encoder encoder;
+    encoder.getSettings().autoLeaveOutAlphaChannel = 0;
+    encoder.getSettings().add_id = 0;
+    encoder.getInfoRaw().color.colorType = 2;
+    encoder.getInfoPng().color.colorType = 2;
+
+    std::vector<uint8_t> png;
+    encoder.encode(png, pixels, WIDTH, HEIGHT);
+    if (encoder.hasError() || png.size() < 8)
+        return;
+
+    uint64_t ms = delay * 1000 / VirtualTime::HZ;
+    if (ms > 0xFFFF)
+        ms = 0xFFFF;
+
+    uint8_t fcTL[26];
+    put32(fcTL + 0, videoSequence++);
+    put32(fcTL + 4, WIDTH);
+    put32(fcTL + 8, HEIGHT);
+    put32(fcTL + 12, 0);        // X offset
+    put32(fcTL + 16, 0);        // Y offset
+    put16(fcTL + 20, ms);       // Delay numerator
+    put16(fcTL + 22, 1000);     // Delay denominator
+    fcTL[24] = 0;               // No disposal
+    fcTL[25] = 0;               // Replace, don't blend
+    writeChunk(videoFile, "fcTL", fcTL, sizeof fcTL);
+
+    const uint8_t *end = &png[0] + png.size();
+    const uint8_t *chunk = &png[0] + 8;
+    std::vector<uint8_t> fdAT;
+
+    while (chunk + 12 <= end && !LodePNG_chunk_type_equals(chunk, "IEND")) {
+        unsigned length = LodePNG_chunk_length(chunk);
+        const uint8_t *data = LodePNG_chunk_data_const(chunk);
+        if (data + length + 4 > end)
+            break;
+
+        if (LodePNG_chunk_type_equals(chunk, "IDAT")) {
+            if (videoFrames == 0) {
+                // The first frame doubles as the default image
+                fwrite(chunk, length + 12, 1, videoFile);
+            } else {
+                fdAT.resize(length + 4);
+                put32(&fdAT[0], videoSequence++);
+                memcpy(&fdAT[4], data, length);
+                writeChunk(videoFile, "fdAT", &fdAT[0], fdAT.size());
+            }
+        }
+
+        chunk = LodePNG_chunk_next_const(chunk);
+    }
+
+    videoFrames++;
+}
+
+
+};  // namespace Cube
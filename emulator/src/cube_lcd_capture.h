@@ -0,0 +1,129 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _CUBE_LCD_CAPTURE_H
+#define _CUBE_LCD_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include "tinythread.h"
+#include "vtime.h"
+
+namespace Cube {
+
+
+/*
+ * Records every frame the LCD finishes, for regression testing of
+ * animations without a window.
+ *
+ * Each frame is reduced to a 64-bit hash. Hashes are kept in memory for
+ * comparison against a golden log, and optionally written to a compact
+ * log file: an 8-byte magic number followed by one little-endian 64-bit
+ * hash per frame.
+ *
+ * Frames can also be encoded losslessly to an animated PNG. Encoding
+ * runs on its own thread, so the simulation only pays for a copy of the
+ * framebuffer. If the encoder falls too far behind, the simulation
+ * waits for it rather than dropping frames.
+ *
+ * captureFrame() is called from the cube simulation thread. Everything
+ * else may be called from the Lua thread.
+ */
+
+class LCDCapture {
+public:
+    static const unsigned WIDTH = 128;
+    static const unsigned HEIGHT = 128;
+    static const unsigned FB_SIZE = WIDTH * HEIGHT;
+
+    static const uint64_t LOG_MAGIC = 0x314853414843434cULL;   // 'LCCHASH1'
+
+    LCDCapture();
+    ~LCDCapture();
+
+    /*
+     * Begin a new capture. Either filename may be NULL. Frame timing for
+     * the video comes from 'time'. Returns false if a file couldn't be
+     * opened.
+     */
+    bool start(const VirtualTime *time, const char *hashLog, const char *video);
+
+    // Finish writing all files. Returns the number of frames captured.
+    unsigned stop();
+
+    bool isRunning() const {
+        return running;
+    }
+
+    // Called by the LCD each time a frame is complete
+    void captureFrame(const uint16_t *fb);
+
+    /*
+     * Compare the hashes from the current or most recent capture with a
+     * golden log. Returns false if the log can't be read. On a mismatch,
+     * 'frame' is the first frame that differs; otherwise it's set to ~0.
+     */
+    bool compare(const char *goldenLog, unsigned &frame,
+        uint64_t &actual, uint64_t &expected);
+
+    static uint64_t hashFrame(const uint16_t *fb);
+
+private:
+    static const unsigned MAX_QUEUED_FRAMES = 64;
+
+    struct Frame {
+        uint16_t pixels[FB_SIZE];
+        uint64_t clocks;
+    };
+
+    tthread::mutex mutex;
+    tthread::condition_variable cond;
+    tthread::thread *encoderThread;
+    bool running;
+
+    const VirtualTime *time;
+    std::vector<uint64_t> hashes;
+    FILE *logFile;
+
+    // Video encoder state, shared with the encoder thread
+    FILE *videoFile;
+    std::deque<Frame*> queue;
+    bool encoderExiting;
+    unsigned videoFrames;
+    unsigned videoSequence;
+
+    static void encoderThreadFn(void *param);
+    void encoderLoop();
+    void encodeFrame(const Frame *frame, uint64_t delay);
+};
+
+
+};  // namespace Cube
+
+#endif
@@ -27,6 +27,7 @@
 #ifdef _WIN32
 #   define WIN32_LEAN_AND_MEAN
 #   include <windows.h>
+#   include <winioctl.h>
 #else
 #   include <sys/mman.h>
 #   include <sys/stat.h>
@@ -38,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "macros.h"
 #include "flash_device.h"
 #include "flash_storage.h"
@@ -52,7 +54,7 @@ extern const uint8_t launcher[];
 
 
 FlashStorage::FlashStorage()
-    : data(NULL), isInitialized(false) {}
+    : data(NULL), isInitialized(false), cubeBase(NULL) {}
     
 FlashStorage::~FlashStorage()
 {
@@ -63,25 +65,38 @@ FlashStorage::~FlashStorage()
     }
 }
 
-bool FlashStorage::init(const char *filename)
+bool FlashStorage::init(const char *filename, const char *cubeBaseFilename)
 {
     ASSERT(isInitialized == false);
     isFileBacked = filename != NULL;
 
+    if (cubeBaseFilename && !mapBaseFile(cubeBaseFilename))
+        return false;
+
+    bool newData = true;
+
     if (isFileBacked) {
         // Disk-backed flash memory
-        if (!mapFile(filename))
-            return false;
-        if (!checkData()) {
-            unmapFile();
+        if (!mapFile(filename, newData) || !checkData()) {
+            if (data)
+                unmapFile();
+            unmapBaseFile();
+            data = NULL;
             return false;
         }
     } else {
-        // Anonymous non-persistent flash memory
-        data = new FileRecord();
+        // Anonymous non-persistent flash memory, zero-filled on demand
+        if (!allocAnonymous()) {
+            unmapBaseFile();
+            return false;
+        }
         initData();
     }
 
+    // New cube flash is already set up in cubeFlash; don't read it back
+    if (cubeBase || !newData)
+        loadCubes();
+
     isInitialized = true;
     return true;
 }
@@ -90,28 +105,196 @@ void FlashStorage::exit()
 {
     ASSERT(isInitialized == true);
 
+    saveCubes();
+
+    // Let go of any pages that point into the base image
+    for (unsigned i = 0; i < arraysize(cubeFlash); ++i) {
+        cubeFlash[i].fill(0, Cube::FlashModel::SIZE, 0x00);
+        cubeFlash[i].share();
+    }
+    unmapBaseFile();
+
     if (isFileBacked)
         unmapFile();
     else
-        delete data;
+        freeAnonymous();
 
     data = NULL;
     isInitialized = false;
 }
 
+void FlashStorage::syncCubes()
+{
+    for (unsigned i = 0; i < arraysize(cubeFlash); ++i)
+        cubeFlash[i].share();
+
+    saveCubes();
+}
+
+void FlashStorage::loadCubes()
+{
+    for (unsigned i = 0; i < arraysize(cubeFlash); ++i) {
+        if (cubeBase) {
+            cubeFlash[i].load(cubeBase->cubes[i].ext, true);
+        } else if (isFileBacked) {
+            cubeFlash[i].load(data->cubes[i].ext);
+            releaseCubeMemory(i);
+        }
+    }
+}
+
+void FlashStorage::saveCubes()
+{
+    // Changes made on top of a base image are intentionally discarded
+    if (!isFileBacked || cubeBase)
+        return;
+
+    for (unsigned i = 0; i < arraysize(cubeFlash); ++i)
+        if (cubeFlash[i].copyOut(data->cubes[i].ext, true))
+            releaseCubeMemory(i);
+}
+
+void FlashStorage::releaseCubeMemory(unsigned id)
+{
+    /*
+     * The file's copy of cube flash is only touched when loading and
+     * saving. Write it out, then drop it from our working set.
+     */
+
+#ifndef _WIN32
+    const uintptr_t pageMask = Cube::FlashPages::PAGE_SIZE - 1;
+    uintptr_t begin = (uintptr_t(data->cubes[id].ext) + pageMask) & ~pageMask;
+    uintptr_t end = (uintptr_t(data->cubes[id].ext) + sizeof data->cubes[id].ext) & ~pageMask;
+
+    msync((void*) begin, end - begin, MS_SYNC);
+    madvise((void*) begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void FlashStorage::readMaster(uint32_t address, uint8_t *buf, unsigned len) const
+{
+    ASSERT(address <= FlashDevice::CAPACITY && len <= FlashDevice::CAPACITY - address);
+
+    while (len) {
+        unsigned block = address / FlashDevice::ERASE_BLOCK_SIZE;
+        unsigned chunk = std::min(len, (block + 1) * FlashDevice::ERASE_BLOCK_SIZE - address);
+
+        if (isMasterBlockErased(block))
+            memset(buf, 0xFF, chunk);
+        else
+            memcpy(buf, data->master.bytes + address, chunk);
+
+        address += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+bool FlashStorage::compareMaster(uint32_t address, const uint8_t *buf, unsigned len) const
+{
+    ASSERT(address <= FlashDevice::CAPACITY && len <= FlashDevice::CAPACITY - address);
+
+    while (len) {
+        unsigned block = address / FlashDevice::ERASE_BLOCK_SIZE;
+        unsigned chunk = std::min(len, (block + 1) * FlashDevice::ERASE_BLOCK_SIZE - address);
+
+        if (isMasterBlockErased(block)) {
+            for (unsigned i = 0; i < chunk; ++i)
+                if (buf[i] != 0xFF)
+                    return false;
+        } else if (memcmp(buf, data->master.bytes + address, chunk)) {
+            return false;
+        }
+
+        address += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+uint8_t *FlashStorage::writableMaster(uint32_t address, unsigned len)
+{
+    /*
+     * Make sure every block in this range holds real data, then return
+     * a pointer to it. Erased blocks only get filled in here, on their
+     * first write after being erased.
+     */
+
+    ASSERT(address <= FlashDevice::CAPACITY && len <= FlashDevice::CAPACITY - address);
+
+    if (len) {
+        unsigned first = address / FlashDevice::ERASE_BLOCK_SIZE;
+        unsigned last = (address + len - 1) / FlashDevice::ERASE_BLOCK_SIZE;
+
+        for (unsigned block = first; block <= last; ++block)
+            if (isMasterBlockErased(block)) {
+                memset(data->master.bytes + block * FlashDevice::ERASE_BLOCK_SIZE,
+                    0xFF, FlashDevice::ERASE_BLOCK_SIZE);
+                data->header.mc_erasedBlocks[block >> 5] &= ~(1U << (block & 31));
+            }
+    }
+
+    return data->master.bytes + address;
+}
+
+void FlashStorage::eraseMasterBlock(unsigned block)
+{
+    ASSERT(block < FlashDevice::CAPACITY / FlashDevice::ERASE_BLOCK_SIZE);
+    uint8_t *bytes = data->master.bytes + block * FlashDevice::ERASE_BLOCK_SIZE;
+
+    if (hasErasedBitmap()) {
+        data->header.mc_erasedBlocks[block >> 5] |= 1U << (block & 31);
+        discardMemory(bytes, FlashDevice::ERASE_BLOCK_SIZE);
+    } else {
+        memset(bytes, 0xFF, FlashDevice::ERASE_BLOCK_SIZE);
+    }
+}
+
+void FlashStorage::eraseMasterAll()
+{
+    if (hasErasedBitmap()) {
+        memset(data->header.mc_erasedBlocks, 0xFF, sizeof data->header.mc_erasedBlocks);
+        discardMemory(data->master.bytes, sizeof data->master.bytes);
+    } else {
+        memset(data->master.bytes, 0xFF, sizeof data->master.bytes);
+    }
+}
+
+void FlashStorage::discardMemory(void *addr, uintptr_t size)
+{
+    /*
+     * We no longer care about the contents of this memory. Where the OS
+     * lets us, give it back, so erased blocks don't take up disk space
+     * in the storage file. Only whole pages inside the range are freed.
+     */
+
+#if !defined(_WIN32) && defined(MADV_REMOVE)
+    const uintptr_t pageMask = Cube::FlashPages::PAGE_SIZE - 1;
+    uintptr_t begin = (uintptr_t(addr) + pageMask) & ~pageMask;
+    uintptr_t end = (uintptr_t(addr) + size) & ~pageMask;
+
+    if (end > begin)
+        madvise((void*) begin, end - begin, isFileBacked ? MADV_REMOVE : MADV_DONTNEED);
+#endif
+}
+
 void FlashStorage::initData()
 {
-    ASSERT(data);
+    /*
+     * New storage is always zero-filled already, and we only write the
+     * parts that need to be something else.
+     */
 
-    // Zero unused parts of the header
-    memset(data->header.bytes, 0x00, sizeof data->header.bytes);
+    ASSERT(data);
 
-    initCubes();
-    initMC();
+    initCubes(true);
+    initMC(true);
     initHeader();
 }
 
-void FlashStorage::initCubes()
+void FlashStorage::initCubes(bool isZeroed)
 {
     for (unsigned i = 0; i < arraysize(data->cubes); ++i) {
         CubeRecord &cube = data->cubes[i];
@@ -123,10 +306,13 @@ void FlashStorage::initCubes()
         // the firmware to erase all areas before they're used. It shouldn't
         // be making assumptions about blocks being already-erased unless it
         // knows this for certain.
-        memset(cube.ext, 0x00, sizeof cube.ext);
+        cubeFlash[i].fill(0, sizeof cube.ext, 0x00);
+        if (isFileBacked && !isZeroed)
+            memset(cube.ext, 0x00, sizeof cube.ext);
 
         // Zero out the erase counts
-        memset(cube.eraseCounts, 0x00, sizeof cube.eraseCounts);
+        if (!isZeroed)
+            memset(cube.eraseCounts, 0x00, sizeof cube.eraseCounts);
     }
 
     data->header.cube_count = arraysize(data->cubes);
@@ -135,14 +321,17 @@ void FlashStorage::initCubes()
     data->header.cube_sectorSize = Cube::FlashModel::SECTOR_SIZE;
 }
 
-void FlashStorage::initMC()
+void FlashStorage::initMC(bool isZeroed)
 {
     // Initialize internal flash to all zeroes, also to make sure nobody
     // relies on it starting out erased.
-    memset(data->master.bytes, 0x00, sizeof data->master.bytes);
+    memset(data->header.mc_erasedBlocks, 0x00, sizeof data->header.mc_erasedBlocks);
+    if (!isZeroed)
+        memset(data->master.bytes, 0x00, sizeof data->master.bytes);
 
     // Zero out the erase counts
-    memset(data->master.eraseCounts, 0x00, sizeof data->master.eraseCounts);
+    if (!isZeroed)
+        memset(data->master.eraseCounts, 0x00, sizeof data->master.eraseCounts);
 
     data->header.mc_pageSize = FlashDevice::PAGE_SIZE;
     data->header.mc_capacity = FlashDevice::CAPACITY;
@@ -197,7 +386,10 @@ bool FlashStorage::checkData()
 {
     /*
      * In the future, we may have softer versioning for these storage files.
-     * For now, require that everything matches our current version exactly.
+     * For now, require that everything matches our current version exactly,
+     * except that version 1 files are still used as-is. They only lack the
+     * erased block bitmap, and their header padding is always zero, which
+     * means no blocks are marked. We leave them at version 1.
      *
      * The only currently permissible variation: Cube data is optional.
      * If the file has cube_count==0, we ignore all cube data and reinitialize
@@ -209,7 +401,8 @@ bool FlashStorage::checkData()
         return false;
     }
 
-    if (data->header.version != HeaderRecord::CURRENT_VERSION) {
+    uint32_t version = data->header.version;
+    if (version != 1 && version != HeaderRecord::CURRENT_VERSION) {
         LOG(("FLASH: Storage file has an unsupported version\n"));
         return false;
     }
@@ -217,18 +410,12 @@ bool FlashStorage::checkData()
     if (data->header.cube_count == 0) {
         // Importing a file with no cubes. Update cubes and header, leave MC alone.
         initHeader();
-        initCubes();
+        data->header.version = version;
+        initCubes(false);
         LOG(("FLASH: Importing storage file with no saved cube data\n"));
     }
 
-    if (data->header.fileSize != sizeof *data ||
-        data->header.cube_count != arraysize(data->cubes) ||
-        data->header.cube_nvmSize != sizeof data->cubes[0].nvm ||
-        data->header.cube_extSize != sizeof data->cubes[0].ext ||
-        data->header.cube_sectorSize != Cube::FlashModel::SECTOR_SIZE ||
-        data->header.mc_pageSize != FlashDevice::PAGE_SIZE ||
-        data->header.mc_capacity != FlashDevice::CAPACITY ||
-        data->header.mc_blockSize != FlashDevice::ERASE_BLOCK_SIZE) {
+    if (!checkLayout(data->header)) {
         LOG(("FLASH: Storage file has an unsupported memory layout\n"));
         return false;
     }
@@ -236,7 +423,19 @@ bool FlashStorage::checkData()
     return true;
 }
 
-bool FlashStorage::mapFile(const char *filename)
+bool FlashStorage::checkLayout(const HeaderRecord &header)
+{
+    return header.fileSize == sizeof(FileRecord) &&
+        header.cube_count == _SYS_NUM_CUBE_SLOTS &&
+        header.cube_nvmSize == sizeof(((CubeRecord*)0)->nvm) &&
+        header.cube_extSize == sizeof(((CubeRecord*)0)->ext) &&
+        header.cube_sectorSize == Cube::FlashModel::SECTOR_SIZE &&
+        header.mc_pageSize == FlashDevice::PAGE_SIZE &&
+        header.mc_capacity == FlashDevice::CAPACITY &&
+        header.mc_blockSize == FlashDevice::ERASE_BLOCK_SIZE;
+}
+
+bool FlashStorage::mapFile(const char *filename, bool &newFile)
 {
 #ifdef _WIN32
 
@@ -250,7 +449,13 @@ bool FlashStorage::mapFile(const char *filename)
     }
 
     fileHandle = (uintptr_t) fh;
-    bool newFile = GetFileSize(fh, NULL) == (DWORD)0;
+    newFile = GetFileSize(fh, NULL) == (DWORD)0;
+
+    if (newFile) {
+        // Without this, NTFS would write out every zero in the file
+        DWORD bytes;
+        DeviceIoControl(fh, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+    }
 
     HANDLE mh = CreateFileMapping(fh, NULL, PAGE_READWRITE, 0, sizeof *data, NULL);
     if (mh == NULL) {
@@ -284,7 +489,7 @@ bool FlashStorage::mapFile(const char *filename)
     }
     fileHandle = fh;
 
-    bool newFile = (unsigned)st.st_size == (unsigned)0;
+    newFile = (unsigned)st.st_size == (unsigned)0;
     if ((unsigned)st.st_size < (unsigned)sizeof *data && ftruncate(fileHandle, sizeof *data)) {
         close(fileHandle);
         LOG(("FLASH: Can't resize backing file '%s' (%s)\n",
@@ -326,3 +531,141 @@ void FlashStorage::unmapFile()
 
 #endif
 }
+
+bool FlashStorage::allocAnonymous()
+{
+    // Ask the OS directly, so we get zero-filled pages only as we use them
+
+#ifdef _WIN32
+
+    void *mapping = VirtualAlloc(NULL, sizeof *data, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (mapping == NULL) {
+        LOG(("FLASH: Can't allocate memory (%08x)\n", (unsigned)GetLastError()));
+        return false;
+    }
+
+#else
+
+    void *mapping = mmap(NULL, sizeof *data, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (mapping == MAP_FAILED) {
+        LOG(("FLASH: Can't allocate memory (%s)\n", strerror(errno)));
+        return false;
+    }
+
+#endif
+
+    data = (FileRecord*) mapping;
+    return true;
+}
+
+void FlashStorage::freeAnonymous()
+{
+#ifdef _WIN32
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, sizeof *data);
+#endif
+}
+
+bool FlashStorage::mapBaseFile(const char *filename)
+{
+    /*
+     * Map a storage file read-only, to use its cube flash as a starting
+     * point. Pages are used in place, so they stay in the OS page cache
+     * and can be shared with other processes.
+     */
+
+#ifdef _WIN32
+
+    HANDLE fh = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        LOG(("FLASH: Can't open cube base image '%s' (%08x)\n",
+            filename, (unsigned)GetLastError()));
+        return false;
+    }
+
+    if (GetFileSize(fh, NULL) < (DWORD)sizeof(FileRecord)) {
+        CloseHandle(fh);
+        LOG(("FLASH: Cube base image '%s' is too small\n", filename));
+        return false;
+    }
+
+    HANDLE mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, sizeof(FileRecord), NULL);
+    LPVOID mapping = mh ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, sizeof(FileRecord)) : NULL;
+    if (mapping == NULL) {
+        if (mh)
+            CloseHandle(mh);
+        CloseHandle(fh);
+        LOG(("FLASH: Can't map cube base image '%s' (%08x)\n",
+            filename, (unsigned)GetLastError()));
+        return false;
+    }
+
+    baseFileHandle = (uintptr_t) fh;
+    baseMappingHandle = (uintptr_t) mh;
+
+#else
+
+    int fh = open(filename, O_RDONLY);
+    struct stat st;
+
+    if (fh < 0 || fstat(fh, &st)) {
+        if (fh >= 0)
+            close(fh);
+        LOG(("FLASH: Can't open cube base image '%s' (%s)\n",
+            filename, strerror(errno)));
+        return false;
+    }
+
+    if ((unsigned)st.st_size < (unsigned)sizeof(FileRecord)) {
+        close(fh);
+        LOG(("FLASH: Cube base image '%s' is too small\n", filename));
+        return false;
+    }
+
+    void *mapping = mmap(NULL, sizeof(FileRecord), PROT_READ, MAP_SHARED, fh, 0);
+    if (mapping == MAP_FAILED) {
+        close(fh);
+        LOG(("FLASH: Can't memory-map cube base image '%s' (%s)\n",
+            filename, strerror(errno)));
+        return false;
+    }
+
+    baseFileHandle = fh;
+
+#endif
+
+    cubeBase = (FileRecord*) mapping;
+    if (cubeBase->header.magic != HeaderRecord::MAGIC ||
+        cubeBase->header.version > HeaderRecord::CURRENT_VERSION ||
+        !checkLayout(cubeBase->header)) {
+        LOG(("FLASH: Cube base image '%s' has an unsupported format\n", filename));
+        unmapBaseFile();
+        return false;
+    }
+
+    return true;
+}
+
+void FlashStorage::unmapBaseFile()
+{
+    if (!cubeBase)
+        return;
+
+#ifdef _WIN32
+
+    UnmapViewOfFile(cubeBase);
+    CloseHandle((HANDLE) baseMappingHandle);
+    CloseHandle((HANDLE) baseFileHandle);
+
+#else
+
+    munmap(cubeBase, sizeof(FileRecord));
+    close(baseFileHandle);
+
+#endif
+
+    cubeBase = NULL;
+}
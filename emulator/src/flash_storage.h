@@ -29,6 +29,26 @@
  *
  * All of this storage is defined in a fixed-layout structure, which
  * can be backed either by anonymous RAM or by a mapped file.
+ *
+ * New storage starts out zero-filled, and we avoid touching any more of
+ * it than we need to, so a new file stays sparse and opens instantly.
+ * Erased master flash blocks are only marked in a bitmap in the header.
+ * Their bytes in the file are stale, and they read back as 0xFF until
+ * the block is programmed again. Always access master flash through the
+ * functions below, not through MasterRecord directly.
+ *
+ * The bitmap is new in version 2, which is what we create. Existing
+ * version 1 files, including raw images written by swiss, are never
+ * upgraded; we erase them the old way, by writing 0xFF, so older tools
+ * can still read them.
+ *
+ * Cube external flash is the exception. While the simulation runs, it
+ * lives in Cube::FlashPages, so identical pages are shared between
+ * cubes. The file layout keeps a full copy, which we load at startup and
+ * update as the cubes change it. Optionally, cubes can start from a
+ * read-only base image instead, whose pages are shared by every
+ * simulator instance using that image. Changes made on top of a base
+ * image aren't saved.
  */
 
 #ifndef _FLASH_STORAGE_H
@@ -39,6 +59,7 @@
 #include <sifteo/abi.h>
 #include "cube_flash_model.h"
 #include "flash_device.h"
+#include "cube_flash_pages.h"
 
 
 class FlashStorage {
@@ -75,11 +96,14 @@ class FlashStorage {
                 uint32_t    mc_blockSize;
                 uint32_t    mc_capacity;
                 uint32_t    uniqueID;
+
+                // One bit per master flash block (Version 2+)
+                uint32_t    mc_erasedBlocks[FlashDevice::CAPACITY / FlashDevice::ERASE_BLOCK_SIZE / 32];
             };
         };
 
         static const uint64_t MAGIC             = 0x534c467974666953LLU;
-        static const uint32_t CURRENT_VERSION   = 1;
+        static const uint32_t CURRENT_VERSION   = 2;
     };
 
     struct FileRecord {
@@ -89,29 +113,65 @@ class FlashStorage {
     };
 
     FileRecord *data;
+    Cube::FlashPages cubeFlash[_SYS_NUM_CUBE_SLOTS];
 
     FlashStorage();
     ~FlashStorage();
 
-    bool init(const char *filename=NULL);
+    bool init(const char *filename=NULL, const char *cubeBaseFilename=NULL);
     bool installLauncher(const char *filename=NULL);
     void exit();
 
+    // Share idle cube pages, and save changes. Called from the cube thread.
+    void syncCubes();
+
+    // Version 1 files have no erased block bitmap
+    bool hasErasedBitmap() const {
+        return data->header.version >= 2;
+    }
+
+    bool isMasterBlockErased(unsigned block) const {
+        return (data->header.mc_erasedBlocks[block >> 5] >> (block & 31)) & 1;
+    }
+
+    // Master flash access, honoring the erased block bitmap
+    void readMaster(uint32_t address, uint8_t *buf, unsigned len) const;
+    bool compareMaster(uint32_t address, const uint8_t *buf, unsigned len) const;
+    uint8_t *writableMaster(uint32_t address, unsigned len);
+    void eraseMasterBlock(unsigned block);
+    void eraseMasterAll();
+
  private:
     bool isInitialized;
     bool isFileBacked;
     uintptr_t fileHandle;
     uintptr_t mappingHandle;
 
-    bool mapFile(const char *filename);
+    FileRecord *cubeBase;
+    uintptr_t baseFileHandle;
+    uintptr_t baseMappingHandle;
+
+    bool mapFile(const char *filename, bool &newFile);
     void unmapFile();
 
+    bool allocAnonymous();
+    void freeAnonymous();
+    void discardMemory(void *addr, uintptr_t size);
+
+    bool mapBaseFile(const char *filename);
+    void unmapBaseFile();
+
+    void loadCubes();
+    void saveCubes();
+    void releaseCubeMemory(unsigned id);
+
     void initData();
     bool checkData();
+    static bool checkLayout(const HeaderRecord &header);
 
     void initHeader();
-    void initMC();
-    void initCubes();
+    void initMC(bool isZeroed);
+    void initCubes(bool isZeroed);
 };
 
 
@@ -33,7 +33,7 @@ void FrontendCube::init(unsigned _id, Cube::Hardware *_hw, b2World &world, float
 {
     id = _id;
     hw = _hw;
-    lastLcdCookie = 0;
+    lastLcdVisible = false;
     flipped = false;
 
     initBody(world, x, y);
@@ -117,34 +117,34 @@ void FrontendCube::initNeighbor(Cube::Neighbors::Side side, float x, float y)
 bool FrontendCube::draw(GLRenderer &r)
 {
     /*
-     * We only want to upload a new framebuffer image to the GPU if the LCD
-     * has actually been written to. Use the LCD hardware's pixel counter as
-     * a cookie to quickly do this test.
-     *
-     * Note that we must use the pixel count instead of the write count- the
-     * pixel count tells us when *any* pixel has been touched, whereas the write
-     * count usually only tells us enough to know when a frame has begun.
+     * We only want to upload the parts of the framebuffer that the LCD
+     * has actually written since our last frame. The LCD tracks this as a
+     * dirty rectangle; an empty one means we can skip the upload entirely.
      *
      * Additionally, if the LCD is invisible, send the renderer a blank black
-     * texture. To capture all of this state, we build a single 32-bit cookie
-     * that combines a 31-bit pixel count and a blanking bit.
+     * texture. Switching between the two replaces the whole image.
      *
      * Returns true if and only if the display has changed. Always draws the
      * cube.
      */
-     
-    uint32_t cookie = hw->lcd.isVisible() ? (hw->lcd.getPixelCount() & 0x7FFFFFFF) : ((uint32_t)-1);
-    bool framebufferChanged = cookie != lastLcdCookie;
-    lastLcdCookie = cookie;
+
+    bool visible = hw->lcd.isVisible();
+    Cube::LCD::DirtyRect dirty = hw->lcd.takeDirtyRect();
+
+    if (visible != lastLcdVisible)
+        dirty = Cube::LCD::DirtyRect::full();
+    else if (!visible)
+        dirty = Cube::LCD::DirtyRect::empty();
+    lastLcdVisible = visible;
     
     static const uint16_t blackness[128 * 128] = { 0 };
-    const uint16_t *framebuffer = hw->lcd.isVisible() ? hw->lcd.fb_mem : blackness;
+    const uint16_t *framebuffer = visible ? hw->lcd.fb_mem : blackness;
 
     r.drawCube(id, body->GetPosition(), body->GetAngle(),
-               hover, tiltVector, framebuffer, framebufferChanged,
+               hover, tiltVector, framebuffer, dirty,
                hw->backlight.getBrightness(), modelMatrix);
 
-    return framebufferChanged;
+    return !dirty.isEmpty();
 }
 
 void FrontendCube::setTiltTarget(b2Vec2 angles)
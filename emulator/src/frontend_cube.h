@@ -168,7 +168,7 @@ public:
     unsigned id;
     Cube::Hardware *hw;
     
-    uint32_t lastLcdCookie;
+    bool lastLcdVisible;
 };
 
 #endif
@@ -190,8 +190,16 @@ void FrontendOverlay::drawCubeInspector(FrontendCube *fe,
         int flashWidth = width - margin * 2;
         int flashHeight = height - margin - (y - top);
 
+        // Flash pages aren't contiguous; take a snapshot when it changes
+        static uint8_t flashImage[Cube::FlashModel::SIZE];
+        static unsigned flashImageID = unsigned(-1);
+        if (hasChanged || flashImageID != id) {
+            sys->cubes[id].flash.getPages()->copyOut(flashImage);
+            flashImageID = id;
+        }
+
         renderer->overlayCubeFlash(id, x, y, flashWidth, flashHeight,
-            sys->cubes[id].flash.getStorage()->ext, hasChanged);
+            flashImage, hasChanged);
     }
 }
 
@@ -511,6 +511,8 @@ void GLRenderer::initCubeFB(unsigned id)
     for (unsigned i = 0; i < NUM_LCD_TEXTURES; i++) {
         initCubeTexture(cube.texAccurate[i], true);
         initCubeTexture(cube.texFiltered[i], false);
+        cube.dirtyAccurate[i] = Cube::LCD::DirtyRect::full();
+        cube.dirtyFiltered[i] = Cube::LCD::DirtyRect::full();
     }
 }
 
@@ -675,20 +677,19 @@ void GLRenderer::cubeTransform(b2Vec2 center, float angle, float hover,
 
 
 void GLRenderer::drawCube(unsigned id, b2Vec2 center, float angle, float hover,
-                          b2Vec2 tilt, const uint16_t *framebuffer, bool framebufferChanged,
+                          b2Vec2 tilt, const uint16_t *framebuffer,
+                          const Cube::LCD::DirtyRect &dirty,
                           float backlight, b2Mat33 &modelMatrix)
 {
     /*
      * Draw one cube, and place its modelview matrix in 'modelmatrix'.
-     * If framebuffer==NULL, don't reupload the framebuffer, it hasn't changed.
+     * Only the 'dirty' part of the framebuffer has changed since last time.
      */
 
-    if (!cubes[id].fbInitialized) {
+    if (!cubes[id].fbInitialized)
         initCubeFB(id);
-        
-        // Re-upload framebuffer, even if the LCD hasn't changed
-        framebufferChanged = true;
-    }
+
+    bool stateChanged = false;
 
     if (currentFrame.pixelZoomMode) {
         // Nudge the position to a pixel grid boundary        
@@ -710,20 +711,19 @@ void GLRenderer::drawCube(unsigned id, b2Vec2 center, float angle, float hover,
     bool pixelAccurate = currentFrame.pixelZoomMode && !tState.nonPixelAccurate;
     if (pixelAccurate != cubes[id].pixelAccurate || tState.isTilted != cubes[id].isTilted) {
         /*
-          * Re-upload framebuffer if the filtering mode has changed.
-          * We may need to regenerate mipmaps, and we definitely need to
-          * change texture state. Avoid doing all this work on every frame.
+          * Update texture state if the filtering mode has changed. Avoid
+          * doing this work on every frame.
           *
-          * (Also, now that we're using separate textures for the accurate vs. non-accurate
-          * case, we do need to re-upload because we'll be using a totally separate GL texture
-          * name.)
+          * (We use separate textures for the accurate vs. non-accurate case.
+          * Each one keeps its own dirty rectangle, so switching to the other
+          * set only uploads what it missed.)
           */
-        framebufferChanged = true;
+        stateChanged = true;
         cubes[id].pixelAccurate = pixelAccurate;
         cubes[id].isTilted = tState.isTilted;
     }
 
-    drawCubeFace(id, framebufferChanged ? framebuffer : NULL, backlight);
+    drawCubeFace(id, framebuffer, dirty, stateChanged, backlight);
 
     glRotatef(180.f, 0,0,1);
     drawCubeBody();
@@ -773,9 +773,11 @@ void GLRenderer::drawCubeBody()
     drawModel(cubeBody);
 }
 
-void GLRenderer::drawCubeFace(unsigned id, const uint16_t *framebuffer, float backlight)
+void GLRenderer::drawCubeFace(unsigned id, const uint16_t *framebuffer,
+                              const Cube::LCD::DirtyRect &dirty, bool stateChanged, float backlight)
 {
     GLCube &cube = cubes[id];
+    Cube::LCD::DirtyRect *texDirty = cube.pixelAccurate ? cube.dirtyAccurate : cube.dirtyFiltered;
     GLhandleARB program = cube.pixelAccurate ? cubeFaceProgUnfiltered : cubeFaceProgFiltered;
 
     glUseProgramObjectARB(program);
@@ -792,7 +794,19 @@ void GLRenderer::drawCubeFace(unsigned id, const uint16_t *framebuffer, float ba
     glActiveTexture(GL_TEXTURE1);
     glEnable(GL_TEXTURE_2D);
 
-    if (framebuffer) {
+    /*
+     * Every texture remembers which parts of it are stale. Textures are
+     * only touched when the one we'd draw with is out of date.
+     */
+
+    for (unsigned i = 0; i < NUM_LCD_TEXTURES; i++) {
+        cube.dirtyAccurate[i].add(dirty);
+        cube.dirtyFiltered[i].add(dirty);
+    }
+
+    bool upload = !texDirty[cube.currentLcdTexture].isEmpty();
+
+    if (upload) {
         /*
          * Next LCD texture in the ring.
          *
@@ -807,18 +821,26 @@ void GLRenderer::drawCubeFace(unsigned id, const uint16_t *framebuffer, float ba
     glBindTexture(GL_TEXTURE_2D, (cube.pixelAccurate ?
         cube.texAccurate : cube.texFiltered)[cube.currentLcdTexture]);
 
-    if (framebuffer) {
+    if ((upload || stateChanged) && !cube.pixelAccurate) {
+        // Update the texture's anisotropy
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, cube.isTilted ? 5.0f : 0.0f);
+    }
+
+    Cube::LCD::DirtyRect &rect = texDirty[cube.currentLcdTexture];
+    if (upload && !rect.isEmpty()) {
         /*
-         * Update the texture's image and anisotropy.
+         * Update only the stale part of the texture's image. The source
+         * rows are still full framebuffer width apart.
          */
-        
-        if (!cube.pixelAccurate) {
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, cube.isTilted ? 5.0f : 0.0f);
-        }
 
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
-                        Cube::LCD::WIDTH, Cube::LCD::HEIGHT,
-                        GL_RGB, GL_UNSIGNED_SHORT_5_6_5, framebuffer);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, Cube::LCD::WIDTH);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0,
+                        rect.width(), rect.height(),
+                        GL_RGB, GL_UNSIGNED_SHORT_5_6_5,
+                        framebuffer + rect.x0 + (rect.y0 << Cube::LCD::FB_ROW_SHIFT));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+        rect = Cube::LCD::DirtyRect::empty();
     }
 
     if (!pendingScreenshotName.empty()) {
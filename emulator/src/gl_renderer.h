@@ -70,7 +70,8 @@ class GLRenderer {
     void drawSolidBackground(const float color[4]);
 
     void drawCube(unsigned id, b2Vec2 center, float angle, float hover,
-                  b2Vec2 tilt, const uint16_t *framebuffer, bool framebufferChanged,
+                  b2Vec2 tilt, const uint16_t *framebuffer,
+                  const Cube::LCD::DirtyRect &dirty,
                   float backlight, b2Mat33 &modelMatrix);
     void drawMC(b2Vec2 center, float angle, const float led[3], float volume);
 
@@ -116,7 +117,8 @@ class GLRenderer {
                        b2Vec2 tilt, CubeTransformState &tState);
 
     void drawCubeBody();
-    void drawCubeFace(unsigned id, const uint16_t *framebuffer, float backlight);
+    void drawCubeFace(unsigned id, const uint16_t *framebuffer,
+                      const Cube::LCD::DirtyRect &dirty, bool stateChanged, float backlight);
 
     void loadModel(const uint8_t *data, Model &model);
     void drawModel(Model &model);
@@ -178,6 +180,10 @@ class GLRenderer {
         uint8_t currentLcdTexture;
         GLuint texFiltered[NUM_LCD_TEXTURES];
         GLuint texAccurate[NUM_LCD_TEXTURES];
+
+        // Parts of each texture that are older than the LCD
+        Cube::LCD::DirtyRect dirtyFiltered[NUM_LCD_TEXTURES];
+        Cube::LCD::DirtyRect dirtyAccurate[NUM_LCD_TEXTURES];
         GLuint flashTex;
     } cubes[System::MAX_CUBES];
 
@@ -37,8 +37,8 @@
 #include "cube_flash_model.h"
 
 
-LoadstreamDecoder::LoadstreamDecoder(uint8_t *buffer, uint32_t bufferSize)
-    : buffer(buffer), bufferSize(bufferSize)
+LoadstreamDecoder::LoadstreamDecoder(Cube::FlashPages &pages, uint32_t bufferSize)
+    : pages(pages), bufferSize(bufferSize)
 {
     ASSERT((bufferSize % Cube::FlashModel::SECTOR_SIZE) == 0);
     reset();
@@ -62,10 +62,10 @@ void LoadstreamDecoder::write8(uint8_t value)
 
     // Auto-erase
     if ((flashAddr % Cube::FlashModel::SECTOR_SIZE) == 0)
-        memset(buffer + flashAddr, 0xFF, Cube::FlashModel::SECTOR_SIZE);
+        pages.fill(flashAddr, Cube::FlashModel::SECTOR_SIZE, 0xFF);
 
     // Endian swap
-    buffer[flashAddr ^ 1] &= value;
+    pages.pokeProgram(flashAddr ^ 1, value);
 
     flashAddr++;
     if (flashAddr == bufferSize)
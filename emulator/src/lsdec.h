@@ -35,11 +35,12 @@
 #define _LSDEC_H
 
 #include <stdint.h>
+#include "cube_flash_pages.h"
 
 
 class LoadstreamDecoder {
 public:
-    LoadstreamDecoder(uint8_t *buffer, uint32_t bufferSize);
+    LoadstreamDecoder(Cube::FlashPages &pages, uint32_t bufferSize);
 
     void reset();
     void handleByte(uint8_t b);
@@ -49,7 +50,7 @@ private:
     void write8(uint8_t value);
     void write16(uint16_t value);
     
-    uint8_t *buffer;
+    Cube::FlashPages &pages;
     uint32_t bufferSize;
     
     // Codec constants
@@ -47,6 +47,9 @@ Lunar<LuaCube>::RegType LuaCube::methods[] = {
     LUNAR_DECLARE_METHOD(LuaCube, handleRadioPacket),
     LUNAR_DECLARE_METHOD(LuaCube, saveScreenshot),
     LUNAR_DECLARE_METHOD(LuaCube, testScreenshot),
+    LUNAR_DECLARE_METHOD(LuaCube, startCapture),
+    LUNAR_DECLARE_METHOD(LuaCube, stopCapture),
+    LUNAR_DECLARE_METHOD(LuaCube, testCapture),
     LUNAR_DECLARE_METHOD(LuaCube, testSetEnabled),
     LUNAR_DECLARE_METHOD(LuaCube, testGetACK),
     LUNAR_DECLARE_METHOD(LuaCube, testWrite),
@@ -160,29 +163,33 @@ int LuaCube::ibPeek(lua_State *L)
 
 int LuaCube::fwPoke(lua_State *L)
 {
-    uint16_t *mem = (uint16_t*) &LuaSystem::sys->cubes[id].flash.getStorage()->ext;
-    mem[(Cube::FlashModel::SIZE/2 - 1) & luaL_checkinteger(L, 1)] = luaL_checkinteger(L, 2);
+    Cube::FlashPages *pages = LuaSystem::sys->cubes[id].flash.getPages();
+    unsigned addr = ((Cube::FlashModel::SIZE/2 - 1) & luaL_checkinteger(L, 1)) << 1;
+    unsigned value = luaL_checkinteger(L, 2);
+    pages->poke(addr, value);
+    pages->poke(addr + 1, value >> 8);
     return 0;
 }
 
 int LuaCube::fbPoke(lua_State *L)
 {
-    uint8_t *mem = (uint8_t*) &LuaSystem::sys->cubes[id].flash.getStorage()->ext;
-    mem[(Cube::FlashModel::SIZE - 1) & luaL_checkinteger(L, 1)] = luaL_checkinteger(L, 2);
+    Cube::FlashPages *pages = LuaSystem::sys->cubes[id].flash.getPages();
+    pages->poke((Cube::FlashModel::SIZE - 1) & luaL_checkinteger(L, 1), luaL_checkinteger(L, 2));
     return 0;
 }
 
 int LuaCube::fwPeek(lua_State *L)
 {
-    uint16_t *mem = (uint16_t*) &LuaSystem::sys->cubes[id].flash.getStorage()->ext;
-    lua_pushinteger(L, mem[(Cube::FlashModel::SIZE/2 - 1) & luaL_checkinteger(L, 1)]);
+    Cube::FlashPages *pages = LuaSystem::sys->cubes[id].flash.getPages();
+    unsigned addr = ((Cube::FlashModel::SIZE/2 - 1) & luaL_checkinteger(L, 1)) << 1;
+    lua_pushinteger(L, pages->peek(addr) | (pages->peek(addr + 1) << 8));
     return 1;
 }
 
 int LuaCube::fbPeek(lua_State *L)
 {
-    uint8_t *mem = (uint8_t*) &LuaSystem::sys->cubes[id].flash.getStorage()->ext;
-    lua_pushinteger(L, mem[(Cube::FlashModel::SIZE - 1) & luaL_checkinteger(L, 1)]);
+    Cube::FlashPages *pages = LuaSystem::sys->cubes[id].flash.getPages();
+    lua_pushinteger(L, pages->peek((Cube::FlashModel::SIZE - 1) & luaL_checkinteger(L, 1)));
     return 1;
 }
 
@@ -265,6 +272,60 @@ int LuaCube::testScreenshot(lua_State *L)
     return 0;
 }
 
+int LuaCube::startCapture(lua_State *L)
+{
+    const char *hashLog = lua_isnoneornil(L, 1) ? 0 : luaL_checkstring(L, 1);
+    const char *video = lua_isnoneornil(L, 2) ? 0 : luaL_checkstring(L, 2);
+
+    Cube::Hardware &cube = LuaSystem::sys->cubes[id];
+    if (!cube.lcd.capture)
+        cube.lcd.capture = new Cube::LCDCapture();
+
+    if (!cube.lcd.capture->start(cube.time, hashLog, video)) {
+        lua_pushfstring(L, "error opening LCD capture files");
+        lua_error(L);
+    }
+
+    return 0;
+}
+
+int LuaCube::stopCapture(lua_State *L)
+{
+    Cube::LCD &lcd = LuaSystem::sys->cubes[id].lcd;
+
+    lua_pushinteger(L, lcd.capture ? lcd.capture->stop() : 0);
+    return 1;
+}
+
+int LuaCube::testCapture(lua_State *L)
+{
+    const char *filename = luaL_checkstring(L, 1);
+    Cube::LCD &lcd = LuaSystem::sys->cubes[id].lcd;
+    Cube::LCDCapture emptyCapture;
+    Cube::LCDCapture *capture = lcd.capture ? lcd.capture : &emptyCapture;
+
+    unsigned frame;
+    uint64_t lcdHash, refHash;
+
+    if (!capture->compare(filename, frame, lcdHash, refHash)) {
+        lua_pushfstring(L, "error loading LCD hash log \"%s\"", filename);
+        lua_error(L);
+    }
+
+    if (frame == ~0U)
+        return 0;
+
+    // Hashes don't fit in a Lua number, return them as hex strings
+    char lcdStr[17], refStr[17];
+    snprintf(lcdStr, sizeof lcdStr, "%016" PRIx64, lcdHash);
+    snprintf(refStr, sizeof refStr, "%016" PRIx64, refHash);
+
+    lua_pushinteger(L, frame);
+    lua_pushstring(L, lcdStr);
+    lua_pushstring(L, refStr);
+    return 3;
+}
+
 int LuaCube::handleRadioPacket(lua_State *L)
 {
     /*
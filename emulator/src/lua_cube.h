@@ -65,6 +65,20 @@ private:
     int saveScreenshot(lua_State *L);
     int testScreenshot(lua_State *L);
 
+    /*
+     * LCD capture
+     *
+     * Records a hash of every completed frame, optionally to a log file,
+     * and optionally encodes every frame to an animated PNG. Stopping
+     * returns the number of frames captured. testCapture() compares the
+     * captured hashes with a golden log. On success it returns nil; on
+     * error it returns (frame, lcdHash, refHash) for the first mismatch.
+     */
+
+    int startCapture(lua_State *L);
+    int stopCapture(lua_State *L);
+    int testCapture(lua_State *L);
+
     /*
      * Factory test interface
      */
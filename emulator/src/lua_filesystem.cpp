@@ -35,6 +35,7 @@
 #include "flash_recycler.h"
 #include "flash_syslfs.h"
 #include "elfprogram.h"
+#include "mc_flash_checkpoint.h"
 
 const char LuaFilesystem::className[] = "Filesystem";
 const char LuaFilesystem::callbackHostField[] = "__filesystem_callbackHost";
@@ -42,6 +43,7 @@ bool LuaFilesystem::callbacksEnabled;
 
 Lunar<LuaFilesystem>::RegType LuaFilesystem::methods[] = {
     LUNAR_DECLARE_METHOD(LuaFilesystem, newVolume),
+    LUNAR_DECLARE_METHOD(LuaFilesystem, newDeltaVolume),
     LUNAR_DECLARE_METHOD(LuaFilesystem, listVolumes),
     LUNAR_DECLARE_METHOD(LuaFilesystem, deleteVolume),
     LUNAR_DECLARE_METHOD(LuaFilesystem, volumeType),
@@ -54,6 +56,9 @@ Lunar<LuaFilesystem>::RegType LuaFilesystem::methods[] = {
     LUNAR_DECLARE_METHOD(LuaFilesystem, rawWrite),
     LUNAR_DECLARE_METHOD(LuaFilesystem, rawErase),
     LUNAR_DECLARE_METHOD(LuaFilesystem, invalidateCache),
+    LUNAR_DECLARE_METHOD(LuaFilesystem, checkpoint),
+    LUNAR_DECLARE_METHOD(LuaFilesystem, rollback),
+    LUNAR_DECLARE_METHOD(LuaFilesystem, deleteCheckpoint),
     LUNAR_DECLARE_METHOD(LuaFilesystem, setCallbacksEnabled),
     LUNAR_DECLARE_METHOD(LuaFilesystem, onRawRead),
     LUNAR_DECLARE_METHOD(LuaFilesystem, onRawWrite),
@@ -175,6 +180,65 @@ int LuaFilesystem::newVolume(lua_State *L)
     return 1;
 }
 
+int LuaFilesystem::newDeltaVolume(lua_State *L)
+{
+    /*
+     * Arguments: (type, source volume, runs).
+     *
+     * Builds a volume the way a delta install does. 'runs' is an array;
+     * each string is appended to the payload, and each number copies that
+     * many bytes from the same offset in the source volume's payload.
+     *
+     * Commits the volume only if its payload came out complete. Returns its
+     * block code on success, or nil on failure.
+     */
+
+    unsigned type = luaL_checkinteger(L, 1);
+    FlashVolume source = FlashMapBlock::fromCode(luaL_checkinteger(L, 2));
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    unsigned numRuns = lua_objlen(L, 3);
+    unsigned payloadBytes = 0;
+
+    for (unsigned i = 1; i <= numRuns; ++i) {
+        lua_rawgeti(L, 3, i);
+        if (lua_type(L, -1) == LUA_TSTRING)
+            payloadBytes += lua_objlen(L, -1);
+        else
+            payloadBytes += luaL_checkinteger(L, -1);
+        lua_pop(L, 1);
+    }
+
+    FlashScopedStealthIO sio;
+    FlashVolumeWriter writer;
+    FlashBlockRecycler recycler;
+
+    SysLFS::cleanupDeletedVolumes();
+    if (!writer.begin(recycler, type, payloadBytes))
+        return 0;
+
+    for (unsigned i = 1; i <= numRuns; ++i) {
+        lua_rawgeti(L, 3, i);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            size_t len = 0;
+            const char *str = lua_tolstring(L, -1, &len);
+            writer.appendPayload((const uint8_t*)str, len);
+        } else {
+            writer.copyPayload(source, lua_tointeger(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+
+    // An incomplete volume is never committed; it gets garbage collected.
+    if (!writer.isPayloadComplete())
+        return 0;
+
+    writer.commit();
+
+    lua_pushinteger(L, writer.volume.block.code);
+    return 1;
+}
+
 int LuaFilesystem::listVolumes(lua_State *L)
 {
     /*
@@ -468,6 +532,52 @@ int LuaFilesystem::invalidateCache(lua_State *L)
     return 0;
 }
 
+int LuaFilesystem::checkpoint(lua_State *L)
+{
+    /*
+     * Save a named checkpoint of raw flash memory and erase counts.
+     * (name) -> (number of blocks copied)
+     */
+
+    const char *name = luaL_checkstring(L, 1);
+
+    lua_pushinteger(L, MCFlashCheckpoint::save(name));
+    return 1;
+}
+
+int LuaFilesystem::rollback(lua_State *L)
+{
+    /*
+     * Put raw flash memory and erase counts back the way they were
+     * at a checkpoint, and invalidate caches.
+     * (name) -> (number of blocks rewritten)
+     */
+
+    const char *name = luaL_checkstring(L, 1);
+    int count = MCFlashCheckpoint::restore(name);
+
+    if (count < 0) {
+        lua_pushfstring(L, "No flash checkpoint named '%s'", name);
+        lua_error(L);
+        return 0;
+    }
+
+    FlashStack::invalidateCache();
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+int LuaFilesystem::deleteCheckpoint(lua_State *L)
+{
+    /*
+     * Free a checkpoint's memory. (name) -> (true if it existed)
+     */
+
+    lua_pushboolean(L, MCFlashCheckpoint::remove(luaL_checkstring(L, 1)));
+    return 1;
+}
+
 int LuaFilesystem::setCallbacksEnabled(lua_State *L)
 {
     callbacksEnabled = lua_toboolean(L, 1);
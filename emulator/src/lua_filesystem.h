@@ -47,6 +47,7 @@ private:
     static bool callbacksEnabled;
 
     int newVolume(lua_State *L);
+    int newDeltaVolume(lua_State *L);
     int listVolumes(lua_State *L);
     int deleteVolume(lua_State *L);
 
@@ -64,6 +65,10 @@ private:
 
     int invalidateCache(lua_State *L);
 
+    int checkpoint(lua_State *L);
+    int rollback(lua_State *L);
+    int deleteCheckpoint(lua_State *L);
+
     int setCallbacksEnabled(lua_State *L);
     int onRawRead(lua_State *L);
     int onRawWrite(lua_State *L);
@@ -30,6 +30,7 @@
 #include "svmruntime.h"
 #include "svmloader.h"
 #include "svmdebugpipe.h"
+#include "syscallcounters.h"
 
 const char LuaRuntime::className[] = "Runtime";
 const char LuaRuntime::callbackHostField[] = "__runtime_callbackHost";
@@ -50,6 +51,8 @@ Lunar<LuaRuntime>::RegType LuaRuntime::methods[] = {
     LUNAR_DECLARE_METHOD(LuaRuntime, previousVolume),
     LUNAR_DECLARE_METHOD(LuaRuntime, flashToVirtAddr),
     LUNAR_DECLARE_METHOD(LuaRuntime, virtToFlashAddr),
+    LUNAR_DECLARE_METHOD(LuaRuntime, syscallCounters),
+    LUNAR_DECLARE_METHOD(LuaRuntime, resetSyscallCounters),
     {0,0}
 };
 
@@ -217,3 +220,36 @@ int LuaRuntime::flashToVirtAddr(lua_State *L)
     lua_pushinteger(L, SvmMemory::flashToVirtAddr(fa));
     return 1;
 }
+
+int LuaRuntime::syscallCounters(lua_State *L)
+{
+    // Table of the syscalls that have been called, keyed by number
+    lua_newtable(L);
+
+    for (unsigned num = 0; num < SyscallCounters::NUM_SYSCALLS; ++num) {
+        const SyscallCounters::Counter &c = SyscallCounters::get(num);
+        if (!c.calls)
+            continue;
+
+        lua_pushnumber(L, num);
+        lua_newtable(L);
+
+        lua_pushnumber(L, c.calls);
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, c.cycles);
+        lua_setfield(L, -2, "cycles");
+        lua_pushnumber(L, c.maxCycles);
+        lua_setfield(L, -2, "maxCycles");
+
+        lua_settable(L, -3);
+    }
+
+    lua_pushnumber(L, SyscallCounters::frameCount());
+    return 2;
+}
+
+int LuaRuntime::resetSyscallCounters(lua_State *L)
+{
+    SyscallCounters::reset();
+    return 0;
+}
@@ -64,6 +64,9 @@ private:
 
     int virtToFlashAddr(lua_State *L);
     int flashToVirtAddr(lua_State *L);
+
+    int syscallCounters(lua_State *L);
+    int resetSyscallCounters(lua_State *L);
 };
 
 #endif
@@ -91,6 +91,15 @@ int LuaSystem::setOptions(lua_State *L)
     if (LuaScript::argMatch(L, "svmStackMonitor"))
         sys->opt_svmStackMonitor = lua_toboolean(L, -1);
 
+    if (LuaScript::argMatch(L, "svmTranslate"))
+        sys->opt_svmTranslate = lua_toboolean(L, -1);
+
+    if (LuaScript::argMatch(L, "svmProfile"))
+        sys->opt_svmProfile = lua_tostring(L, -1);
+
+    if (LuaScript::argMatch(L, "svmCallgrind"))
+        sys->opt_svmCallgrind = lua_tostring(L, -1);
+
     if (LuaScript::argMatch(L, "noCubeReconnect"))
         sys->opt_noCubeReconnect = lua_toboolean(L, -1);
 
@@ -77,6 +77,7 @@ static void usage()
             "  -e SCRIPT.lua         Execute a Lua script instead of the default frontend\n"
             "  -l LAUNCHER.elf       Start the supplied binary as the system launcher\n"
             "\n"
+            "  --cube-flash-base FILE  Start all cubes with the flash memory saved in FILE\n"
             "  --headless            Run without graphics or sound output\n"
             "  --lock-rotation       Lock rotation by default\n"
             "  --mute                Mute the Base's volume control by default\n"
@@ -87,6 +88,10 @@ static void usage()
             "  --svm-trace           Trace SVM instruction execution\n"
             "  --svm-stack           Monitor SVM stack usage\n"
             "  --svm-flash-stats     Dump statistics about flash memory usage\n"
+            "  --svm-profile FILE    Profile SVM code, writing folded call stacks to FILE\n"
+            "  --svm-callgrind FILE  Profile SVM code, writing callgrind data to FILE\n"
+            "  --svm-translate       Translate SVM code to host code, for faster simulation\n"
+            "  --usb-port PORT       Accept swiss connections on the specified TCP port\n"
             "  --waveout FILE.wav    Log all audio output to LOG.wav\n"
             "  --white-bg            Force the UI to use a plain white background\n"
             "  --window WxH          Initial window size (default 800x600)\n"
@@ -269,6 +274,29 @@ int main(int argc, char **argv)
             continue;
         }
 
+        if (!strcmp(arg, "--svm-profile") && argv[c+1]) {
+            sys.opt_svmProfile = argv[c+1];
+            c++;
+            continue;
+        }
+
+        if (!strcmp(arg, "--svm-callgrind") && argv[c+1]) {
+            sys.opt_svmCallgrind = argv[c+1];
+            c++;
+            continue;
+        }
+
+        if (!strcmp(arg, "--cube-flash-base") && argv[c+1]) {
+            sys.opt_cubeFlashBase = argv[c+1];
+            c++;
+            continue;
+        }
+
+        if (!strcmp(arg, "--svm-translate")) {
+            sys.opt_svmTranslate = true;
+            continue;
+        }
+
         if (!strcmp(arg, "--radio-trace")) {
             sys.opt_radioTrace = true;
             continue;
@@ -294,6 +322,12 @@ int main(int argc, char **argv)
             continue;
         }
 
+        if (!strcmp(arg, "--usb-port") && argv[c+1]) {
+            sys.opt_usbServerPort = atoi(argv[c+1]);
+            c++;
+            continue;
+        }
+
         if (!strcmp(arg, "--radio-noise") && argv[c+1]) {
             sys.opt_radioNoise = atof(argv[c+1]);
             c++;
@@ -64,8 +64,7 @@ bool AssetLoader::loaderBypass(_SYSCubeID id, AssetGroupInfo &group)
     if (!simCube)
         return false;
 
-    FlashStorage::CubeRecord *storage = simCube->flash.getStorage();
-    LoadstreamDecoder lsdec(storage->ext, sizeof storage->ext);
+    LoadstreamDecoder lsdec(*simCube->flash.getPages(), Cube::FlashModel::SIZE);
 
     lsdec.setAddress(baseAddr << 7);
 
@@ -28,6 +28,7 @@
 #define ELF_DEBUG_INFO_H
 
 #include "elfprogram.h"
+#include "elfsymbolindex.h"
 #include <vector>
 #include <map>
 #include <string>
@@ -50,7 +51,10 @@ private:
     sections_t sections;
     sectionMap_t sectionMap;
 
-    static void demangle(std::string &name);
+    // Built lazily, on the first address lookup
+    mutable Elf::SymbolIndex symbols;
+
+    const Elf::Symbol *lookupSymbol(uint32_t address) const;
     std::string readString(const Elf::SectionHeader *SI, uint32_t offset) const;
     const Elf::SectionHeader *findSection(const std::string &name) const;
 
@@ -29,6 +29,8 @@
 #include "svmmemory.h"
 #include "system.h"
 #include "system_mc.h"
+#include "mc_svmprofiler.h"
+#include "svmcpu.h"
 #include <vector>
 #include <algorithm>
 
@@ -39,8 +41,23 @@ bool FlashBlock::isAddrValid(uintptr_t pa)
 {
     // Quick predicate to check a physical address. Used only in simulation.
 
-    uintptr_t offset = reinterpret_cast<uint8_t*>(pa) - &mem[0][0];
-    return offset < sizeof mem;
+    return cacheOffset(pa) < sizeof mem;
+}
+
+uintptr_t FlashBlock::cacheOffset(uintptr_t pa)
+{
+    /*
+     * Byte offset of a physical address from the start of the cache
+     * memory. Addresses outside the cache give an offset of at least
+     * sizeof mem.
+     */
+
+    return reinterpret_cast<uint8_t*>(pa) - &mem[0][0];
+}
+
+void FlashBlock::invalidateTranslation(unsigned id)
+{
+    SvmCpu::invalidateTranslation(id);
 }
 
 void FlashBlock::verify()
@@ -60,6 +77,8 @@ void FlashBlock::countBlockMiss(uint32_t blockAddr)
     unsigned blockNumber = blockAddr / BLOCK_SIZE;
     ASSERT(blockNumber < arraysize(stats.periodic.blockMissCounts));
     stats.periodic.blockMissCounts[blockNumber]++;
+
+    SvmProfiler::onFlashMiss();
 }
 
 bool FlashBlock::hotBlockSort(unsigned i, unsigned j) {
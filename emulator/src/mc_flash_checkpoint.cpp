@@ -0,0 +1,157 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "mc_flash_checkpoint.h"
+#include "system.h"
+#include "system_mc.h"
+#include "flash_storage.h"
+
+uint32_t MCFlashCheckpoint::dirty[NUM_BLOCKS / 32];
+MCFlashCheckpoint::BlockList MCFlashCheckpoint::current;
+MCFlashCheckpoint::CheckpointMap MCFlashCheckpoint::checkpoints;
+
+
+void MCFlashCheckpoint::markAllDirty()
+{
+    memset(dirty, 0xFF, sizeof dirty);
+}
+
+void MCFlashCheckpoint::initCurrent()
+{
+    /*
+     * 'current' is the state of each block as of the last save or
+     * restore, shared with whichever checkpoint holds it. Until the first
+     * one, we know nothing, so every block is dirty.
+     */
+
+    if (current.empty()) {
+        current.resize(NUM_BLOCKS, NULL);
+        markAllDirty();
+    }
+}
+
+MCFlashCheckpoint::Block *MCFlashCheckpoint::captureBlock(unsigned block)
+{
+    FlashStorage &storage = SystemMC::getSystem()->flash;
+    Block *b = new Block;
+
+    b->refs = 1;
+    b->eraseCount = storage.data->master.eraseCounts[block];
+
+    if (storage.isMasterBlockErased(block)) {
+        // Nothing to copy
+        b->bytes = NULL;
+    } else {
+        b->bytes = new uint8_t[FlashDevice::ERASE_BLOCK_SIZE];
+        memcpy(b->bytes, storage.data->master.bytes + block * FlashDevice::ERASE_BLOCK_SIZE,
+            FlashDevice::ERASE_BLOCK_SIZE);
+    }
+
+    return b;
+}
+
+void MCFlashCheckpoint::restoreBlock(unsigned block, const Block *b)
+{
+    FlashStorage &storage = SystemMC::getSystem()->flash;
+    uint32_t address = block * FlashDevice::ERASE_BLOCK_SIZE;
+
+    if (b->bytes)
+        memcpy(storage.writableMaster(address, FlashDevice::ERASE_BLOCK_SIZE),
+            b->bytes, FlashDevice::ERASE_BLOCK_SIZE);
+    else
+        storage.eraseMasterBlock(block);
+
+    storage.data->master.eraseCounts[block] = b->eraseCount;
+}
+
+void MCFlashCheckpoint::release(Block *b)
+{
+    if (b && !--b->refs) {
+        delete [] b->bytes;
+        delete b;
+    }
+}
+
+unsigned MCFlashCheckpoint::save(const std::string &name)
+{
+    initCurrent();
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < NUM_BLOCKS; ++i)
+        if (isDirty(i)) {
+            release(current[i]);
+            current[i] = captureBlock(i);
+            count++;
+        }
+
+    memset(dirty, 0, sizeof dirty);
+
+    BlockList &list = checkpoints[name];
+    for (unsigned i = 0; i < list.size(); ++i)
+        release(list[i]);
+
+    list = current;
+    for (unsigned i = 0; i < list.size(); ++i)
+        list[i]->refs++;
+
+    return count;
+}
+
+int MCFlashCheckpoint::restore(const std::string &name)
+{
+    CheckpointMap::iterator it = checkpoints.find(name);
+    if (it == checkpoints.end())
+        return -1;
+
+    const BlockList &list = it->second;
+    int count = 0;
+
+    for (unsigned i = 0; i < NUM_BLOCKS; ++i)
+        if (isDirty(i) || current[i] != list[i]) {
+            restoreBlock(i, list[i]);
+            list[i]->refs++;
+            release(current[i]);
+            current[i] = list[i];
+            count++;
+        }
+
+    memset(dirty, 0, sizeof dirty);
+    return count;
+}
+
+bool MCFlashCheckpoint::remove(const std::string &name)
+{
+    CheckpointMap::iterator it = checkpoints.find(name);
+    if (it == checkpoints.end())
+        return false;
+
+    for (unsigned i = 0; i < it->second.size(); ++i)
+        release(it->second[i]);
+
+    checkpoints.erase(it);
+    return true;
+}
@@ -0,0 +1,92 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _MC_FLASH_CHECKPOINT_H
+#define _MC_FLASH_CHECKPOINT_H
+
+/*
+ * Named checkpoints of the MC's flash memory, for tests.
+ * This file contains simulation-only definitions.
+ *
+ * A checkpoint holds the contents and erase count of every 64 kB block.
+ * FlashDevice marks blocks dirty as they're written or erased, and only
+ * dirty blocks get copied when saving a checkpoint. Unchanged blocks are
+ * shared with earlier checkpoints. Rolling back only rewrites blocks
+ * that differ from the checkpoint.
+ *
+ * Runs on the MC thread, like FlashDevice itself.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include "macros.h"
+#include "flash_device.h"
+
+class MCFlashCheckpoint {
+public:
+    static const unsigned NUM_BLOCKS = FlashDevice::CAPACITY / FlashDevice::ERASE_BLOCK_SIZE;
+
+    static ALWAYS_INLINE void markDirty(unsigned block) {
+        ASSERT(block < NUM_BLOCKS);
+        dirty[block >> 5] |= 1U << (block & 31);
+    }
+
+    static void markAllDirty();
+
+    // Save or replace a checkpoint. Returns the number of blocks copied.
+    static unsigned save(const std::string &name);
+
+    // Returns the number of blocks rewritten, or -1 if there's no such checkpoint.
+    static int restore(const std::string &name);
+
+    static bool remove(const std::string &name);
+
+private:
+    struct Block {
+        unsigned refs;
+        uint64_t eraseCount;
+        uint8_t *bytes;         // NULL if erased
+    };
+
+    typedef std::vector<Block*> BlockList;
+    typedef std::map<std::string, BlockList> CheckpointMap;
+
+    static uint32_t dirty[NUM_BLOCKS / 32];
+    static BlockList current;
+    static CheckpointMap checkpoints;
+
+    static bool isDirty(unsigned block) {
+        return (dirty[block >> 5] >> (block & 31)) & 1;
+    }
+
+    static void initCurrent();
+    static Block *captureBlock(unsigned block);
+    static void restoreBlock(unsigned block, const Block *b);
+    static void release(Block *b);
+};
+
+#endif
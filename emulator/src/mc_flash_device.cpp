@@ -31,6 +31,7 @@
 #include "flash_device.h"
 #include "flash_storage.h"
 #include "lua_filesystem.h"
+#include "mc_flash_checkpoint.h"
 
 static int gStealthIOCounter;
 
@@ -54,13 +55,13 @@ void FlashDevice::setStealthIO(int counter)
 
 void FlashDevice::read(uint32_t address, uint8_t *buf, unsigned len)
 {
-    FlashStorage::MasterRecord &storage = SystemMC::getSystem()->flash.data->master;
+    FlashStorage &storage = SystemMC::getSystem()->flash;
 
-    if (address <= sizeof storage.bytes &&
-        len <= sizeof storage.bytes &&
-        address + len <= sizeof storage.bytes) {
+    if (address <= CAPACITY &&
+        len <= CAPACITY &&
+        address + len <= CAPACITY) {
 
-        memcpy(buf, storage.bytes + address, len);
+        storage.readMaster(address, buf, len);
     } else {
         ASSERT(0 && "MC flash read() out of range");
     }
@@ -73,33 +74,40 @@ void FlashDevice::read(uint32_t address, uint8_t *buf, unsigned len)
 
 void FlashDevice::verify(uint32_t address, const uint8_t *buf, unsigned len)
 {
-    FlashStorage::MasterRecord &storage = SystemMC::getSystem()->flash.data->master;
+    FlashStorage &storage = SystemMC::getSystem()->flash;
 
-    ASSERT(address <= sizeof storage.bytes &&
-           len <= sizeof storage.bytes &&
-           address + len <= sizeof storage.bytes);
+    ASSERT(address <= CAPACITY &&
+           len <= CAPACITY &&
+           address + len <= CAPACITY);
 
-    ASSERT(0 == memcmp(buf, storage.bytes + address, len));
+    ASSERT(storage.compareMaster(address, buf, len));
 }
 
 void FlashDevice::write(uint32_t address, const uint8_t *buf, unsigned len)
 {
-    FlashStorage::MasterRecord &storage = SystemMC::getSystem()->flash.data->master;
+    FlashStorage &storage = SystemMC::getSystem()->flash;
 
-    if (address <= sizeof storage.bytes &&
-        len <= sizeof storage.bytes &&
-        address + len <= sizeof storage.bytes) {
+    if (address <= CAPACITY &&
+        len <= CAPACITY &&
+        address + len <= CAPACITY) {
 
         if (!gStealthIOCounter) {
             LuaFilesystem::onRawWrite(address, buf, len);
             SystemMC::elapseTicks(MCTiming::TICKS_PER_PAGE_WRITE);
         }
 
+        if (len) {
+            for (unsigned block = address / ERASE_BLOCK_SIZE;
+                 block <= (address + len - 1) / ERASE_BLOCK_SIZE; ++block)
+                MCFlashCheckpoint::markDirty(block);
+        }
+
         // Program bits from 1 to 0 only.
+        uint8_t *bytes = storage.writableMaster(address, len);
         while (len) {
-            storage.bytes[address] &= *buf;
+            *bytes &= *buf;
             buf++;
-            address++;
+            bytes++;
             len--;
         }
 
@@ -110,11 +118,11 @@ void FlashDevice::write(uint32_t address, const uint8_t *buf, unsigned len)
 
 void FlashDevice::eraseBlock(uint32_t address)
 {
-    FlashStorage::MasterRecord &storage = SystemMC::getSystem()->flash.data->master;
+    FlashStorage &storage = SystemMC::getSystem()->flash;
 
     if (address < FlashDevice::CAPACITY) {
         // Address can be anywhere inside the actual sector
-        unsigned sector = address - (address % FlashDevice::ERASE_BLOCK_SIZE);
+        unsigned block = address / FlashDevice::ERASE_BLOCK_SIZE;
 
         if (!gStealthIOCounter) {
             // Log non-stealth erases, since these will introduce a visible performance hiccup.
@@ -124,8 +132,10 @@ void FlashDevice::eraseBlock(uint32_t address)
             SystemMC::elapseTicks(MCTiming::TICKS_PER_BLOCK_ERASE);
         }
 
-        memset(storage.bytes + sector, 0xFF, FlashDevice::ERASE_BLOCK_SIZE);
-        storage.eraseCounts[sector / FlashDevice::ERASE_BLOCK_SIZE]++;
+        // Only marks the block; its contents now read as 0xFF
+        storage.eraseMasterBlock(block);
+        storage.data->master.eraseCounts[block]++;
+        MCFlashCheckpoint::markDirty(block);
 
     } else {
         ASSERT(0 && "MC flash eraseSector() out of range");
@@ -134,10 +144,11 @@ void FlashDevice::eraseBlock(uint32_t address)
 
 void FlashDevice::eraseAll()
 {
-    FlashStorage::MasterRecord &storage = SystemMC::getSystem()->flash.data->master;
-    memset(storage.bytes, 0xff, sizeof storage.bytes);
-    for (unsigned i = 0; i < arraysize(storage.eraseCounts); ++i)
-        storage.eraseCounts[i]++;
+    FlashStorage &storage = SystemMC::getSystem()->flash;
+    storage.eraseMasterAll();
+    for (unsigned i = 0; i < arraysize(storage.data->master.eraseCounts); ++i)
+        storage.data->master.eraseCounts[i]++;
+    MCFlashCheckpoint::markAllDirty();
 }
 
 bool FlashDevice::busy()
@@ -32,6 +32,9 @@
 #include "system.h"
 #include "system_mc.h"
 #include "svmmemory.h"
+#include "syscallcounters.h"
+#include "mc_svmprofiler.h"
+#include "mc_svmjit.h"
 
 #include <string.h>
 
@@ -546,7 +549,7 @@ static void emulateSXTH(uint16_t instr)
     unsigned Rm = (instr >> 3) & 0x7;
     unsigned Rdn = instr & 0x7;
 
-    regs[Rdn] = (uint32_t) signExtend(regs[Rm], 16);
+    regs[Rdn] = (uint32_t) signExtend(regs[Rm] & 0xFFFF, 16);
 }
 
 static void emulateSXTB(uint16_t instr)
@@ -554,7 +557,7 @@ static void emulateSXTB(uint16_t instr)
     unsigned Rm = (instr >> 3) & 0x7;
     unsigned Rdn = instr & 0x7;
 
-    regs[Rdn] = (uint32_t) signExtend(regs[Rm], 8);
+    regs[Rdn] = (uint32_t) signExtend(regs[Rm] & 0xFF, 8);
 }
 
 static void emulateUXTH(uint16_t instr)
@@ -846,6 +849,9 @@ static void emulateDIV(uint32_t instr)
         regs[Rd] = 0;
     } else if (UnsignedBit & instr) {
         regs[Rd] = (uint32_t)regs[Rn] / m32;
+    } else if (m32 == 0xFFFFFFFF) {
+        // Negate instead, so INT_MIN / -1 gives INT_MIN rather than a host trap
+        regs[Rd] = (int32_t)(0 - (uint32_t)regs[Rn]);
     } else {
         regs[Rd] = (int32_t)regs[Rn] / (int32_t)m32;
     }
@@ -941,7 +947,29 @@ static uint16_t fetch()
     return *pc;
 }
 
-static void execute16(uint16_t instr)
+typedef void (*Handler16)(uint16_t instr);
+typedef void (*Handler32)(uint32_t instr);
+
+static void emulateNop(uint16_t instr)
+{
+    // nothing to do
+}
+
+static void emulateInvalid16(uint16_t instr)
+{
+    // should never get here since we should only be executing validated instructions
+    LOG(("SVMCPU: invalid 16bit instruction: 0x%x\n", instr));
+    emulateFault(F_CPU_SIM);
+}
+
+static void emulateInvalid32(uint32_t instr)
+{
+    // should never get here since we should only be executing validated instructions
+    LOG(("SVMCPU: invalid 32bit instruction: 0x%x\n", instr));
+    emulateFault(F_CPU_SIM);
+}
+
+static Handler16 decode16(uint16_t instr)
 {
     if ((instr & AluMask) == AluTest) {
         // lsl, lsr, asr, add, sub, mov, cmp
@@ -949,158 +977,450 @@ static void execute16(uint16_t instr)
         uint8_t prefix = (instr >> 11) & 0x7;
         switch (prefix) {
         case 0: // 0b000 - LSL
-            emulateLSLImm(instr);
-            return;
+            return emulateLSLImm;
         case 1: // 0b001 - LSR
-            emulateLSRImm(instr);
-            return;
+            return emulateLSRImm;
         case 2: // 0b010 - ASR
-            emulateASRImm(instr);
-            return;
+            return emulateASRImm;
         case 3: { // 0b011 - ADD/SUB reg/imm
             uint8_t subop = (instr >> 9) & 0x3;
             switch (subop) {
             case 0:
-                emulateADDReg(instr);
-                return;
+                return emulateADDReg;
             case 1:
-                emulateSUBReg(instr);
-                return;
+                return emulateSUBReg;
             case 2:
-                emulateADD3Imm(instr);
-                return;
+                return emulateADD3Imm;
             case 3:
-                emulateADD8Imm(instr);
-                return;
+                return emulateADD8Imm;
             }
         }
         case 4: // 0b100 - MOV
-            emulateMovImm(instr);
-            return;
+            return emulateMovImm;
         case 5: // 0b101
-            emulateCmpImm(instr);
-            return;
+            return emulateCmpImm;
         case 6: // 0b110 - ADD 8bit
-            emulateADD8Imm(instr);
-            return;
+            return emulateADD8Imm;
         case 7: // 0b111 - SUB 8bit
-            emulateSUB8Imm(instr);
-            return;
+            return emulateSUB8Imm;
         }
         ASSERT(0 && "unhandled ALU instruction!");
     }
     if ((instr & DataProcMask) == DataProcTest) {
         uint8_t opcode = (instr >> 6) & 0xf;
         switch (opcode) {
-        case 0:  emulateANDReg(instr); return;
-        case 1:  emulateEORReg(instr); return;
-        case 2:  emulateLSLReg(instr); return;
-        case 3:  emulateLSRReg(instr); return;
-        case 4:  emulateASRReg(instr); return;
-        case 5:  emulateADCReg(instr); return;
-        case 6:  emulateSBCReg(instr); return;
-        case 7:  emulateRORReg(instr); return;
-        case 8:  emulateTSTReg(instr); return;
-        case 9:  emulateRSBImm(instr); return;
-        case 10: emulateCMPReg(instr); return;
-        case 11: emulateCMNReg(instr); return;
-        case 12: emulateORRReg(instr); return;
-        case 13: emulateMUL(instr);    return;
-        case 14: emulateBICReg(instr); return;
-        case 15: emulateMVNReg(instr); return;
+        case 0:  return emulateANDReg;
+        case 1:  return emulateEORReg;
+        case 2:  return emulateLSLReg;
+        case 3:  return emulateLSRReg;
+        case 4:  return emulateASRReg;
+        case 5:  return emulateADCReg;
+        case 6:  return emulateSBCReg;
+        case 7:  return emulateRORReg;
+        case 8:  return emulateTSTReg;
+        case 9:  return emulateRSBImm;
+        case 10: return emulateCMPReg;
+        case 11: return emulateCMNReg;
+        case 12: return emulateORRReg;
+        case 13: return emulateMUL;
+        case 14: return emulateBICReg;
+        case 15: return emulateMVNReg;
         }
     }
     if ((instr & MiscMask) == MiscTest) {
         uint8_t opcode = (instr >> 5) & 0x7f;
-        if ((opcode & 0x78) == 0x2) {   // bits [6:3] of opcode identify this group
-            switch (opcode & 0x6) {     // bits [2:1] of the opcode identify the instr
-            case 0: emulateSXTH(instr); return;
-            case 1: emulateSXTB(instr); return;
-            case 2: emulateUXTH(instr); return;
-            case 3: emulateUXTB(instr); return;
+        if ((opcode & 0x78) == 0x10) {  // bits [6:3] of opcode identify this group
+            switch ((opcode >> 1) & 3) {    // bits [2:1] of the opcode identify the instr
+            case 0: return emulateSXTH;
+            case 1: return emulateSXTB;
+            case 2: return emulateUXTH;
+            case 3: return emulateUXTB;
             }
         }
     }
-    if ((instr & MovMask) == MovTest) {
-        emulateMOV(instr);
-        return;
-    }    
-    if ((instr & SvcMask) == SvcTest) {
-        emulateSVC(instr);
-        return;
-    }
-    if ((instr & PcRelLdrMask) == PcRelLdrTest) {
-        emulateLDRLitPool(instr);
-        return;
-    }
+    if ((instr & MovMask) == MovTest)
+        return emulateMOV;
+    if ((instr & SvcMask) == SvcTest)
+        return emulateSVC;
+    if ((instr & PcRelLdrMask) == PcRelLdrTest)
+        return emulateLDRLitPool;
     if ((instr & SpRelLdrStrMask) == SpRelLdrStrTest) {
         uint16_t isLoad = instr & (1 << 11);
         if (isLoad)
-            emulateLDRSPImm(instr);
+            return emulateLDRSPImm;
         else
-            emulateSTRSPImm(instr);
-        return;
-    }
-    if ((instr & SpRelAddMask) == SpRelAddTest) {
-        emulateADDSpImm(instr);
-        return;
-    }
-    if ((instr & UncondBranchMask) == UncondBranchTest) {
-        emulateB(instr);
-        return;
+            return emulateSTRSPImm;
     }
-    if ((instr & CompareBranchMask) == CompareBranchTest) {
-        emulateCBZ_CBNZ(instr);
-        return;
-    }
-    if ((instr & CondBranchMask) == CondBranchTest) {
-        emulateCondB(instr);
-        return;
-    }
-    if (instr == Nop) {
-        // nothing to do
-        return;
+    if ((instr & SpRelAddMask) == SpRelAddTest)
+        return emulateADDSpImm;
+    if ((instr & UncondBranchMask) == UncondBranchTest)
+        return emulateB;
+    if ((instr & CompareBranchMask) == CompareBranchTest)
+        return emulateCBZ_CBNZ;
+    if ((instr & CondBranchMask) == CondBranchTest)
+        return emulateCondB;
+    if (instr == Nop)
+        return emulateNop;
+
+    return emulateInvalid16;
+}
+
+static Handler32 decode32(uint32_t instr)
+{
+    if ((instr & StrMask) == StrTest)
+        return emulateSTR;
+    if ((instr & StrBhMask) == StrBhTest)
+        return emulateSTRBH;
+    if ((instr & LdrBhMask) == LdrBhTest)
+        return emulateLDRBH;
+    if ((instr & LdrMask) == LdrTest)
+        return emulateLDR;
+    if ((instr & MovWtMask) == MovWtTest)
+        return emulateMOVWT;
+    if ((instr & DivMask) == DivTest)
+        return emulateDIV;
+    if ((instr & ClzMask) == ClzTest)
+        return emulateCLZ;
+
+    return emulateInvalid32;
+}
+
+
+/***************************************************************************
+ * Translation Cache
+ ***************************************************************************/
+
+/*
+ * With --svm-translate, we remember the decoded form of each instruction
+ * we run, keyed by its location in the flash block cache. Later visits
+ * skip fetch() and the decode trees above, and jump straight to the
+ * emulation function.
+ *
+ * On hosts with a SvmJit backend, the next visit goes further: we compile
+ * the run of instructions starting there, up to the end of its cache
+ * block, into host code. Instructions the backend doesn't handle end the
+ * run early, and the rest go through the decode cache as usual.
+ *
+ * Only the fetch-time checks are skipped, and only for code in the same
+ * cache block as an instruction we have already fetched successfully.
+ * Cycle counts, PC updates, and everything the emulation functions do,
+ * including faults, are exactly the same as the interpreter.
+ *
+ * The flash cache calls invalidateTranslation() whenever a block's
+ * contents change. Segment remapping doesn't matter here: it only changes
+ * which virtual address maps to a block, not the instructions in it.
+ */
+
+struct Translation {
+    Handler16 handler16;    // Set for 16-bit instructions
+    Handler32 handler32;    // Set for 32-bit instructions
+    uint32_t instr;
+    SvmJit::Code native;    // Compiled block starting here, if any
+    bool nativeTried;
+};
+
+static const unsigned HALFWORDS_PER_BLOCK = FlashBlock::BLOCK_SIZE / sizeof(uint16_t);
+static const unsigned MAX_NATIVE_INSTRS = 64;
+static Translation translations[FlashBlock::NUM_CACHE_BLOCKS][HALFWORDS_PER_BLOCK];
+static bool nativeInitialized;
+static bool nativeAvailable;
+
+static bool describe16(SvmJit::Instr &i, uint16_t instr)
+{
+    /*
+     * Describe a 16-bit instruction for SvmJit, keyed on the same
+     * emulation function the interpreter would pick. Returns false if
+     * the backend can't run it.
+     */
+
+    Handler16 h = decode16(instr);
+    unsigned lo = instr & 0x7;
+    unsigned mid = (instr >> 3) & 0x7;
+    unsigned hi = (instr >> 8) & 0x7;
+    unsigned imm5 = (instr >> 6) & 0x1f;
+    reg_t pc = i.addr + sizeof(uint16_t);   // As seen by the emulation function
+
+    i.rd = lo;
+    i.rn = mid;
+    i.rm = mid;
+
+    if (h == emulateLSLImm) {
+        i.op = SvmJit::OP_LSL_IMM;
+        i.imm = imm5;
+    } else if (h == emulateLSRImm || h == emulateASRImm) {
+        // Shifts by 32 go through the emulation function
+        i.op = imm5 == 0 ? SvmJit::OP_CALL16 :
+            h == emulateLSRImm ? SvmJit::OP_LSR_IMM : SvmJit::OP_ASR_IMM;
+        i.imm = imm5;
+        i.call16 = h;
+    } else if (h == emulateADDReg || h == emulateSUBReg) {
+        i.op = h == emulateADDReg ? SvmJit::OP_ADD : SvmJit::OP_SUB;
+        i.rm = (instr >> 6) & 0x7;
+    } else if (h == emulateADD3Imm || h == emulateSUB3Imm) {
+        i.op = h == emulateADD3Imm ? SvmJit::OP_ADD_IMM : SvmJit::OP_SUB_IMM;
+        i.imm = (instr >> 6) & 0x7;
+    } else if (h == emulateMovImm) {
+        i.op = SvmJit::OP_MOV_IMM;
+        i.rd = hi;
+        i.imm = instr & 0xff;
+    } else if (h == emulateCmpImm) {
+        i.op = SvmJit::OP_CMP_IMM;
+        i.rn = hi;
+        i.imm = instr & 0xff;
+    } else if (h == emulateADD8Imm || h == emulateSUB8Imm) {
+        i.op = h == emulateADD8Imm ? SvmJit::OP_ADD_IMM : SvmJit::OP_SUB_IMM;
+        i.rd = i.rn = hi;
+        i.imm = instr & 0xff;
+    } else if (h == emulateANDReg || h == emulateEORReg || h == emulateORRReg ||
+               h == emulateMUL || h == emulateBICReg) {
+        i.op = h == emulateANDReg ? SvmJit::OP_AND :
+               h == emulateEORReg ? SvmJit::OP_EOR :
+               h == emulateORRReg ? SvmJit::OP_ORR :
+               h == emulateMUL ? SvmJit::OP_MUL : SvmJit::OP_BIC;
+        i.rn = lo;
+    } else if (h == emulateTSTReg || h == emulateCMPReg || h == emulateCMNReg) {
+        i.op = h == emulateTSTReg ? SvmJit::OP_TST :
+               h == emulateCMPReg ? SvmJit::OP_CMP : SvmJit::OP_CMN;
+        i.rn = lo;
+    } else if (h == emulateLSLReg || h == emulateLSRReg || h == emulateASRReg ||
+               h == emulateADCReg || h == emulateSBCReg || h == emulateRORReg) {
+        i.op = SvmJit::OP_CALL16;
+        i.call16 = h;
+    } else if (h == emulateRSBImm) {
+        i.op = SvmJit::OP_RSB;
+    } else if (h == emulateMVNReg || h == emulateMOV || h == emulateSXTB ||
+               h == emulateSXTH || h == emulateUXTB || h == emulateUXTH) {
+        i.op = h == emulateMVNReg ? SvmJit::OP_MVN :
+               h == emulateMOV ? SvmJit::OP_MOV :
+               h == emulateSXTB ? SvmJit::OP_SXTB :
+               h == emulateSXTH ? SvmJit::OP_SXTH :
+               h == emulateUXTB ? SvmJit::OP_UXTB : SvmJit::OP_UXTH;
+    } else if (h == emulateB) {
+        i.target = branchTargetB(instr, pc);
+        i.op = i.target == pc ? SvmJit::OP_NOP : SvmJit::OP_B;
+    } else if (h == emulateCondB) {
+        i.cond = (instr >> 8) & 0xf;
+        i.target = passedBranchTargetCondB(instr, pc);
+        i.op = i.target == pc ? SvmJit::OP_NOP :
+               i.cond == NoneAL ? SvmJit::OP_B : SvmJit::OP_BCOND;
+    } else if (h == emulateCBZ_CBNZ) {
+        i.rn = lo;
+        i.target = passedBranchTargetCBZ_CBNZ(instr, pc);
+        i.op = i.target == pc ? SvmJit::OP_NOP :
+               (instr & (1 << 11)) ? SvmJit::OP_CBNZ : SvmJit::OP_CBZ;
+    } else if (h == emulateSTRSPImm || h == emulateLDRSPImm) {
+        i.op = h == emulateLDRSPImm ? SvmJit::OP_LDR : SvmJit::OP_STR;
+        i.rd = hi;
+        i.rn = REG_SP;
+        i.imm = (instr & 0xff) << 2;
+    } else if (h == emulateADDSpImm) {
+        i.op = SvmJit::OP_ADD_SP;
+        i.rd = hi;
+        i.imm = (instr & 0xff) << 2;
+    } else if (h == emulateLDRLitPool) {
+        // The address is constant. If it would fault, let the interpreter do that.
+        i.op = SvmJit::OP_LDR_LIT;
+        i.rd = hi;
+        i.target = ((pc + 3) & ~3) + ((instr & 0xff) << 2);
+        if (!SvmMemory::isAddrValid(i.target) || !SvmMemory::isAddrAligned(i.target, 4))
+            return false;
+    } else if (h == emulateSVC) {
+        i.op = SvmJit::OP_SVC;
+    } else if (h == emulateNop) {
+        i.op = SvmJit::OP_NOP;
+    } else {
+        return false;
     }
 
-    // should never get here since we should only be executing validated instructions
-    LOG(("SVMCPU: invalid 16bit instruction: 0x%x\n", instr));
-    return emulateFault(F_CPU_SIM);
+    return true;
 }
 
-static void execute32(uint32_t instr)
+static bool describe32(SvmJit::Instr &i, uint32_t instr)
 {
-    if ((instr & StrMask) == StrTest) {
-        emulateSTR(instr);
-        return;
+    // Like describe16(). None of these may use PC.
+
+    const unsigned HalfwordBit = 1 << 21;
+    const unsigned SignExtBit = 1 << 24;
+    const unsigned TopBit = 1 << 23;
+
+    Handler32 h = decode32(instr);
+    unsigned Rn = (instr >> 16) & 0xF;
+    unsigned Rt = (instr >> 12) & 0xF;
+    unsigned Rd = (instr >> 8) & 0xF;
+
+    if (h == emulateSTR || h == emulateLDR || h == emulateSTRBH || h == emulateLDRBH) {
+        if (Rn == REG_PC || Rt == REG_PC)
+            return false;
+        i.rd = Rt;
+        i.rn = Rn;
+        i.imm = instr & 0xFFF;
+        if (h == emulateSTR)
+            i.op = SvmJit::OP_STR;
+        else if (h == emulateLDR)
+            i.op = SvmJit::OP_LDR;
+        else if (h == emulateSTRBH)
+            i.op = (instr & HalfwordBit) ? SvmJit::OP_STRH : SvmJit::OP_STRB;
+        else switch (instr & (HalfwordBit | SignExtBit)) {
+            case 0:             i.op = SvmJit::OP_LDRB; break;
+            case HalfwordBit:   i.op = SvmJit::OP_LDRH; break;
+            case SignExtBit:    i.op = SvmJit::OP_LDRSB; break;
+            default:            i.op = SvmJit::OP_LDRSH; break;
+        }
+    } else if (h == emulateMOVWT) {
+        if (Rd == REG_PC)
+            return false;
+        i.rd = Rd;
+        i.imm = (instr & 0x000000FF) |
+                (instr & 0x00007000) >> 4 |
+                (instr & 0x04000000) >> 15 |
+                (instr & 0x000F0000) >> 4;
+        i.op = (instr & TopBit) ? SvmJit::OP_MOVT : SvmJit::OP_MOV_IMM;
+    } else if (h == emulateDIV || (h == emulateCLZ && Rn == (instr & 0xF))) {
+        if (Rd == REG_PC || Rn == REG_PC || (instr & 0xF) == REG_PC)
+            return false;
+        i.op = SvmJit::OP_CALL32;
+        i.rd = Rd;
+        i.call32 = h;
+    } else {
+        return false;
     }
-    if ((instr & StrBhMask) == StrBhTest) {
-        emulateSTRBH(instr);
-        return;
+
+    return true;
+}
+
+static unsigned describeBlock(SvmJit::Instr *list, reg_t pc)
+{
+    /*
+     * Describe the instructions starting at PC, up to the end of its
+     * flash cache block. Stops after an unconditional branch or SVC,
+     * or before anything the backend can't run.
+     */
+
+    uintptr_t offset = FlashBlock::cacheOffset(pc);
+    reg_t end = pc - offset % FlashBlock::BLOCK_SIZE + FlashBlock::BLOCK_SIZE;
+    unsigned count = 0;
+
+    while (count < MAX_NATIVE_INSTRS && pc + sizeof(uint16_t) <= end) {
+        const uint16_t *code = reinterpret_cast<const uint16_t*>(pc);
+        SvmJit::Instr &i = list[count];
+
+        memset(&i, 0, sizeof i);
+        i.addr = pc;
+        i.raw = code[0];
+
+        if (instructionSize(code[0]) == InstrBits16) {
+            i.size = sizeof(uint16_t);
+            if (!describe16(i, code[0]))
+                break;
+        } else {
+            i.size = 2 * sizeof(uint16_t);
+            if (pc + i.size > end)
+                break;
+            i.raw = code[0] << 16 | code[1];
+            if (!describe32(i, i.raw))
+                break;
+        }
+
+        count++;
+        pc += i.size;
+        if (i.op == SvmJit::OP_B || i.op == SvmJit::OP_SVC)
+            break;
     }
-    if ((instr & LdrBhMask) == LdrBhTest) {
-        emulateLDRBH(instr);
-        return;
+
+    return count;
+}
+
+static bool initNative()
+{
+    // Tell SvmJit where guest memory lives. Called with PC in the flash cache.
+
+    SvmJit::Runtime rt;
+    SvmMemory::VirtAddr va = SvmMemory::VIRTUAL_RAM_BASE;
+    SvmMemory::PhysAddr ram;
+
+    if (!SvmMemory::mapRAM(va, SvmMemory::RAM_SIZE_IN_BYTES, ram))
+        return false;
+
+    rt.svc = emulateSVC;
+    rt.ramBase = reinterpret_cast<uintptr_t>(ram);
+    rt.ramSize = SvmMemory::RAM_SIZE_IN_BYTES;
+    rt.cacheBase = regs[REG_PC] - FlashBlock::cacheOffset(regs[REG_PC]);
+    rt.cacheSize = FlashBlock::NUM_CACHE_BLOCKS * FlashBlock::BLOCK_SIZE;
+    rt.virtualRAMBase = SvmMemory::VIRTUAL_RAM_BASE;
+
+    return SvmJit::init(rt);
+}
+
+static void compileNative(Translation *t)
+{
+    t->nativeTried = true;
+
+    if (!nativeInitialized) {
+        nativeInitialized = true;
+        nativeAvailable = initNative();
     }
-    if ((instr & LdrMask) == LdrTest) {
-        emulateLDR(instr);
+    if (!nativeAvailable)
         return;
-    }
-    if ((instr & MovWtMask) == MovWtTest) {
-        emulateMOVWT(instr);
+
+    SvmJit::Instr list[MAX_NATIVE_INSTRS];
+    unsigned count = describeBlock(list, regs[REG_PC]);
+    if (!count)
         return;
+
+    t->native = SvmJit::compile(list, count);
+    if (!t->native) {
+        // Out of code memory. Start over, keeping this instruction's decode.
+        Translation saved = *t;
+        SvmJit::flush();
+        memset(translations, 0, sizeof translations);
+        *t = saved;
+        t->native = SvmJit::compile(list, count);
     }
-    if ((instr & DivMask) == DivTest) {
-        emulateDIV(instr);
-        return;
+}
+
+static Translation *translate()
+{
+    /*
+     * Find or create the translation for the instruction at PC.
+     * Returns 0 if it must go through the interpreter instead.
+     */
+
+    uintptr_t offset = FlashBlock::cacheOffset(regs[REG_PC]);
+    if (offset >= FlashBlock::NUM_CACHE_BLOCKS * FlashBlock::BLOCK_SIZE || (offset & 1))
+        return 0;
+
+    unsigned blockId = offset / FlashBlock::BLOCK_SIZE;
+    unsigned index = (offset % FlashBlock::BLOCK_SIZE) / sizeof(uint16_t);
+    Translation *t = &translations[blockId][index];
+
+    if (t->handler16 || t->handler32) {
+        if (!t->nativeTried)
+            compileNative(t);
+        return t;
     }
-    if ((instr & ClzMask) == ClzTest) {
-        emulateCLZ(instr);
-        return;
+
+    /*
+     * The first visit goes through the interpreter, so this instruction
+     * gets all of fetch()'s checks. Translate it next time.
+     */
+    const uint16_t *pc = reinterpret_cast<const uint16_t*>(regs[REG_PC]);
+    uint16_t instr = pc[0];
+
+    if (instructionSize(instr) == InstrBits16) {
+        t->instr = instr;
+        t->handler16 = decode16(instr);
+    } else if (index + 1 < HALFWORDS_PER_BLOCK) {
+        t->instr = instr << 16 | pc[1];
+        t->handler32 = decode32(t->instr);
     }
 
-    // should never get here since we should only be executing validated instructions
-    LOG(("SVMCPU: invalid 32bit instruction: 0x%x\n", instr));
-    return emulateFault(F_CPU_SIM);
+    return 0;
+}
+
+void invalidateTranslation(unsigned blockId)
+{
+    ASSERT(blockId < FlashBlock::NUM_CACHE_BLOCKS);
+    memset(translations[blockId], 0, sizeof translations[blockId]);
 }
 
 
@@ -1113,17 +1433,58 @@ void run(reg_t sp, reg_t pc)
     regs[REG_SP] = sp;
     regs[REG_PC] = pc;
 
+    // Tracing happens in fetch(), so it needs every instruction to get there
+    const System *sys = SystemMC::getSystem();
+    const bool useTranslations = sys->opt_svmTranslate && !sys->opt_svmTrace;
+
     for (;;) {
+        if (useTranslations) {
+            Translation *t = translate();
+            if (t && t->native) {
+                unsigned reason = t->native(regs, &svmCyclesElapsed);
+                if (reason == SvmJit::EXIT_BRANCH)
+                    calculateElapsedTicks();
+                if (reason != SvmJit::EXIT_INTERPRET)
+                    continue;
+            } else if (t) {
+                if (t->handler16) {
+                    svmCyclesElapsed += MCTiming::CPU_FETCH;
+                    regs[REG_PC] += sizeof(uint16_t);
+                    t->handler16(t->instr);
+                } else {
+                    svmCyclesElapsed += 2 * MCTiming::CPU_FETCH;
+                    regs[REG_PC] += 2 * sizeof(uint16_t);
+                    t->handler32(t->instr);
+                }
+                continue;
+            }
+        }
+
         uint16_t instr = fetch();
         if (instructionSize(instr) == InstrBits16) {
-            execute16(instr);
+            decode16(instr)(instr);
         }
         else {
             uint16_t instrLow = fetch();
-            execute32(instr << 16 | instrLow);
+            uint32_t instr32 = instr << 16 | instrLow;
+            decode32(instr32)(instr32);
         }
     }
 }
 
 
 }  // namespace SvmCpu
+
+
+uint64_t SvmProfiler::cycles()
+{
+    // Virtual CPU cycles, including any we haven't forwarded yet
+    uint64_t cycles = SystemMC::getTicks() * MCTiming::CPU_RATE_NUMERATOR
+        + SvmCpu::svmCyclesElapsed;
+    return cycles / MCTiming::CPU_RATE_DENOMINATOR;
+}
+
+uint32_t SyscallCounters::timestamp()
+{
+    return SvmProfiler::cycles();
+}
@@ -34,6 +34,7 @@
 #include "mc_elfdebuginfo.h"
 #include "mc_gdbserver.h"
 #include "mc_logdecoder.h"
+#include "mc_svmprofiler.h"
 #include "lua_runtime.h"
 #include "tinythread.h"
 #include "tasks.h"
@@ -241,6 +242,7 @@ void SvmDebugPipe::setSymbolSource(const Elf::Program &program)
     gELFDebugInfo.init(program);
     GDBServer::setDebugInfo(&gELFDebugInfo);
     GDBServer::setMessageCallback(debuggerMsgCallback);
+    SvmProfiler::onExec(program);
 }
 
 static void luaHandler(const char *str, void*)
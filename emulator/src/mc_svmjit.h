@@ -0,0 +1,158 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _MC_SVMJIT_H
+#define _MC_SVMJIT_H
+
+/*
+ * Host code generation for SVM instructions, used by --svm-translate.
+ * This file contains simulation-only definitions.
+ *
+ * SvmCpu decodes a run of instructions from one flash cache block into
+ * a list of SvmJit::Instr, and a host backend compiles that list into a
+ * native function. Each instruction must behave exactly as it does in
+ * the interpreter, including cycle counts and the quirks of each
+ * emulation function.
+ *
+ * A block runs until it reaches an unconditional branch or an SVC, or
+ * falls off the end of the list. Taken conditional branches leave the
+ * block too. Anything the backend can't do quickly, like a memory
+ * access that would fault, leaves the block with EXIT_INTERPRET and PC
+ * pointing at that instruction, so the interpreter can run it.
+ *
+ * Runs on the MC thread, like SvmCpu itself.
+ */
+
+#include "svm.h"
+
+namespace SvmJit {
+
+enum Opcode {
+    OP_NOP,
+
+    // Data processing. 'rd' is written, 'rn' and 'rm' are read.
+    OP_MOV,         // rd = rm
+    OP_MOV_IMM,     // rd = imm
+    OP_ADD,         // rd = rn + rm, sets NZCV
+    OP_ADD_IMM,     // rd = rn + imm, sets NZCV
+    OP_SUB,         // rd = rn - rm, sets NZCV
+    OP_SUB_IMM,     // rd = rn - imm, sets NZCV
+    OP_RSB,         // rd = 0 - rn, sets NZCV
+    OP_CMP,         // rn - rm, sets NZCV
+    OP_CMP_IMM,     // rn - imm, sets NZCV
+    OP_CMN,         // rn + rm, sets NZCV
+    OP_AND,         // rd = rn & rm, sets NZ
+    OP_EOR,         // rd = rn ^ rm, sets NZ
+    OP_ORR,         // rd = rn | rm, sets NZ
+    OP_TST,         // rn & rm, sets NZ
+    OP_BIC,         // rd = uint32(rn & ~rm)
+    OP_MVN,         // rd = uint32(~rm)
+    OP_MUL,         // rd = uint32(rn * rm), NZ from the 64-bit product
+    OP_LSL_IMM,     // rd = rm << imm, sets NZC. imm is 0-31.
+    OP_LSR_IMM,     // rd = rm >> imm, sets NZC. imm is 1-31.
+    OP_ASR_IMM,     // rd = int32(rm) >> imm, sets NZC. imm is 1-31.
+    OP_SXTB,        // rd = uint32(sext(rm, 8))
+    OP_SXTH,        // rd = uint32(sext(rm, 16))
+    OP_UXTB,        // rd = rm & 0xFF
+    OP_UXTH,        // rd = rm & 0xFFFF
+    OP_MOVT,        // rd = (rd & 0xFFFF) | imm << 16
+    OP_ADD_SP,      // rd = uint32(squash(SP) + imm)
+
+    // Memory, at address rn + imm. 'rd' is the data register.
+    OP_LDR,
+    OP_LDRB,
+    OP_LDRH,
+    OP_LDRSB,
+    OP_LDRSH,
+    OP_STR,         // Stores squash(rd)
+    OP_STRB,
+    OP_STRH,
+    OP_LDR_LIT,     // rd = *(uint32_t*)target, known to be valid
+
+    // Runtime call to the interpreter's emulation function. It must not
+    // branch or fault. It can read any register or flag, and writes 'rd'.
+    OP_CALL16,
+    OP_CALL32,
+
+    // Control flow
+    OP_B,           // Branch to 'target' and end the block
+    OP_BCOND,       // Branch to 'target' if 'cond' passes
+    OP_CBZ,         // Branch to 'target' if rn == 0
+    OP_CBNZ,        // Branch to 'target' if rn != 0
+    OP_SVC,         // Runtime call for SVC 'raw', and end the block
+};
+
+struct Instr {
+    uint8_t op;
+    uint8_t rd, rn, rm;
+    uint8_t cond;
+    uint8_t size;               // Bytes of code, 2 or 4
+    uint32_t imm;
+    uint32_t raw;               // Original encoding
+    Svm::reg_t addr;            // Physical address of this instruction
+    Svm::reg_t target;          // Branch target or literal address
+    void (*call16)(uint16_t);
+    void (*call32)(uint32_t);
+};
+
+/*
+ * What the backend needs from the rest of the simulator. The memory
+ * ranges are the same ones SvmMemory::isAddrValid() checks.
+ */
+struct Runtime {
+    void (*svc)(uint16_t instr);
+    uintptr_t ramBase;
+    uintptr_t ramSize;
+    uintptr_t cacheBase;
+    uintptr_t cacheSize;
+    uint32_t virtualRAMBase;
+};
+
+// How a compiled block finished
+enum ExitReason {
+    EXIT_NEXT,          // PC is the next instruction to run
+    EXIT_BRANCH,        // Took a branch. Forward elapsed cycles, like the interpreter.
+    EXIT_INTERPRET,     // Run the instruction at PC in the interpreter
+};
+
+/*
+ * A compiled block. Reads and writes the SVM registers in 'regs', and
+ * adds the cycles it used to '*cycles'. Returns an ExitReason.
+ */
+typedef unsigned (*Code)(Svm::reg_t *regs, unsigned *cycles);
+
+// Returns false if there's no backend for this host.
+bool init(const Runtime &rt);
+
+// Returns 0 if we're out of code memory. flush() and try again.
+Code compile(const Instr *instrs, unsigned count);
+
+// Forget all compiled code
+void flush();
+
+}  // namespace SvmJit
+
+#endif
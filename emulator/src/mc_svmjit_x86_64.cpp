@@ -0,0 +1,955 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ * Micah Elizabeth Scott <micah@misc.name>
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * x86-64 backend for SvmJit, for hosts with the System V calling
+ * convention (Linux and Mac OS). Other hosts get the stubs at the
+ * bottom of this file, and SvmCpu sticks to its decode cache.
+ *
+ * Register use inside a compiled block:
+ *
+ *   r8-r15   SVM r0-r7. Loaded on entry, stored on exit if modified.
+ *   rbx      Pointer to the SVM register file. Other SVM registers
+ *            live there, and are accessed in place.
+ *   rbp      Pointer to the cycle counter
+ *   esi/edi  Operands of the last flag-setting instruction
+ *   rax-rdx  Scratch
+ *
+ * Flags are lazy. An instruction that sets flags only saves its 32-bit
+ * operands in esi/edi, and we rebuild CPSR from them when something
+ * needs it: a runtime call, a block exit, or a condition we can't test
+ * directly. Most conditional branches re-run the host CMP or ADD on the
+ * saved operands and use the host flags.
+ *
+ * Code memory is never writable and executable at once. It stays
+ * read/execute, except for the pages we're copying a new block into.
+ */
+
+#include "mc_svmjit.h"
+#include "mc_timing.h"
+#include "macros.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <vector>
+
+namespace SvmJit {
+
+using namespace Svm;
+
+enum HostReg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum HostCond {
+    CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+// Opcode extensions for the 0x81 group
+enum AluOp {
+    ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7
+};
+
+// What the pending flag state in esi/edi came from
+enum FlagState {
+    FLAGS_CLEAN,        // CPSR in memory is up to date
+    FLAGS_ADD,          // NZCV from esi + edi
+    FLAGS_SUB,          // NZCV from esi - edi
+    FLAGS_NZ32,         // NZ from esi
+    FLAGS_NZ64,         // NZ from rsi
+};
+
+static const unsigned NUM_MAPPED_REGS = 8;
+static const unsigned CODE_SIZE = 4 << 20;
+static const unsigned CPSR_OFFSET = REG_CPSR * sizeof(reg_t);
+
+static Runtime runtime;
+static uint8_t *codeBase;
+static unsigned codeUsed;
+
+
+class BlockCompiler {
+public:
+    BlockCompiler() : flags(FLAGS_CLEAN), dirty(0), cycles(0) {}
+
+    void compile(const Instr *instrs, unsigned count);
+
+    const std::vector<uint8_t> &getCode() const {
+        return code;
+    }
+
+private:
+    /*
+     * Everything an exit stub needs to leave the block. Stubs are
+     * emitted out of line, after the body of the block.
+     */
+    struct Exit {
+        unsigned patch[2];
+        unsigned numPatches;
+        uint8_t flags;
+        uint8_t dirty;
+        uint8_t reason;
+        bool svc;
+        uint16_t svcInstr;
+        unsigned cycles;
+        reg_t pc;
+    };
+
+    std::vector<uint8_t> code;
+    std::vector<Exit> exits;
+    FlagState flags;
+    unsigned dirty;
+    unsigned cycles;
+
+    // Raw encoding
+
+    void emit8(uint8_t b) {
+        code.push_back(b);
+    }
+
+    void emit32(uint32_t w) {
+        for (unsigned i = 0; i < 4; i++)
+            emit8(w >> (i * 8));
+    }
+
+    void emit64(uint64_t w) {
+        emit32(w);
+        emit32(w >> 32);
+    }
+
+    void rex(bool w, unsigned reg, unsigned rm) {
+        uint8_t b = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (b != 0x40)
+            emit8(b);
+    }
+
+    void opcode(unsigned opc) {
+        if (opc > 0xFF)
+            emit8(opc >> 8);
+        emit8(opc);
+    }
+
+    // Instruction with a register-direct r/m operand
+    void opReg(unsigned opc, bool w, unsigned reg, unsigned rm) {
+        rex(w, reg, rm);
+        opcode(opc);
+        emit8(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    // Instruction with a [base + disp32] r/m operand
+    void opMem(unsigned opc, bool w, unsigned reg, unsigned base, int32_t disp) {
+        ASSERT((base & 7) != RSP);
+        rex(w, reg, base);
+        opcode(opc);
+        emit8(0x80 | (reg & 7) << 3 | (base & 7));
+        emit32(disp);
+    }
+
+    // Common instructions
+
+    void aluRR(unsigned opc, bool w, unsigned dst, unsigned src) {
+        opReg(opc, w, src, dst);
+    }
+
+    void aluRI(AluOp op, bool w, unsigned dst, uint32_t imm) {
+        opReg(0x81, w, op, dst);
+        emit32(imm);
+    }
+
+    void movRR(bool w, unsigned dst, unsigned src) {
+        aluRR(0x89, w, dst, src);
+    }
+
+    void movImm(unsigned dst, uint64_t imm) {
+        // 32-bit moves zero-extend
+        bool w = imm != (uint32_t)imm;
+        rex(w, 0, dst);
+        emit8(0xB8 + (dst & 7));
+        if (w)
+            emit64(imm);
+        else
+            emit32(imm);
+    }
+
+    void shiftImm(unsigned ext, bool w, unsigned dst, unsigned amount) {
+        opReg(0xC1, w, ext, dst);
+        emit8(amount);
+    }
+
+    void btImm(unsigned reg, unsigned bit) {
+        opReg(0x0FBA, true, 4, reg);
+        emit8(bit);
+    }
+
+    void setcc(HostCond cc, unsigned dst) {
+        // 'dst' must be AL, CL, or DL
+        opReg(0x0F90 + cc, false, 0, dst);
+    }
+
+    unsigned jcc(HostCond cc) {
+        emit8(0x0F);
+        emit8(0x80 + cc);
+        emit32(0);
+        return code.size() - 4;
+    }
+
+    void patch(unsigned at) {
+        int32_t rel = code.size() - (at + 4);
+        memcpy(&code[at], &rel, sizeof rel);
+    }
+
+    void callAbs(const void *fn) {
+        movImm(RAX, reinterpret_cast<uintptr_t>(fn));
+        opReg(0xFF, false, 2, RAX);
+    }
+
+    void addCycles(unsigned n) {
+        if (n) {
+            opMem(0x81, false, ALU_ADD, RBP, 0);
+            emit32(n);
+        }
+    }
+
+    // SVM registers
+
+    static unsigned regOffset(unsigned r) {
+        return r * sizeof(reg_t);
+    }
+
+    void loadReg(unsigned dst, unsigned r, bool w = true) {
+        if (r < NUM_MAPPED_REGS)
+            movRR(w, dst, R8 + r);
+        else
+            opMem(0x8B, w, dst, RBX, regOffset(r));
+    }
+
+    void storeReg(unsigned r, unsigned src) {
+        if (r < NUM_MAPPED_REGS) {
+            movRR(true, R8 + r, src);
+            dirty |= 1 << r;
+        } else {
+            opMem(0x89, true, src, RBX, regOffset(r));
+        }
+    }
+
+    void writeBack(unsigned mask) {
+        for (unsigned r = 0; r < NUM_MAPPED_REGS; r++)
+            if (mask & (1 << r))
+                opMem(0x89, true, R8 + r, RBX, regOffset(r));
+    }
+
+    void reloadReg(unsigned r) {
+        if (r < NUM_MAPPED_REGS)
+            opMem(0x8B, true, R8 + r, RBX, regOffset(r));
+    }
+
+    // Flags
+
+    void setFlags(FlagState f, unsigned a, unsigned b);
+    void keepCarryAndOverflow();
+    void setFlagsNZ(FlagState f, unsigned src);
+    void materializeFlags(FlagState f);
+    void composeFlags(bool carry, bool overflow);
+    bool directCondition(unsigned cond, HostCond &cc);
+
+    void materializeFlags() {
+        materializeFlags(flags);
+        flags = FLAGS_CLEAN;
+    }
+
+    // Control flow
+
+    unsigned newExit(reg_t pc, unsigned exitCycles, ExitReason reason);
+    void jumpToExit(unsigned exit, HostCond cc);
+    void jumpToExit(unsigned exit);
+    void emitExit(const Exit &e);
+    void emitEpilogue();
+
+    // Instructions
+
+    void emitMemCheck(unsigned exit, unsigned alignment);
+    void emitSquash(unsigned reg);
+    void emitInstr(const Instr &i);
+    void emitCall(const Instr &i);
+    void emitBranch(const Instr &i);
+};
+
+
+/***************************************************************************
+ * Flags
+ ***************************************************************************/
+
+void BlockCompiler::setFlags(FlagState f, unsigned a, unsigned b)
+{
+    // A new NZCV result makes any pending flags dead
+    movRR(false, RSI, a);
+    movRR(false, RDI, b);
+    flags = f;
+}
+
+void BlockCompiler::keepCarryAndOverflow()
+{
+    /*
+     * Before an instruction that only sets NZ: C and V still belong to
+     * the older result, if there is one. Uses the scratch registers.
+     */
+    if (flags == FLAGS_ADD || flags == FLAGS_SUB)
+        materializeFlags();
+}
+
+void BlockCompiler::setFlagsNZ(FlagState f, unsigned src)
+{
+    ASSERT(flags != FLAGS_ADD && flags != FLAGS_SUB);
+    movRR(f == FLAGS_NZ64, RSI, src);
+    flags = f;
+}
+
+void BlockCompiler::materializeFlags(FlagState f)
+{
+    switch (f) {
+
+    case FLAGS_CLEAN:
+        break;
+
+    case FLAGS_ADD:
+    case FLAGS_SUB:
+        movRR(false, RAX, RSI);
+        aluRR(f == FLAGS_ADD ? 0x01 : 0x29, false, RAX, RDI);
+        // ARM's carry is the inverse of x86's borrow
+        setcc(f == FLAGS_ADD ? CC_B : CC_AE, RCX);
+        setcc(CC_O, RDX);
+        emit8(0x9F);    // lahf
+        composeFlags(true, true);
+        break;
+
+    case FLAGS_NZ32:
+    case FLAGS_NZ64:
+        aluRR(0x85, f == FLAGS_NZ64, RSI, RSI);
+        emit8(0x9F);    // lahf
+        composeFlags(false, false);
+        break;
+    }
+}
+
+void BlockCompiler::composeFlags(bool carry, bool overflow)
+{
+    /*
+     * Build NZ from SF and ZF in AH, plus C from CL and V from DL if
+     * we have them. Like the interpreter's setNeg(), the result leaves
+     * CPSR sign-extended from bit 31.
+     */
+
+    uint32_t mask = 0xC0000000;
+
+    opReg(0x0FB6, false, RAX, 4);   // movzx eax, ah
+    aluRI(ALU_AND, false, RAX, 0xC0);
+    shiftImm(4, false, RAX, 24);
+    if (carry) {
+        opReg(0x0FB6, false, RCX, RCX);
+        shiftImm(4, false, RCX, 29);
+        aluRR(0x09, false, RAX, RCX);
+        mask |= 1 << 29;
+    }
+    if (overflow) {
+        opReg(0x0FB6, false, RDX, RDX);
+        shiftImm(4, false, RDX, 28);
+        aluRR(0x09, false, RAX, RDX);
+        mask |= 1 << 28;
+    }
+
+    opMem(0x8B, false, RCX, RBX, CPSR_OFFSET);
+    aluRI(ALU_AND, false, RCX, ~mask);
+    aluRR(0x09, false, RAX, RCX);
+    opReg(0x63, true, RAX, RAX);    // movsxd rax, eax
+    opMem(0x89, true, RAX, RBX, CPSR_OFFSET);
+}
+
+bool BlockCompiler::directCondition(unsigned cond, HostCond &cc)
+{
+    /*
+     * Can we test 'cond' with host flags, without building CPSR?
+     * If so, sets the host flags and returns the host condition.
+     */
+
+    static const HostCond subConds[] = {
+        CC_E, CC_NE, CC_AE, CC_B, CC_S, CC_NS, CC_O, CC_NO,
+        CC_A, CC_BE, CC_GE, CC_L, CC_G, CC_LE
+    };
+    static const HostCond addConds[] = {
+        CC_E, CC_NE, CC_B, CC_AE, CC_S, CC_NS, CC_O, CC_NO,
+        CC_P /* unused */, CC_P /* unused */, CC_GE, CC_L, CC_G, CC_LE
+    };
+
+    ASSERT(cond < NoneAL);
+
+    switch (flags) {
+
+    case FLAGS_SUB:
+        aluRR(0x39, false, RSI, RDI);
+        cc = subConds[cond];
+        return true;
+
+    case FLAGS_ADD:
+        if (cond == HI || cond == LS)
+            return false;
+        movRR(false, RAX, RSI);
+        aluRR(0x01, false, RAX, RDI);
+        cc = addConds[cond];
+        return true;
+
+    case FLAGS_NZ32:
+    case FLAGS_NZ64:
+        if (cond != EQ && cond != NE && cond != MI && cond != PL)
+            return false;
+        aluRR(0x85, flags == FLAGS_NZ64, RSI, RSI);
+        cc = subConds[cond];
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+
+/***************************************************************************
+ * Control Flow
+ ***************************************************************************/
+
+unsigned BlockCompiler::newExit(reg_t pc, unsigned exitCycles, ExitReason reason)
+{
+    Exit e;
+    e.numPatches = 0;
+    e.flags = flags;
+    e.dirty = dirty;
+    e.reason = reason;
+    e.svc = false;
+    e.svcInstr = 0;
+    e.cycles = exitCycles;
+    e.pc = pc;
+    exits.push_back(e);
+    return exits.size() - 1;
+}
+
+void BlockCompiler::jumpToExit(unsigned exit, HostCond cc)
+{
+    Exit &e = exits[exit];
+    ASSERT(e.numPatches < arraysize(e.patch));
+    e.patch[e.numPatches++] = jcc(cc);
+}
+
+void BlockCompiler::jumpToExit(unsigned exit)
+{
+    Exit &e = exits[exit];
+    ASSERT(e.numPatches < arraysize(e.patch));
+    emit8(0xE9);
+    emit32(0);
+    e.patch[e.numPatches++] = code.size() - 4;
+}
+
+void BlockCompiler::emitExit(const Exit &e)
+{
+    for (unsigned i = 0; i < e.numPatches; i++)
+        patch(e.patch[i]);
+
+    materializeFlags(FlagState(e.flags));
+    writeBack(e.dirty);
+
+    movImm(RAX, e.pc);
+    opMem(0x89, true, RAX, RBX, regOffset(REG_PC));
+    addCycles(e.cycles);
+
+    if (e.svc) {
+        // May longjmp away; everything is already stored
+        movImm(RDI, e.svcInstr);
+        callAbs(reinterpret_cast<const void*>(runtime.svc));
+    }
+
+    movImm(RAX, e.reason);
+    emitEpilogue();
+}
+
+void BlockCompiler::emitEpilogue()
+{
+    aluRI(ALU_ADD, true, RSP, 8);
+    emit8(0x41); emit8(0x58 + (R15 & 7));
+    emit8(0x41); emit8(0x58 + (R14 & 7));
+    emit8(0x41); emit8(0x58 + (R13 & 7));
+    emit8(0x41); emit8(0x58 + (R12 & 7));
+    emit8(0x58 + RBP);
+    emit8(0x58 + RBX);
+    emit8(0xC3);
+}
+
+
+/***************************************************************************
+ * Instructions
+ ***************************************************************************/
+
+void BlockCompiler::emitMemCheck(unsigned exit, unsigned alignment)
+{
+    /*
+     * Same checks as SvmMemory::isAddrValid() and isAddrAligned(), on
+     * the address in RAX. Anything that would fault goes back to the
+     * interpreter, which raises the fault properly.
+     */
+
+    movImm(RCX, -runtime.ramBase);
+    aluRR(0x01, true, RCX, RAX);
+    aluRI(ALU_CMP, true, RCX, runtime.ramSize);
+    unsigned inRAM = jcc(CC_B);
+
+    movImm(RCX, -runtime.cacheBase);
+    aluRR(0x01, true, RCX, RAX);
+    aluRI(ALU_CMP, true, RCX, runtime.cacheSize);
+    jumpToExit(exit, CC_AE);
+
+    patch(inRAM);
+    if (alignment > 1) {
+        emit8(0xA8);    // test al, imm8
+        emit8(alignment - 1);
+        jumpToExit(exit, CC_NE);
+    }
+}
+
+void BlockCompiler::emitSquash(unsigned reg)
+{
+    /*
+     * SvmMemory::squashPhysicalAddr() on a 64-bit 'reg', using RDX.
+     * The low 32 bits of 'reg' hold the result.
+     */
+
+    movRR(false, RDX, reg);
+    aluRR(0x39, true, reg, RDX);
+    unsigned small = jcc(CC_E);
+
+    movImm(RDX, -runtime.ramBase);
+    aluRR(0x01, true, RDX, reg);
+    aluRI(ALU_CMP, true, RDX, runtime.ramSize);
+    unsigned notRAM = jcc(CC_AE);
+    opMem(0x8D, false, reg, RDX, runtime.virtualRAMBase);   // lea
+
+    patch(small);
+    patch(notRAM);
+}
+
+void BlockCompiler::emitCall(const Instr &i)
+{
+    // The emulation function works on the register file in memory
+    materializeFlags();
+    writeBack(dirty);
+    dirty = 0;
+
+    movImm(RDI, i.raw);
+    if (i.op == OP_CALL16)
+        callAbs(reinterpret_cast<const void*>(i.call16));
+    else
+        callAbs(reinterpret_cast<const void*>(i.call32));
+
+    // SVM r0-r3 live in caller-saved registers, and the call may have written 'rd'
+    for (unsigned r = 0; r < 4; r++)
+        reloadReg(r);
+    if (i.rd >= 4)
+        reloadReg(i.rd);
+}
+
+void BlockCompiler::emitBranch(const Instr &i)
+{
+    unsigned exit;
+
+    switch (i.op) {
+
+    case OP_BCOND: {
+        HostCond cc;
+        if (!directCondition(i.cond, cc)) {
+            // Test CPSR against a table of the NZCV values that pass
+            uint16_t passMask = 0;
+            for (unsigned nzcv = 0; nzcv < 16; nzcv++)
+                if (conditionPassed(i.cond, reg_t(nzcv) << 28))
+                    passMask |= 1 << nzcv;
+
+            materializeFlags();
+            opMem(0x8B, false, RAX, RBX, CPSR_OFFSET);
+            shiftImm(5, false, RAX, 28);
+            movImm(RCX, passMask);
+            opReg(0x0FA3, false, RAX, RCX);     // bt ecx, eax
+            cc = CC_B;
+        }
+        exit = newExit(i.target, cycles + MCTiming::CPU_PIPELINE_RELOAD, EXIT_BRANCH);
+        jumpToExit(exit, cc);
+        break;
+    }
+
+    case OP_CBZ:
+    case OP_CBNZ: {
+        // Compares the full register, like the interpreter
+        exit = newExit(i.target, cycles + MCTiming::CPU_PIPELINE_RELOAD, EXIT_BRANCH);
+        loadReg(RAX, i.rn);
+        aluRR(0x85, true, RAX, RAX);
+        jumpToExit(exit, i.op == OP_CBZ ? CC_E : CC_NE);
+        break;
+    }
+
+    case OP_B:
+        exit = newExit(i.target, cycles + MCTiming::CPU_PIPELINE_RELOAD, EXIT_BRANCH);
+        jumpToExit(exit);
+        break;
+
+    case OP_SVC:
+        exit = newExit(i.addr + i.size, cycles, EXIT_NEXT);
+        exits[exit].svc = true;
+        exits[exit].svcInstr = i.raw;
+        jumpToExit(exit);
+        break;
+    }
+}
+
+void BlockCompiler::emitInstr(const Instr &i)
+{
+    // Cycles for leaving the block before this instruction
+    unsigned before = cycles;
+    cycles += (i.size / sizeof(uint16_t)) * MCTiming::CPU_FETCH;
+
+    switch (i.op) {
+
+    case OP_NOP:
+        break;
+
+    case OP_MOV:
+        loadReg(RAX, i.rm);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_MOV_IMM:
+        movImm(RAX, i.imm);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_CMP:
+    case OP_CMN:
+        loadReg(RAX, i.rn);
+        loadReg(RCX, i.rm);
+        setFlags(i.op == OP_ADD || i.op == OP_CMN ? FLAGS_ADD : FLAGS_SUB, RAX, RCX);
+        if (i.op == OP_ADD || i.op == OP_SUB) {
+            // Full-width result, like opADD()
+            aluRR(i.op == OP_ADD ? 0x01 : 0x29, true, RAX, RCX);
+            storeReg(i.rd, RAX);
+        }
+        break;
+
+    case OP_ADD_IMM:
+    case OP_SUB_IMM:
+    case OP_CMP_IMM:
+        loadReg(RAX, i.rn);
+        movImm(RCX, i.imm);
+        setFlags(i.op == OP_ADD_IMM ? FLAGS_ADD : FLAGS_SUB, RAX, RCX);
+        if (i.op != OP_CMP_IMM) {
+            aluRI(i.op == OP_ADD_IMM ? ALU_ADD : ALU_SUB, true, RAX, i.imm);
+            storeReg(i.rd, RAX);
+        }
+        break;
+
+    case OP_RSB:
+        loadReg(RCX, i.rn);
+        movImm(RAX, 0);
+        setFlags(FLAGS_SUB, RAX, RCX);
+        opReg(0xF7, true, 3, RCX);      // neg rcx
+        storeReg(i.rd, RCX);
+        break;
+
+    case OP_AND:
+    case OP_EOR:
+    case OP_ORR:
+    case OP_TST:
+        keepCarryAndOverflow();
+        loadReg(RAX, i.rn);
+        loadReg(RCX, i.rm);
+        aluRR(i.op == OP_EOR ? 0x31 : i.op == OP_ORR ? 0x09 : 0x21, true, RAX, RCX);
+        setFlagsNZ(FLAGS_NZ32, RAX);
+        if (i.op != OP_TST)
+            storeReg(i.rd, RAX);
+        break;
+
+    case OP_BIC:
+        loadReg(RAX, i.rn);
+        loadReg(RCX, i.rm);
+        opReg(0xF7, true, 2, RCX);      // not rcx
+        aluRR(0x21, false, RAX, RCX);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_MVN:
+        loadReg(RAX, i.rm);
+        opReg(0xF7, false, 2, RAX);     // not eax
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_MUL:
+        keepCarryAndOverflow();
+        loadReg(RAX, i.rn);
+        loadReg(RCX, i.rm);
+        opReg(0x0FAF, true, RAX, RCX);  // imul rax, rcx
+        setFlagsNZ(FLAGS_NZ64, RAX);
+        movRR(false, RAX, RAX);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_LSL_IMM:
+    case OP_LSR_IMM:
+    case OP_ASR_IMM:
+        // These set C eagerly, from CL
+        materializeFlags();
+        loadReg(RDX, i.rm);
+        if (i.op == OP_LSL_IMM && i.imm == 0) {
+            aluRR(0x31, false, RCX, RCX);
+            movRR(false, RDX, RDX);
+        } else {
+            btImm(RDX, i.op == OP_LSL_IMM ? 32 - i.imm : i.imm - 1);
+            setcc(CC_B, RCX);
+            if (i.op == OP_LSL_IMM)
+                shiftImm(4, false, RDX, i.imm);
+            else if (i.op == OP_ASR_IMM)
+                shiftImm(7, false, RDX, i.imm);
+            else {
+                // Upper bits of a 64-bit register shift into the result
+                shiftImm(5, true, RDX, i.imm);
+                movRR(false, RDX, RDX);
+            }
+        }
+        storeReg(i.rd, RDX);
+        aluRR(0x85, false, RDX, RDX);
+        emit8(0x9F);    // lahf
+        composeFlags(true, false);
+        break;
+
+    case OP_SXTB:
+    case OP_SXTH:
+    case OP_UXTB:
+    case OP_UXTH: {
+        static const unsigned ops[] = { 0x0FBE, 0x0FBF, 0x0FB6, 0x0FB7 };
+        loadReg(RAX, i.rm);
+        opReg(ops[i.op - OP_SXTB], false, RAX, RAX);
+        storeReg(i.rd, RAX);
+        break;
+    }
+
+    case OP_MOVT:
+        loadReg(RAX, i.rd);
+        opReg(0x0FB7, false, RAX, RAX);
+        aluRI(ALU_OR, false, RAX, i.imm << 16);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_ADD_SP:
+        loadReg(RAX, REG_SP);
+        emitSquash(RAX);
+        aluRI(ALU_ADD, false, RAX, i.imm);
+        storeReg(i.rd, RAX);
+        break;
+
+    case OP_LDR:
+    case OP_LDRB:
+    case OP_LDRH:
+    case OP_LDRSB:
+    case OP_LDRSH:
+    case OP_STR:
+    case OP_STRB:
+    case OP_STRH: {
+        static const unsigned alignment[] = { 4, 1, 2, 1, 2, 4, 1, 2 };
+        unsigned exit = newExit(i.addr, before, EXIT_INTERPRET);
+        loadReg(RAX, i.rn);
+        if (i.imm)
+            aluRI(ALU_ADD, true, RAX, i.imm);
+        emitMemCheck(exit, alignment[i.op - OP_LDR]);
+
+        switch (i.op) {
+        case OP_LDR:    opMem(0x8B, false, RCX, RAX, 0); break;
+        case OP_LDRB:   opMem(0x0FB6, false, RCX, RAX, 0); break;
+        case OP_LDRH:   opMem(0x0FB7, false, RCX, RAX, 0); break;
+        case OP_LDRSB:  opMem(0x0FBE, false, RCX, RAX, 0); break;
+        case OP_LDRSH:  opMem(0x0FBF, false, RCX, RAX, 0); break;
+        case OP_STR:
+            loadReg(RCX, i.rd);
+            emitSquash(RCX);
+            opMem(0x89, false, RCX, RAX, 0);
+            break;
+        case OP_STRB:
+            loadReg(RCX, i.rd);
+            opMem(0x88, false, RCX, RAX, 0);
+            break;
+        case OP_STRH:
+            loadReg(RCX, i.rd);
+            emit8(0x66);
+            opMem(0x89, false, RCX, RAX, 0);
+            break;
+        }
+
+        if (i.op < OP_STR)
+            storeReg(i.rd, RCX);
+        cycles += MCTiming::CPU_LOAD_STORE;
+        break;
+    }
+
+    case OP_LDR_LIT:
+        movImm(RAX, i.target);
+        opMem(0x8B, false, RCX, RAX, 0);
+        storeReg(i.rd, RCX);
+        cycles += MCTiming::CPU_LOAD_STORE;
+        break;
+
+    case OP_CALL16:
+    case OP_CALL32:
+        emitCall(i);
+        break;
+
+    default:
+        emitBranch(i);
+        break;
+    }
+}
+
+void BlockCompiler::compile(const Instr *instrs, unsigned count)
+{
+    // Prologue. Keeps the stack 16-byte aligned for runtime calls.
+    emit8(0x50 + RBX);
+    emit8(0x50 + RBP);
+    emit8(0x41); emit8(0x50 + (R12 & 7));
+    emit8(0x41); emit8(0x50 + (R13 & 7));
+    emit8(0x41); emit8(0x50 + (R14 & 7));
+    emit8(0x41); emit8(0x50 + (R15 & 7));
+    aluRI(ALU_SUB, true, RSP, 8);
+    movRR(true, RBX, RDI);
+    movRR(true, RBP, RSI);
+    for (unsigned r = 0; r < NUM_MAPPED_REGS; r++)
+        reloadReg(r);
+
+    bool terminated = false;
+    for (unsigned n = 0; n < count && !terminated; n++) {
+        emitInstr(instrs[n]);
+        terminated = instrs[n].op == OP_B || instrs[n].op == OP_SVC;
+    }
+
+    if (!terminated) {
+        const Instr &last = instrs[count - 1];
+        jumpToExit(newExit(last.addr + last.size, cycles, EXIT_NEXT));
+    }
+
+    for (unsigned n = 0; n < exits.size(); n++)
+        emitExit(exits[n]);
+}
+
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+bool init(const Runtime &rt)
+{
+    if (!codeBase) {
+        void *p = mmap(0, CODE_SIZE, PROT_READ | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (p == MAP_FAILED)
+            return false;
+        codeBase = static_cast<uint8_t*>(p);
+    }
+
+    runtime = rt;
+    return true;
+}
+
+Code compile(const Instr *instrs, unsigned count)
+{
+    ASSERT(codeBase);
+    ASSERT(count > 0);
+
+    BlockCompiler c;
+    c.compile(instrs, count);
+
+    // Everything inside the block is position-independent
+    const std::vector<uint8_t> &code = c.getCode();
+    if (codeUsed + code.size() > CODE_SIZE)
+        return 0;
+
+    /*
+     * Make just the pages we're writing writable, and not executable.
+     * Blocks never run while we compile, since both happen on the MC
+     * thread. If mprotect() fails, report that we're out of memory; the
+     * caller flushes, so nothing runs from pages we couldn't restore.
+     */
+
+    uintptr_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+    uint8_t *p = codeBase + codeUsed;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(p) & ~pageMask;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(p) + code.size() + pageMask) & ~pageMask;
+    void *pages = reinterpret_cast<void*>(begin);
+
+    if (mprotect(pages, end - begin, PROT_READ | PROT_WRITE))
+        return 0;
+    memcpy(p, &code[0], code.size());
+    if (mprotect(pages, end - begin, PROT_READ | PROT_EXEC))
+        return 0;
+
+    codeUsed = (codeUsed + code.size() + 15) & ~15;
+
+    return reinterpret_cast<Code>(p);
+}
+
+void flush()
+{
+    codeUsed = 0;
+}
+
+}  // namespace SvmJit
+
+
+#else  // No backend for this host
+
+
+namespace SvmJit {
+
+bool init(const Runtime &rt)
+{
+    return false;
+}
+
+Code compile(const Instr *instrs, unsigned count)
+{
+    return 0;
+}
+
+void flush()
+{
+}
+
+}  // namespace SvmJit
+
+#endif
@@ -0,0 +1,339 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "mc_svmprofiler.h"
+#include "svmdebugpipe.h"
+#include "svmmemory.h"
+#include "flash_blockcache.h"
+#include "macros.h"
+#include <sifteo/abi.h>
+#include <string.h>
+#include <errno.h>
+
+// Generated from the SDK's syscall ABI, with the syscall table
+#include "syscall-names.def"
+
+bool SvmProfiler::enabled;
+std::string SvmProfiler::foldedPath;
+std::string SvmProfiler::callgrindPath;
+std::vector<SvmProfiler::Function> SvmProfiler::functions;
+std::map<std::string, unsigned> SvmProfiler::functionsByName;
+std::map<uint32_t, unsigned> SvmProfiler::functionsByAddr;
+std::string SvmProfiler::currentObject;
+std::vector<SvmProfiler::Node> SvmProfiler::nodes;
+std::vector<SvmProfiler::Frame> SvmProfiler::stack;
+unsigned SvmProfiler::syscallNode;
+uint64_t SvmProfiler::lastCycles;
+
+
+void SvmProfiler::init(const char *folded, const char *callgrind)
+{
+    foldedPath = folded ? folded : "";
+    callgrindPath = callgrind ? callgrind : "";
+    enabled = !foldedPath.empty() || !callgrindPath.empty();
+
+    functions.clear();
+    functionsByName.clear();
+    functionsByAddr.clear();
+    nodes.clear();
+    stack.clear();
+    syscallNode = 0;
+
+    // Node zero is the root, above every program. Nothing is charged to it.
+    nodes.push_back(Node(getFunction("", "(root)"), 0));
+}
+
+void SvmProfiler::charge()
+{
+    uint64_t now = cycles();
+    if (!stack.empty())
+        nodes[currentNode()].cycles += now - lastCycles;
+    lastCycles = now;
+}
+
+unsigned SvmProfiler::child(unsigned parent, unsigned function)
+{
+    std::map<unsigned, unsigned>::iterator i = nodes[parent].children.find(function);
+    if (i != nodes[parent].children.end())
+        return i->second;
+
+    unsigned id = nodes.size();
+    nodes.push_back(Node(function, parent));
+    nodes[parent].children[function] = id;
+    return id;
+}
+
+unsigned SvmProfiler::getFunction(const std::string &object, const std::string &name)
+{
+    std::string key = object + ':' + name;
+    std::map<std::string, unsigned>::iterator i = functionsByName.find(key);
+    if (i != functionsByName.end())
+        return i->second;
+
+    Function f = { name, object };
+    unsigned id = functions.size();
+    functions.push_back(f);
+    functionsByName[key] = id;
+    return id;
+}
+
+unsigned SvmProfiler::functionForAddr(Svm::reg_t addr)
+{
+    // Same bits that SvmMemory::mapROCode() uses. Code is always in segment 0.
+    uint32_t va = SvmMemory::SEGMENT_0_VA + (addr & 0xfffffc);
+
+    std::map<uint32_t, unsigned>::iterator i = functionsByAddr.find(va);
+    if (i != functionsByAddr.end())
+        return i->second;
+
+    unsigned id = getFunction(currentObject, SvmDebugPipe::formatAddress(va));
+    functionsByAddr[va] = id;
+    return id;
+}
+
+unsigned SvmProfiler::functionForSyscall(unsigned num)
+{
+    if (num < arraysize(SyscallNames) && SyscallNames[num])
+        return getFunction("firmware", SyscallNames[num]);
+
+    char name[32];
+    snprintf(name, sizeof name, "_SYS_%u", num);
+    return getFunction("firmware", name);
+}
+
+void SvmProfiler::onExec(const Elf::Program &program)
+{
+    if (!enabled)
+        return;
+
+    /*
+     * Each program gets its own subtree, headed by its package name.
+     * Addresses are only meaningful within one program, so forget the
+     * ones we've looked up already.
+     */
+
+    charge();
+
+    FlashBlockRef ref;
+    const char *package = program.getMetaString(ref, _SYS_METADATA_PACKAGE_STR);
+    currentObject = package ? package : "(unknown)";
+    functionsByAddr.clear();
+
+    unsigned node = child(0, getFunction(currentObject, currentObject));
+    nodes[node].calls++;
+
+    Frame f = { node, ~(Svm::reg_t)0 };
+    stack.clear();
+    stack.push_back(f);
+    syscallNode = 0;
+}
+
+void SvmProfiler::onCall(Svm::reg_t addr, Svm::reg_t fp)
+{
+    if (stack.empty())
+        return;
+    charge();
+
+    unsigned node = child(stack.back().node, functionForAddr(addr));
+    nodes[node].calls++;
+
+    Frame f = { node, fp };
+    stack.push_back(f);
+}
+
+void SvmProfiler::onTailCall(Svm::reg_t addr)
+{
+    // Replaces the current function, keeping its frame
+
+    if (stack.size() < 2)
+        return;
+    charge();
+
+    Frame &f = stack.back();
+    f.node = child(nodes[f.node].parent, functionForAddr(addr));
+    nodes[f.node].calls++;
+}
+
+void SvmProfiler::onReturn(Svm::reg_t fp)
+{
+    /*
+     * Pop back to the frame that's being returned from. Normally that's
+     * the top of our stack, but don't let one surprise leave us out of
+     * sync for the rest of the run.
+     */
+
+    for (unsigned i = stack.size(); i > 1; --i) {
+        if (stack[i - 1].fp == fp) {
+            charge();
+            stack.resize(i - 1);
+            return;
+        }
+    }
+}
+
+void SvmProfiler::onSyscallEnter(unsigned num)
+{
+    if (stack.empty())
+        return;
+    charge();
+
+    syscallNode = child(stack.back().node, functionForSyscall(num));
+    nodes[syscallNode].calls++;
+}
+
+void SvmProfiler::onSyscallLeave()
+{
+    if (!syscallNode)
+        return;
+    charge();
+    syscallNode = 0;
+}
+
+std::string SvmProfiler::stackName(unsigned node)
+{
+    std::string name = functions[nodes[node].function].name;
+    for (node = nodes[node].parent; node; node = nodes[node].parent)
+        name = functions[nodes[node].function].name + ';' + name;
+    return name;
+}
+
+void SvmProfiler::inclusiveCosts(std::vector<Inclusive> &costs)
+{
+    // Children are always created after their parents
+
+    costs.resize(nodes.size());
+    for (unsigned i = nodes.size(); i--;) {
+        costs[i].cycles += nodes[i].cycles;
+        costs[i].misses += nodes[i].misses;
+        if (i) {
+            costs[nodes[i].parent].cycles += costs[i].cycles;
+            costs[nodes[i].parent].misses += costs[i].misses;
+        }
+    }
+}
+
+bool SvmProfiler::writeFolded(FILE *f)
+{
+    // One "stack cycles" line per call stack with any exclusive time
+
+    for (unsigned i = 1; i < nodes.size(); ++i) {
+        if (nodes[i].cycles)
+            fprintf(f, "%s %llu\n", stackName(i).c_str(),
+                (unsigned long long) nodes[i].cycles);
+    }
+    return !ferror(f);
+}
+
+bool SvmProfiler::writeCallgrind(FILE *f)
+{
+    /*
+     * Callgrind wants costs per function, not per stack: the exclusive
+     * cost of each function, then for each function it calls, the
+     * number of calls and their inclusive cost. We have no line
+     * numbers, so every cost is on line 0.
+     */
+
+    std::vector<Inclusive> inclusive;
+    inclusiveCosts(inclusive);
+
+    std::vector<Inclusive> self(functions.size());
+    std::vector<Calls> calls(functions.size());
+    std::vector<bool> seen(functions.size());
+
+    for (unsigned i = 1; i < nodes.size(); ++i) {
+        const Node &n = nodes[i];
+        self[n.function].cycles += n.cycles;
+        self[n.function].misses += n.misses;
+        seen[n.function] = true;
+
+        if (n.parent) {
+            Call &c = calls[nodes[n.parent].function][n.function];
+            c.calls += n.calls;
+            c.cost.cycles += inclusive[i].cycles;
+            c.cost.misses += inclusive[i].misses;
+        }
+    }
+
+    fprintf(f, "# callgrind format\n"
+        "version: 1\n"
+        "creator: siftulator\n"
+        "positions: line\n"
+        "events: Cycles FlashMisses\n"
+        "summary: %llu %llu\n",
+        (unsigned long long) inclusive[0].cycles,
+        (unsigned long long) inclusive[0].misses);
+
+    for (unsigned fn = 0; fn < functions.size(); ++fn) {
+        if (!seen[fn])
+            continue;
+
+        fprintf(f, "\nob=%s\nfn=%s\n0 %llu %llu\n",
+            functions[fn].object.c_str(), functions[fn].name.c_str(),
+            (unsigned long long) self[fn].cycles,
+            (unsigned long long) self[fn].misses);
+
+        for (Calls::const_iterator i = calls[fn].begin(); i != calls[fn].end(); ++i) {
+            const Function &callee = functions[i->first];
+            fprintf(f, "cob=%s\ncfn=%s\ncalls=%llu 0\n0 %llu %llu\n",
+                callee.object.c_str(), callee.name.c_str(),
+                (unsigned long long) i->second.calls,
+                (unsigned long long) i->second.cost.cycles,
+                (unsigned long long) i->second.cost.misses);
+        }
+    }
+
+    return !ferror(f);
+}
+
+void SvmProfiler::write()
+{
+    if (!enabled)
+        return;
+    charge();
+
+    for (unsigned i = 0; i < 2; ++i) {
+        const std::string &path = i ? callgrindPath : foldedPath;
+        if (path.empty())
+            continue;
+
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f) {
+            LOG(("SVM: Can't open profile output '%s': %s\n",
+                path.c_str(), strerror(errno)));
+            continue;
+        }
+
+        bool success = i ? writeCallgrind(f) : writeFolded(f);
+        if (fclose(f) || !success) {
+            LOG(("SVM: Error writing profile output '%s'\n", path.c_str()));
+            continue;
+        }
+
+        LOG(("SVM: Profile written to '%s'\n", path.c_str()));
+    }
+
+    // Only once, even if we exit from more than one place
+    enabled = false;
+}
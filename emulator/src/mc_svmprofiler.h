@@ -0,0 +1,154 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SVM_PROFILER_H
+#define SVM_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "elfprogram.h"
+#include "svm.h"
+
+
+/*
+ * Exact call-graph profiler for SVM code.
+ *
+ * SvmRuntime tells us about every call, tail call, return and syscall,
+ * so we can keep a shadow call stack and charge virtual CPU cycles and
+ * flash block misses to the exact stack they happened in. Time spent
+ * inside a syscall, including waiting for the next frame, is charged to
+ * the syscall as a child of the function that made it.
+ *
+ * Because Siftulator's clock is virtual, a profile doesn't depend on
+ * the speed of the host. Results are written on exit, as folded stacks
+ * (for flame graph tools, and for slinky's '-profile' option) and/or
+ * in callgrind format.
+ */
+
+class SvmProfiler {
+public:
+    SvmProfiler();  // Do not implement
+
+    static void init(const char *foldedPath, const char *callgrindPath);
+    static void write();
+
+    static bool isEnabled() {
+        return enabled;
+    }
+
+    // Virtual CPU cycles since the simulation started
+    static uint64_t cycles();
+
+    // A new program is starting. Resets the call stack.
+    static void onExec(const Elf::Program &program);
+
+    /*
+     * 'addr' is a branch target, as passed to SvmRuntime::call().
+     * 'fp' identifies the new call frame, so a return can find its caller.
+     */
+    static void onCall(Svm::reg_t addr, Svm::reg_t fp);
+    static void onTailCall(Svm::reg_t addr);
+    static void onReturn(Svm::reg_t fp);
+
+    static void onSyscallEnter(unsigned num);
+    static void onSyscallLeave();
+
+    static void onFlashMiss() {
+        if (enabled && !stack.empty())
+            nodes[currentNode()].misses++;
+    }
+
+private:
+    struct Function {
+        std::string name;
+        std::string object;
+    };
+
+    // One node per distinct call stack
+    struct Node {
+        unsigned function;
+        unsigned parent;
+        uint64_t calls;
+        uint64_t cycles;        // Exclusive
+        uint64_t misses;        // Exclusive
+        std::map<unsigned, unsigned> children;
+
+        Node(unsigned f, unsigned p) :
+            function(f), parent(p), calls(0), cycles(0), misses(0) {}
+    };
+
+    struct Frame {
+        unsigned node;
+        Svm::reg_t fp;
+    };
+
+    struct Inclusive {
+        uint64_t cycles;
+        uint64_t misses;
+    };
+
+    // Calls from one function to another, for callgrind
+    struct Call {
+        uint64_t calls;
+        Inclusive cost;
+    };
+    typedef std::map<unsigned, Call> Calls;
+
+    static bool enabled;
+    static std::string foldedPath;
+    static std::string callgrindPath;
+
+    static std::vector<Function> functions;
+    static std::map<std::string, unsigned> functionsByName;
+    static std::map<uint32_t, unsigned> functionsByAddr;
+    static std::string currentObject;
+
+    static std::vector<Node> nodes;
+    static std::vector<Frame> stack;
+    static unsigned syscallNode;
+    static uint64_t lastCycles;
+
+    static unsigned currentNode() {
+        if (syscallNode)
+            return syscallNode;
+        return stack.empty() ? 0 : stack.back().node;
+    }
+
+    static void charge();
+    static unsigned child(unsigned parent, unsigned function);
+    static unsigned getFunction(const std::string &object, const std::string &name);
+    static unsigned functionForAddr(Svm::reg_t addr);
+    static unsigned functionForSyscall(unsigned num);
+
+    static std::string stackName(unsigned node);
+    static void inclusiveCosts(std::vector<Inclusive> &costs);
+    static bool writeFolded(FILE *f);
+    static bool writeCallgrind(FILE *f);
+};
+
+#endif
@@ -0,0 +1,317 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Must be before other headers
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define WINVER WindowsXP
+#   define _WIN32_WINNT 0x502
+#   include <windows.h>
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/select.h>
+#   include <netinet/tcp.h>
+#   include <netinet/in.h>
+#   include <fcntl.h>
+#   include <netdb.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   define closesocket(_s) close(_s)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif
+
+#include "mc_usbserver.h"
+#include "macros.h"
+#include "tasks.h"
+#include <string.h>
+#include <stdio.h>
+
+#define LOG_PREFIX  "USB Server: "
+
+UsbServer UsbServer::instance;
+
+void UsbServer::start(int port)
+{
+    /*
+     * Spawn a thread which listens for connections from host tools
+     */
+
+    ASSERT(instance.running == false);
+    ASSERT(instance.thread == NULL);
+
+    instance.port = port;
+    instance.clientFD = -1;
+    instance.queueHead = 0;
+    instance.queueCount = 0;
+    instance.running = true;
+    instance.thread = new tthread::thread(threadEntry, (void*) &instance);
+}
+
+void UsbServer::stop()
+{
+    /*
+     * Ask the background thread to stop at its next convenience,
+     * asynchronously. Does not wait for the thread.
+     */
+
+    tthread::lock_guard<tthread::mutex> guard(instance.queueLock);
+    instance.running = false;
+    instance.queueCond.notify_all();
+}
+
+void UsbServer::setNonBlock(int fd)
+{
+#ifdef _WIN32
+    unsigned long arg = 1;
+    ioctlsocket(fd, FIONBIO, &arg);
+#else
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+void UsbServer::threadEntry(void *param)
+{
+    UsbServer *self = (UsbServer *) param;
+    self->threadMain();
+}
+
+void UsbServer::threadMain()
+{
+    /*
+     * Accept one client at a time. While a client is connected, the
+     * firmware sees the same thing it would with a USB host attached.
+     */
+
+    #ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+    #endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = 0x0100007f;
+    addr.sin_port = htons(port);
+
+    int listenFD = socket(AF_INET, SOCK_STREAM, 0);
+
+    unsigned long arg = 1;
+    setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, (const char *)&arg, sizeof arg);
+
+    if (bind(listenFD, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        fprintf(stderr, LOG_PREFIX "Can't bind to port!\n");
+        return;
+    }
+
+    if (listen(listenFD, 1) < 0) {
+        fprintf(stderr, LOG_PREFIX "Can't listen on socket\n");
+        return;
+    }
+
+    fprintf(stderr, LOG_PREFIX "Listening on port %d. Connect with "
+        "\"swiss --siftulator %d\"\n", port, port);
+
+    while (running) {
+        struct sockaddr_in addr;
+        socklen_t addrSize = sizeof addr;
+        int fd = accept(listenFD, (struct sockaddr *) &addr, &addrSize);
+        if (fd < 0)
+            break;
+
+        unsigned long arg;
+        #ifdef SO_NOSIGPIPE
+            arg = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &arg, sizeof arg);
+        #endif
+        arg = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&arg, sizeof arg);
+        setNonBlock(fd);
+
+        sendLock.lock();
+        clientFD = fd;
+        sendLock.unlock();
+
+        fprintf(stderr, LOG_PREFIX "Client connected\n");
+        handleClient();
+        fprintf(stderr, LOG_PREFIX "Client disconnected\n");
+
+        // Like unplugging the cable: anything not yet delivered is lost
+        sendLock.lock();
+        clientFD = -1;
+        closesocket(fd);
+        sendLock.unlock();
+
+        queueLock.lock();
+        queueCount = 0;
+        queueLock.unlock();
+    }
+
+    closesocket(listenFD);
+}
+
+void UsbServer::handleClient()
+{
+    /*
+     * Reassemble framed packets from the socket and queue them for the
+     * firmware. We only read as much as we have room to frame, and
+     * pushPacket() blocks while the firmware's queue is full.
+     */
+
+    uint8_t rxBuffer[4096];
+    unsigned rxLen = 0;
+
+    while (running) {
+        unsigned offset = 0;
+        while (rxLen - offset >= 1 && rxLen - offset >= 1u + rxBuffer[offset]) {
+            unsigned len = rxBuffer[offset];
+            if (len == 0 || len > USBProtocolMsg::MAX_LEN) {
+                fprintf(stderr, LOG_PREFIX "Bad packet length (%u)\n", len);
+                return;
+            }
+            if (!pushPacket(rxBuffer + offset + 1, len))
+                return;
+            offset += 1 + len;
+        }
+        memmove(rxBuffer, rxBuffer + offset, rxLen - offset);
+        rxLen -= offset;
+
+        fd_set efds, rfds;
+        struct timeval pollInterval = { 0, 20000 };  // 20ms
+
+        FD_ZERO(&efds);
+        FD_ZERO(&rfds);
+        FD_SET(clientFD, &rfds);
+        FD_SET(clientFD, &efds);
+
+        int sel = select(clientFD + 1, &rfds, NULL, &efds, &pollInterval);
+        if (sel < 1)
+            continue;
+
+        int ret = recv(clientFD, (char *) rxBuffer + rxLen, sizeof rxBuffer - rxLen, 0);
+
+        if (ret <= 0) {
+            if (errno == EAGAIN)
+                continue;
+            if (ret < 0 && errno != 0)
+                fprintf(stderr, LOG_PREFIX "Read error (%d)\n", errno);
+            return;
+        }
+
+        rxLen += ret;
+    }
+}
+
+bool UsbServer::pushPacket(const uint8_t *bytes, unsigned len)
+{
+    tthread::lock_guard<tthread::mutex> guard(queueLock);
+
+    while (running && queueCount == QUEUE_DEPTH)
+        queueCond.wait(queueLock);
+    if (!running)
+        return false;
+
+    Packet &p = queue[(queueHead + queueCount) % QUEUE_DEPTH];
+    p.len = len;
+    memcpy(p.bytes, bytes, len);
+    queueCount++;
+
+    Tasks::trigger(Tasks::UsbOUT);
+    return true;
+}
+
+void UsbServer::handleOUTData()
+{
+    /*
+     * Dispatch one queued OUT packet, like a USB endpoint interrupt would.
+     * If there are more, the task runs again after other pending work.
+     */
+
+    USBProtocolMsg m;
+    {
+        tthread::lock_guard<tthread::mutex> guard(instance.queueLock);
+        if (!instance.queueCount)
+            return;
+
+        Packet &p = instance.queue[instance.queueHead];
+        m.len = p.len;
+        memcpy(m.bytes, p.bytes, p.len);
+
+        instance.queueHead = (instance.queueHead + 1) % QUEUE_DEPTH;
+        if (--instance.queueCount)
+            Tasks::trigger(Tasks::UsbOUT);
+        instance.queueCond.notify_all();
+    }
+
+    USBProtocol::dispatch(m);
+}
+
+bool UsbServer::write(const uint8_t *buf, unsigned len)
+{
+    /*
+     * Send one IN packet to the connected client. This blocks until the
+     * socket accepts the whole frame, the same way a hardware write waits
+     * for the host to poll the endpoint.
+     */
+
+    ASSERT(len <= USBProtocolMsg::MAX_LEN);
+
+    uint8_t frame[1 + USBProtocolMsg::MAX_LEN];
+    frame[0] = len;
+    memcpy(frame + 1, buf, len);
+
+    {
+        tthread::lock_guard<tthread::mutex> guard(instance.sendLock);
+        int fd = instance.clientFD;
+        if (fd < 0)
+            return false;
+
+        unsigned sent = 0;
+        while (sent < len + 1) {
+            int ret = send(fd, (const char *) frame + sent, len + 1 - sent, MSG_NOSIGNAL);
+            if (ret > 0) {
+                sent += ret;
+                continue;
+            }
+            if (ret < 0 && errno != EAGAIN)
+                return false;
+
+            fd_set wfds;
+            struct timeval pollInterval = { 0, 20000 };  // 20ms
+            FD_ZERO(&wfds);
+            FD_SET(fd, &wfds);
+            select(fd + 1, NULL, &wfds, NULL, &pollInterval);
+        }
+    }
+
+    // The IN transfer is done; give the user pipe a chance to send more
+    Tasks::trigger(Tasks::UsbIN);
+    return true;
+}
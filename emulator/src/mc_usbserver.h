@@ -0,0 +1,88 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo Thundercracker simulator
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef USB_SERVER_H
+#define USB_SERVER_H
+
+#include <stdint.h>
+#include "usbprotocol.h"
+#include "tinythread.h"
+
+
+/*
+ * Stands in for the base's USB device, so host tools like swiss can talk
+ * to Siftulator. Clients connect over TCP on localhost, and each USB
+ * packet is framed on the stream as a single length byte followed by
+ * that many bytes of packet data.
+ *
+ * OUT packets are queued by the server thread and handed to
+ * USBProtocol::dispatch() from the UsbOUT task, on the firmware thread.
+ * When the queue is full we stop reading from the socket, so a fast
+ * client sees the same backpressure it would from real hardware.
+ */
+
+class UsbServer {
+public:
+    static void start(int port);
+    static void stop();
+
+    // Firmware thread only. Returns false if no client is connected.
+    static bool write(const uint8_t *buf, unsigned len);
+
+    // Handler for the UsbOUT task
+    static void handleOUTData();
+
+private:
+    UsbServer() {}
+    static UsbServer instance;
+
+    static const unsigned QUEUE_DEPTH = 64;
+
+    struct Packet {
+        uint8_t len;
+        uint8_t bytes[USBProtocolMsg::MAX_LEN];
+    };
+
+    tthread::thread *thread;
+    tthread::mutex queueLock;
+    tthread::condition_variable queueCond;
+    tthread::mutex sendLock;
+
+    int port;
+    int clientFD;
+    bool running;
+
+    Packet queue[QUEUE_DEPTH];
+    unsigned queueHead;
+    unsigned queueCount;
+
+    static void threadEntry(void *param);
+    void threadMain();
+    void handleClient();
+    bool pushPacket(const uint8_t *bytes, unsigned len);
+    static void setNonBlock(int fd);
+};
+
+#endif  // USB_SERVER_H
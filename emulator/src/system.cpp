@@ -29,6 +29,7 @@
 #include "system.h"
 #include "cube_debug.h"
 #include "mc_gdbserver.h"
+#include "mc_usbserver.h"
 
 
 System::System()
@@ -45,7 +46,9 @@ System::System()
         opt_paintTrace(false),
         opt_svmTrace(false),
         opt_svmFlashStats(false),
+        opt_svmTranslate(false),
         opt_gdbServerPort(0),
+        opt_usbServerPort(0),
         opt_cube0Debug(false),
         opt_mute(false),
         opt_radioNoise(0),
@@ -59,7 +62,8 @@ bool System::init()
     if (mIsInitialized)
         return true;
 
-    if (!flash.init(opt_flashFilename.empty() ? NULL : opt_flashFilename.c_str()))
+    if (!flash.init(opt_flashFilename.empty() ? NULL : opt_flashFilename.c_str(),
+                    opt_cubeFlashBase.empty() ? NULL : opt_cubeFlashBase.c_str()))
         return false;
 
     if (!sc.init(this))
@@ -121,6 +125,8 @@ void System::start()
 
     if (opt_gdbServerPort)
         GDBServer::start(opt_gdbServerPort);
+    if (opt_usbServerPort)
+        UsbServer::start(opt_usbServerPort);
 }
 
 void System::exit()
@@ -132,6 +138,8 @@ void System::exit()
     if (mIsStarted) {
         if (opt_gdbServerPort)
             GDBServer::stop();
+        if (opt_usbServerPort)
+            UsbServer::stop();
 
         smc.stop();
         sc.stop();
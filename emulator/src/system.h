@@ -61,6 +61,7 @@ class System {
     unsigned opt_numCubes;
     std::string opt_cubeFirmware;
     std::string opt_flashFilename;
+    std::string opt_cubeFlashBase;
     std::string opt_launcherFilename;
     std::string opt_waveoutFilename;
 
@@ -85,7 +86,11 @@ class System {
     bool opt_svmTrace;
     bool opt_svmFlashStats;
     bool opt_svmStackMonitor;
+    bool opt_svmTranslate;
+    std::string opt_svmProfile;
+    std::string opt_svmCallgrind;
     unsigned opt_gdbServerPort;
+    unsigned opt_usbServerPort;
 
     // Debug options, applicable to cube 0 only
     bool opt_cube0Debug;
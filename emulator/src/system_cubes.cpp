@@ -117,7 +117,7 @@ bool SystemCubes::initCube(unsigned id)
 
     ASSERT(sys->flash.data);
     if (!sys->cubes[id].init(&sys->time, firmware,
-        &sys->flash.data->cubes[id]))
+        &sys->flash.data->cubes[id], &sys->flash.cubeFlash[id]))
         return false;
 
     sys->cubes[id].cpu.id = id;
@@ -166,6 +166,12 @@ void SystemCubes::stop()
 void SystemCubes::exit()
 {
     stop();
+
+    // Finish any LCD captures that scripts left running
+    for (unsigned i = 0; i < System::MAX_CUBES; i++)
+        if (sys->cubes[i].lcd.capture)
+            sys->cubes[i].lcd.capture->stop();
+
     if (!sys->opt_cube0Profile.empty())
         Cube::Debug::writeProfile(&sys->cubes[0].cpu, sys->opt_cube0Profile.c_str());
 }
@@ -192,6 +198,14 @@ void SystemCubes::threadFn(void *param)
     // Seed PRNG per-thread
     srand(OSTime::clock() * 1e6);
 
+    /*
+     * Cube flash pages are deduplicated, and written back to the storage
+     * file, every so often. This only looks at pages written since the
+     * last sync, so it's cheap when the cubes are idle.
+     */
+    const double flashSyncInterval = 1.0;
+    double nextFlashSync = OSTime::clock() + flashSyncInterval;
+
     while (self->mThreadRunning) {
         /*
          * Pick one of several specific tick batch loops. This keeps the loop tight by
@@ -211,6 +225,11 @@ void SystemCubes::threadFn(void *param)
         } else {
             self->tickLoopFastSBT();
         }
+
+        if (OSTime::clock() >= nextFlashSync) {
+            sys->flash.syncCubes();
+            nextFlashSync = OSTime::clock() + flashSyncInterval;
+        }
         self->mBigCubeLock.unlock();
 
         /*
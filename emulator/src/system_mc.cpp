@@ -57,6 +57,7 @@
 #include "cubeconnector.h"
 #include "neighbor_tx.h"
 #include "led.h"
+#include "mc_svmprofiler.h"
 
 SystemMC *SystemMC::instance;
 std::vector< std::vector<uint8_t> > SystemMC::pendingGameInstalls;
@@ -77,6 +78,7 @@ bool SystemMC::init(System *sys)
     FlashStack::init();
     SysInfo::init();
     Crc32::init();
+    SvmProfiler::init(sys->opt_svmProfile.c_str(), sys->opt_svmCallgrind.c_str());
 
     if (instance->sys->opt_headless) {
         Tasks::trigger(Tasks::AudioPull);
@@ -111,6 +113,7 @@ void SystemMC::exit()
         AudioOutDevice::stop();
 
     waveOut.close();
+    SvmProfiler::write();
 }
 
 void SystemMC::autoInstall()
@@ -334,5 +337,6 @@ void SystemMC::exit(int result)
      */
 
     getSystem()->stopCubesOnly();
+    SvmProfiler::write();
     ::exit(result);
 }
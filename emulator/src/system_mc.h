@@ -61,6 +61,11 @@ class SystemMC {
         return instance->sys;
     }
 
+    // Current MC simulation time, in MCTiming::TICK_HZ units
+    static uint64_t getTicks() {
+        return instance->ticks;
+    }
+
     // Exit from Siftulator entirely, from within the System simulation thread.
     static void exit(int result);
 
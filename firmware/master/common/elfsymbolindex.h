@@ -0,0 +1,203 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Thundercracker firmware
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host-side index of the symbols in a game's ELF file, shared by the
+ * simulator and swiss for turning addresses back into function names.
+ */
+
+#ifndef ELF_SYMBOL_INDEX_H
+#define ELF_SYMBOL_INDEX_H
+
+#ifndef SIFTEO_SIMULATOR
+#   error This is host-only code
+#endif
+
+#include "elfdefs.h"
+#include <cxxabi.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+
+
+namespace Elf {
+
+/*
+ * SymbolIndex --
+ *
+ *    Address lookups used to be a linear scan over .symtab, reading each
+ *    symbol and then its name out of the ELF. That's fine for a single
+ *    fault message, but painful for a long profile or log of a large game.
+ *
+ *    Instead, we make one pass over the symbol and string tables, and
+ *    keep the symbols sorted by start address. Each entry also records
+ *    the furthest end address of any symbol at or before it, so that
+ *    a lookup is a binary search followed by a short backwards walk over
+ *    just the symbols which could possibly contain the address.
+ *
+ *    Results are identical to the original scan: the containing symbol
+ *    with the nearest start address wins, and ties go to the symbol
+ *    that comes first in the table. Demangled names are cached.
+ */
+
+class SymbolIndex {
+public:
+    SymbolIndex() : loaded(false) {}
+
+    void clear() {
+        entries.clear();
+        strings.clear();
+        demangled.clear();
+        loaded = false;
+    }
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    unsigned size() const {
+        return entries.size();
+    }
+
+    void load(const uint8_t *symtab, uint32_t symtabSize,
+              const uint8_t *strtab, uint32_t strtabSize)
+    {
+        clear();
+        loaded = true;
+
+        // Keep a NUL-terminated copy of the string table
+        strings.assign((const char*)strtab, (const char*)strtab + strtabSize);
+        strings.push_back('\0');
+
+        for (uint32_t offset = 0, index = 0; offset + sizeof(Symbol) <= symtabSize;
+             offset += sizeof(Symbol), index++) {
+
+            Entry e;
+            memcpy(&e.sym, symtab + offset, sizeof e.sym);
+
+            // Strip the Thumb bit from function symbols.
+            if ((e.sym.st_info & 0xF) == STT_FUNC)
+                e.sym.st_value &= ~1;
+
+            // Empty symbols can never contain an address
+            if (e.sym.st_size == 0)
+                continue;
+
+            e.order = index;
+            entries.push_back(e);
+        }
+
+        std::sort(entries.begin(), entries.end(), compareEntries);
+
+        uint64_t maxEnd = 0;
+        for (unsigned i = 0, end = entries.size(); i != end; ++i) {
+            const Symbol &sym = entries[i].sym;
+            maxEnd = std::max<uint64_t>(maxEnd, (uint64_t)sym.st_value + sym.st_size);
+            entries[i].maxEnd = maxEnd;
+        }
+    }
+
+    const Symbol *find(uint32_t address) const
+    {
+        // Find the nearest symbol containing 'address', or NULL.
+
+        Entry key;
+        key.sym.st_value = address;
+        std::vector<Entry>::const_iterator I =
+            std::upper_bound(entries.begin(), entries.end(), key, compareStart);
+
+        while (I != entries.begin()) {
+            --I;
+            if (I->maxEnd <= address)
+                break;
+            if (address - I->sym.st_value < I->sym.st_size)
+                return &I->sym;
+        }
+
+        return 0;
+    }
+
+    const char *name(const Symbol &sym) const
+    {
+        if (sym.st_name < strings.size())
+            return &strings[sym.st_name];
+        return "";
+    }
+
+    const std::string &demangledName(const Symbol &sym) const
+    {
+        std::map<uint32_t, std::string>::iterator I = demangled.find(sym.st_name);
+        if (I != demangled.end())
+            return I->second;
+
+        std::string &s = demangled[sym.st_name];
+        s = name(sym);
+        demangle(s);
+        return s;
+    }
+
+    static void demangle(std::string &name)
+    {
+        // This uses the demangler built into GCC's libstdc++.
+        // It uses the same name mangling style as clang.
+
+        int status;
+        char *result = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
+        if (status == 0) {
+            name = result;
+            free(result);
+        }
+    }
+
+private:
+    struct Entry {
+        Symbol sym;
+        uint32_t order;     // Index in the original .symtab
+        uint64_t maxEnd;    // Furthest end address of this or any earlier entry
+    };
+
+    std::vector<Entry> entries;
+    std::vector<char> strings;
+    mutable std::map<uint32_t, std::string> demangled;
+    bool loaded;
+
+    static bool compareEntries(const Entry &a, const Entry &b) {
+        // By address, then backwards by table order. Lookups walk backwards.
+        if (a.sym.st_value != b.sym.st_value)
+            return a.sym.st_value < b.sym.st_value;
+        return a.order > b.order;
+    }
+
+    static bool compareStart(const Entry &a, const Entry &b) {
+        return a.sym.st_value < b.sym.st_value;
+    }
+};
+
+}   // namespace Elf
+
+#endif // ELF_SYMBOL_INDEX_H
@@ -105,7 +105,7 @@ void FlashBlock::anonymous(FlashBlockRef &ref)
 
     // This ensures nobody else will ref the same block.
     recycled->address = INVALID_ADDRESS;
-    recycled->validCodeBundles[recycled->id()] = 0;
+    recycled->invalidateCode();
 
     ref.set(recycled);
     ASSERT(recycled->refCount == 1);
@@ -203,7 +203,7 @@ void FlashBlock::load(uint32_t blockAddr, unsigned flags)
     ASSERT(blockAddr != INVALID_ADDRESS);
     ASSERT((blockAddr & (BLOCK_SIZE - 1)) == 0);
 
-    validCodeBundles[id()] = 0;
+    invalidateCode();
     address = blockAddr;
 
     uint8_t *data = getData();
@@ -269,7 +269,7 @@ void FlashBlockWriter::beginBlock(const FlashBlockRef &r)
     ASSERT(ref.isHeld());
 
     // Prepare to write
-    ref->validCodeBundles[ref->id()] = 0;
+    ref->invalidateCode();
 }
 
 void FlashBlockWriter::beginBlock()
@@ -153,6 +153,8 @@ public:
 
 #ifdef SIFTEO_SIMULATOR
     static bool isAddrValid(uintptr_t pa);
+    static uintptr_t cacheOffset(uintptr_t pa);
+    static void invalidateTranslation(unsigned id);
     static void resetStats();
     static void dumpStats();
     static bool hotBlockSort(unsigned i, unsigned j);
@@ -177,6 +179,14 @@ public:
     void invalidateBlock(unsigned flags = 0);
 
 private:
+    ALWAYS_INLINE void invalidateCode() {
+        validCodeBundles[id()] = 0;
+#ifdef SIFTEO_SIMULATOR
+        // Also drop any instructions the simulated CPU has pre-decoded
+        invalidateTranslation(id());
+#endif
+    }
+
     ALWAYS_INLINE void incRef() {
         ASSERT(refCount <= MAX_REFCOUNT);
 
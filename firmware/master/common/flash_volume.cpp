@@ -107,6 +107,22 @@ FlashVolume FlashVolume::getParent() const
     return FlashMapBlock::fromCode(hdr->parentBlock);
 }
 
+bool FlashVolume::isGamePackage(const char *package) const
+{
+    // Is this a game whose package string matches 'package'?
+
+    if (getType() != T_GAME)
+        return false;
+
+    FlashBlockRef ref;
+    Elf::Program program;
+    if (!program.init(getPayload(ref)))
+        return false;
+
+    const char *str = program.getMetaString(ref, _SYS_METADATA_PACKAGE_STR);
+    return str && !strcmp(str, package);
+}
+
 FlashMapSpan FlashVolume::getPayload(FlashBlockRef &ref) const
 {
     ASSERT(isValid());
@@ -279,6 +295,7 @@ bool FlashVolumeWriter::begin(FlashBlockRecycler &recycler,
     this->type = type;
     this->payloadBytes = payloadBytes;
     this->payloadOffset = 0;
+    this->payloadFailed = false;
 
     // Start building a volume header, in anonymous cache memory.
     // populateMap() will assign concrete block addresses to the volume.
@@ -471,11 +488,12 @@ void FlashVolumeWriter::appendPayload(const uint8_t *bytes, uint32_t count)
 
         /*
          * If we're overrunning the end of the volume, it's an error!
-         * Prevent the write from happening, and make sure payloadOffset does get
-         * incremented so that isPayloadComplete() will never return 'true'.
+         * Prevent the write from happening, and make sure isPayloadComplete()
+         * will never return 'true'.
          */
 
         payloadOffset += count;
+        payloadFailed = true;
         return;
     }
 
@@ -508,6 +526,34 @@ void FlashVolumeWriter::appendPayload(const uint8_t *bytes, uint32_t count)
     }
 }
 
+void FlashVolumeWriter::copyPayload(FlashVolume source, uint32_t count)
+{
+    if (!source.isValid()) {
+        payloadOffset += count;
+        payloadFailed = true;
+        return;
+    }
+
+    FlashBlockRef spanRef;
+    FlashMapSpan span = source.getPayload(spanRef);
+
+    while (count) {
+        uint32_t chunk = count;
+        FlashBlockRef dataRef;
+        FlashMapSpan::PhysAddr pa;
+
+        if (!span.getBytes(dataRef, payloadOffset, pa, chunk)) {
+            // Past the end of the source volume
+            payloadOffset += count;
+            payloadFailed = true;
+            return;
+        }
+
+        appendPayload(pa, chunk);
+        count -= chunk;
+    }
+}
+
 FlashVolume::FlashVolume(_SYSVolumeHandle vh)
 {
     /*
@@ -566,7 +612,8 @@ uint32_t FlashVolume::signHandle(uint32_t h)
     return b.code | (Crc32::get() & 0xFFFFFF00);
 }
 
-bool FlashVolumeWriter::beginGame(unsigned payloadBytes, const char *package)
+bool FlashVolumeWriter::beginGame(unsigned payloadBytes, const char *package,
+    FlashVolume keep)
 {
     /**
      * Start writing a game, after deleting any existing game volumes with
@@ -580,16 +627,8 @@ bool FlashVolumeWriter::beginGame(unsigned payloadBytes, const char *package)
 
     vi.begin();
     while (vi.next(vol)) {
-        if (vol.getType() != FlashVolume::T_GAME)
-            continue;
-
-        FlashBlockRef ref;
-        Elf::Program program;
-        if (program.init(vol.getPayload(ref))) {
-            const char *str = program.getMetaString(ref, _SYS_METADATA_PACKAGE_STR);
-            if (str && !strcmp(str, package))
-                vol.deleteTree();
-        }
+        if (vol.block.code != keep.block.code && vol.isGamePackage(package))
+            vol.deleteTree();
     }
 
     FlashBlockRecycler recycler;
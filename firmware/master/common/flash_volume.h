@@ -105,6 +105,7 @@ public:
     bool isValid() const;
     unsigned getType() const;
     FlashVolume getParent() const;
+    bool isGamePackage(const char *package) const;
     FlashMapSpan getPayload(FlashBlockRef &ref) const;
     uint8_t *mapTypeSpecificData(FlashBlockRef &ref, unsigned &size) const;
 
@@ -221,9 +222,11 @@ public:
 
     /**
      * Start writing a game, after deleting any existing game volumes with
-     * the same package name.
+     * the same package name. If 'keep' is valid, that volume is left alone
+     * so we can copy from it; the caller deletes it after commit().
      */
-    bool beginGame(unsigned payloadBytes, const char *package);
+    bool beginGame(unsigned payloadBytes, const char *package,
+        FlashVolume keep = FlashMapBlock::invalid());
 
     /**
      * Start writing the launcher, after deleting any existing launcher.
@@ -249,6 +252,14 @@ public:
      */ 
     void appendPayload(const uint8_t *bytes, uint32_t count);
 
+    /**
+     * Like appendPayload(), but the data comes from the same offset in
+     * another volume's payload. If the source is invalid or too short, the
+     * write fails and isPayloadComplete() will never return 'true', even
+     * if the total byte count comes out right.
+     */
+    void copyPayload(FlashVolume source, uint32_t count);
+
     /**
      * Finish writing the volume. This completes any writes that are pending
      * from earlier appendPayload() operations, plus it writes the correct
@@ -256,15 +267,16 @@ public:
      */
     void commit();
 
-    /// Have exactly the right number of payload bytes been written?
+    /// Have exactly the right number of payload bytes been written, with no errors?
     ALWAYS_INLINE bool isPayloadComplete() const {
-        return payloadOffset == payloadBytes;
+        return !payloadFailed && payloadOffset == payloadBytes;
     }
 
 private:
     FlashBlockWriter payloadWriter;
     unsigned payloadOffset;
     unsigned payloadBytes;
+    bool payloadFailed;
     uint16_t type;
     bool useEraseLog;
 
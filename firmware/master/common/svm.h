@@ -357,7 +357,7 @@ static ALWAYS_INLINE reg_t branchTargetCondB(uint16_t instr, reg_t pc, reg_t cps
 
 static ALWAYS_INLINE reg_t passedBranchTargetCBZ_CBNZ(uint16_t instr, reg_t pc)
 {
-    unsigned i = instr & (1 << 9);
+    unsigned i = (instr >> 9) & 1;
     unsigned imm5 = (instr >> 3) & 0x1f;
 
     // ZeroExtend(i:imm5:'0')
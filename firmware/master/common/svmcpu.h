@@ -60,6 +60,11 @@ namespace SvmCpu {
 
     void run(reg_t sp, reg_t pc) SVM_RUN_ATTRS;
 
+#ifdef SIFTEO_SIMULATOR
+    // Forget any pre-decoded instructions from one flash cache block
+    void invalidateTranslation(unsigned blockId);
+#endif
+
     // Registers that get saved to the stack automatically by hardware
     struct HwContext {
         reg_t r0;
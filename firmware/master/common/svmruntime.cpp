@@ -34,10 +34,26 @@
 #include "tasks.h"
 #include "cubeslots.h"
 #include "faultlogger.h"
+#include "syscallcounters.h"
 
 #include <math.h>
 #include <sifteo/abi.h>
 
+/*
+ * Call-graph profiling, available in emulation only.
+ */
+#ifdef SIFTEO_SIMULATOR
+#   include "mc_svmprofiler.h"
+#   define PROFILER_ONLY(x) \
+        do { \
+            if (SvmProfiler::isEnabled()) { \
+                x ; \
+            } \
+        } while (0)
+#else
+#   define PROFILER_ONLY(x)
+#endif
+
 typedef uint64_t (*SvmSyscall)(reg_t p0, reg_t p1, reg_t p2, reg_t p3,
                                reg_t p4, reg_t p5, reg_t p6, reg_t p7);
 
@@ -65,6 +81,7 @@ void SvmRuntime::run(uint32_t entryFunc, const StackInfo &stack)
     UART(("Entering SVM.\r\n"));
 
     initStack(stack);
+    PROFILER_ONLY(SvmProfiler::onCall(entryFunc, 0));
 
     SvmMemory::PhysAddr pa;
     if (SvmMemory::mapROCode(codeBlock, entryFunc, pa)) {
@@ -97,6 +114,7 @@ void SvmRuntime::exec(uint32_t entryFunc, const StackInfo &stack)
 
     setSP(stack.top - getSPAdjustBytes(entryFunc));
     branch(entryFunc);
+    PROFILER_ONLY(SvmProfiler::onCall(entryFunc, 0));
 }
 
 void SvmRuntime::initStack(const StackInfo &stack)
@@ -157,6 +175,7 @@ void SvmRuntime::call(reg_t addr)
     });
 
     enterFunction(addr);
+    PROFILER_ONLY(SvmProfiler::onCall(addr, reinterpret_cast<reg_t>(fp)));
 }
 
 ALWAYS_INLINE void SvmRuntime::tailcall(reg_t addr)
@@ -181,6 +200,7 @@ ALWAYS_INLINE void SvmRuntime::tailcall(reg_t addr)
     });
 
     enterFunction(addr);
+    PROFILER_ONLY(SvmProfiler::onTailCall(addr));
 }
 
 ALWAYS_INLINE void SvmRuntime::enterFunction(reg_t addr)
@@ -254,6 +274,7 @@ void SvmRuntime::ret(unsigned actions)
     }
 
     if (actions & RET_POP_FRAME) {
+        PROFILER_ONLY(SvmProfiler::onReturn(regFP));
         SvmCpu::setReg(REG_FP, reinterpret_cast<reg_t>(fpPA));
         setSP(reinterpret_cast<reg_t>(fp + 1));
 
@@ -429,6 +450,7 @@ void SvmRuntime::syscall(unsigned num)
         SvmRuntime::fault(F_BAD_SYSCALL);
         return;
     }
+    STATIC_ASSERT(arraysize(SyscallTable) <= SyscallCounters::NUM_SYSCALLS);
     SvmSyscall fn = SyscallTable[num];
     if (!fn) {
         SvmRuntime::fault(F_BAD_SYSCALL);
@@ -448,11 +470,17 @@ void SvmRuntime::syscall(unsigned num)
             reinterpret_cast<void*>(SvmCpu::reg(7))));
     });
 
+    PROFILER_ONLY(SvmProfiler::onSyscallEnter(num));
+    uint32_t start = SyscallCounters::timestamp();
+
     uint64_t result = fn(SvmCpu::reg(0), SvmCpu::reg(1),
                          SvmCpu::reg(2), SvmCpu::reg(3),
                          SvmCpu::reg(4), SvmCpu::reg(5),
                          SvmCpu::reg(6), SvmCpu::reg(7));
 
+    SyscallCounters::record(num, start);
+    PROFILER_ONLY(SvmProfiler::onSyscallLeave());
+
     uint32_t result0 = result;
     uint32_t result1 = result >> 32;
 
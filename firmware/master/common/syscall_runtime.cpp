@@ -45,6 +45,7 @@
 #include "ui_coordinator.h"
 #include "ui_shutdown.h"
 #include "sysinfo.h"
+#include "syscallcounters.h"
 
 extern "C" {
 
@@ -72,12 +73,14 @@ void _SYS_yield(void)
 
 void _SYS_paint(void)
 {
+    SyscallCounters::onFrame();
     CubeSlots::paintCubes(CubeSlots::userConnected);
     SvmRuntime::dispatchEventsOnReturn();
 }
 
 void _SYS_paintUnlimited(void)
 {
+    SyscallCounters::onFrame();
     CubeSlots::paintCubes(CubeSlots::userConnected, false);
     SvmRuntime::dispatchEventsOnReturn();
 }
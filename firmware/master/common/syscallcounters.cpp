@@ -0,0 +1,125 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Thundercracker firmware
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "syscallcounters.h"
+
+#ifdef SIFTEO_SIMULATOR
+#include "mc_usbserver.h"
+#else
+#include "usb/usbdevice.h"
+#endif
+
+SyscallCounters::Counter SyscallCounters::counters[NUM_SYSCALLS];
+uint32_t SyscallCounters::frames;
+bool SyscallCounters::resetPending;
+
+
+void SyscallCounters::init()
+{
+#ifndef SIFTEO_SIMULATOR
+    // Turn on the DWT unit, then its cycle counter
+    NVIC.DEMCR |= 1 << 24;
+    DWT.CYCCNT = 0;
+    DWT.CTRL |= 1;
+#endif
+
+    reset();
+}
+
+void SyscallCounters::reset()
+{
+    memset(counters, 0, sizeof counters);
+    frames = 0;
+    resetPending = false;
+}
+
+void SyscallCounters::onFrame()
+{
+    if (resetPending)
+        reset();
+    else
+        frames++;
+}
+
+void SyscallCounters::onUSBData(const USBProtocolMsg &m)
+{
+    if (m.payloadLen() < sizeof(uint32_t))
+        return;
+
+    switch (m.payload[0]) {
+
+    case ResetSyscallCounters:
+        resetPending = true;
+        break;
+
+    case GetSyscallCounters:
+        getCounters(m);
+        break;
+    }
+}
+
+void SyscallCounters::getCounters(const USBProtocolMsg &m)
+{
+    STATIC_ASSERT(sizeof(CountersReply) <= USBProtocolMsg::MAX_PAYLOAD_BYTES);
+
+    if (m.payloadLen() < sizeof(uint32_t) + sizeof(CountersRequest))
+        return;
+
+    // Nothing has painted since a reset was requested? Do it now.
+    if (resetPending)
+        reset();
+
+    const CountersRequest *req =
+        reinterpret_cast<const CountersRequest*>(m.payload + sizeof(uint32_t));
+
+    USBProtocolMsg reply(USBProtocol::Profiler);
+    reply.header |= GetSyscallCounters;
+    CountersReply *r = reply.zeroCopyAppend<CountersReply>();
+
+    r->frames = frames;
+    r->count = 0;
+
+    unsigned num = req->first;
+    for (; num < NUM_SYSCALLS && r->count < MAX_ENTRIES_PER_REPLY; ++num) {
+        if (counters[num].calls) {
+            CountersEntry &e = r->entries[r->count++];
+            e.number = num;
+            e.counter = counters[num];
+        }
+    }
+
+    // Skip ahead to the next syscall that has something to report
+    while (num < NUM_SYSCALLS && !counters[num].calls)
+        num++;
+    r->next = num;
+
+    reply.len -= (MAX_ENTRIES_PER_REPLY - r->count) * sizeof(CountersEntry);
+
+#ifdef SIFTEO_SIMULATOR
+    UsbServer::write(reply.bytes, reply.len);
+#else
+    UsbDevice::write(reply.bytes, reply.len);
+#endif
+}
@@ -0,0 +1,138 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Thundercracker firmware
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SYSCALL_COUNTERS_H
+#define SYSCALL_COUNTERS_H
+
+#include "macros.h"
+#include "usbprotocol.h"
+
+#ifndef SIFTEO_SIMULATOR
+#include "hardware.h"
+#endif
+
+/*
+ * Call counts and timing for each syscall, to find out which ones a
+ * game is spending its frames in.
+ *
+ * These are always enabled, so they need to stay cheap: one cycle counter
+ * read on each side of a syscall, and a few adds. Cycles are 72 MHz CPU
+ * cycles. On hardware they come from the Cortex-M3 DWT cycle counter, and
+ * in Siftulator from the virtual clock.
+ *
+ * Resets wait for the next frame, so that totals cover whole frames and
+ * can be averaged by the frame count. Cycle totals are 32-bit, which wraps
+ * after about a minute, so read them at least that often.
+ *
+ * The host talks to us over the Profiler USB subsystem. SampleProfiler
+ * already uses command 0 there.
+ */
+
+class SyscallCounters
+{
+public:
+    // One more than the highest syscall number we can count
+    static const unsigned NUM_SYSCALLS = 256;
+
+    enum Command {
+        ResetSyscallCounters = 1,
+        GetSyscallCounters,
+    };
+
+    struct Counter {
+        uint32_t calls;
+        uint32_t cycles;
+        uint32_t maxCycles;
+    };
+
+    // Request for GetSyscallCounters, after a 32-bit command word
+    struct CountersRequest {
+        uint32_t first;     // Lowest syscall number to report
+    };
+
+    static const unsigned MAX_ENTRIES_PER_REPLY = 3;
+
+    struct CountersEntry {
+        uint32_t number;
+        Counter counter;
+    };
+
+    /*
+     * Reply to GetSyscallCounters, with the command in the low bits of the
+     * header. Only syscalls that have been called are included, so ask
+     * again starting at 'next' until it reaches NUM_SYSCALLS.
+     */
+    struct CountersReply {
+        uint32_t frames;    // Frames started since the last reset
+        uint32_t next;
+        uint32_t count;
+        CountersEntry entries[MAX_ENTRIES_PER_REPLY];
+    };
+
+    static void init();
+    static void onUSBData(const USBProtocolMsg &m);
+
+    // Called at the start of each frame, by _SYS_paint()
+    static void onFrame();
+
+    static void reset();
+
+    static const Counter &get(unsigned num) {
+        ASSERT(num < NUM_SYSCALLS);
+        return counters[num];
+    }
+
+    static uint32_t frameCount() {
+        return frames;
+    }
+
+#ifdef SIFTEO_SIMULATOR
+    static uint32_t timestamp();
+#else
+    static ALWAYS_INLINE uint32_t timestamp() {
+        return DWT.CYCCNT;
+    }
+#endif
+
+    static ALWAYS_INLINE void record(unsigned num, uint32_t start) {
+        ASSERT(num < NUM_SYSCALLS);
+        uint32_t cycles = timestamp() - start;
+        Counter &c = counters[num];
+
+        c.calls++;
+        c.cycles += cycles;
+        if (cycles > c.maxCycles)
+            c.maxCycles = cycles;
+    }
+
+private:
+    static Counter counters[NUM_SYSCALLS];
+    static uint32_t frames;
+    static bool resetPending;
+
+    static void getCounters(const USBProtocolMsg &m);
+};
+
+#endif // SYSCALL_COUNTERS_H
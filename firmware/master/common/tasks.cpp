@@ -43,6 +43,7 @@
 #   include "system_mc.h"
 #   include "system.h"
 #   include "batterylevel.h"
+#   include "mc_usbserver.h"
 #else
 #   include "nrf8001/nrf8001.h"
 #   include "usb/usbdevice.h"
@@ -74,6 +75,9 @@ ALWAYS_INLINE void Tasks::taskInvoke(unsigned id)
         #if (BOARD == BOARD_TEST_JIG && !defined(BOOTLOADER))
         case Tasks::TestJig:            return TestJig::task();
         #endif
+    #else
+        case Tasks::UsbOUT:             return UsbServer::handleOUTData();
+        case Tasks::UsbIN:              return USBProtocol::inTask();
     #endif
 
     #if !defined(BOOTLOADER) && !BOARD_EQUALS(BOARD_TEST_JIG)
@@ -28,8 +28,11 @@
 #include "usbvolumemanager.h"
 #include "macros.h"
 #include "event.h"
+#include "syscallcounters.h"
 
-#ifndef SIFTEO_SIMULATOR
+#ifdef SIFTEO_SIMULATOR
+#include "mc_usbserver.h"
+#else
 #include "usb/usbdevice.h"
 #include "hardware.h"
 #include "factorytest.h"
@@ -49,7 +52,9 @@ void USBProtocol::dispatch(const USBProtocolMsg &m)
         case Installer:     UsbVolumeManager::onUsbData(m); return;
     #if (!(defined(SIFTEO_SIMULATOR) || ((BOARD == BOARD_TEST_JIG) && !defined(BOOTLOADER)) || defined(RFTEST)))
         case FactoryTest:   FactoryTest::usbHandler(m); return;
-        case Profiler:      SampleProfiler::onUSBData(m); return;
+        case Profiler:      SampleProfiler::onUSBData(m); SyscallCounters::onUSBData(m); return;
+    #else
+        case Profiler:      SyscallCounters::onUSBData(m); return;
     #endif
         case User:          onReceiveData(m); return;
         default:
@@ -117,7 +122,9 @@ void USBProtocol::requestUserINPacket()
 
         // timeout here should leave some headroom for system watchdog,
         // which is currently 3 seconds.
-#ifndef SIFTEO_SIMULATOR
+#ifdef SIFTEO_SIMULATOR
+        UsbServer::write(buf, pkt->length + sizeof pkt->type);
+#else
         UsbDevice::write(buf, pkt->length + sizeof pkt->type, 1000);
 #endif
         return Event::setBasePending(Event::PID_BASE_USB_WRITE_AVAILABLE);
@@ -30,12 +30,18 @@
 #include "flash_volumeheader.h"
 #include "flash_syslfs.h"
 #include "flash_stack.h"
+#include "flash_blockcache.h"
+#include "flash_device.h"
+#include "tasks.h"
 
-#ifndef SIFTEO_SIMULATOR
+#ifdef SIFTEO_SIMULATOR
+#include "mc_usbserver.h"
+#else
 #include "usb/usbdevice.h"
 #endif
 
 FlashVolumeWriter UsbVolumeManager::writer;
+FlashVolume UsbVolumeManager::deltaSource;
 UsbVolumeManager::LFSObjectWriteStatus UsbVolumeManager::lfsWriter;
 
 void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
@@ -56,6 +62,7 @@ void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
         if (!memchr(packageStr, 0, m.payloadLen() - 4))
             break;
 
+        deltaSource.block.setInvalid();
         if (writer.beginGame(numBytes, packageStr)) {
             reply.header |= WroteHeaderOK;
         } else {
@@ -73,6 +80,7 @@ void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
             break;
 
         const uint32_t numBytes = *reinterpret_cast<const uint32_t*>(m.payload);
+        deltaSource.block.setInvalid();
         if (writer.beginLauncher(numBytes)) {
             reply.header |= WroteHeaderOK;
         } else {
@@ -86,16 +94,36 @@ void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
         // NOTE: we don't respond to these to avoid the traffic overhead, so just return
         return;
 
+    case WriteDeltaGameHeader:
+        beginDeltaGame(m, reply);
+        break;
+
+    case WritePayloadCopy:
+        if (m.payloadLen() >= sizeof(PayloadCopyRequest))
+            writer.copyPayload(deltaSource, m.castPayload<PayloadCopyRequest>()->numBytes);
+        // No response, same as WritePayload
+        return;
+
     case WriteCommit:
         if (writer.isPayloadComplete()) {
             writer.commit();
             reply.header |= WriteCommitOK;
             reply.append(&writer.volume.block.code, 1);
+
+            // A delta install replaces its source only once it's complete
+            if (deltaSource.isValid()) {
+                deltaSource.deleteTree();
+                deltaSource.block.setInvalid();
+            }
         } else {
             reply.header |= WriteCommitFail;
         }
         break;
 
+    case PayloadHashes:
+        payloadHashes(m, reply);
+        break;
+
     case VolumeOverview:
         volumeOverview(reply);
         break;
@@ -184,6 +212,19 @@ void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
         flashDeviceRead(m, reply);
         break;
 
+    case FlashDeviceChecksums:
+        flashDeviceChecksums(m, reply);
+        break;
+
+    case FlashDeviceErase:
+        flashDeviceErase(m, reply);
+        break;
+
+    case FlashDeviceWrite:
+        flashDeviceWrite(m);
+        // No response, same as WritePayload
+        return;
+
     case BaseSysInfo:
         baseSysInfo(m, reply);
         break;
@@ -196,13 +237,19 @@ void UsbVolumeManager::onUsbData(const USBProtocolMsg &m)
         beginLFSObjectWrite(m, reply);
         break;
 
+    case LFSObjectList:
+        lfsObjectList(m, reply);
+        break;
+
     case WriteLFSObjectPayload:
         // NOTE: we don't respond to these to avoid the traffic overhead, so just return
         lfsPayloadWrite(m);
         return;
     }
 
-#ifndef SIFTEO_SIMULATOR
+#ifdef SIFTEO_SIMULATOR
+    UsbServer::write(reply.bytes, reply.len);
+#else
     UsbDevice::write(reply.bytes, reply.len);
 #endif
 }
@@ -364,6 +411,56 @@ void UsbVolumeManager::lfsDetail(const USBProtocolMsg &m, USBProtocolMsg &reply)
     }
 }
 
+void UsbVolumeManager::lfsObjectList(const USBProtocolMsg &m, USBProtocolMsg &reply)
+{
+    /*
+     * Walk the LFS from newest to oldest, the same way objects are read,
+     * and report the first copy of each key that passes its CRC check.
+     * Keys in the request's exclusion set are skipped entirely.
+     */
+
+    STATIC_ASSERT(sizeof(LFSObjectListReply) <= USBProtocolMsg::MAX_PAYLOAD_BYTES);
+
+    if (m.payloadLen() < sizeof(LFSObjectListRequest))
+        return;
+
+    const LFSObjectListRequest *req = m.castPayload<LFSObjectListRequest>();
+    FlashVolume vol = FlashMapBlock::fromCode(req->volume);
+
+    if (req->volume != SYSLFS_VOLUME_BLOCK_CODE && !vol.isValid())
+        return;
+
+    LFSObjectListReply *r = reply.zeroCopyAppend<LFSObjectListReply>();
+    r->count = 0;
+    reply.header |= LFSObjectList;
+
+    FlashLFS &lfs = req->volume == SYSLFS_VOLUME_BLOCK_CODE
+        ? SysLFS::get() : FlashLFSCache::get(vol);
+
+    FlashLFSIndexRecord::KeyVector_t keys = req->excludedKeys;
+    FlashLFSObjectIter iter(lfs);
+    uint32_t crc;
+
+    while (r->count < arraysize(r->objects) && iter.previous(FlashLFSKeyQuery(&keys))) {
+
+        // A corrupt copy doesn't hide older copies of the same key
+        if (!iter.readAndCheckCRCOnly(crc))
+            continue;
+
+        const FlashLFSIndexRecord *rec = iter.record();
+        keys.mark(rec->getKey());
+
+        LFSObjectListEntry &e = r->objects[r->count++];
+        e.address = iter.address();
+        e.crc = crc;
+        e.key = rec->getKey();
+        e.sizeInUnits = rec->getSizeInUnits();
+    }
+
+    // Only as many entries as we found
+    reply.len -= sizeof(r->objects[0]) * (arraysize(r->objects) - r->count);
+}
+
 void UsbVolumeManager::pairCube(const USBProtocolMsg &m, USBProtocolMsg &reply)
 {
     /*
@@ -421,6 +518,83 @@ void UsbVolumeManager::pairingSlotDetail(const USBProtocolMsg &m, USBProtocolMsg
     r->pairingSlot = pairingSlot;
 }
 
+void UsbVolumeManager::payloadHashes(const USBProtocolMsg &m, USBProtocolMsg &reply)
+{
+    /*
+     * CRC the payload of a volume in PAYLOAD_HASH_CHUNK pieces, starting
+     * with the requested chunk, and reply with as many as we can fit.
+     * Only whole chunks are included.
+     */
+
+    if (m.payloadLen() < sizeof(PayloadHashRequest))
+        return;
+
+    const PayloadHashRequest *req = m.castPayload<PayloadHashRequest>();
+    reply.header |= PayloadHashes;
+
+    FlashVolume vol = FlashMapBlock::fromCode(req->volume);
+    if (!vol.isValid())
+        return;
+
+    FlashBlockRef spanRef, dataRef;
+    FlashMapSpan span = vol.getPayload(spanRef);
+    unsigned numChunks = span.sizeInBytes() / PAYLOAD_HASH_CHUNK;
+
+    for (unsigned chunk = req->firstChunk;
+         chunk < numChunks && reply.bytesFree() >= sizeof(uint32_t); ++chunk) {
+
+        CrcStream cs;
+        cs.reset();
+
+        for (unsigned offset = 0; offset < PAYLOAD_HASH_CHUNK;) {
+            FlashMapSpan::PhysAddr pa;
+            uint32_t length = PAYLOAD_HASH_CHUNK - offset;
+            if (!span.getBytes(dataRef, chunk * PAYLOAD_HASH_CHUNK + offset, pa, length))
+                return;
+            cs.addBytes(pa, length);
+            offset += length;
+        }
+
+        uint32_t crc = cs.get();
+        reply.append((const uint8_t*) &crc, sizeof crc);
+    }
+}
+
+void UsbVolumeManager::beginDeltaGame(const USBProtocolMsg &m, USBProtocolMsg &reply)
+{
+    /*
+     * Like WriteGameHeader, but the new volume's payload may be built
+     * partly from an existing game's payload, via WritePayloadCopy.
+     * That game stays installed until the new one is committed.
+     */
+
+    if (m.payloadLen() < sizeof(DeltaGameHeader) + 1)
+        return;
+
+    const DeltaGameHeader *hdr = m.castPayload<DeltaGameHeader>();
+    const char* packageStr = reinterpret_cast<const char*>(m.payload + sizeof *hdr);
+    if (!memchr(packageStr, 0, m.payloadLen() - sizeof *hdr))
+        return;
+
+    /*
+     * The source is deleted when the new volume commits, so it had better
+     * be an older version of this same game.
+     */
+    deltaSource = FlashMapBlock::fromCode(hdr->sourceVolume);
+    if (!deltaSource.isValid() || !deltaSource.isGamePackage(packageStr)) {
+        deltaSource.block.setInvalid();
+        reply.header |= WroteHeaderFail;
+        return;
+    }
+
+    if (writer.beginGame(hdr->numBytes, packageStr, deltaSource)) {
+        reply.header |= WroteHeaderOK;
+    } else {
+        deltaSource.block.setInvalid();
+        reply.header |= WroteHeaderFail;
+    }
+}
+
 void UsbVolumeManager::flashDeviceRead(const USBProtocolMsg &m, USBProtocolMsg &reply)
 {
     if (m.payloadLen() < sizeof(FlashDeviceReadRequest))
@@ -439,6 +613,92 @@ void UsbVolumeManager::flashDeviceRead(const USBProtocolMsg &m, USBProtocolMsg &
     reply.len += length;
 }
 
+void UsbVolumeManager::flashDeviceChecksums(const USBProtocolMsg &m, USBProtocolMsg &reply)
+{
+    /*
+     * CRC a run of FLASH_CHECKSUM_CHUNK sized chunks, straight from the
+     * device, and note which ones are completely erased.
+     */
+
+    if (m.payloadLen() < sizeof(FlashChecksumRequest))
+        return;
+
+    const FlashChecksumRequest *req = m.castPayload<FlashChecksumRequest>();
+    uint32_t address = req->address;
+    unsigned count = MIN(req->count, MAX_FLASH_CHECKSUMS);
+
+    if (address % FLASH_CHECKSUM_CHUNK)
+        return;
+    if (address > FlashDevice::CAPACITY)
+        return;
+    count = MIN(count, (FlashDevice::CAPACITY - address) / FLASH_CHECKSUM_CHUNK);
+
+    reply.header |= FlashDeviceChecksums;
+    FlashChecksumReply *r = reply.zeroCopyAppend<FlashChecksumReply>();
+    r->erasedMask = 0;
+
+    for (unsigned i = 0; i < count; ++i) {
+        CrcStream cs;
+        cs.reset();
+        bool erased = true;
+
+        for (unsigned offset = 0; offset < FLASH_CHECKSUM_CHUNK;) {
+            uint8_t buf[FlashDevice::PAGE_SIZE];
+            FlashDevice::read(address + offset, buf, sizeof buf);
+            cs.addBytes(buf, sizeof buf);
+
+            for (unsigned j = 0; erased && j < sizeof buf; ++j)
+                erased = buf[j] == 0xFF;
+
+            offset += sizeof buf;
+        }
+
+        r->crc[i] = cs.get();
+        if (erased)
+            r->erasedMask |= 1 << i;
+
+        address += FLASH_CHECKSUM_CHUNK;
+    }
+
+    // Only as many CRCs as we computed
+    reply.len -= sizeof(r->crc[0]) * (MAX_FLASH_CHECKSUMS - count);
+}
+
+void UsbVolumeManager::flashDeviceErase(const USBProtocolMsg &m, USBProtocolMsg &reply)
+{
+    if (m.payloadLen() < sizeof(FlashEraseRequest))
+        return;
+
+    uint32_t address = m.castPayload<FlashEraseRequest>()->address;
+    if (address % FlashDevice::ERASE_BLOCK_SIZE || address >= FlashDevice::CAPACITY)
+        return;
+
+    FlashDevice::eraseBlock(address);
+    while (FlashDevice::busy())
+        Tasks::resetWatchdog();
+
+    // Nothing cached from the old contents may survive
+    FlashStack::invalidateCache(FlashBlock::F_ABORT_TRAP);
+
+    reply.header |= FlashDeviceErase;
+}
+
+void UsbVolumeManager::flashDeviceWrite(const USBProtocolMsg &m)
+{
+    if (m.payloadLen() < sizeof(FlashWriteHeader))
+        return;
+
+    uint32_t address = m.castPayload<FlashWriteHeader>()->address;
+    const uint8_t *data = m.payload + sizeof(FlashWriteHeader);
+    unsigned length = m.payloadLen() - sizeof(FlashWriteHeader);
+
+    if (address > FlashDevice::CAPACITY || length > FlashDevice::CAPACITY - address)
+        return;
+
+    FlashDevice::write(address, data, length);
+    FlashBlock::invalidate(address, address + length, FlashBlock::F_ABORT_TRAP);
+}
+
 void UsbVolumeManager::baseSysInfo(const USBProtocolMsg &m, USBProtocolMsg &reply)
 {
     reply.header |= BaseSysInfo;
@@ -58,9 +58,23 @@ public:
         WriteLFSObjectHeader,
         WriteLFSObjectHeaderFail,
         WriteLFSObjectPayload,
-        DeleteLFSChildren
+        DeleteLFSChildren,
+        PayloadHashes,
+        WriteDeltaGameHeader,
+        WritePayloadCopy,
+        FlashDeviceChecksums,
+        FlashDeviceErase,
+        FlashDeviceWrite,
+        LFSObjectList
     };
 
+    /*
+     * Delta installs compare the payload of an installed volume with
+     * a new ELF in fixed-size chunks, and copy the unchanged chunks on
+     * the base instead of sending them over USB again.
+     */
+    static const unsigned PAYLOAD_HASH_CHUNK = 4096;
+
     struct VolumeOverviewReply {
         unsigned systemBytes;
         unsigned freeBytes;
@@ -104,6 +118,37 @@ public:
         uint32_t length;
     };
 
+    /*
+     * Raw access to the whole flash device, for backing up and re-imaging
+     * a base. Checksums and erased state are reported for fixed-size chunks.
+     *
+     * Erasing and writing bypass the volume layer entirely, and leave any
+     * running program in an abort trap. The host reboots the base afterwards.
+     */
+    static const unsigned FLASH_CHECKSUM_CHUNK = 4096;
+    static const unsigned MAX_FLASH_CHECKSUMS = 14;
+
+    struct FlashChecksumRequest {
+        uint32_t address;   // Chunk-aligned
+        uint32_t count;     // At most MAX_FLASH_CHECKSUMS
+    };
+
+    // Reply to FlashDeviceChecksums, truncated to 'count' CRCs.
+    struct FlashChecksumReply {
+        uint32_t erasedMask;    // Bit N is set if chunk N is all 0xFF
+        uint32_t crc[MAX_FLASH_CHECKSUMS];
+    };
+
+    // Erase one FlashDevice::ERASE_BLOCK_SIZE block. Replies when done.
+    struct FlashEraseRequest {
+        uint32_t address;
+    };
+
+    // Followed by the data to write. No reply, as with WritePayload.
+    struct FlashWriteHeader {
+        uint32_t address;
+    };
+
     struct SysInfoReply {
         uint8_t baseUniqueID[SysInfo::UniqueIdNumBytes];
         uint8_t baseHwRevision;
@@ -120,6 +165,52 @@ public:
         unsigned dataSize;
     };
 
+    /*
+     * List the newest valid copy of each object in a volume's LFS, except
+     * for keys the host already has. Repeat, excluding the keys seen so far,
+     * until a reply comes back with fewer than MAX_LFS_OBJECTS_PER_REPLY.
+     * Object data is stored contiguously; read it with FlashDeviceRead.
+     */
+    struct LFSObjectListRequest {
+        unsigned volume;                    // Parent volume, or SYSLFS_VOLUME_BLOCK_CODE
+        BitVector<256> excludedKeys;
+    };
+
+    struct LFSObjectListEntry {
+        uint32_t address;
+        uint16_t crc;                       // As stored in the LFS index
+        uint8_t key;
+        uint8_t sizeInUnits;                // Multiples of 16 bytes
+    };
+
+    static const unsigned MAX_LFS_OBJECTS_PER_REPLY = 7;
+
+    struct LFSObjectListReply {
+        unsigned count;
+        LFSObjectListEntry objects[MAX_LFS_OBJECTS_PER_REPLY];
+    };
+
+    // Reply is an array of CRC32s, one per chunk, for as many as fit.
+    struct PayloadHashRequest {
+        unsigned volume;
+        unsigned firstChunk;
+    };
+
+    /*
+     * Followed by the package string, as in WriteGameHeader. The source
+     * must be an installed game with that same package string, since it
+     * gets deleted when the new volume commits.
+     */
+    struct DeltaGameHeader {
+        uint32_t numBytes;
+        unsigned sourceVolume;
+    };
+
+    // Copy the next 'numBytes' of payload from the source volume.
+    struct PayloadCopyRequest {
+        uint32_t numBytes;
+    };
+
     static void onUsbData(const USBProtocolMsg &m);
 
 private:
@@ -132,6 +223,7 @@ private:
     };
 
     static FlashVolumeWriter writer;
+    static FlashVolume deltaSource;
     static LFSObjectWriteStatus lfsWriter;
 
     // handlers
@@ -142,9 +234,15 @@ private:
     static ALWAYS_INLINE void pairCube(const USBProtocolMsg &m, USBProtocolMsg &reply);
     static ALWAYS_INLINE void pairingSlotDetail(const USBProtocolMsg &m, USBProtocolMsg &reply);
     static ALWAYS_INLINE void flashDeviceRead(const USBProtocolMsg &m, USBProtocolMsg &reply);
+    static ALWAYS_INLINE void flashDeviceChecksums(const USBProtocolMsg &m, USBProtocolMsg &reply);
+    static ALWAYS_INLINE void flashDeviceErase(const USBProtocolMsg &m, USBProtocolMsg &reply);
+    static ALWAYS_INLINE void flashDeviceWrite(const USBProtocolMsg &m);
+    static ALWAYS_INLINE void lfsObjectList(const USBProtocolMsg &m, USBProtocolMsg &reply);
     static ALWAYS_INLINE void baseSysInfo(const USBProtocolMsg &m, USBProtocolMsg &reply);
     static ALWAYS_INLINE void beginLFSObjectWrite(const USBProtocolMsg &m, USBProtocolMsg &reply);
     static ALWAYS_INLINE void lfsPayloadWrite(const USBProtocolMsg &m);
+    static ALWAYS_INLINE void payloadHashes(const USBProtocolMsg &m, USBProtocolMsg &reply);
+    static ALWAYS_INLINE void beginDeltaGame(const USBProtocolMsg &m, USBProtocolMsg &reply);
 };
 
 #endif // _USB_VOLUME_MANAGER_H
@@ -652,7 +652,8 @@ struct NVIC_t {
     uint32_t _res4[33];
     uint16_t DCRDR_l;
     uint16_t DCRDR_h;
-    uint32_t _res5[65];
+    uint32_t DEMCR;
+    uint32_t _res5[64];
 
     uint32_t softIrqTrigger;
     uint32_t _res6[51];
@@ -724,5 +725,23 @@ struct NVIC_t {
 
 extern volatile NVIC_t NVIC;
 
+/*
+ * Cortex-M3 Data Watchpoint and Trace unit. We only use the cycle counter,
+ * which must be turned on with the TRCENA bit in NVIC.DEMCR.
+ */
+
+struct DWT_t {
+    uint32_t CTRL;
+    uint32_t CYCCNT;
+    uint32_t CPICNT;
+    uint32_t EXCCNT;
+    uint32_t SLEEPCNT;
+    uint32_t LSUCNT;
+    uint32_t FOLDCNT;
+    uint32_t PCSR;
+};
+
+extern volatile DWT_t DWT;
+
 
 #endif
@@ -41,6 +41,7 @@
 #include "powermanager.h"
 #include "crc.h"
 #include "sampleprofiler.h"
+#include "syscallcounters.h"
 #include "bootloader.h"
 #include "cubeconnector.h"
 #include "neighbor_tx.h"
@@ -240,6 +241,7 @@ int main()
 
     PowerManager::beginVbusMonitor();
     SampleProfiler::init();
+    SyscallCounters::init();
 
 #ifdef HAVE_NRF8001
     // Initialize Bluetooth LE radio. Includes a short power-on delay. (Shorter than Radio::init)
@@ -5,6 +5,9 @@
 # Reads "abi.h" from stdin, produces a function pointer table on stdout,
 # for use in the SVM runtime implementation.
 #
+# With --names, produces a table of syscall names instead, for host tools
+# that report per-syscall statistics.
+#
 # Micah Elizabeth Scott <micah@misc.name>
 # Copyright <c> 2012 Sifteo, Inc. All rights reserved.
 #
@@ -124,6 +127,21 @@ for line in sys.stdin:
     elif fallback.search(line):
         raise Exception("Regex might have missed a syscall on line: %r" % line);
 
+#
+# Name table only? Unused slots are NULL.
+#
+
+if '--names' in sys.argv[1:]:
+    print "static const char * const SyscallNames[] = {"
+    for i in range(highestNum+1):
+        name = callMap.get(i)
+        if name:
+            print '    /* %4d */ "%s",' % (i, name)
+        else:
+            print "    /* %4d */ 0," % i
+    print "};"
+    sys.exit(0)
+
 #
 # Generate extern declarations for all internal libgcc functions
 #
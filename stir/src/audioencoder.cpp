@@ -25,6 +25,7 @@
  */
 
 #include "audioencoder.h"
+#include "workqueue.h"
 
 #include <errno.h>
 #include <string.h>
@@ -37,7 +38,7 @@
 using namespace std;
 
 
-AudioEncoder *AudioEncoder::create(string name)
+AudioEncoder *AudioEncoder::create(string name, unsigned icWindow)
 {
     transform(name.begin(), name.end(), name.begin(), ::tolower);
 
@@ -45,7 +46,7 @@ AudioEncoder *AudioEncoder::create(string name)
         return new PCMEncoder();
 
     if (name == "adpcm" || name == "")
-        return new ADPCMEncoder();
+        return new ADPCMEncoder(icWindow ? icWindow : ADPCMEncoder::DEFAULT_IC_WINDOW);
 
     return 0;
 }
@@ -60,7 +61,7 @@ void ADPCMEncoder::encode(const std::vector<uint8_t> &in, std::vector<uint8_t> &
 {
     State state;
     optimizeIC(state, in);
-    encodeWithIC(state, in, out, in.size());
+    encodeWithIC(state, in, &out, in.size());
 }
 
 void ADPCMEncoder::optimizeIC(State &state, const std::vector<uint8_t> &in)
@@ -86,9 +87,19 @@ void ADPCMEncoder::optimizeIC(State &state, const std::vector<uint8_t> &in)
     // First sample
     state.sample = int16_t(in[0] | (in[1] << 8));
 
-    // Try at most 100 samples
-    unsigned inBytes = std::min<unsigned>(100 * sizeof(int16_t), in.size());
-    std::vector<uint8_t> dummy;
+    // Only the first few samples matter much. Search over a window of them.
+    unsigned inBytes = std::min<unsigned>(mICWindow * sizeof(int16_t), in.size());
+
+    /*
+     * Long windows are worth spreading across threads. Every candidate is
+     * still compared in the same order as a serial search, so the result
+     * doesn't depend on the thread count or on scheduling.
+     */
+    bool parallel = mICWindow >= PARALLEL_IC_WINDOW && Stir::WorkQueue::getNumThreads() > 0;
+
+    SearchContext ctx;
+    ctx.in = &in;
+    ctx.inBytes = inBytes;
 
     /*
      * Pick the best initial index value.
@@ -103,11 +114,17 @@ void ADPCMEncoder::optimizeIC(State &state, const std::vector<uint8_t> &in)
     uint64_t error = -1;
     int bestIndex = 0;
 
+    ctx.limit = error;
     for (state.index = 0; state.index < INDEX_MAX; state.index++)  {
-        uint64_t nextError = encodeWithIC(state, in, dummy, inBytes);
-        if (nextError < error) {
-            error = nextError;
-            bestIndex = state.index;
+        Candidate c = { state, 0 };
+        ctx.candidates.push_back(c);
+    }
+    evaluate(ctx, parallel);
+
+    for (unsigned i = 0; i < ctx.candidates.size(); i++) {
+        if (ctx.candidates[i].error < error) {
+            error = ctx.candidates[i].error;
+            bestIndex = ctx.candidates[i].state.index;
         }
     }
 
@@ -119,48 +136,76 @@ void ADPCMEncoder::optimizeIC(State &state, const std::vector<uint8_t> &in)
      * At this point we're close to the best solution. Try making incremental
      * changes along each axis, and stop when there's no single change which
      * improves quality.
+     *
+     * Each step tests a unit change in each direction on each axis, and
+     * takes the first one (in that order) which beats the current error.
      */
 
-    // Test a unit change in each direction on each axis
     for (;;) {
-        uint64_t nextError;
+        ctx.candidates.clear();
+        ctx.limit = error;
 
-        state.sample += 1;
-        if ((nextError = encodeWithIC(state, in, dummy, inBytes)) < error) {
-            error = nextError;
-            continue;
-        }
-        state.sample -= 2;
-        if ((nextError = encodeWithIC(state, in, dummy, inBytes)) < error) {
-            error = nextError;
-            continue;
-        }
-        state.sample += 1;
+        Candidate c = { state, 0 };
+
+        c.state.sample = state.sample + 1;
+        ctx.candidates.push_back(c);
+        c.state.sample = state.sample - 1;
+        ctx.candidates.push_back(c);
+        c.state.sample = state.sample;
 
         if (state.index < INDEX_MAX) {
-            state.index++;
-            if ((nextError = encodeWithIC(state, in, dummy, inBytes)) < error) {
-                error = nextError;
-                continue;
-            }
-            state.index--;
+            c.state.index = state.index + 1;
+            ctx.candidates.push_back(c);
         }
-
         if (state.index > 0) {
-            state.index--;
-            if ((nextError = encodeWithIC(state, in, dummy, inBytes)) < error) {
-                error = nextError;
-                continue;
-            }
-            state.index++;
+            c.state.index = state.index - 1;
+            ctx.candidates.push_back(c);
         }
 
-        break;
+        evaluate(ctx, parallel);
+
+        unsigned i;
+        for (i = 0; i < ctx.candidates.size(); i++)
+            if (ctx.candidates[i].error < error)
+                break;
+
+        if (i == ctx.candidates.size())
+            break;
+
+        state = ctx.candidates[i].state;
+        error = ctx.candidates[i].error;
     }
 }
 
+void ADPCMEncoder::evaluate(SearchContext &ctx, bool parallel)
+{
+    /*
+     * Measure the error for every candidate in 'ctx'. Candidates that
+     * can't beat ctx.limit may stop early, reporting a partial error
+     * that is still greater than the limit.
+     */
+
+    if (parallel) {
+        Stir::WorkQueue::parallelFor(ctx.candidates.size(), evaluateCandidate, &ctx);
+    } else {
+        for (unsigned i = 0; i < ctx.candidates.size(); i++) {
+            evaluateCandidate(&ctx, i);
+
+            // Later candidates only matter if they beat this one
+            ctx.limit = std::min(ctx.limit, ctx.candidates[i].error);
+        }
+    }
+}
+
+void ADPCMEncoder::evaluateCandidate(void *context, unsigned index)
+{
+    SearchContext *ctx = static_cast<SearchContext*>(context);
+    Candidate &c = ctx->candidates[index];
+    c.error = encodeWithIC(c.state, *ctx->in, NULL, ctx->inBytes, ctx->limit);
+}
+
 uint64_t ADPCMEncoder::encodeWithIC(State state, const std::vector<uint8_t> &in,
-    std::vector<uint8_t> &out, unsigned inBytes)
+    std::vector<uint8_t> *out, unsigned inBytes, uint64_t limit)
 {
     /*
      * Using the provided initial conditions, encode some PCM data
@@ -177,6 +222,9 @@ uint64_t ADPCMEncoder::encodeWithIC(State state, const std::vector<uint8_t> &in,
      * If the input is not a multiple of two samples, we will duplicate
      * the last sample for padding. (We expect this sample to be truncated
      * via loopEnd.)
+     *
+     * 'out' may be NULL if only the error is needed. Once the error
+     * exceeds 'limit' we stop early and return the partial error.
      */
 
     assert(inBytes <= in.size());
@@ -186,18 +234,22 @@ uint64_t ADPCMEncoder::encodeWithIC(State state, const std::vector<uint8_t> &in,
     const int16_t *inPtr = reinterpret_cast<const int16_t*>(&in[0]);
     uint64_t error = 0;
 
-    out.resize(0);
-    out.reserve(numPairs + HEADER_SIZE);
+    if (out) {
+        out->resize(0);
+        out->reserve(numPairs + HEADER_SIZE);
 
-    // Write the initial conditions header
-    out.push_back(state.sample);
-    out.push_back(state.sample >> 8);
-    out.push_back(state.index);
+        // Write the initial conditions header
+        out->push_back(state.sample);
+        out->push_back(state.sample >> 8);
+        out->push_back(state.index);
+    }
 
     while (numPairs--) {
         int s1 = *(inPtr++);
         int s2 = *(inPtr++);
         error += encodePair(state, s1, s2, out);
+        if (error > limit)
+            return error;
     }
 
     // Doubled final sample?
@@ -209,7 +261,7 @@ uint64_t ADPCMEncoder::encodeWithIC(State state, const std::vector<uint8_t> &in,
     return error;
 }
 
-uint64_t ADPCMEncoder::encodePair(State &state, int s1, int s2, std::vector<uint8_t> &out)
+uint64_t ADPCMEncoder::encodePair(State &state, int s1, int s2, std::vector<uint8_t> *out)
 {
     // Compressed nybbles, and predictor errors
     unsigned n1 = encodeSample(state, s1);
@@ -218,7 +270,8 @@ uint64_t ADPCMEncoder::encodePair(State &state, int s1, int s2, std::vector<uint
     int64_t e2 = state.sample - s2;
 
     // Write out one byte (2 samples)
-    out.push_back(n1 | (n2 << 4));
+    if (out)
+        out->push_back(n1 | (n2 << 4));
 
     // Error metric, with 64-bit math
     return e1*e1 + e2*e2;
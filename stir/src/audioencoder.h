@@ -42,8 +42,12 @@ public:
     virtual const char *getTypeSymbol() = 0;
     virtual const char *getName() = 0;
     virtual const _SYSAudioType getType() = 0;
-    
-    static AudioEncoder *create(std::string name);
+
+    /*
+     * 'icWindow' is the number of leading samples used when searching
+     * for ADPCM initial conditions. Zero selects the encoder's default.
+     */
+    static AudioEncoder *create(std::string name, unsigned icWindow = 0);
 };
 
 
@@ -70,6 +74,15 @@ public:
     static const unsigned HEADER_SIZE = 3;
     static const unsigned INDEX_MAX = 88;
 
+    // Samples examined by the initial-condition search, by default
+    static const unsigned DEFAULT_IC_WINDOW = 100;
+
+    // Windows at least this long search on the WorkQueue in parallel
+    static const unsigned PARALLEL_IC_WINDOW = 4096;
+
+    ADPCMEncoder(unsigned icWindow = DEFAULT_IC_WINDOW)
+        : mICWindow(icWindow) {}
+
     virtual void encode(const std::vector<uint8_t> &in, std::vector<uint8_t> &out);
 
     virtual const char *getTypeSymbol() {
@@ -90,12 +103,29 @@ private:
         int sample;
     };
 
-    static void optimizeIC(State &state, const std::vector<uint8_t> &in);
+    struct Candidate {
+        State state;
+        uint64_t error;
+    };
+
+    struct SearchContext {
+        const std::vector<uint8_t> *in;
+        unsigned inBytes;
+        uint64_t limit;
+        std::vector<Candidate> candidates;
+    };
+
+    unsigned mICWindow;
+
+    void optimizeIC(State &state, const std::vector<uint8_t> &in);
+    static void evaluate(SearchContext &ctx, bool parallel);
+    static void evaluateCandidate(void *context, unsigned index);
+
     static uint64_t encodeWithIC(State state, const std::vector<uint8_t> &in,
-        std::vector<uint8_t> &out, unsigned inBytes);
+        std::vector<uint8_t> *out, unsigned inBytes, uint64_t limit = (uint64_t)-1);
 
     static unsigned encodeSample(State &state, int sample);
-    static uint64_t encodePair(State &state, int s1, int s2, std::vector<uint8_t> &out);
+    static uint64_t encodePair(State &state, int s1, int s2, std::vector<uint8_t> *out);
 };
 
 #endif
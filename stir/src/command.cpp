@@ -29,10 +29,13 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tile.h"
 #include "script.h"
+#include "workqueue.h"
+#include "profiler.h"
 
 #define STRINGIFY(_x)   #_x
 #define TOSTRING(_x)    STRINGIFY(_x)
@@ -52,6 +55,10 @@ static void usage()
             "Options:\n"
             "  -h            Show this help message, and exit\n"
             "  -v            Verbose mode, show progress as we work\n"
+            "  -j THREADS    Number of worker threads (default: one per CPU)\n"
+            "  --profile-report=FILE.json\n"
+            "                Record per-asset timing and memory usage, as a JSON\n"
+            "                summary and a Chrome trace (FILE.trace.json)\n"
             "  -o FILE.cpp   Generate a C++ source file with your asset data\n"
             "  -o FILE.h     Generate a C++ header with metadata for your assets\n"
             "  -o FILE.html  Generate a proofing sheet for your assets, in HTML format\n"
@@ -65,8 +72,10 @@ static void usage()
 int main(int argc, char **argv)
 {
     Stir::ConsoleLogger log;
-    Stir::Script script(log);
+    Stir::ProfileLogger profileLog(log);
+    Stir::Script script(profileLog);
     const char *scriptFile = NULL;
+    const char *profileReport = NULL;
 
     /*
      * Parse command line options
@@ -85,6 +94,18 @@ int main(int argc, char **argv)
             continue;
         }
          
+        if (!strcmp(arg, "-j") && argv[c+1]) {
+            Stir::WorkQueue::setNumThreads(atoi(argv[c+1]));
+            c++;
+            continue;
+        }
+
+        if (!strncmp(arg, "--profile-report=", 17) && arg[17]) {
+            profileReport = arg + 17;
+            Stir::Profiler::enable();
+            continue;
+        }
+
         if (!strcmp(arg, "-o") && argv[c+1]) {
             if (script.addOutput(argv[c+1])) {
                 c++;
@@ -126,8 +147,10 @@ int main(int argc, char **argv)
 
     Stir::CIELab::initialize();
 
-    if (!script.run(scriptFile))
+    bool success = script.run(scriptFile);
+
+    if (profileReport && !Stir::Profiler::writeReport(profileReport, log))
         return 1;
 
-    return 0;
+    return success ? 0 : 1;
 }
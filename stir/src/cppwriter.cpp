@@ -27,6 +27,7 @@
 #include "cppwriter.h"
 #include "audioencoder.h"
 #include "wavedecoder.h"
+#include "profiler.h"
 #include <assert.h>
 #include "sifteo/abi.h"
 
@@ -188,7 +189,8 @@ bool CPPSourceWriter::writeGroup(const Group &group)
 
 bool CPPSourceWriter::writeSound(const Sound &sound)
 {
-    AudioEncoder *enc = AudioEncoder::create(sound.getEncode());
+    Profiler::Scope scope("sound", sound.getName(), "Encoding");
+    AudioEncoder *enc = AudioEncoder::create(sound.getEncode(), sound.getICWindow());
     assert(enc != 0);
 
     std::vector<uint8_t> raw;
@@ -226,6 +228,11 @@ bool CPPSourceWriter::writeSound(const Sound &sound)
 
     enc->encode(raw, data);
 
+    scope.set("samples", numSamples);
+    scope.set("bytes", data.size());
+    if (!raw.empty())
+        scope.set("compression", 100.0 - data.size() * 100.0 / raw.size());
+
     mLog.infoLineWithLabel(sound.getName().c_str(),
         "%7.02f kiB, %s (%s)",
         data.size() / 1024.0f, enc->getName(), sound.getFile().c_str());
@@ -25,6 +25,7 @@
  */
 
 #include <map>
+#include <algorithm>
 #include <assert.h>
 #include "dubencoder.h"
 #include "logger.h"
@@ -153,6 +154,11 @@ unsigned DUBEncoder::getCompressedWords() const
     return getIndexSize() + blockResult.size();
 }
 
+float DUBEncoder::getCodesPerTile() const
+{
+    return mNumCodes / (float)getTileCount();
+}
+
 float DUBEncoder::getRatio() const
 {
     return 100.0 - getCompressedWords() * 100.0 / getTileCount();
@@ -161,61 +167,82 @@ float DUBEncoder::getRatio() const
 void DUBEncoder::logStats(const std::string &name, Logger &log)
 {
     log.infoLineWithLabel(name.c_str(),
-        "%4d tiles, %4d words, % 5.01f%% compression",
-        getTileCount(), getCompressedWords(), getRatio());
+        "%4d tiles, %4d words, % 5.01f%% compression, %4.02f codes/tile",
+        getTileCount(), getCompressedWords(), getRatio(), getCodesPerTile());
 }
 
 void DUBEncoder::encodeBlock(uint16_t *pTopLeft,
     unsigned width, unsigned height, std::vector<uint16_t> &data)
 {
     BitBuffer bits;
-    std::vector<uint16_t> dict;
+    std::vector<uint16_t> tiles;
+    std::vector<Code> codes;
     Code prevCode = { Code::INVALID };
     unsigned repeatCount = 0;
     bool repeating = false;
 
     for (unsigned y = 0; y < height; y++)
-        for (unsigned x = 0; x < width; x++) {
-            uint16_t tile = pTopLeft[x + y*mWidth];
+        for (unsigned x = 0; x < width; x++)
+            tiles.push_back(pTopLeft[x + y*mWidth]);
 
+    // Choose a code for every tile
+
+    if (mOptimal) {
+        findOptimalCodes(tiles, codes);
+    } else {
+        std::vector<uint16_t> dict;
+        for (unsigned i = 0; i < tiles.size(); i++) {
             // Find the best code for this tile, and update the dictionary
-            Code code = findBestCode(dict, tile);
-            dict.push_back(tile);
-
-            // If we ever output two identical codes in a row, that counts
-            // as a run. The next code *must* be a REPEAT code.
-            bool sameCode = (code.type == prevCode.type && code.value == prevCode.value);
-            prevCode = code;
-
-            if (repeating) {
-                if (sameCode) {
-                    // Extending an existing run
-                    repeatCount++;
-                    continue;
-                } else {
-                    // Break an existing run
-                    Code rep = { Code::REPEAT, repeatCount };
-                    debugCode(x, y, rep, tile);
-                    packCode(rep, bits);
-                    bits.flush(data);
-                    repeating = false;
-                }
-            } else if (sameCode) {
-                // Beginning a run. The next code will be a REPEAT.
-                repeating = true;
-                repeatCount = 0;
-            }
+            codes.push_back(findBestCode(dict, tiles[i]));
+            dict.push_back(tiles[i]);
+        }
+    }
 
-            debugCode(x, y, code, tile);
-            packCode(code, bits);
-            bits.flush(data);
+    // Pack the codes, collapsing runs into REPEAT codes
+
+    for (unsigned i = 0; i < tiles.size(); i++) {
+        unsigned x = i % width;
+        unsigned y = i / width;
+        uint16_t tile = tiles[i];
+        Code code = codes[i];
+
+        // If we ever output two identical codes in a row, that counts
+        // as a run. The next code *must* be a REPEAT code.
+        bool sameCode = code == prevCode;
+        prevCode = code;
+
+        if (repeating) {
+            if (sameCode) {
+                // Extending an existing run
+                repeatCount++;
+                continue;
+            } else {
+                // Break an existing run
+                Code rep = { Code::REPEAT, repeatCount };
+                debugCode(x, y, rep, tile);
+                packCode(rep, bits);
+                bits.flush(data);
+                mNumCodes++;
+                repeating = false;
+            }
+        } else if (sameCode) {
+            // Beginning a run. The next code will be a REPEAT.
+            repeating = true;
+            repeatCount = 0;
         }
 
+        debugCode(x, y, code, tile);
+        packCode(code, bits);
+        bits.flush(data);
+        mNumCodes++;
+    }
+
     if (repeating) {
         // Flush any final REPEAT code we have stowed away.
         Code rep = { Code::REPEAT, repeatCount };
         debugCode(-1, -1, rep, -1);
         packCode(rep, bits);
+        mNumCodes++;
     }
 
     // Flush all remaining data, padding to a word boundary.
@@ -256,7 +283,11 @@ DUBEncoder::Code DUBEncoder::findBestCode(const std::vector<uint16_t> &dict, uin
     // in our history, and emitting a REF code. In the event of a tie,
     // always prefer a REF code.
 
-    for (unsigned i = 0; i < dict.size(); i++)
+    unsigned depth = dict.size();
+    if (mDictDepth)
+        depth = std::min(depth, mDictDepth);
+
+    for (unsigned i = 0; i < depth; i++)
         if (tile == dict[dict.size() - 1 - i]) {
             Code candidate = { Code::REF, i };
             unsigned len = codeLen(candidate);
@@ -272,6 +303,123 @@ DUBEncoder::Code DUBEncoder::findBestCode(const std::vector<uint16_t> &dict, uin
     return code;
 }
 
+void DUBEncoder::findOptimalCodes(const std::vector<uint16_t> &tiles,
+    std::vector<Code> &codes)
+{
+    /*
+     * Shortest-path search for the cheapest code sequence in one block.
+     *
+     * The packed stream is a series of runs, each applying one code to
+     * one or more consecutive tiles. A run of N > 1 tiles costs two
+     * copies of the code plus a REPEAT of N-2. Adjacent runs must use
+     * different codes, or the decoder would see them as a single run.
+     *
+     * At each tile boundary we keep two nodes: the cheapest path to that
+     * point, and the cheapest path whose last run used a different code.
+     * That's always enough to extend with any next code while honoring
+     * the adjacency rule.
+     */
+
+    const unsigned numTiles = tiles.size();
+    std::vector<ParseNode> nodes((numTiles + 1) * 2);
+
+    for (unsigned i = 0; i < nodes.size(); i++)
+        nodes[i].cost = NO_PATH;
+
+    nodes[0].cost = 0;
+    nodes[0].code.type = Code::INVALID;
+    nodes[0].code.value = 0;
+
+    // REPEAT lengths get used constantly; tabulate them.
+    std::vector<unsigned> repeatLen(numTiles + 1);
+    for (unsigned i = 0; i <= numTiles; i++) {
+        Code rep = { Code::REPEAT, (int)i };
+        repeatLen[i] = codeLen(rep);
+    }
+
+    for (unsigned start = 0; start < numTiles; start++) {
+        if (nodes[start * 2].cost == NO_PATH)
+            continue;
+
+        // Candidate codes for the tile at 'start': one DELTA, plus any REF
+        std::vector<Code> candidates;
+        Code delta = { Code::DELTA, (int)tiles[start] - (start ? (int)tiles[start - 1] : 0) };
+        candidates.push_back(delta);
+
+        for (unsigned i = 0; i < start && (!mDictDepth || i < mDictDepth); i++)
+            if (tiles[start - 1 - i] == tiles[start]) {
+                Code ref = { Code::REF, (int)i };
+                candidates.push_back(ref);
+            }
+
+        for (unsigned c = 0; c < candidates.size(); c++) {
+            Code code = candidates[c];
+            unsigned slot = nodes[start * 2].code == code ? 1 : 0;
+            unsigned base = nodes[start * 2 + slot].cost;
+            unsigned len = codeLen(code);
+
+            if (base == NO_PATH)
+                continue;
+
+            for (unsigned end = start + 1; end <= numTiles; end++) {
+                if (end > start + 1 && !isCodeValid(tiles, end - 1, code))
+                    break;
+
+                unsigned count = end - start;
+                unsigned cost = base + (count == 1 ? len : 2 * len + repeatLen[count - 2]);
+
+                ParseNode node = { cost, code, start, slot };
+                ParseNode &best = nodes[end * 2];
+                ParseNode &second = nodes[end * 2 + 1];
+
+                if (best.cost != NO_PATH && best.code == code) {
+                    if (cost < best.cost)
+                        best = node;
+                } else if (cost < best.cost) {
+                    second = best;
+                    best = node;
+                } else if (cost < second.cost) {
+                    second = node;
+                }
+            }
+        }
+    }
+
+    // Walk the winning path backwards
+
+    codes.resize(numTiles);
+    unsigned end = numTiles;
+    unsigned slot = 0;
+
+    while (end) {
+        const ParseNode &node = nodes[end * 2 + slot];
+        assert(node.cost != NO_PATH);
+        for (unsigned i = node.start; i < end; i++)
+            codes[i] = node.code;
+        end = node.start;
+        slot = node.slot;
+    }
+}
+
+bool DUBEncoder::isCodeValid(const std::vector<uint16_t> &tiles, unsigned i, Code code) const
+{
+    // Would 'code' reproduce tiles[i], given all tiles before it?
+
+    switch (code.type) {
+
+    case Code::DELTA:
+        return (int)tiles[i] - (i ? (int)tiles[i - 1] : 0) == code.value;
+
+    case Code::REF:
+        return (unsigned)code.value < i
+            && (!mDictDepth || (unsigned)code.value < mDictDepth)
+            && tiles[i - 1 - code.value] == tiles[i];
+
+    default:
+        return false;
+    }
+}
+
 void DUBEncoder::packCode(Code code, BitBuffer &bits) const
 {
     // Experimentally determined sweet-spot
@@ -48,12 +48,28 @@ class Logger;
  *    To quickly locate the proper 8x8 block(s) in a large asset, the
  *    encoded data is prefixed with a block index, which lists the size
  *    of each compressed block.
+ *
+ *    By default each tile greedily takes its shortest code. The optional
+ *    optimal parse searches all DELTA/REF choices in a block with dynamic
+ *    programming, accounting for REPEAT runs. Both produce streams that
+ *    the firmware's ImageDecoder reads identically. The dictionary depth
+ *    optionally limits how far back a REF code may reach.
  */
 
 class DUBEncoder {
 public:
     DUBEncoder(unsigned width, unsigned height, unsigned frames)
-        : mWidth(width), mHeight(height), mFrames(frames) {}
+        : mWidth(width), mHeight(height), mFrames(frames),
+          mOptimal(false), mDictDepth(0), mNumCodes(0) {}
+
+    void setOptimalParse(bool optimal) {
+        mOptimal = optimal;
+    }
+
+    void setDictionaryDepth(unsigned depth) {
+        // Zero means the whole block
+        mDictDepth = depth;
+    }
 
     void encodeTiles(std::vector<uint16_t> &tiles);
     void logStats(const std::string &name, Logger &log);
@@ -62,6 +78,7 @@ public:
     unsigned getCompressedWords() const;
     float getRatio() const;
     unsigned getNumBlocks() const;
+    float getCodesPerTile() const;
     bool isTooLarge() const;
     bool isIndex16() const;
     void getResult(std::vector<uint16_t> &result) const;
@@ -72,10 +89,26 @@ private:
     struct Code {
         enum { DELTA, REF, REPEAT, INVALID } type;
         int value;
+
+        bool operator== (const Code &other) const {
+            return type == other.type && value == other.value;
+        }
     };
 
+    struct ParseNode {
+        unsigned cost;      // Total bits, or NO_PATH
+        Code code;          // Code for the run that ends here
+        unsigned start;     // First tile of that run
+        unsigned slot;      // Which ParseNode at 'start' we came from
+    };
+
+    static const unsigned NO_PATH = (unsigned)-1;
+
     unsigned mWidth, mHeight, mFrames;
     bool mIndex16;
+    bool mOptimal;
+    unsigned mDictDepth;
+    unsigned mNumCodes;     // Codes the decoder reads, over all blocks
 
     std::vector<uint16_t> blockResult;  // Compressed block data
     std::vector<uint16_t> indexResult;  // Word number, starting at blockResult[0]
@@ -83,6 +116,8 @@ private:
     void encodeBlock(uint16_t *pTopLeft, unsigned width, unsigned height,
         std::vector<uint16_t> &blockData);
     Code findBestCode(const std::vector<uint16_t> &dict, uint16_t tile);
+    void findOptimalCodes(const std::vector<uint16_t> &tiles, std::vector<Code> &codes);
+    bool isCodeValid(const std::vector<uint16_t> &tiles, unsigned i, Code code) const;
 
     unsigned getIndexSize() const;
     void debugCode(int x, int y, Code code, int tile) const;
@@ -37,8 +37,11 @@ ImageStack::ImageStack()
 
 ImageStack::~ImageStack()
 {
-    for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++)
+    for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++) {
+        // Don't pull the rug out from under an in-flight decode
+        (*i)->wait();
         delete *i;
+    }
 }
 
 void ImageStack::setWidth(int width)
@@ -67,15 +70,25 @@ void ImageStack::setFrames(int frames)
 
 bool ImageStack::load(const char *filename)
 {
-   std::vector<uint8_t> png;
-   LodePNG::loadFile(png, filename);
-   if (png.empty())
-       return false;
+   /*
+    * Read the file and its PNG header, so that our geometry is known.
+    * The actual decode is deferred; see beginDecode().
+    */
 
    source *s = new source();
+   s->filename = filename;
+   s->started = false;
+
+   LodePNG::loadFile(s->png, filename);
+   if (s->png.empty()) {
+       delete s;
+       return false;
+   }
 
-   s->decoder.decode(s->rgba, png);
-   if (s->rgba.empty() || s->decoder.getWidth() == 0 || s->decoder.getHeight() == 0) {
+   s->decoder.inspect(s->png);
+   s->width = s->decoder.getWidth();
+   s->height = s->decoder.getHeight();
+   if (s->decoder.hasError() || s->width == 0 || s->height == 0) {
        delete s;
        return false;
    }
@@ -84,6 +97,43 @@ bool ImageStack::load(const char *filename)
    return true;
 }
 
+void ImageStack::beginDecode()
+{
+    for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++) {
+        source *s = *i;
+        if (!s->started) {
+            s->started = true;
+            WorkQueue::submit(s);
+        }
+    }
+}
+
+void ImageStack::source::run()
+{
+    // Runs on a worker thread. The Decoder and buffers are private to us.
+
+    decoder.decode(rgba, png);
+    std::vector<uint8_t>().swap(png);
+}
+
+bool ImageStack::source::finishDecode()
+{
+    if (started) {
+        wait();
+    } else {
+        started = true;
+        run();
+    }
+
+    return !rgba.empty() && decoder.getWidth() == width && decoder.getHeight() == height;
+}
+
+void ImageStack::source::release()
+{
+    std::vector<uint8_t>().swap(rgba);
+    std::vector<uint8_t>().swap(png);
+}
+
 void ImageStack::finishLoading()
 {
     /*
@@ -112,13 +162,13 @@ void ImageStack::finishLoading()
         return;
 
     if (!mWidth)
-        setWidth(sources[0]->decoder.getWidth());
+        setWidth(sources[0]->width);
     if (!mHeight)
-        setHeight(sources[0]->decoder.getHeight());
+        setHeight(sources[0]->height);
 
     for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++) {
-        unsigned width = (*i)->decoder.getWidth();
-        unsigned height = (*i)->decoder.getHeight();
+        unsigned width = (*i)->width;
+        unsigned height = (*i)->height;
 
         if ((width % mWidth) || (height % mHeight)) {
             mConsistent = false;
@@ -133,7 +183,7 @@ void ImageStack::finishLoading()
     setFrames(frames);
 }
 
- ImageStack::source *ImageStack::getSourceForFrame(unsigned frame)
+ImageStack::source *ImageStack::getSourceForFrame(unsigned frame)
 {
     for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++) {
         source *s = *i;
@@ -148,18 +198,89 @@ void ImageStack::finishLoading()
 void ImageStack::storeFrame(unsigned frame, TileGrid &tg, const TileOptions &opt)
 {
     source *s = getSourceForFrame(frame);
-    if (!s)
+    if (!s || !s->finishDecode())
         return;
 
     unsigned index = frame - s->firstFrame;
-    unsigned gridW = s->decoder.getWidth() / mWidth;
+    unsigned gridW = s->width / mWidth;
     unsigned gridX = index % gridW;
     unsigned gridY = index / gridW;
     unsigned x = gridX * mWidth;
     unsigned y = gridY * mHeight;
-    unsigned stride = s->decoder.getWidth() * 4;
+    unsigned stride = s->width * 4;
 
     tg.load(opt, &s->rgba[x*4 + y*stride], stride, mWidth, mHeight);
 }
 
+bool ImageStack::storeFrames(std::vector<TileGrid> &grids, TilePool *pool, const TileOptions &opt)
+{
+    /*
+     * Convert every frame to a TileGrid, appending to 'grids' in frame
+     * order. Converting pixels to tile identities is done in parallel,
+     * but handing them to the pool happens here, serially and in order,
+     * so the resulting tile serials are identical to a one-at-a-time load.
+     *
+     * Sources are processed in order, and each source's pixel data is
+     * dropped as soon as it has been sliced.
+     */
+
+    const unsigned tilesPerFrame = (mWidth / Tile::SIZE) * (mHeight / Tile::SIZE);
+
+    beginDecode();
+
+    for (std::vector<source*>::iterator i = sources.begin(); i != sources.end(); i++) {
+        source *s = *i;
+
+        if (!s->finishDecode()) {
+            mFailedFile = s->filename;
+            for (; i != sources.end(); i++) {
+                (*i)->wait();
+                (*i)->release();
+            }
+            return false;
+        }
+
+        sliceContext ctx;
+        ctx.src = s;
+        ctx.opt = &opt;
+        ctx.width = mWidth;
+        ctx.height = mHeight;
+        ctx.ids.resize(s->numFrames * tilesPerFrame);
+
+        WorkQueue::parallelFor(s->numFrames, sliceFrame, &ctx);
+
+        for (unsigned f = 0; f < s->numFrames; f++) {
+            grids.push_back(TileGrid(pool));
+            grids.back().load(&ctx.ids[f * tilesPerFrame], mWidth, mHeight);
+        }
+
+        s->release();
+    }
+
+    return true;
+}
+
+void ImageStack::sliceFrame(void *context, unsigned index)
+{
+    // Runs on any thread. Reads only the source image, writes only ctx->ids.
+
+    sliceContext *ctx = static_cast<sliceContext*>(context);
+    const source *s = ctx->src;
+
+    unsigned gridW = s->width / ctx->width;
+    unsigned x = (index % gridW) * ctx->width;
+    unsigned y = (index / gridW) * ctx->height;
+    unsigned stride = s->width * 4;
+    unsigned tilesW = ctx->width / Tile::SIZE;
+    unsigned tilesH = ctx->height / Tile::SIZE;
+    uint8_t *frame = const_cast<uint8_t*>(&s->rgba[x*4 + y*stride]);
+    Tile::Identity *ids = &ctx->ids[index * tilesW * tilesH];
+
+    for (unsigned ty = 0; ty < tilesH; ty++)
+        for (unsigned tx = 0; tx < tilesW; tx++)
+            Tile::identity(ids[tx + ty * tilesW], *ctx->opt,
+                           frame + (tx * Tile::SIZE * 4) + (ty * Tile::SIZE * stride),
+                           stride);
+}
+
 };  // namespace Stir
@@ -29,9 +29,11 @@
 
 #include <stdint.h>
 #include <vector>
+#include <string>
 
 #include "tile.h"
 #include "lodepng.h"
+#include "workqueue.h"
 
 namespace Stir {
 
@@ -43,6 +45,12 @@ namespace Stir {
  *    need not be a one-to-one relationship between input images and
  *    frames: One image can be used as a strip or grid of frames, for
  *    example.
+ *
+ *    load() only reads each PNG header, so geometry is known right away.
+ *    Pixel data is decoded on the WorkQueue, starting either explicitly
+ *    via beginDecode() or on demand. storeFrames() slices every frame in
+ *    parallel, and releases each source's RGBA buffer as soon as all of
+ *    its frames are in the TilePool.
  */
 
 class ImageStack {
@@ -57,7 +65,21 @@ class ImageStack {
     void setHeight(int height);
     void setFrames(int frames);
 
+    // Start decoding all sources in the background
+    void beginDecode();
+
+    // Decoded (or in-flight) sources hold their RGBA data until stored
+    unsigned getNumSources() const {
+        return sources.size();
+    }
+
     void storeFrame(unsigned frame, TileGrid &tg, const TileOptions &opt);
+    bool storeFrames(std::vector<TileGrid> &grids, TilePool *pool, const TileOptions &opt);
+
+    // After a failed storeFrames(), the file which couldn't be decoded
+    const std::string &getFailedFile() const {
+        return mFailedFile;
+    }
 
     unsigned getWidth() const {
         return mWidth;
@@ -80,21 +102,39 @@ class ImageStack {
     }
 
  private:
-    struct source {
+    struct source : public WorkQueue::Task {
+        std::string filename;
+        std::vector<uint8_t> png;
         LodePNG::Decoder decoder;
         std::vector<uint8_t> rgba;
+        unsigned width;
+        unsigned height;
         unsigned firstFrame;
         unsigned numFrames;
+        bool started;
+
+        virtual void run();
+        bool finishDecode();
+        void release();
     };
 
     bool mConsistent;
     unsigned mWidth;
     unsigned mHeight;
     unsigned mFrames;
+    std::string mFailedFile;
 
     std::vector<source*> sources;
 
+    struct sliceContext {
+        const source *src;
+        const TileOptions *opt;
+        unsigned width, height;
+        std::vector<Tile::Identity> ids;
+    };
+
     source *getSourceForFrame(unsigned frame);
+    static void sliceFrame(void *context, unsigned index);
 };
 
 
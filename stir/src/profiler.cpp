@@ -0,0 +1,478 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * STIR -- Sifteo Tiled Image Reducer
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef WIN32
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/time.h>
+#   include <sys/resource.h>
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+
+#include "profiler.h"
+
+namespace Stir {
+
+bool Profiler::mEnabled = false;
+uint64_t Profiler::mEpoch = 0;
+std::vector<Profiler::Event> Profiler::mEvents;
+std::vector<unsigned> Profiler::mOpen;
+
+
+void Profiler::enable()
+{
+    if (!mEnabled) {
+        mEnabled = true;
+        mEpoch = now();
+    }
+}
+
+uint64_t Profiler::now()
+{
+    // Wall clock time, in microseconds
+
+#ifdef WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (count.QuadPart / freq.QuadPart) * 1000000ULL +
+        (count.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+#endif
+}
+
+uint64_t Profiler::peakRSS()
+{
+    // Peak resident set size of the whole process so far, in bytes
+
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru))
+        return 0;
+#   ifdef __APPLE__
+    return ru.ru_maxrss;
+#   else
+    return ru.ru_maxrss * 1024ULL;
+#   endif
+#endif
+}
+
+unsigned Profiler::begin(const char *kind, const std::string &name, const char *phase)
+{
+    if (!mEnabled)
+        return NONE;
+
+    Event e;
+    e.kind = kind;
+    e.name = name;
+    e.phase = phase;
+    e.parent = mOpen.empty() ? NONE : mOpen.back();
+    e.start = now() - mEpoch;
+    e.duration = 0;
+    e.peakRSS = 0;
+
+    unsigned index = mEvents.size();
+    mEvents.push_back(e);
+    mOpen.push_back(index);
+    return index;
+}
+
+unsigned Profiler::beginPhase(const char *phase)
+{
+    /*
+     * Begin a phase of whatever asset the innermost open event
+     * belongs to. Phases outside of any asset belong to STIR itself.
+     */
+
+    if (!mEnabled)
+        return NONE;
+
+    if (mOpen.empty())
+        return begin("stir", "", phase);
+
+    // Copy first; begin() may reallocate mEvents
+    Event &outer = mEvents[mOpen.back()];
+    std::string kind = outer.kind;
+    std::string name = outer.name;
+    return begin(kind.c_str(), name, phase);
+}
+
+void Profiler::end(unsigned event)
+{
+    if (event == NONE)
+        return;
+
+    Event &e = mEvents[event];
+    e.duration = now() - mEpoch - e.start;
+    e.peakRSS = peakRSS();
+
+    std::vector<unsigned>::iterator i = std::find(mOpen.begin(), mOpen.end(), event);
+    if (i != mOpen.end())
+        mOpen.erase(i);
+}
+
+void Profiler::set(unsigned event, const char *key, double value)
+{
+    if (event != NONE)
+        mEvents[event].stats.push_back(std::make_pair(std::string(key), value));
+}
+
+void Profiler::rename(unsigned event, const std::string &name)
+{
+    /*
+     * Some assets (like images) are loaded before we know their name.
+     * Renaming an event also renames any phases nested inside it.
+     */
+
+    if (event == NONE)
+        return;
+
+    for (unsigned i = event + 1; i < mEvents.size(); i++)
+        if (mEvents[i].parent == event && sameAsset(mEvents[i], mEvents[event]))
+            rename(i, name);
+
+    mEvents[event].name = name;
+}
+
+bool Profiler::sameAsset(const Event &a, const Event &b)
+{
+    return a.kind == b.kind && a.name == b.name;
+}
+
+std::string Profiler::quote(const std::string &s)
+{
+    // Quote and escape a JSON string
+
+    std::string out = "\"";
+
+    for (unsigned i = 0; i < s.length(); i++) {
+        char c = s[i];
+
+        if (c == '"' || c == '\\') {
+            out.append(1, '\\');
+            out.append(1, c);
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            sprintf(buf, "\\u%04x", (unsigned char)c);
+            out.append(buf);
+        } else {
+            out.append(1, c);
+        }
+    }
+
+    out.append(1, '"');
+    return out;
+}
+
+std::string Profiler::number(double value)
+{
+    // Format a statistic, without spurious decimals on whole numbers
+
+    char buf[64];
+    if (value == floor(value) && fabs(value) < 1e15)
+        sprintf(buf, "%.0f", value);
+    else
+        sprintf(buf, "%.6f", value);
+    return buf;
+}
+
+std::string Profiler::traceFileName(const std::string &reportName)
+{
+    // "build.json" -> "build.trace.json"
+
+    std::string base = reportName;
+    if (base.length() > 5 && base.compare(base.length() - 5, 5, ".json") == 0)
+        base.erase(base.length() - 5);
+
+    return base + ".trace.json";
+}
+
+bool Profiler::writeReport(const char *filename, Logger &log)
+{
+    std::string traceName = traceFileName(filename);
+
+    if (!writeSummary(filename)) {
+        log.error("Error writing profile report '%s'", filename);
+        return false;
+    }
+
+    if (!writeTrace(traceName.c_str())) {
+        log.error("Error writing profile trace '%s'", traceName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+struct Profiler::Asset {
+    // Per-asset totals for writeSummary()
+
+    std::string kind;
+    std::string name;
+    double time;
+    uint64_t peakRSS;
+    std::vector<std::pair<std::string, double> > phases;
+    std::vector<std::pair<std::string, double> > stats;
+
+    static void add(std::vector<std::pair<std::string, double> > &v,
+                    const std::string &key, double value, bool sum) {
+        for (unsigned i = 0; i < v.size(); i++)
+            if (v[i].first == key) {
+                v[i].second = sum ? v[i].second + value : value;
+                return;
+            }
+        v.push_back(std::make_pair(key, value));
+    }
+
+    static bool slower(const Asset &a, const Asset &b) {
+        return a.time > b.time;
+    }
+};
+
+bool Profiler::writeSummary(const char *filename)
+{
+    /*
+     * Summarize per asset. An asset's time is the total of its
+     * outermost events, and each phase's time includes any phases
+     * nested inside it. Statistics are merged, last value wins.
+     */
+
+    std::ofstream out(filename);
+    if (!out.is_open())
+        return false;
+
+    std::vector<Asset> assets;
+    uint64_t end = now() - mEpoch;
+
+    for (unsigned i = 0; i < mEvents.size(); i++) {
+        const Event &e = mEvents[i];
+        double seconds = e.duration * 1e-6;
+
+        unsigned a = 0;
+        while (a < assets.size() && !(assets[a].kind == e.kind && assets[a].name == e.name))
+            a++;
+
+        if (a == assets.size()) {
+            Asset n;
+            n.kind = e.kind;
+            n.name = e.name;
+            n.time = 0;
+            n.peakRSS = 0;
+            assets.push_back(n);
+        }
+
+        Asset &asset = assets[a];
+
+        if (e.parent == NONE || !sameAsset(mEvents[e.parent], e))
+            asset.time += seconds;
+
+        asset.peakRSS = std::max(asset.peakRSS, e.peakRSS);
+        Asset::add(asset.phases, e.phase, seconds, true);
+
+        for (unsigned j = 0; j < e.stats.size(); j++)
+            Asset::add(asset.stats, e.stats[j].first, e.stats[j].second, false);
+    }
+
+    std::stable_sort(assets.begin(), assets.end(), Asset::slower);
+
+    out.setf(std::ios::fixed, std::ios::floatfield);
+    out.precision(6);
+
+    out << "{\n"
+        "  \"totalTime\": " << end * 1e-6 << ",\n"
+        "  \"peakRSS\": " << peakRSS() << ",\n"
+        "  \"assets\": [";
+
+    for (unsigned i = 0; i < assets.size(); i++) {
+        const Asset &asset = assets[i];
+
+        out << (i ? ",\n" : "\n") <<
+            "    {\n"
+            "      \"kind\": " << quote(asset.kind) << ",\n"
+            "      \"name\": " << quote(asset.name) << ",\n"
+            "      \"time\": " << asset.time << ",\n"
+            "      \"peakRSS\": " << asset.peakRSS << ",\n"
+            "      \"phases\": {";
+
+        for (unsigned j = 0; j < asset.phases.size(); j++)
+            out << (j ? ", " : " ") << quote(asset.phases[j].first) << ": " << asset.phases[j].second;
+
+        out << " },\n"
+            "      \"stats\": {";
+
+        for (unsigned j = 0; j < asset.stats.size(); j++)
+            out << (j ? ", " : " ") << quote(asset.stats[j].first) << ": " << number(asset.stats[j].second);
+
+        out << " }\n"
+            "    }";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.good();
+}
+
+bool Profiler::writeTrace(const char *filename)
+{
+    /*
+     * Chrome trace-event format: one complete ("X") event per phase,
+     * plus a counter track for the peak RSS.
+     */
+
+    std::ofstream out(filename);
+    if (!out.is_open())
+        return false;
+
+    out.setf(std::ios::fixed, std::ios::floatfield);
+    out.precision(2);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"stir\"}}";
+
+    for (unsigned i = 0; i < mEvents.size(); i++) {
+        const Event &e = mEvents[i];
+        std::string label = e.name.empty() ? e.phase : e.name + ": " + e.phase;
+
+        out << ",\n{\"name\":" << quote(label) << ",\"cat\":" << quote(e.kind)
+            << ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << e.start
+            << ",\"dur\":" << e.duration << ",\"args\":{\"phase\":" << quote(e.phase)
+            << ",\"peakRSS\":" << e.peakRSS;
+
+        for (unsigned j = 0; j < e.stats.size(); j++)
+            out << "," << quote(e.stats[j].first) << ":" << number(e.stats[j].second);
+
+        out << "}}";
+
+        out << ",\n{\"name\":\"Peak RSS (MB)\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+            << (e.start + e.duration) << ",\"args\":{\"MB\":"
+            << e.peakRSS / (1024.0 * 1024.0) << "}}";
+    }
+
+    out << "\n]}\n";
+    return out.good();
+}
+
+
+ProfileLogger::~ProfileLogger() {}
+
+void ProfileLogger::heading(const char *name)
+{
+    mNext.heading(name);
+}
+
+void ProfileLogger::taskBegin(const char *name)
+{
+    mNext.taskBegin(name);
+    mTasks.push_back(Profiler::beginPhase(name));
+}
+
+void ProfileLogger::taskProgress(const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof line, fmt, ap);
+    va_end(ap);
+
+    mNext.taskProgress("%s", line);
+}
+
+void ProfileLogger::taskEnd()
+{
+    mNext.taskEnd();
+
+    if (!mTasks.empty()) {
+        Profiler::end(mTasks.back());
+        mTasks.pop_back();
+    }
+}
+
+void ProfileLogger::infoBegin(const char *name)
+{
+    mNext.infoBegin(name);
+}
+
+void ProfileLogger::infoLine(const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof line, fmt, ap);
+    va_end(ap);
+
+    mNext.infoLine("%s", line);
+}
+
+void ProfileLogger::infoLineWithLabel(const char *label, const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof line, fmt, ap);
+    va_end(ap);
+
+    mNext.infoLineWithLabel(label, "%s", line);
+}
+
+void ProfileLogger::infoEnd()
+{
+    mNext.infoEnd();
+}
+
+void ProfileLogger::error(const char *fmt, ...)
+{
+    char line[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof line, fmt, ap);
+    va_end(ap);
+
+    mNext.error("%s", line);
+}
+
+void ProfileLogger::setMinLabelWidth(unsigned width)
+{
+    mNext.setMinLabelWidth(width);
+}
+
+
+};  // namespace Stir
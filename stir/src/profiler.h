@@ -0,0 +1,165 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * STIR -- Sifteo Tiled Image Reducer
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "logger.h"
+
+namespace Stir {
+
+
+/*
+ * Profiler --
+ *
+ *    Optional build profiling, for finding out which assets make a
+ *    STIR run slow. When enabled, we record the wall time of each
+ *    phase of work on each Group, Image, Sound and Tracker, the peak
+ *    RSS at the end of each phase, and any per-asset statistics.
+ *
+ *    writeReport() produces a JSON summary with one entry per asset,
+ *    sorted from slowest to fastest, plus a Chrome trace-event file
+ *    for viewing the whole timeline in chrome://tracing.
+ *
+ *    Like the Logger, the Profiler must only be used on the main thread.
+ */
+
+class Profiler {
+ public:
+    static const unsigned NONE = (unsigned)-1;
+
+    /*
+     * Records one phase of work on one asset, for the lifetime of
+     * the Scope. Does nothing while the profiler is disabled.
+     */
+    class Scope {
+     public:
+        Scope(const char *kind, const std::string &name, const char *phase)
+            : mEvent(Profiler::begin(kind, name, phase)) {}
+
+        ~Scope() {
+            Profiler::end(mEvent);
+        }
+
+        void set(const char *key, double value) {
+            Profiler::set(mEvent, key, value);
+        }
+
+        unsigned getEvent() const {
+            return mEvent;
+        }
+
+     private:
+        unsigned mEvent;
+    };
+
+    static void enable();
+
+    static bool isEnabled() {
+        return mEnabled;
+    }
+
+    // Low-level event API. Every function accepts NONE, and ignores it.
+    static unsigned begin(const char *kind, const std::string &name, const char *phase);
+    static unsigned beginPhase(const char *phase);
+    static void end(unsigned event);
+    static void set(unsigned event, const char *key, double value);
+    static void rename(unsigned event, const std::string &name);
+
+    // Write a JSON summary to 'filename', and a Chrome trace beside it
+    static bool writeReport(const char *filename, Logger &log);
+
+ private:
+    struct Event {
+        std::string kind;
+        std::string name;
+        std::string phase;
+        unsigned parent;
+        uint64_t start;
+        uint64_t duration;
+        uint64_t peakRSS;
+        std::vector<std::pair<std::string, double> > stats;
+    };
+
+    struct Asset;
+
+    static bool mEnabled;
+    static uint64_t mEpoch;
+    static std::vector<Event> mEvents;
+    static std::vector<unsigned> mOpen;
+
+    static uint64_t now();
+    static uint64_t peakRSS();
+    static bool sameAsset(const Event &a, const Event &b);
+    static std::string quote(const std::string &s);
+    static std::string number(double value);
+    static std::string traceFileName(const std::string &reportName);
+    static bool writeSummary(const char *filename);
+    static bool writeTrace(const char *filename);
+};
+
+
+/*
+ * ProfileLogger --
+ *
+ *    Forwards everything to another Logger, while turning each
+ *    taskBegin()/taskEnd() pair into a Profiler phase of whichever
+ *    asset is currently being worked on.
+ */
+
+class ProfileLogger : public Logger {
+ public:
+    ProfileLogger(Logger &next) : mNext(next) {}
+    virtual ~ProfileLogger();
+
+    virtual void heading(const char *name);
+
+    virtual void taskBegin(const char *name);
+    virtual void taskProgress(const char *fmt, ...);
+    virtual void taskEnd();
+
+    virtual void infoBegin(const char *name);
+    virtual void infoLine(const char *fmt, ...);
+    virtual void infoLineWithLabel(const char *label, const char *fmt, ...);
+    virtual void infoEnd();
+
+    virtual void error(const char *fmt, ...);
+
+    virtual void setMinLabelWidth(unsigned width);
+
+ private:
+    Logger &mNext;
+    std::vector<unsigned> mTasks;
+};
+
+
+};  // namespace Stir
+
+#endif
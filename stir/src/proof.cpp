@@ -24,6 +24,8 @@
  * THE SOFTWARE.
  */
 
+#include <sstream>
+#include <algorithm>
 #include "proof.h"
 #include "lodepng.h"
 
@@ -117,7 +119,7 @@ std::string HTMLEscape(const std::string &s)
 
 
 ProofWriter::ProofWriter(Logger &log, const char *filename)
-    : mLog(log), mID(0)
+    : mLog(log), mID(0), mAtlas(false)
 {
     if (filename) {
         mStream.open(filename);
@@ -125,11 +127,16 @@ ProofWriter::ProofWriter(Logger &log, const char *filename)
             log.error("Error opening proof file '%s'", filename);
     }
     
-    if (mStream.is_open()) {
-        mStream.setf(std::ios::fixed, std::ios::floatfield);  
-        mStream.precision(2);   
-
+    if (mStream.is_open())
         mStream << header;
+}
+
+ProofWriter::~ProofWriter()
+{
+    // Jobs may still be running if we never made it to close()
+    for (std::list<GroupJob*>::iterator i = mJobs.begin(); i != mJobs.end(); i++) {
+        (*i)->wait();
+        delete *i;
     }
 }
  
@@ -139,59 +146,155 @@ void ProofWriter::writeGroup(const Group &group)
         return;
 
     mLog.taskBegin("Generating proof");
-    
-    mStream <<
+
+    const TilePool &pool = group.getPool();
+    GroupJob *job = new GroupJob(mAtlas);
+    std::ostringstream heading, body;
+
+    heading.setf(std::ios::fixed, std::ios::floatfield);
+    heading.precision(2);
+
+    heading <<
         "<h1>" << HTMLEscape(group.getName()) << "</h1>\n"
         "<p>\n"
-               << group.getPool().size() << " tiles, "
+               << pool.size() << " tiles, "
                << group.getLoadstream().size() / 1024.0 << " kB stream\n"
         "</p>\n";
 
-    defineTiles(group.getPool());
+    if (mAtlas)
+        defineAtlas(pool, *job);
+    else
+        for (unsigned i = 0; i < pool.size(); i++)
+            job->tiles.push_back(pool.tile(i));
 
     if (!group.isFixed())
-        tileRange(0, group.getPool().size(), Tile::SIZE, 96);
+        tileRange(body, 0, pool.size(), Tile::SIZE, 96);
 
     for (std::set<Image*>::iterator i = group.getImages().begin();
          i != group.getImages().end(); i++) {
 
         Image *image = *i;
 
-        mStream << "<h2>" << HTMLEscape(image->getName());
+        body << "<h2>" << HTMLEscape(image->getName());
 
         unsigned firstId = mID + 1;
         unsigned idCount = image->getGrids().size();
         if (idCount > 1) {
-            mStream << "<span class=\"button\" id=\"buttonAll" << firstId
-                    << "\" onclick=\"toggleDisplayMode(" << firstId << ", " << idCount << ", \'all\')\">all</span>";
+            body << "<span class=\"button\" id=\"buttonAll" << firstId
+                 << "\" onclick=\"toggleDisplayMode(" << firstId << ", " << idCount << ", \'all\')\">all</span>";
 
-            mStream << "<span class=\"button\" id=\"buttonAnim" << firstId
-                    << "\" onclick=\"toggleDisplayMode(" << firstId << ", " << idCount << ", \'anim\')\">play</span>";
+            body << "<span class=\"button\" id=\"buttonAnim" << firstId
+                 << "\" onclick=\"toggleDisplayMode(" << firstId << ", " << idCount << ", \'anim\')\">play</span>";
         }
 
-        mStream << "</h2>\n";
+        body << "</h2>\n";
 
         bool hidden = false;
         for (std::vector<TileGrid>::const_iterator j = image->getGrids().begin();
              j != image->getGrids().end(); j++) {
 
-            tileGrid(*j, Tile::SIZE * 2, hidden);
+            tileGrid(body, *j, Tile::SIZE * 2, hidden);
             hidden = true;
         }
     }
 
+    job->heading = heading.str();
+    job->body = body.str();
+
+    // Encode tiles in the background, keeping about one job per thread in flight
+    WorkQueue::submit(job);
+    mJobs.push_back(job);
+    flushJobs(WorkQueue::getNumThreads());
+
     mLog.taskEnd();
 }
 
 void ProofWriter::close()
 {
     if (mStream.is_open()) {
+        flushJobs(0);
         mStream << "</body></html>\n";
         mStream.close();
     }
 }
 
-void ProofWriter::defineTiles(const TilePool &pool)
+void ProofWriter::flushJobs(unsigned keep)
+{
+    /*
+     * Write out finished groups, in order, until at most 'keep'
+     * are still pending.
+     */
+
+    while (mJobs.size() > keep) {
+        GroupJob *job = mJobs.front();
+        mJobs.pop_front();
+
+        job->wait();
+        mStream << job->heading << job->tileData << job->body;
+        mStream.flush();
+        delete job;
+    }
+}
+
+void ProofWriter::GroupJob::run()
+{
+    if (atlas) {
+        std::ostringstream out;
+
+        out << "<script>";
+
+        if (!tiles.empty()) {
+            std::string uri;
+            atlasURIEncode(tiles, uri);
+            out << "defineAtlas(\"" << uri << "\"," << tiles.size() << ","
+                << ATLAS_COLUMNS << "," << Tile::SIZE << ");";
+        }
+
+        out << "pool = definePool([";
+        for (unsigned i = 0; i < poolIndices.size(); i++)
+            out << poolIndices[i] << ",";
+        out << "]);</script>\n";
+
+        tileData = out.str();
+
+    } else if (!tiles.empty()) {
+        defineTiles(tiles, tileData);
+    }
+
+    // Don't hold on to tile references after we're done
+    std::vector<TileRef>().swap(tiles);
+}
+
+void ProofWriter::defineAtlas(const TilePool &pool, GroupJob &job)
+{
+    /*
+     * Look up each tile in the shared atlas by its pixel data. Tiles
+     * we haven't seen yet are assigned the next atlas index, and
+     * queued for encoding with this group.
+     */
+
+    std::string key(Tile::PIXELS * sizeof(RGB565), '\0');
+
+    for (unsigned i = 0; i < pool.size(); i++) {
+        TileRef t = pool.tile(i);
+
+        for (unsigned p = 0; p < Tile::PIXELS; p++) {
+            uint16_t value = t->pixel(p).value;
+            key[p * 2] = value >> 8;
+            key[p * 2 + 1] = value;
+        }
+
+        unsigned nextIndex = mAtlasIndex.size();
+        std::pair<std::tr1::unordered_map<std::string, unsigned>::iterator, bool> r =
+            mAtlasIndex.insert(std::make_pair(key, nextIndex));
+
+        if (r.second)
+            job.tiles.push_back(t);
+        job.poolIndices.push_back(r.first->second);
+    }
+}
+
+void ProofWriter::defineTiles(const std::vector<TileRef> &tiles, std::string &out)
 {
     /*
      * Define a set of tile data, in Javascript. Tiles are represented
@@ -199,67 +302,108 @@ void ProofWriter::defineTiles(const TilePool &pool)
      * array of tile-specific suffixes.
      */
 
-    if (!pool.size())
-        return;
-
-    std::vector<std::string> uri(pool.size());
+    std::vector<std::string> uri(tiles.size());
 
-    for (unsigned i = 0; i < pool.size(); i++)
-        TileURIEncode(*pool.tile(i), uri[i]);
+    for (unsigned i = 0; i < tiles.size(); i++)
+        TileURIEncode(*tiles[i], uri[i]);
 
     // Find the longest common prefix
     unsigned prefixLen = uri[0].length();
-    for (unsigned i = 0; i < pool.size(); i++)
+    for (unsigned i = 0; i < tiles.size(); i++)
         while (prefixLen && uri[i].compare(0, prefixLen, uri[0], 0, prefixLen))
             prefixLen--;
 
-    mStream << "<script>pool = defineTiles(\"" << uri[0].substr(0, prefixLen) << "\",[";
+    out.append("<script>pool = defineTiles(\"");
+    out.append(uri[0], 0, prefixLen);
+    out.append("\",[");
+
+    for (unsigned i = 0; i < tiles.size(); i++) {
+        out.append("\"");
+        out.append(uri[i], prefixLen, std::string::npos);
+        out.append("\",");
+    }
+
+    out.append("]);</script>\n");
+}
+
+void ProofWriter::atlasURIEncode(const std::vector<TileRef> &tiles, std::string &out)
+{
+    /*
+     * Encode a list of tiles as one PNG data URI, ATLAS_COLUMNS tiles
+     * wide, at their native size. Unused space is transparent.
+     */
+
+    const unsigned columns = std::min<unsigned>(tiles.size(), ATLAS_COLUMNS);
+    const unsigned rows = (tiles.size() + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+    const unsigned width = columns * Tile::SIZE;
+    const unsigned height = rows * Tile::SIZE;
 
-    for (unsigned i = 0; i < pool.size(); i++)
-        mStream << "\"" << uri[i].substr(prefixLen) << "\",";
+    LodePNG::Encoder encoder;
+    std::vector<uint8_t> png;
+    std::vector<uint8_t> image(4 * width * height, 0);
+
+    for (unsigned i = 0; i < tiles.size(); i++) {
+        const Tile &t = *tiles[i];
+        unsigned x0 = (i % ATLAS_COLUMNS) * Tile::SIZE;
+        unsigned y0 = (i / ATLAS_COLUMNS) * Tile::SIZE;
+
+        for (unsigned y = 0; y < Tile::SIZE; y++)
+            for (unsigned x = 0; x < Tile::SIZE; x++) {
+                RGB565 color = t.pixel(x, y);
+                uint8_t *p = &image[4 * (x0 + x + (y0 + y) * width)];
+                p[0] = color.red();
+                p[1] = color.green();
+                p[2] = color.blue();
+                p[3] = 0xFF;
+            }
+    }
 
-    mStream << "]);</script>\n";
+    encoder.encode(png, &image[0], width, height);
+    DataURIEncode(png, "image/png", out);
 }
 
-unsigned ProofWriter::newCanvas(unsigned tilesW, unsigned tilesH, unsigned tileSize, bool hidden)
+unsigned ProofWriter::newCanvas(std::ostream &out, unsigned tilesW, unsigned tilesH,
+    unsigned tileSize, bool hidden)
 {
     mID++;
 
-    mStream << "<canvas id=\"i" << mID << "\" width=\""
-            << (tilesW * tileSize) << "px\" height=\""
-            << (tilesH * tileSize) << "px\" ";
+    out << "<canvas id=\"i" << mID << "\" width=\""
+        << (tilesW * tileSize) << "px\" height=\""
+        << (tilesH * tileSize) << "px\" ";
 
     if (hidden)
-        mStream << "style=\"display: none;\" ";
+        out << "style=\"display: none;\" ";
 
-    mStream << "></canvas>";
+    out << "></canvas>";
 
     return mID;
 }
 
-void ProofWriter::tileRange(unsigned begin, unsigned end, unsigned tileSize, unsigned width)
+void ProofWriter::tileRange(std::ostream &out, unsigned begin, unsigned end,
+    unsigned tileSize, unsigned width)
 {
     unsigned height = ((end - begin) + (width - 1)) / width;
-    unsigned id = newCanvas(width, height, tileSize);
+    unsigned id = newCanvas(out, width, height, tileSize);
 
-    mStream << "<script>(new TileGrid(pool, " << id << ", " << tileSize
-            << ")).range(" << begin << ", " << end << ");</script>";
+    out << "<script>(new TileGrid(pool, " << id << ", " << tileSize
+        << ")).range(" << begin << ", " << end << ");</script>";
 }
 
-void ProofWriter::tileGrid(const TileGrid &grid, unsigned tileSize, bool hidden)
+void ProofWriter::tileGrid(std::ostream &out, const TileGrid &grid,
+    unsigned tileSize, bool hidden)
 {
-    unsigned id = newCanvas(grid.width(), grid.height(), tileSize, hidden);
+    unsigned id = newCanvas(out, grid.width(), grid.height(), tileSize, hidden);
 
-    mStream << "<script>(new TileGrid(pool, " << id << ", " << tileSize
-            << ")).array([";
+    out << "<script>(new TileGrid(pool, " << id << ", " << tileSize
+        << ")).array([";
 
     for (unsigned y = 0; y < grid.height(); y++)
         for (unsigned x = 0; x < grid.width(); x++) {
             TilePool::Index index = grid.getPool().index(grid.tile(x, y));
-            mStream << index << ",";
+            out << index << ",";
         }
 
-    mStream << "]);</script>";
+    out << "]);</script>";
 }
 
 
@@ -31,10 +31,13 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <list>
+#include <tr1/unordered_map>
 
 #include "tile.h"
 #include "script.h"
 #include "logger.h"
+#include "workqueue.h"
 
 namespace Stir {
 
@@ -53,11 +56,29 @@ std::string HTMLEscape(const std::string &s);
  *
  *     Writes out a self-contained HTML file that visualizes the
  *     results of a particular STIR processing run.
+ *
+ *     Tile images are the bulk of the proof, so they're encoded by
+ *     a WorkQueue task while STIR moves on to the next group. Finished
+ *     groups are streamed to the file in order.
+ *
+ *     In atlas mode, every unique tile is stored exactly once, in a
+ *     PNG atlas that grows with each group, and the groups' pools
+ *     refer to it by index. This is much smaller and faster than
+ *     encoding each tile as its own image, so it's the default for
+ *     projects with at least ATLAS_THRESHOLD tiles.
  */
 
 class ProofWriter {
  public:
+    static const unsigned ATLAS_THRESHOLD = 1024;
+    static const unsigned ATLAS_COLUMNS = 64;
+
     ProofWriter(Logger &log, const char *filename);
+    ~ProofWriter();
+
+    void setAtlas(bool enable) {
+        mAtlas = enable;
+    }
 
     void writeGroup(const Group &group);
     void close();
@@ -65,14 +86,39 @@ class ProofWriter {
  private:
     static const char *header;
 
+    /*
+     * The output for one group: heading and body are formatted on the
+     * main thread, the tile definitions in between are encoded by run().
+     */
+    class GroupJob : public WorkQueue::Task {
+     public:
+        GroupJob(bool atlas) : atlas(atlas) {}
+        virtual void run();
+
+        bool atlas;
+        std::vector<TileRef> tiles;
+        std::vector<unsigned> poolIndices;
+        std::string heading;
+        std::string tileData;
+        std::string body;
+    };
+
     Logger &mLog;
     unsigned mID;
+    bool mAtlas;
     std::ofstream mStream;
-
-    void defineTiles(const TilePool &pool);
-    unsigned newCanvas(unsigned tilesW, unsigned tilesH, unsigned tileSize, bool hidden=false);
-    void tileRange(unsigned begin, unsigned end, unsigned tileSize, unsigned width);
-    void tileGrid(const TileGrid &grid, unsigned tileSize, bool hidden=false);
+    std::list<GroupJob*> mJobs;
+    std::tr1::unordered_map<std::string, unsigned> mAtlasIndex;
+
+    void flushJobs(unsigned keep);
+    void defineAtlas(const TilePool &pool, GroupJob &job);
+    unsigned newCanvas(std::ostream &out, unsigned tilesW, unsigned tilesH,
+        unsigned tileSize, bool hidden=false);
+    void tileRange(std::ostream &out, unsigned begin, unsigned end, unsigned tileSize, unsigned width);
+    void tileGrid(std::ostream &out, const TileGrid &grid, unsigned tileSize, bool hidden=false);
+
+    static void defineTiles(const std::vector<TileRef> &tiles, std::string &out);
+    static void atlasURIEncode(const std::vector<TileRef> &tiles, std::string &out);
 };
 
 
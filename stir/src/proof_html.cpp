@@ -48,16 +48,44 @@ const char *Stir::ProofWriter::header =
     "         var img = new Image();\n"
     "         img.src = prefix + tiles[i];\n"
     "\n"
-    "         // Keep a list of closures that can be used to redraw\n"
-    "         // every occurrance of this tile in the TileGrids.\n"
-    "         img.tgRedraw = []\n"
-    " \n"
-    "         tiles[i] = img;\n"
+    "         // Each tile is a source rectangle within an image, plus a list\n"
+    "         // of closures that can be used to redraw every occurrance of\n"
+    "         // this tile in the TileGrids.\n"
+    "         tiles[i] = { img: img, x: 0, y: 0, w: 0, h: 0, tgRedraw: [] };\n"
     "       }\n"
     "       return tiles;\n"
     "     }\n"
     "\n"
     "     /*\n"
+    "      * Tile atlas (shared by all groups in atlas mode)\n"
+    "      *\n"
+    "      * Each defineAtlas() call appends one PNG containing every tile\n"
+    "      * that hasn't been seen in an earlier group, and each group's pool\n"
+    "      * is just a list of indices into the combined atlas.\n"
+    "      */\n"
+    "\n"
+    "     atlasTiles = [];\n"
+    "\n"
+    "     function defineAtlas(uri, count, columns, size) {\n"
+    "       var img = new Image();\n"
+    "       img.src = uri;\n"
+    "\n"
+    "       for (var i = 0; i < count; i++) {\n"
+    "         atlasTiles.push({ img: img,\n"
+    "                           x: (i % columns) * size,\n"
+    "                           y: Math.floor(i / columns) * size,\n"
+    "                           w: size, h: size, tgRedraw: [] });\n"
+    "       }\n"
+    "     }\n"
+    "\n"
+    "     function definePool(indices) {\n"
+    "       var tiles = [];\n"
+    "       for (var i = 0; i < indices.length; i++)\n"
+    "         tiles[i] = atlasTiles[indices[i]];\n"
+    "       return tiles;\n"
+    "     }\n"
+    "\n"
+    "     /*\n"
     "      * Object for a single TileGrid, with some interactive features.\n"
     "      * Renders onto an HTML5 Canvas\n"
     "      */\n"
@@ -75,6 +103,11 @@ const char *Stir::ProofWriter::header =
     "       this.canvas = document.getElementById(\"i\" + canvasId);\n"
     "       this.ctx = this.canvas.getContext(\"2d\");\n"
     "\n"
+    "       // Atlas tiles are drawn unscaled from the source image; keep them sharp\n"
+    "       this.ctx.imageSmoothingEnabled = false;\n"
+    "       this.ctx.mozImageSmoothingEnabled = false;\n"
+    "       this.ctx.webkitImageSmoothingEnabled = false;\n"
+    "\n"
     "       this.size = tileSize;\n"
     "       this.width = this.canvas.width / this.size;\n"
     "       this.height = this.canvas.height / this.size;\n"
@@ -160,7 +193,8 @@ const char *Stir::ProofWriter::header =
     "       if (tile) {\n"
     "\n"
     "         this.ctx.globalAlpha = 1.0;\n"
-    "         this.ctx.drawImage(tile, 0, 0, tile.width, tile.height, \n"
+    "         this.ctx.drawImage(tile.img, tile.x, tile.y,\n"
+    "                            tile.w || tile.img.width, tile.h || tile.img.height,\n"
     "                            x*this.size, y*this.size, this.size, this.size);\n"
     "\n"
     "         if (tile == highlightTile) {\n"
@@ -43,15 +43,43 @@ header = """
          var img = new Image();
          img.src = prefix + tiles[i];
 
-         // Keep a list of closures that can be used to redraw
-         // every occurrance of this tile in the TileGrids.
-         img.tgRedraw = []
- 
-         tiles[i] = img;
+         // Each tile is a source rectangle within an image, plus a list
+         // of closures that can be used to redraw every occurrance of
+         // this tile in the TileGrids.
+         tiles[i] = { img: img, x: 0, y: 0, w: 0, h: 0, tgRedraw: [] };
        }
        return tiles;
      }
 
+     /*
+      * Tile atlas (shared by all groups in atlas mode)
+      *
+      * Each defineAtlas() call appends one PNG containing every tile
+      * that hasn't been seen in an earlier group, and each group's pool
+      * is just a list of indices into the combined atlas.
+      */
+
+     atlasTiles = [];
+
+     function defineAtlas(uri, count, columns, size) {
+       var img = new Image();
+       img.src = uri;
+
+       for (var i = 0; i < count; i++) {
+         atlasTiles.push({ img: img,
+                           x: (i % columns) * size,
+                           y: Math.floor(i / columns) * size,
+                           w: size, h: size, tgRedraw: [] });
+       }
+     }
+
+     function definePool(indices) {
+       var tiles = [];
+       for (var i = 0; i < indices.length; i++)
+         tiles[i] = atlasTiles[indices[i]];
+       return tiles;
+     }
+
      /*
       * Object for a single TileGrid, with some interactive features.
       * Renders onto an HTML5 Canvas
@@ -70,6 +98,11 @@ header = """
        this.canvas = document.getElementById("i" + canvasId);
        this.ctx = this.canvas.getContext("2d");
 
+       // Atlas tiles are drawn unscaled from the source image; keep them sharp
+       this.ctx.imageSmoothingEnabled = false;
+       this.ctx.mozImageSmoothingEnabled = false;
+       this.ctx.webkitImageSmoothingEnabled = false;
+
        this.size = tileSize;
        this.width = this.canvas.width / this.size;
        this.height = this.canvas.height / this.size;
@@ -155,7 +188,8 @@ header = """
        if (tile) {
 
          this.ctx.globalAlpha = 1.0;
-         this.ctx.drawImage(tile, 0, 0, tile.width, tile.height, 
+         this.ctx.drawImage(tile.img, tile.x, tile.y,
+                            tile.w || tile.img.width, tile.h || tile.img.height,
                             x*this.size, y*this.size, this.size, this.size);
 
          if (tile == highlightTile) {
@@ -29,6 +29,7 @@
 #include <assert.h>
 
 #include <sstream>
+#include <algorithm>
 
 #include "script.h"
 #include "proof.h"
@@ -42,12 +43,16 @@ namespace Stir {
 // Important global variables
 #define GLOBAL_DEFGROUP         "_defaultGroup"
 #define GLOBAL_QUALITY          "quality"
+#define GLOBAL_DUB              "dub"
+#define GLOBAL_DUB_DEPTH        "dub_depth"
 
 const char Group::className[] = "group";
 const char Image::className[] = "image";
 const char Sound::className[] = "sound";
 const char Tracker::className[] = "tracker";
 
+std::list<Image*> Image::pending;
+
 Lunar<Group>::RegType Group::methods[] = {
     {0,0}
 };
@@ -88,6 +93,8 @@ Script::Script(Logger &l)
 
 Script::~Script()
 {
+    // Nothing left to encode; don't let garbage collection decode images
+    Image::cancelPending();
     lua_close(L);
 }
 
@@ -96,8 +103,17 @@ bool Script::run(const char *filename)
     if (!anyOutputs)
         log.error("Warning, no output files given!");
 
-    if (!luaRunFile(filename))
-        return false;
+    {
+        Profiler::Scope scope("stir", "", "Running script");
+        if (!luaRunFile(filename))
+            return false;
+    }
+
+    {
+        Profiler::Scope scope("stir", "", "Loading images");
+        if (!Image::loadPending(&log))
+            return false;
+    }
 
     if (!collect())
         return false;
@@ -106,9 +122,12 @@ bool Script::run(const char *filename)
     CPPHeaderWriter header(log, outputHeader);
     CPPSourceWriter source(log, outputSource);
 
+    proof.setAtlas(countTiles() >= ProofWriter::ATLAS_THRESHOLD);
+
     for (std::set<Group*>::iterator i = groups.begin(); i != groups.end(); i++) {
         Group *group = *i;
         TilePool &pool = group->getPool();
+        Profiler::Scope scope("group", group->getName(), "Building group");
 
         log.heading(group->getName().c_str());
         pool.optimize(log);
@@ -124,7 +143,18 @@ bool Script::run(const char *filename)
             pool.encode(group->getLoadstream(), &log);
         }
 
+        if (Profiler::isEnabled()) {
+            unsigned rawBytes = pool.size() * Tile::PIXELS * sizeof(RGB565);
+            unsigned streamBytes = group->getLoadstream().size();
+            scope.set("tiles", pool.size());
+            scope.set("streamBytes", streamBytes);
+            if (rawBytes && !group->isFixed())
+                scope.set("compression", 100.0 - streamBytes * 100.0 / rawBytes);
+        }
+
         proof.writeGroup(*group);
+
+        Profiler::Scope writeScope("group", group->getName(), "Writing C++");
         header.writeGroup(*group);
 
         if (!source.writeGroup(*group))
@@ -156,6 +186,7 @@ bool Script::run(const char *filename)
         log.infoBegin("Parsing modules");
         for (std::set<Tracker*>::iterator i = trackers.begin(); i != trackers.end(); i++) {
             Tracker *tracker = *i;
+            Profiler::Scope scope("tracker", tracker->getName(), "Loading module");
 
             if(!tracker->loader.load(tracker->getFile().c_str(), log)) {
                 return false;
@@ -166,6 +197,11 @@ bool Script::run(const char *filename)
             unsigned uncompressedSize = tracker->getFileSize();
             double ratio = uncompressedSize ? 100.0 - compressedSize * 100.0 / uncompressedSize : 0;
 
+            scope.set("patterns", song.nPatterns);
+            scope.set("instruments", song.nInstruments);
+            scope.set("bytes", compressedSize);
+            scope.set("compression", ratio);
+
             log.infoLineWithLabel(tracker->getName().c_str(), "% 3u patterns,% 3u instruments, %5.02f kiB, % 5.01f%% compression (%s)",
                                    song.nPatterns,
                                    song.nInstruments,
@@ -180,6 +216,7 @@ bool Script::run(const char *filename)
         source.writeTrackerShared(**trackers.begin());
         for (std::set<Tracker*>::iterator i = trackers.begin(); i != trackers.end(); i++) {
             Tracker *tracker = *i;
+            Profiler::Scope scope("tracker", tracker->getName(), "Writing C++");
 
             header.writeTracker(*tracker);
             source.writeTracker(*tracker);
@@ -408,6 +445,29 @@ bool Script::collect()
     return true;
 }
 
+unsigned Script::countTiles()
+{
+    /*
+     * Total number of (unoptimized) tiles in every image we collected.
+     * Used to decide how heavyweight our proofing output should be.
+     */
+
+    unsigned total = 0;
+
+    for (std::set<Group*>::iterator i = groups.begin(); i != groups.end(); i++) {
+        const std::set<Image*> &images = (*i)->getImages();
+
+        for (std::set<Image*>::const_iterator j = images.begin(); j != images.end(); j++) {
+            const std::vector<TileGrid> &grids = (*j)->getGrids();
+
+            for (std::vector<TileGrid>::const_iterator k = grids.begin(); k != grids.end(); k++)
+                total += k->width() * k->height();
+        }
+    }
+
+    return total;
+}
+
 bool Script::collectList(const char* name, int tableStackIndex) {
     /* 
      * Could this be an image image list?
@@ -533,7 +593,7 @@ Group *Group::getDefault(lua_State *L)
     return obj;
 }
 
-Image::Image(lua_State *L) : mInList(false)
+Image::Image(lua_State *L) : mInList(false), mProfileEvent(Profiler::NONE)
 {
     if (!Script::argBegin(L, className))
         return;
@@ -577,6 +637,28 @@ Image::Image(lua_State *L) : mInList(false)
         return;
     }
 
+    // DUB encoder search, defaulting to the global variables of the same name
+    if (!Script::argMatch(L, "dub"))
+        lua_getglobal(L, GLOBAL_DUB);
+    if (!lua_isnil(L, -1) && !lua_isstring(L, -1)) {
+        luaL_error(L, "Dub mode must be a string, \"greedy\" or \"optimal\" (got %s)",
+                   luaL_typename(L, -1));
+        return;
+    }
+    if (lua_isnil(L, -1) || !strcmp(lua_tostring(L, -1), "greedy")) {
+        mDubOptimal = false;
+    } else if (!strcmp(lua_tostring(L, -1), "optimal")) {
+        mDubOptimal = true;
+    } else {
+        luaL_error(L, "Unknown dub mode '%s', should be \"greedy\" or \"optimal\"",
+                   lua_tostring(L, -1));
+        return;
+    }
+
+    if (!Script::argMatch(L, "dub_depth"))
+        lua_getglobal(L, GLOBAL_DUB_DEPTH);
+    mDubDepth = std::max(0, (int)lua_tointeger(L, -1));
+
     if (Script::argMatch(L, 1)) {
         /*
          * The positional argument can be a single string, or a
@@ -626,7 +708,19 @@ Image::Image(lua_State *L) : mInList(false)
         return;
     }
 
-    createGrids();
+    /*
+     * Pixel data is decoded and sliced later, by loadPending(). That lets
+     * every image in the script decode concurrently, while still adding
+     * tiles to each pool in script order.
+     */
+    pending.push_back(this);
+}
+
+Image::~Image()
+{
+    // Images that were created but garbage collected still own tiles
+    if (std::find(pending.begin(), pending.end(), this) != pending.end())
+        loadPending(NULL, this);
 }
 
 int Image::width(lua_State *L)
@@ -659,14 +753,60 @@ int Image::group(lua_State *L)
     return 1;
 }
 
-void Image::createGrids()
+bool Image::createGrids()
 {
     mGrids.clear();
+    return mImages.storeFrames(mGrids, &mGroup->getPool(), mTileOpt);
+}
+
+bool Image::loadPending(Logger *log, Image *upTo)
+{
+    /*
+     * Work through pending images in creation order. To keep memory
+     * bounded, only a window of images ahead of the current one (about
+     * two sources per worker thread) are allowed to decode concurrently.
+     * Each source's RGBA data is freed as soon as it's been sliced.
+     */
+
+    const unsigned window = 2 * std::max(1u, WorkQueue::getNumThreads());
+
+    while (!pending.empty()) {
+        Image *head = pending.front();
+        unsigned inFlight = 0;
+
+        for (std::list<Image*>::iterator i = pending.begin();
+             i != pending.end() && inFlight < window; ++i) {
+            (*i)->mImages.beginDecode();
+            inFlight += (*i)->mImages.getNumSources();
+        }
+
+        pending.pop_front();
+
+        Profiler::Scope scope("image", head->mName, "Loading");
+        head->mProfileEvent = scope.getEvent();
+
+        if (!head->createGrids()) {
+            if (log)
+                log->error("Not a valid PNG image file: '%s'",
+                           head->mImages.getFailedFile().c_str());
+            cancelPending();
+            return false;
+        }
 
-    for (unsigned frame = 0; frame < mImages.getFrames(); frame++) {
-        mGrids.push_back(TileGrid(&mGroup->getPool()));
-        mImages.storeFrame(frame, mGrids.back(), mTileOpt);
+        scope.set("frames", head->mImages.getFrames());
+        scope.set("tiles", head->mImages.getFrames() *
+            (head->mImages.getWidth() / Tile::SIZE) * (head->mImages.getHeight() / Tile::SIZE));
+
+        if (head == upTo)
+            break;
     }
+
+    return true;
+}
+
+void Image::cancelPending()
+{
+    pending.clear();
 }
 
 const char *Image::getClassName() const
@@ -705,15 +845,24 @@ void Image::encodeFlat(std::vector<uint16_t> &data) const
 bool Image::encodeDUB(std::vector<uint16_t> &data, Logger &log, std::string &format) const
 {
     // Compressed image, encoded using the DUB codec.
-    
+
+    Profiler::Scope scope("image", getName(), "DUB encode");
+
     DUBEncoder encoder( mImages.getWidth() / Tile::SIZE,
                         mImages.getHeight() / Tile::SIZE,
                         mImages.getFrames() );
 
+    encoder.setOptimalParse(mDubOptimal);
+    encoder.setDictionaryDepth(mDubDepth);
+
     std::vector<uint16_t> tiles;
     encodeFlat(tiles);
 
     encoder.encodeTiles(tiles);
+
+    scope.set("compressedWords", encoder.getCompressedWords());
+    scope.set("compression", encoder.getRatio());
+    scope.set("codesPerTile", encoder.getCodesPerTile());
     
     // Too large to encode correctly?
     if (encoder.isTooLarge()) {
@@ -784,6 +933,17 @@ Sound::Sound(lua_State *L)
         setVolume(_SYS_AUDIO_DEFAULT_VOLUME);
     }
 
+    if (Script::argMatch(L, "adpcm_window")) {
+        int window = lua_tointeger(L, -1);
+        if (window <= 0) {
+            luaL_error(L, "adpcm_window must be a positive number of samples");
+            return;
+        }
+        setICWindow(window);
+    } else {
+        setICWindow(0);     // Encoder default
+    }
+
     if (!Script::argEnd(L))
         return;
 
@@ -35,9 +35,11 @@ extern "C" {
 
 #include <vector>
 #include <set>
+#include <list>
 
 #include "lunar.h"
 #include "logger.h"
+#include "profiler.h"
 #include "tile.h"
 #include "imagestack.h"
 #include "sifteo/abi.h"
@@ -95,6 +97,7 @@ public:
     bool luaRunFile(const char *filename);
     bool collect();
     bool collectList(const char* name, int tableStackIndex);
+    unsigned countTiles();
 
     static bool matchExtension(const char *filename, const char *ext);
 
@@ -193,9 +196,11 @@ public:
     static Lunar<Image>::RegType methods[];
 
     Image(lua_State *L);
+    ~Image();
 
     void setName(std::string s) {
         mName = s;
+        Profiler::rename(mProfileEvent, s);
     }
 
     const std::string &getName() const {
@@ -232,7 +237,13 @@ public:
     void encodeFlat(std::vector<uint16_t> &data) const;
     bool encodeDUB(std::vector<uint16_t> &data, Logger &log, std::string &format) const;
 
+    // Decode and slice every image created so far, in creation order
+    static bool loadPending(Logger *log, Image *upTo = NULL);
+    static void cancelPending();
+
  private:
+    static std::list<Image*> pending;
+
     Group *mGroup;
     ImageStack mImages;
     TileOptions mTileOpt;
@@ -240,8 +251,11 @@ public:
     std::string mName;
     bool mIsFlat;
     bool mInList;
+    bool mDubOptimal;
+    unsigned mDubDepth;
+    unsigned mProfileEvent;
 
-    void createGrids();
+    bool createGrids();
 
     int width(lua_State *L);
     int height(lua_State *L);
@@ -337,6 +351,11 @@ public:
         mVolume = volume;
     }
 
+    void setICWindow(unsigned samples)
+    {
+        mICWindow = samples;
+    }
+
     const std::string &getName() const {
         return mName;
     }
@@ -369,6 +388,10 @@ public:
         return mVolume;
     }
 
+    unsigned getICWindow() const {
+        return mICWindow;
+    }
+
 private:
     std::string mName;
     std::string mFile;
@@ -378,6 +401,7 @@ private:
     uint32_t mLoopLength;
     uint16_t mVolume;
     _SYSAudioLoopType mLoopType;
+    unsigned mICWindow;
 };
 
 class Tracker {
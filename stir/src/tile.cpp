@@ -91,6 +91,18 @@ TileRef Tile::instance(const TileOptions &opt, uint8_t *rgba, size_t stride)
      */
 
     Identity id;
+    identity(id, opt, rgba, stride);
+    return instance(id);
+}
+
+void Tile::identity(Identity &id, const TileOptions &opt, uint8_t *rgba, size_t stride)
+{
+    /*
+     * Convert a tile from a full-color RGBA source bitmap into its
+     * flyweight Identity. Unlike instance(), this doesn't touch any
+     * shared state, so it may run on a worker thread.
+     */
+
     const uint8_t alphaThreshold = 0x80;
     uint8_t *row, *pixel;
     unsigned x, y;
@@ -145,8 +157,6 @@ TileRef Tile::instance(const TileOptions &opt, uint8_t *rgba, size_t stride)
 
             dest++;
         }    
-
-    return instance(id);
 }
 
 double TileOptions::getMaxMSE() const
@@ -520,6 +530,16 @@ void TileGrid::load(const TileOptions &opt, uint8_t *rgba,
         }
 }
 
+void TileGrid::load(const Tile::Identity *ids, unsigned width, unsigned height)
+{
+    mWidth = width / Tile::SIZE;
+    mHeight = height / Tile::SIZE;
+    tiles.resize(mWidth * mHeight);
+
+    for (unsigned i = 0, e = mWidth * mHeight; i != e; ++i)
+        tiles[i] = mPool->add(Tile::instance(ids[i]));
+}
+
 void TilePool::optimize(Logger &log)
 {
     /*
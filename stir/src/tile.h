@@ -159,6 +159,9 @@ class Tile {
 
     static TileRef instance(const Identity &id);
     static TileRef instance(const TileOptions &opt, uint8_t *rgba, size_t stride);
+
+    // Thread-safe half of instance(): convert RGBA pixels to an Identity
+    static void identity(Identity &id, const TileOptions &opt, uint8_t *rgba, size_t stride);
     
     RGB565 pixel(unsigned i) const {
         return mID.pixels[i];
@@ -369,6 +372,9 @@ class TileGrid {
     void load(const TileOptions &opt, uint8_t *rgba,
               size_t stride, unsigned width, unsigned height);
 
+    // Load from identities that were already sliced, in row-major order
+    void load(const Tile::Identity *ids, unsigned width, unsigned height);
+
     unsigned width() const {
         return mWidth;
     }
@@ -0,0 +1,198 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * STIR -- Sifteo Tiled Image Reducer
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <vector>
+#include <algorithm>
+#include "workqueue.h"
+
+namespace Stir {
+
+unsigned WorkQueue::mNumThreads = tthread::thread::hardware_concurrency();
+bool WorkQueue::mStarted = false;
+
+
+WorkQueue::Task::Task()
+    : mQueued(false), mDone(true)
+    {}
+
+WorkQueue::Task::~Task()
+{
+}
+
+WorkQueue::Shared &WorkQueue::shared()
+{
+    /*
+     * Intentionally leaked. Worker threads are still blocked on this
+     * condition variable when the process exits, and destroying it out
+     * from under them would hang.
+     */
+    static Shared *instance = new Shared();
+    return *instance;
+}
+
+void WorkQueue::Task::wait()
+{
+    Shared &s = shared();
+    tthread::lock_guard<tthread::mutex> guard(s.lock);
+
+    if (mQueued) {
+        /*
+         * Nobody has picked this task up yet. Rather than sleeping
+         * while it waits its turn, run it right here. This also keeps
+         * nested waits from a worker thread deadlock-free.
+         */
+        s.queue.remove(this);
+        mQueued = false;
+        s.lock.unlock();
+        run();
+        s.lock.lock();
+        mDone = true;
+        s.cond.notify_all();
+    }
+
+    while (!mDone)
+        s.cond.wait(s.lock);
+}
+
+void WorkQueue::setNumThreads(unsigned count)
+{
+    // Must be called before the first task is submitted
+    if (!mStarted)
+        mNumThreads = count;
+}
+
+unsigned WorkQueue::getNumThreads()
+{
+    return mNumThreads;
+}
+
+void WorkQueue::start()
+{
+    // Caller holds the lock
+    mStarted = true;
+    for (unsigned i = 0; i < mNumThreads; ++i)
+        shared().threads.push_back(new tthread::thread(threadFn, 0));
+}
+
+void WorkQueue::submit(Task *task)
+{
+    if (mNumThreads == 0) {
+        task->mDone = false;
+        task->run();
+        task->mDone = true;
+        return;
+    }
+
+    Shared &s = shared();
+    tthread::lock_guard<tthread::mutex> guard(s.lock);
+
+    if (!mStarted)
+        start();
+
+    task->mQueued = true;
+    task->mDone = false;
+    s.queue.push_back(task);
+    s.cond.notify_all();
+}
+
+void WorkQueue::threadFn(void *)
+{
+    // Worker threads live for the rest of the process
+
+    Shared &s = shared();
+    s.lock.lock();
+    for (;;) {
+        while (s.queue.empty())
+            s.cond.wait(s.lock);
+
+        Task *task = s.queue.front();
+        s.queue.pop_front();
+        task->mQueued = false;
+
+        s.lock.unlock();
+        task->run();
+        s.lock.lock();
+
+        task->mDone = true;
+        s.cond.notify_all();
+    }
+}
+
+struct WorkQueue::ForState {
+    tthread::mutex lock;
+    unsigned next;
+    unsigned count;
+    void (*fn)(void *context, unsigned index);
+    void *context;
+
+    void work() {
+        for (;;) {
+            unsigned i;
+            {
+                tthread::lock_guard<tthread::mutex> guard(lock);
+                if (next >= count)
+                    return;
+                i = next++;
+            }
+            fn(context, i);
+        }
+    }
+};
+
+class WorkQueue::ForTask : public WorkQueue::Task {
+ public:
+    ForState *state;
+    virtual void run() {
+        state->work();
+    }
+};
+
+void WorkQueue::parallelFor(unsigned count, void (*fn)(void *context, unsigned index),
+                            void *context)
+{
+    ForState state;
+    state.next = 0;
+    state.count = count;
+    state.fn = fn;
+    state.context = context;
+
+    // One helper per worker thread, not counting the caller
+    unsigned numHelpers = std::min(mNumThreads, count ? count - 1 : 0);
+    std::vector<ForTask> helpers(numHelpers);
+
+    for (unsigned i = 0; i < numHelpers; ++i) {
+        helpers[i].state = &state;
+        submit(&helpers[i]);
+    }
+
+    state.work();
+
+    for (unsigned i = 0; i < numHelpers; ++i)
+        helpers[i].wait();
+}
+
+
+};  // namespace Stir
@@ -0,0 +1,104 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * STIR -- Sifteo Tiled Image Reducer
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include <list>
+#include "tinythread.h"
+
+namespace Stir {
+
+
+/*
+ * WorkQueue --
+ *
+ *    A small global pool of worker threads, used to spread independent
+ *    CPU-bound jobs (image decoding, tile slicing, ...) across all of the
+ *    host's cores.
+ *
+ *    Tasks are executed in FIFO order. The submitter owns each Task, and
+ *    must wait() on it before destroying it. Everything that touches
+ *    shared state (the Tile flyweight table, TilePools, the Logger) must
+ *    stay on the main thread; tasks should only read their inputs and
+ *    fill in private outputs.
+ */
+
+class WorkQueue {
+ public:
+    class Task {
+     public:
+        Task();
+        virtual ~Task();
+        virtual void run() = 0;
+
+        // Block until this task has finished running
+        void wait();
+
+     private:
+        friend class WorkQueue;
+        bool mQueued;
+        bool mDone;
+    };
+
+    // Set the number of worker threads. Zero runs everything synchronously.
+    static void setNumThreads(unsigned count);
+    static unsigned getNumThreads();
+
+    // Queue a task for asynchronous execution.
+    static void submit(Task *task);
+
+    /*
+     * Run fn(context, i) for every i in [0, count), using the worker
+     * threads plus the calling thread. Returns once every item is done.
+     * Safe to call from inside a Task.
+     */
+    static void parallelFor(unsigned count, void (*fn)(void *context, unsigned index),
+                            void *context);
+
+ private:
+    struct ForState;
+    class ForTask;
+
+    struct Shared {
+        tthread::mutex lock;
+        tthread::condition_variable cond;
+        std::list<Task*> queue;
+        std::list<tthread::thread*> threads;
+    };
+
+    static unsigned mNumThreads;
+    static bool mStarted;
+
+    static Shared &shared();
+    static void start();
+    static void threadFn(void *);
+};
+
+
+};  // namespace Stir
+
+#endif
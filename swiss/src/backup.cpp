@@ -24,12 +24,13 @@
  */
 
 #include "backup.h"
-#include "usbprotocol.h"
 #include "progressbar.h"
 #include "swisserror.h"
+#include "transferengine.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #   define unlink(x) _unlink(x)
@@ -40,34 +41,51 @@
 
 int Backup::run(int argc, char **argv, IODevice &_dev)
 {
-    if (argc != 2) {
+    FlashImage::Format format = FlashImage::Compressed;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--raw")) {
+            format = FlashImage::Raw;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+
+    if (!path) {
         fprintf(stderr, "incorrect args\n");
         return EINVAL;
     }
 
     Backup m(_dev);
-    return m.backup(argv[1]);
+    return m.backup(path, format);
 }
 
 Backup::Backup(IODevice &_dev) : dev(_dev) {}
 
-int Backup::backup(const char *path)
+int Backup::backup(const char *path, FlashImage::Format format)
 {
-    FILE *f = fopen(path, "wb");
-    if (!f) {
+    FlashImage image;
+    if (!image.create(path, format)) {
         fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
         return ENOENT;
     }
 
     if (!dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID)) {
+        image.close();
+        unlink(path);
         return ENODEV;
     }
 
-    requestProgress = 0;
-    replyProgress = 0;
-
-    bool success = writeFileHeader(f) && writeFlashContents(f);
-    fclose(f);
+    bool success = writeFlashContents(image);
+    if (success && !image.finish()) {
+        fprintf(stderr, "error writing %s\n", path);
+        success = false;
+    }
+    image.close();
 
     if (!success) {
         unlink(path);
@@ -77,101 +95,109 @@ int Backup::backup(const char *path)
     return EOK;
 }
 
-bool Backup::writeFileHeader(FILE *f)
+bool Backup::writeFlashContents(FlashImage &image)
 {
     /*
-     * This is a basic header that describes the geometry of the flash device,
-     * and identifies this file as something that Siftulator knows how to import
-     * with the -F command line option.
+     * Ask the base which parts of flash are erased, and only read the
+     * rest. Every block we do read is checked against the base's CRCs.
+     *
+     * Older firmware can't tell us, so we read everything.
      */
 
-    struct Header {
-        uint64_t    magic;
-        uint32_t    version;
-        uint32_t    fileSize;
-        uint32_t    cube_count;
-        uint32_t    cube_nvmSize;
-        uint32_t    cube_extSize;
-        uint32_t    cube_sectorSize;
-        uint32_t    mc_pageSize;
-        uint32_t    mc_blockSize;
-        uint32_t    mc_capacity;
-        uint32_t    uniqueID;
-        uint32_t    reserved[52];
-    };
-
-    static const Header hdr = {
-        0x534c467974666953LLU,      // magic
-        1,                          // version
-        DEVICE_SIZE + PAGE_SIZE,    // fileSize
-        0, 0, 0, 0,                 // (no cubes)
-        PAGE_SIZE,                  // mc_pageSize
-        BLOCK_SIZE,                 // mc_blockSize,
-        DEVICE_SIZE,                // mc_capacity
-        -1,                         // uniqueID,
-    };
-
-    STATIC_ASSERT(sizeof hdr == PAGE_SIZE);
-    return fwrite(&hdr, sizeof hdr, 1, f) == 1;
-}
-
-bool Backup::sendRequest()
-{
-    unsigned offset = requestProgress;
-    if (offset >= DEVICE_SIZE)
-        return false;
+    const unsigned numChunks = FlashImage::DEVICE_SIZE / FlashImage::CHUNK_SIZE;
 
-    USBProtocolMsg m(USBProtocol::Installer);
-    m.header |= UsbVolumeManager::FlashDeviceRead;
-    UsbVolumeManager::FlashDeviceReadRequest *req =
-        m.zeroCopyAppend<UsbVolumeManager::FlashDeviceReadRequest>();
+    TransferEngine engine(dev);
+    bool checksums = engine.supportsFlashChecksums();
 
-    req->address = offset;
-    req->length = std::min(DEVICE_SIZE - offset,
-        USBProtocolMsg::MAX_LEN - USBProtocolMsg::HEADER_BYTES);
+    std::vector<uint32_t> crcs;
+    std::vector<bool> erased;
 
-    requestProgress = offset + req->length;
-
-    dev.writePacket(m.bytes, m.len);
-
-    return true;
-}
+    if (checksums) {
+        if (!engine.readFlashChecksums(0, numChunks, crcs, erased))
+            return false;
+    } else {
+        fprintf(stderr, "base firmware can't checksum flash, reading every block\n");
+        erased.assign(numChunks, false);
+    }
 
-bool Backup::writeReply(FILE *f)
-{
-    USBProtocolMsg m;
+    unsigned skipped = 0;
+    {
+        ScopedProgressBar pb(FlashImage::DEVICE_SIZE);
+        FlashImage::Block block;
+
+        for (unsigned b = 0; b < FlashImage::NUM_BLOCKS; ++b) {
+            const unsigned first = b * FlashImage::CHUNKS_PER_BLOCK;
+            std::vector<bool> blockErased(erased.begin() + first,
+                erased.begin() + first + FlashImage::CHUNKS_PER_BLOCK);
+
+            block.address = b * FlashImage::BLOCK_SIZE;
+
+            for (unsigned retry = 0;; ++retry) {
+                if (!readBlock(engine, pb, block, blockErased))
+                    return false;
+                block.computeChecksums();
+
+                if (!checksums || !memcmp(block.crc, &crcs[first], sizeof block.crc))
+                    break;
+
+                if (retry == MAX_RETRIES) {
+                    fprintf(stderr, "\nflash block at 0x%06x failed verification\n",
+                        block.address);
+                    return false;
+                }
+
+                // Flash may have changed since we asked. Get fresh checksums and try again.
+                std::vector<uint32_t> blockCrcs;
+                if (!engine.readFlashChecksums(block.address, FlashImage::CHUNKS_PER_BLOCK,
+                                               blockCrcs, blockErased))
+                    return false;
+                std::copy(blockCrcs.begin(), blockCrcs.end(), crcs.begin() + first);
+            }
+
+            for (unsigned i = 0; i < FlashImage::CHUNKS_PER_BLOCK; ++i)
+                if (blockErased[i])
+                    skipped += FlashImage::CHUNK_SIZE;
+
+            if (!image.writeBlock(block)) {
+                fprintf(stderr, "\nwrite error\n");
+                return false;
+            }
 
-    dev.readPacket(m.bytes, m.MAX_LEN, m.len);
-    if ((m.header & 0xff) != UsbVolumeManager::FlashDeviceRead) {
-        fprintf(stderr, "\nunexpected response\n");
-        return false;
+            pb.update(block.address + FlashImage::BLOCK_SIZE);
+        }
     }
 
-    unsigned len = m.payloadLen();
-    replyProgress += len;
+    engine.printThroughput();
+    if (skipped)
+        fprintf(stdout, "skipped %u kB of erased flash\n", skipped / 1024);
 
-    return fwrite(m.castPayload<uint8_t>(), len, 1, f) == 1;
+    return true;
 }
 
-bool Backup::writeFlashContents(FILE *f)
+bool Backup::readBlock(TransferEngine &engine, ProgressBar &pb,
+    FlashImage::Block &block, const std::vector<bool> &erased)
 {
-    ScopedProgressBar pb(DEVICE_SIZE);
-
-    // Queue up the first few reads, respond as results arrive
-    for (unsigned i = 0; i < 3; ++i)
-        sendRequest();
+    // Read each run of chunks that have data in them, and fill in the rest
+
+    unsigned i = 0;
+    while (i < FlashImage::CHUNKS_PER_BLOCK) {
+        if (erased[i]) {
+            memset(block.chunk(i), 0xFF, FlashImage::CHUNK_SIZE);
+            i++;
+            continue;
+        }
 
-    while (1) {
-        dev.processEvents(1);
+        unsigned end = i + 1;
+        while (end < FlashImage::CHUNKS_PER_BLOCK && !erased[end])
+            end++;
 
-        while (dev.numPendingINPackets() != 0) {
-            if (!writeReply(f))
-                return false;
+        engine.setProgress(&pb, block.address + i * FlashImage::CHUNK_SIZE);
+        if (!engine.readFlash(block.address + i * FlashImage::CHUNK_SIZE,
+                              (end - i) * FlashImage::CHUNK_SIZE, block.chunk(i)))
+            return false;
 
-            pb.update(replyProgress);
-            sendRequest();
-            if (replyProgress == DEVICE_SIZE)
-                return true;
-        }
+        i = end;
     }
+
+    return true;
 }
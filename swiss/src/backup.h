@@ -27,9 +27,12 @@
 #define BACKUP_H
 
 #include "iodevice.h"
-#include "usbvolumemanager.h"
+#include "flashimage.h"
 
-#include <string>
+#include <vector>
+
+class TransferEngine;
+class ProgressBar;
 
 class Backup
 {
@@ -38,23 +41,17 @@ public:
 
     static int run(int argc, char **argv, IODevice &_dev);
 
-    int backup(const char *path);
+    int backup(const char *path, FlashImage::Format format);
 
 private:
     IODevice &dev;
 
-    unsigned requestProgress;
-    unsigned replyProgress;
-
-    static const unsigned DEVICE_SIZE = 16*1024*1024;
-    static const unsigned PAGE_SIZE = 256;
-    static const unsigned BLOCK_SIZE = 64*1024;
-
-    bool writeFileHeader(FILE *f);
-    bool writeFlashContents(FILE *f);
+    // How many times to re-read a block whose checksums don't match
+    static const unsigned MAX_RETRIES = 3;
 
-    bool sendRequest();
-    bool writeReply(FILE *f);
+    bool writeFlashContents(FlashImage &image);
+    bool readBlock(TransferEngine &engine, ProgressBar &pb,
+        FlashImage::Block &block, const std::vector<bool> &erased);
 };
 
 #endif // BACKUP_H
@@ -195,6 +195,40 @@ UsbVolumeManager::LFSDetailReply *BaseDevice::getLFSDetail(USBProtocolMsg &msg,
 }
 
 
+UsbVolumeManager::LFSObjectListReply *BaseDevice::listLFSObjects(USBProtocolMsg &msg, unsigned volBlockCode,
+                                                                 const BitVector<256> &excludedKeys)
+{
+    /*
+     * Retrieve the next batch of objects in a volume's LFS, not counting
+     * any in 'excludedKeys'. Returns NULL on failure, including when the
+     * base's firmware is too old to list objects.
+     */
+
+    msg.init(USBProtocol::Installer);
+    msg.header |= UsbVolumeManager::LFSObjectList;
+    UsbVolumeManager::LFSObjectListRequest *req =
+        msg.zeroCopyAppend<UsbVolumeManager::LFSObjectListRequest>();
+
+    req->volume = volBlockCode;
+    req->excludedKeys = excludedKeys;
+
+    if (!writeAndWaitForReply(msg)) {
+        return 0;
+    }
+
+    UsbVolumeManager::LFSObjectListReply *reply =
+        msg.castPayload<UsbVolumeManager::LFSObjectListReply>();
+
+    if (msg.payloadLen() >= sizeof reply->count &&
+        reply->count <= UsbVolumeManager::MAX_LFS_OBJECTS_PER_REPLY &&
+        msg.payloadLen() == sizeof reply->count + reply->count * sizeof reply->objects[0]) {
+        return reply;
+    }
+
+    return 0;
+}
+
+
 bool BaseDevice::pairCube(USBProtocolMsg &msg, uint64_t hwid, unsigned slot)
 {
     /*
@@ -51,6 +51,8 @@ public:
     UsbVolumeManager::VolumeDetailReply *getVolumeDetail(USBProtocolMsg &msg, unsigned volBlockCode);
     bool volumeCodeForPackage(const std::string & pkg, unsigned &volBlockCode);
     UsbVolumeManager::LFSDetailReply *getLFSDetail(USBProtocolMsg &buffer, unsigned volBlockCode);
+    UsbVolumeManager::LFSObjectListReply *listLFSObjects(USBProtocolMsg &msg, unsigned volBlockCode,
+                                                         const BitVector<256> &excludedKeys);
 
     bool pairCube(USBProtocolMsg &msg, uint64_t hwid, unsigned slot);
     UsbVolumeManager::PairingSlotDetailReply *pairingSlotDetail(USBProtocolMsg &msg, unsigned pairingSlot);
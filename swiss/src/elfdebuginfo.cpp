@@ -24,7 +24,6 @@
  */
 
 #include "elfdebuginfo.h"
-#include <cxxabi.h>
 #include "macros.h"
 
 #include <sifteo/abi/elf.h>
@@ -46,6 +45,7 @@ void ELFDebugInfo::clear()
     mappedFile.unmap();
     sections.clear();
     sectionMap.clear();
+    symbols.clear();
 }
 
 bool ELFDebugInfo::copyProgramBytes(uint32_t byteOffset, uint8_t *dest, uint32_t length) const
@@ -179,6 +179,37 @@ std::string ELFDebugInfo::readString(const std::string &section, uint32_t offset
         return "";
 }
 
+const Elf::Symbol *ELFDebugInfo::lookupSymbol(uint32_t address) const
+{
+    /*
+     * Find the nearest symbol containing 'address', or NULL. On first use,
+     * reads the whole symbol and string tables and builds a sorted index.
+     */
+
+    if (!symbols.isLoaded()) {
+        const Elf::SectionHeader *symSI = findSection(".symtab");
+        const Elf::SectionHeader *strSI = findSection(".strtab");
+        std::vector<uint8_t> symtab, strtab;
+
+        if (symSI) {
+            symtab.resize(symSI->sh_size);
+            if (symtab.empty() || !copyProgramBytes(symSI->sh_offset, &symtab[0], symtab.size()))
+                symtab.clear();
+        }
+
+        if (strSI) {
+            strtab.resize(strSI->sh_size);
+            if (strtab.empty() || !copyProgramBytes(strSI->sh_offset, &strtab[0], strtab.size()))
+                strtab.clear();
+        }
+
+        symbols.load(symtab.empty() ? 0 : &symtab[0], symtab.size(),
+                     strtab.empty() ? 0 : &strtab[0], strtab.size());
+    }
+
+    return symbols.find(address);
+}
+
 bool ELFDebugInfo::findNearestSymbol(uint32_t address,
     Elf::Symbol &symbol, std::string &name) const
 {
@@ -189,36 +220,11 @@ bool ELFDebugInfo::findNearestSymbol(uint32_t address,
     // If nothing is found, we still fill in the output buffer and name
     // with "(unknown)" and zeroes, but 'false' is returned.
 
-    const Elf::SectionHeader *SI = findSection(".symtab");
-    if (SI) {
-        Elf::Symbol currentSym;
-        const uint32_t worstOffset = (uint32_t) -1;
-        uint32_t bestOffset = worstOffset;
-
-        for (unsigned index = 0;; index++) {
-            uint32_t tableOffset = index * sizeof currentSym;
-
-            if (tableOffset + sizeof currentSym > SI->sh_size ||
-                !copyProgramBytes(
-                    SI->sh_offset + tableOffset,
-                    (uint8_t*) &currentSym, sizeof currentSym))
-                break;
-
-            // Strip the Thumb bit from function symbols.
-            if ((currentSym.st_info & 0xF) == Elf::STT_FUNC)
-                currentSym.st_value &= ~1;
-
-            uint32_t addrOffset = address - currentSym.st_value;
-            if (addrOffset < currentSym.st_size && addrOffset < bestOffset) {
-                symbol = currentSym;
-                bestOffset = addrOffset;
-            }
-        }
-
-        if (bestOffset != worstOffset) {
-            name = readString(".strtab", symbol.st_name);
-            return true;
-        }
+    const Elf::Symbol *sym = lookupSymbol(address);
+    if (sym) {
+        symbol = *sym;
+        name = symbols.name(*sym);
+        return true;
     }
 
     memset(&symbol, 0, sizeof symbol);
@@ -288,12 +294,9 @@ uint8_t* ELFDebugInfo::metadata(uint16_t key, uint32_t &actualSize)
 
 std::string ELFDebugInfo::formatAddress(uint32_t address) const
 {
-    Elf::Symbol symbol;
-    std::string name;
-
-    findNearestSymbol(address, symbol, name);
-    demangle(name);
-    uint32_t offset = address - symbol.st_value;
+    const Elf::Symbol *sym = lookupSymbol(address);
+    std::string name = sym ? symbols.demangledName(*sym) : "(unknown)";
+    uint32_t offset = address - (sym ? sym->st_value : 0);
 
     if (offset != 0) {
         char buf[16];
@@ -304,19 +307,6 @@ std::string ELFDebugInfo::formatAddress(uint32_t address) const
     return name;
 }
 
-void ELFDebugInfo::demangle(std::string &name)
-{
-    // This uses the demangler built into GCC's libstdc++.
-    // It uses the same name mangling style as clang.
-
-    int status;
-    char *result = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
-    if (status == 0) {
-        name = result;
-        free(result);
-    }
-}
-
 bool ELFDebugInfo::readROM(uint32_t address, uint8_t *buffer, uint32_t bytes) const
 {
     /*
@@ -29,6 +29,7 @@
 #include "elfdefs.h"
 #include "mappedfile.h"
 
+#include "elfsymbolindex.h"
 #include <vector>
 #include <map>
 #include <string>
@@ -41,6 +42,10 @@ public:
     std::string readString(const std::string &section, uint32_t offset) const;
     bool findNearestSymbol(uint32_t address, Elf::Symbol &symbol, std::string &name) const;
     std::string formatAddress(uint32_t address) const;
+    const Elf::Symbol *lookupSymbol(uint32_t address) const;
+    const std::string &symbolName(const Elf::Symbol &sym) const {
+        return symbols.demangledName(sym);
+    }
     bool readROM(uint32_t address, uint8_t *buffer, uint32_t bytes) const;
 
     bool metadataString(uint16_t key, std::string &s);
@@ -55,7 +60,9 @@ private:
     sections_t sections;
     sectionMap_t sectionMap;
 
-    static void demangle(std::string &name);
+    // Built lazily, on the first address lookup
+    mutable Elf::SymbolIndex symbols;
+
     std::string readString(const Elf::SectionHeader *SI, uint32_t offset) const;
 
     const Elf::FileHeader *getFileHeader() const;
@@ -0,0 +1,373 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "flashimage.h"
+#include "util.h"
+#include "macros.h"
+
+#include <string.h>
+#include <zlib.h>
+
+namespace {
+
+    /*
+     * Raw images share their header with Siftulator's flash storage files.
+     * The master flash contents follow immediately after.
+     *
+     * We write version 1. Siftulator's version 2 files add a bitmap of
+     * erased blocks, whose contents in the file are stale and must be
+     * read as 0xFF.
+     */
+    struct RawHeader {
+        uint64_t    magic;
+        uint32_t    version;
+        uint32_t    fileSize;
+        uint32_t    cube_count;
+        uint32_t    cube_nvmSize;
+        uint32_t    cube_extSize;
+        uint32_t    cube_sectorSize;
+        uint32_t    mc_pageSize;
+        uint32_t    mc_blockSize;
+        uint32_t    mc_capacity;
+        uint32_t    uniqueID;
+        uint32_t    erasedBlocks[8];    // Version 2+
+        uint32_t    reserved[44];
+    };
+
+    struct CompressedHeader {
+        uint64_t    magic;
+        uint32_t    version;
+        uint32_t    deviceSize;
+        uint32_t    blockSize;
+        uint32_t    chunkSize;
+    };
+
+    const uint64_t RAW_MAGIC = 0x534c467974666953LLU;           // "SiftyFLS"
+    const uint64_t COMPRESSED_MAGIC = 0x315a6b4274666953LLU;    // "SiftBkZ1"
+    const uint32_t END_OF_IMAGE = 0xFFFFFFFF;
+}
+
+
+void FlashImage::Block::erase(uint32_t addr)
+{
+    address = addr;
+    memset(&data[0], 0xFF, BLOCK_SIZE);
+    computeChecksums();
+}
+
+void FlashImage::Block::computeChecksums()
+{
+    erasedMask = 0;
+
+    for (unsigned i = 0; i < CHUNKS_PER_BLOCK; ++i) {
+        const uint8_t *p = chunk(i);
+        crc[i] = Util::baseCrc32(p, CHUNK_SIZE);
+
+        unsigned j = 0;
+        while (j < CHUNK_SIZE && p[j] == 0xFF)
+            j++;
+        if (j == CHUNK_SIZE)
+            erasedMask |= 1 << i;
+    }
+}
+
+
+FlashImage::FlashImage()
+    : file(0), mFormat(Raw), nextBlock(0), haveStored(false)
+{
+}
+
+FlashImage::~FlashImage()
+{
+    close();
+}
+
+void FlashImage::close()
+{
+    if (file) {
+        fclose(file);
+        file = 0;
+    }
+}
+
+bool FlashImage::create(const char *path, Format format)
+{
+    close();
+
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    mFormat = format;
+    nextBlock = 0;
+
+    return format == Raw ? writeRawHeader() : writeCompressedHeader();
+}
+
+bool FlashImage::writeRawHeader()
+{
+    /*
+     * A basic header that describes the geometry of the flash device,
+     * and identifies this file as something that Siftulator knows how
+     * to import with the -F command line option.
+     */
+
+    static const RawHeader hdr = {
+        RAW_MAGIC,                  // magic
+        1,                          // version
+        DEVICE_SIZE + PAGE_SIZE,    // fileSize
+        0, 0, 0, 0,                 // (no cubes)
+        PAGE_SIZE,                  // mc_pageSize
+        BLOCK_SIZE,                 // mc_blockSize,
+        DEVICE_SIZE,                // mc_capacity
+        0xFFFFFFFF,                 // uniqueID,
+    };
+
+    STATIC_ASSERT(sizeof hdr == PAGE_SIZE);
+    return fwrite(&hdr, sizeof hdr, 1, file) == 1;
+}
+
+bool FlashImage::writeCompressedHeader()
+{
+    CompressedHeader hdr;
+    hdr.magic = COMPRESSED_MAGIC;
+    hdr.version = 1;
+    hdr.deviceSize = DEVICE_SIZE;
+    hdr.blockSize = BLOCK_SIZE;
+    hdr.chunkSize = CHUNK_SIZE;
+
+    return fwrite(&hdr, sizeof hdr, 1, file) == 1;
+}
+
+bool FlashImage::writeBlock(const Block &b)
+{
+    /*
+     * Blocks must be written in order, all of them.
+     */
+
+    ASSERT(file);
+    ASSERT(b.address == nextBlock * BLOCK_SIZE);
+    nextBlock++;
+
+    if (mFormat == Raw)
+        return fwrite(&b.data[0], BLOCK_SIZE, 1, file) == 1;
+
+    if (b.isErased())
+        return true;
+
+    // Compress only the chunks with data in them
+
+    std::vector<uint8_t> packed;
+    for (unsigned i = 0; i < CHUNKS_PER_BLOCK; ++i)
+        if (!b.isChunkErased(i))
+            packed.insert(packed.end(), b.chunk(i), b.chunk(i) + CHUNK_SIZE);
+
+    uLongf outSize = compressBound(packed.size());
+    std::vector<uint8_t> out(outSize);
+    if (compress(&out[0], &outSize, &packed[0], packed.size()) != Z_OK)
+        return false;
+
+    StoredBlockHeader hdr;
+    hdr.address = b.address;
+    hdr.erasedMask = b.erasedMask;
+    memcpy(hdr.crc, b.crc, sizeof hdr.crc);
+    hdr.compressedSize = outSize;
+
+    return fwrite(&hdr, sizeof hdr, 1, file) == 1 &&
+           fwrite(&out[0], outSize, 1, file) == 1;
+}
+
+bool FlashImage::finish()
+{
+    ASSERT(file);
+    bool success = nextBlock == NUM_BLOCKS;
+
+    if (mFormat == Compressed) {
+        StoredBlockHeader hdr;
+        memset(&hdr, 0, sizeof hdr);
+        hdr.address = END_OF_IMAGE;
+        success = success && fwrite(&hdr, sizeof hdr, 1, file) == 1;
+    }
+
+    success = !fclose(file) && success;
+    file = 0;
+    return success;
+}
+
+bool FlashImage::open(const char *path)
+{
+    close();
+
+    file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    nextBlock = 0;
+    haveStored = false;
+
+    // Both headers start with a magic number
+
+    uint64_t magic;
+    if (fread(&magic, sizeof magic, 1, file) != 1 || fseek(file, 0, SEEK_SET)) {
+        close();
+        return false;
+    }
+
+    if (magic == RAW_MAGIC) {
+        RawHeader hdr;
+        mFormat = Raw;
+        if (fread(&hdr, sizeof hdr, 1, file) == 1 &&
+            (hdr.version == 1 || hdr.version == 2) &&
+            hdr.mc_pageSize == PAGE_SIZE &&
+            hdr.mc_blockSize == BLOCK_SIZE &&
+            hdr.mc_capacity == DEVICE_SIZE) {
+
+            // Version 1 has no bitmap; its padding is always zero
+            STATIC_ASSERT(sizeof hdr.erasedBlocks == sizeof rawErasedBlocks);
+            memcpy(rawErasedBlocks, hdr.erasedBlocks, sizeof rawErasedBlocks);
+            return true;
+        }
+
+    } else if (magic == COMPRESSED_MAGIC) {
+        CompressedHeader hdr;
+        mFormat = Compressed;
+        if (fread(&hdr, sizeof hdr, 1, file) == 1 &&
+            hdr.version == 1 &&
+            hdr.deviceSize == DEVICE_SIZE &&
+            hdr.blockSize == BLOCK_SIZE &&
+            hdr.chunkSize == CHUNK_SIZE)
+            return true;
+    }
+
+    close();
+    return false;
+}
+
+bool FlashImage::readBlock(Block &b)
+{
+    /*
+     * Read the next block, in order. Returns false if the image is
+     * truncated or damaged, or we're already at the end.
+     */
+
+    ASSERT(file);
+    if (nextBlock >= NUM_BLOCKS)
+        return false;
+
+    uint32_t address = nextBlock * BLOCK_SIZE;
+    nextBlock++;
+
+    if (mFormat == Raw) {
+        b.address = address;
+        if (fread(&b.data[0], BLOCK_SIZE, 1, file) != 1)
+            return false;
+
+        // Erased blocks may be stale, or holes in a sparse file
+        unsigned index = address / BLOCK_SIZE;
+        if ((rawErasedBlocks[index >> 5] >> (index & 31)) & 1)
+            b.erase(address);
+        else
+            b.computeChecksums();
+        return true;
+    }
+
+    if (!haveStored && !readStoredHeader())
+        return false;
+
+    bool success;
+    if (stored.address != address) {
+        // Not stored, so it's erased
+        b.erase(address);
+        success = true;
+    } else {
+        haveStored = false;
+        success = readStoredBlock(b);
+    }
+
+    // The last block must be followed by the end marker
+    if (success && nextBlock == NUM_BLOCKS)
+        success = (haveStored || readStoredHeader()) && stored.address == END_OF_IMAGE;
+
+    return success;
+}
+
+bool FlashImage::readStoredHeader()
+{
+    if (fread(&stored, sizeof stored, 1, file) != 1)
+        return false;
+
+    // Stored blocks are in order, and the image must be properly ended
+    if (stored.address != END_OF_IMAGE) {
+        if (stored.address % BLOCK_SIZE || stored.address / BLOCK_SIZE < nextBlock - 1)
+            return false;
+        if (stored.address >= DEVICE_SIZE || stored.erasedMask >= ALL_CHUNKS_ERASED)
+            return false;
+    }
+
+    haveStored = true;
+    return true;
+}
+
+bool FlashImage::readStoredBlock(Block &b)
+{
+    std::vector<uint8_t> compressed(stored.compressedSize);
+    if (compressed.empty() || fread(&compressed[0], compressed.size(), 1, file) != 1)
+        return false;
+
+    // A block never unpacks to more than BLOCK_SIZE
+    std::vector<uint8_t> out(BLOCK_SIZE);
+    uLongf outSize = out.size();
+    if (uncompress(&out[0], &outSize, &compressed[0], compressed.size()) != Z_OK)
+        return false;
+
+    // Unpack the chunks, and check each one against the base's CRC
+
+    b.address = stored.address;
+    b.erasedMask = stored.erasedMask;
+    memcpy(b.crc, stored.crc, sizeof b.crc);
+
+    bool success = true;
+    size_t offset = 0;
+
+    for (unsigned i = 0; i < CHUNKS_PER_BLOCK; ++i) {
+        if (b.isChunkErased(i)) {
+            memset(b.chunk(i), 0xFF, CHUNK_SIZE);
+            continue;
+        }
+
+        if (offset + CHUNK_SIZE > outSize) {
+            success = false;
+            break;
+        }
+
+        memcpy(b.chunk(i), &out[offset], CHUNK_SIZE);
+        offset += CHUNK_SIZE;
+
+        if (Util::baseCrc32(b.chunk(i), CHUNK_SIZE) != b.crc[i])
+            success = false;
+    }
+
+    return success && offset == outSize;
+}
@@ -0,0 +1,137 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FLASH_IMAGE_H
+#define FLASH_IMAGE_H
+
+#include "usbvolumemanager.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * A backup of a base's entire flash device, read or written one erase
+ * block at a time, in order.
+ *
+ * Raw images are a 256-byte header followed by every byte of flash. This
+ * is the format Siftulator loads with its -F option. We can also read
+ * Siftulator's own storage files, which may mark some blocks as erased
+ * in the header instead of storing 0xFF bytes.
+ *
+ * Compressed images store only the blocks that have data in them. Within
+ * each block, erased chunks are left out and the rest is zlib-compressed
+ * on its own, along with the base's CRC of every chunk so we can tell if
+ * the image was damaged.
+ */
+
+class FlashImage
+{
+public:
+    static const unsigned DEVICE_SIZE = 16*1024*1024;
+    static const unsigned PAGE_SIZE = 256;
+    static const unsigned BLOCK_SIZE = 64*1024;
+    static const unsigned NUM_BLOCKS = DEVICE_SIZE / BLOCK_SIZE;
+    static const unsigned CHUNK_SIZE = UsbVolumeManager::FLASH_CHECKSUM_CHUNK;
+    static const unsigned CHUNKS_PER_BLOCK = BLOCK_SIZE / CHUNK_SIZE;
+    static const uint32_t ALL_CHUNKS_ERASED = (1 << CHUNKS_PER_BLOCK) - 1;
+
+    enum Format {
+        Raw,
+        Compressed
+    };
+
+    struct Block {
+        uint32_t address;
+        uint32_t erasedMask;                // Bit N set if chunk N is all 0xFF
+        uint32_t crc[CHUNKS_PER_BLOCK];     // Base's CRC of each chunk
+        std::vector<uint8_t> data;          // BLOCK_SIZE bytes
+
+        Block() : address(0), erasedMask(0), data(BLOCK_SIZE) {}
+
+        bool isErased() const {
+            return erasedMask == ALL_CHUNKS_ERASED;
+        }
+
+        bool isChunkErased(unsigned i) const {
+            return (erasedMask >> i) & 1;
+        }
+
+        uint8_t *chunk(unsigned i) {
+            return &data[i * CHUNK_SIZE];
+        }
+
+        const uint8_t *chunk(unsigned i) const {
+            return &data[i * CHUNK_SIZE];
+        }
+
+        // Make an erased block
+        void erase(uint32_t address);
+
+        // Fill in erasedMask and crc[] from the data
+        void computeChecksums();
+    };
+
+    FlashImage();
+    ~FlashImage();
+
+    Format format() const {
+        return mFormat;
+    }
+
+    bool create(const char *path, Format format);
+    bool writeBlock(const Block &b);
+    bool finish();
+
+    bool open(const char *path);
+    bool readBlock(Block &b);
+    void close();
+
+private:
+    FILE *file;
+    Format mFormat;
+    unsigned nextBlock;
+
+    // Compressed images: the next stored block we've seen, if any
+    struct StoredBlockHeader {
+        uint32_t address;
+        uint32_t erasedMask;
+        uint32_t crc[CHUNKS_PER_BLOCK];
+        uint32_t compressedSize;
+    };
+
+    StoredBlockHeader stored;
+    bool haveStored;
+
+    // Raw images: blocks the header says are erased, one bit each
+    uint32_t rawErasedBlocks[NUM_BLOCKS / 32];
+
+    bool writeRawHeader();
+    bool writeCompressedHeader();
+    bool readStoredHeader();
+    bool readStoredBlock(Block &b);
+};
+
+#endif // FLASH_IMAGE_H
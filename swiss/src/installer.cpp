@@ -31,6 +31,7 @@
 #include "util.h"
 #include "basedevice.h"
 #include "swisserror.h"
+#include "transferengine.h"
 
 #include <sifteo/abi/elf.h>
 
@@ -42,6 +43,7 @@ int Installer::run(int argc, char **argv, IODevice &_dev)
     bool launcher = false;
     bool forceLauncher = false;
     bool rpc = false;
+    bool full = false;
     const char *path = NULL;
 
     for (int i = 1; i < argc; i++) {
@@ -51,6 +53,8 @@ int Installer::run(int argc, char **argv, IODevice &_dev)
             rpc = true;
         } else if (!strcmp(argv[i], "-f")) {
             forceLauncher = true;
+        } else if (!strcmp(argv[i], "--full")) {
+            full = true;
         } else if (!path) {
             path = argv[i];
         } else {
@@ -65,7 +69,8 @@ int Installer::run(int argc, char **argv, IODevice &_dev)
                              IODevice::BASE_PID,
                              launcher,
                              forceLauncher,
-                             rpc);
+                             rpc,
+                             full);
 }
 
 Installer::Installer(IODevice &_dev) :
@@ -80,8 +85,12 @@ Installer::Installer(IODevice &_dev) :
  *      erases/allocates space for upcoming transfer
  * - Send the content of the application.
  * - Commit the transaction.
+ *
+ * If an earlier version of a game is installed, we first try a delta
+ * install, which only sends the parts of the file that changed.
  */
-int Installer::install(const char *path, int vid, int pid, bool launcher, bool forceLauncher, bool rpc)
+int Installer::install(const char *path, int vid, int pid, bool launcher, bool forceLauncher, bool rpc,
+                       bool fullInstall)
 {
     isRPC = rpc;
     isLauncher = launcher;
@@ -125,6 +134,12 @@ int Installer::install(const char *path, int vid, int pid, bool launcher, bool f
         printf("installing %s, version %s (%d bytes)\n",
             package.c_str(), version.c_str(), fileSize);
 
+    if (!launcher && !fullInstall) {
+        int rv = deltaInstall(f, fileSize);
+        if (rv != EAGAIN)
+            return rv;
+    }
+
     int rv = sendHeader(fileSize);
     if (rv != 0) {
         return rv;
@@ -231,48 +246,206 @@ int Installer::sendHeader(uint32_t filesz)
 
 /*
  * Write the body of this file.
- *
- * There are no restrictions on the format of the payload - just fit as much
- * into each packet as we can.
  */
 bool Installer::sendFileContents(FILE *f, uint32_t filesz)
 {
     rewind(f);
- 
-    unsigned progress = 0;
-    ScopedProgressBar pb(filesz);
+
+    TransferEngine engine(dev);
+    {
+        ScopedProgressBar pb(filesz);
+        engine.setProgress(&pb, 0, isRPC ? filesz : 0);
+        if (!engine.writeFile(f, filesz, UsbVolumeManager::WritePayload))
+            return false;
+    }
+
+    engine.printThroughput();
+    return true;
+}
+
+/*
+ * Delta install: the base tells us CRCs for each PAYLOAD_HASH_CHUNK of
+ * the installed game, and we only send chunks that differ. The base copies
+ * everything else from the old volume, which it keeps until commit.
+ *
+ * Returns EAGAIN if a delta install isn't possible, and we should fall
+ * back on sending the whole file.
+ */
+int Installer::deltaInstall(FILE *f, uint32_t filesz)
+{
+    const unsigned chunkSize = UsbVolumeManager::PAYLOAD_HASH_CHUNK;
+
+    unsigned sourceVolume;
+    std::vector<uint32_t> hashes;
+    if (!getInstalledHashes(sourceVolume, hashes))
+        return EAGAIN;
+
+    std::vector<uint8_t> data(filesz);
+    rewind(f);
+    if (filesz && fread(&data[0], filesz, 1, f) != 1) {
+        fprintf(stderr, "read error\n");
+        return EIO;
+    }
+
+    // Which whole chunks of the new file match the installed version?
+    std::vector<bool> unchanged(filesz / chunkSize);
+    unsigned numUnchanged = 0;
+    for (unsigned i = 0; i < unchanged.size() && i < hashes.size(); ++i) {
+        unchanged[i] = Util::baseCrc32(&data[i * chunkSize], chunkSize) == hashes[i];
+        numUnchanged += unchanged[i];
+    }
+
+    // Nothing to gain, and a delta needs room for both versions at once
+    if (!numUnchanged)
+        return EAGAIN;
+
+    int rv = sendDeltaHeader(filesz, sourceVolume);
+    if (rv == ENOSPC) {
+        printf("not enough room for a delta install, sending the whole file\n");
+        return EAGAIN;
+    }
+    if (rv != EOK)
+        return rv;
+
+    if (!sendDeltaContents(data, unchanged) || !commit())
+        return EIO;
+
+    return EOK;
+}
+
+bool Installer::getInstalledHashes(unsigned &volume, std::vector<uint32_t> &hashes)
+{
+    /*
+     * Find the installed version of this package, and collect its payload
+     * hashes. Fails if it isn't installed, or the base's firmware doesn't
+     * support delta installs.
+     */
+
+    BaseDevice base(dev);
+    if (!base.volumeCodeForPackage(package, volume))
+        return false;
 
     for (;;) {
         USBProtocolMsg m(USBProtocol::Installer);
-        m.header |= UsbVolumeManager::WritePayload;
+        m.header |= UsbVolumeManager::PayloadHashes;
+        UsbVolumeManager::PayloadHashRequest *req =
+            m.zeroCopyAppend<UsbVolumeManager::PayloadHashRequest>();
+        req->volume = volume;
+        req->firstChunk = hashes.size();
 
-        unsigned chunk = std::min(filesz - progress, m.bytesFree());
-        m.len += chunk;
-        progress += chunk;
-        if (isRPC) {
-            fprintf(stdout, "::progress:%u:%u\n", progress, filesz); fflush(stdout);
-        }
-        if (!chunk)
-            return true;
-
-        if (fread(m.payload, chunk, 1, f) != 1) {
-            fprintf(stderr, "read error\n");
+        if (!base.writeAndWaitForReply(m))
             return false;
-        }
 
-        if (dev.writePacket(m.bytes, m.len) < 0) {
-            return false;
-        }
+        unsigned count = m.payloadLen() / sizeof(uint32_t);
+        if (!count)
+            break;
 
-        while (dev.numPendingOUTPackets() > IODevice::MAX_OUTSTANDING_OUT_TRANSFERS) {
-            dev.processEvents(1);
-        }
+        const uint32_t *crcs = m.castPayload<uint32_t>();
+        hashes.insert(hashes.end(), crcs, crcs + count);
+    }
 
-        pb.update(progress);
+    return !hashes.empty();
+}
+
+int Installer::sendDeltaHeader(uint32_t filesz, unsigned sourceVolume)
+{
+    USBProtocolMsg m(USBProtocol::Installer);
+    m.header |= UsbVolumeManager::WriteDeltaGameHeader;
+
+    UsbVolumeManager::DeltaGameHeader *hdr =
+        m.zeroCopyAppend<UsbVolumeManager::DeltaGameHeader>();
+    hdr->numBytes = filesz;
+    hdr->sourceVolume = sourceVolume;
+
+    if (package.size() + 1 > m.bytesFree()) {
+        fprintf(stderr, "package name too long\n");
+        return EINVAL;
     }
+    m.append((uint8_t*)package.c_str(), package.size() + 1);
 
-    // should never get here
-    return false;
+    if (dev.writePacket(m.bytes, m.len) < 0) {
+        return EIO;
+    }
+
+    if (!BaseDevice(dev).waitForReply(UsbVolumeManager::WroteHeaderOK, m)) {
+        if (m.header == UsbVolumeManager::WroteHeaderFail)
+            return ENOSPC;
+
+        fprintf(stderr, "error: unexpected response (0x%x)\n", m.header);
+        return EIO;
+    }
+
+    return EOK;
+}
+
+bool Installer::sendDeltaContents(const std::vector<uint8_t> &data,
+    const std::vector<bool> &unchanged)
+{
+    /*
+     * Alternate between runs of unchanged chunks, which the base copies,
+     * and runs of changed data, which we send. A partial chunk at the end
+     * of the file is always sent.
+     */
+
+    const unsigned chunkSize = UsbVolumeManager::PAYLOAD_HASH_CHUNK;
+    const unsigned filesz = data.size();
+
+    // Large copies are split up, so the base never spends too long on one packet
+    const unsigned maxCopy = 64 * 1024;
+
+    TransferEngine engine(dev);
+    unsigned offset = 0;
+    unsigned copied = 0;
+
+    {
+        ScopedProgressBar pb(filesz);
+
+        while (offset < filesz) {
+            unsigned end = offset;
+            unsigned chunk = offset / chunkSize;
+
+            if (chunk < unchanged.size() && unchanged[chunk]) {
+                while (chunk < unchanged.size() && unchanged[chunk] && end - offset < maxCopy) {
+                    chunk++;
+                    end += chunkSize;
+                }
+
+                USBProtocolMsg m(USBProtocol::Installer);
+                m.header |= UsbVolumeManager::WritePayloadCopy;
+                m.zeroCopyAppend<UsbVolumeManager::PayloadCopyRequest>()->numBytes = end - offset;
+
+                while (dev.numPendingOUTPackets() >= engine.window())
+                    dev.processEvents(1);
+                if (dev.writePacket(m.bytes, m.len) < 0)
+                    return false;
+
+                copied += end - offset;
+                pb.update(end);
+                if (isRPC) {
+                    fprintf(stdout, "::progress:%u:%u\n", end, filesz); fflush(stdout);
+                }
+
+            } else {
+                while (chunk < unchanged.size() && !unchanged[chunk]) {
+                    chunk++;
+                    end += chunkSize;
+                }
+                if (chunk >= unchanged.size())
+                    end = filesz;
+
+                engine.setProgress(&pb, offset, isRPC ? filesz : 0);
+                if (!engine.writeBuffer(&data[offset], end - offset, UsbVolumeManager::WritePayload))
+                    return false;
+            }
+
+            offset = end;
+        }
+    }
+
+    printf("delta install: sent %u bytes, reused %u bytes from the installed version\n",
+        filesz - copied, copied);
+    engine.printThroughput();
+    return true;
 }
 
 /*
@@ -30,6 +30,7 @@
 #include "usbvolumemanager.h"
 
 #include <string>
+#include <vector>
 
 class Installer
 {
@@ -38,7 +39,8 @@ public:
 
     static int run(int argc, char **argv, IODevice &_dev);
 
-    int install(const char *path, int vid, int pid, bool launcher, bool forceLauncher, bool rpc);
+    int install(const char *path, int vid, int pid, bool launcher, bool forceLauncher, bool rpc,
+                bool fullInstall = false);
 
     static unsigned getInstallableElfSize(FILE *f);
 
@@ -48,6 +50,11 @@ private:
     bool sendFileContents(FILE *f, uint32_t filesz);
     bool commit();
 
+    int deltaInstall(FILE *f, uint32_t filesz);
+    bool getInstalledHashes(unsigned &volume, std::vector<uint32_t> &hashes);
+    int sendDeltaHeader(uint32_t filesz, unsigned sourceVolume);
+    bool sendDeltaContents(const std::vector<uint8_t> &data, const std::vector<bool> &unchanged);
+
     IODevice &dev;
     std::string package, version;
     bool isLauncher;
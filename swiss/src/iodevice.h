@@ -51,6 +51,9 @@ public:
     virtual unsigned numPendingINPackets() const = 0;
     virtual int readPacket(uint8_t *buf, unsigned maxlen, unsigned & rxlen) = 0;
 
+    // Request room for at least this many IN packets in flight at once.
+    virtual void setINWindow(unsigned numTransfers) {}
+
     virtual unsigned maxOUTPacketSize() const = 0;
     virtual unsigned numPendingOUTPackets() const = 0;
     virtual int writePacket(const uint8_t *buf, unsigned len) = 0;
@@ -26,11 +26,42 @@
 #include "listen.h"
 #include "libusb.h"
 #include "swisserror.h"
+#include "util.h"
 
 #include <stdio.h>
+#include <errno.h>
+#include <string.h>
 
 sig_atomic_t Listen::interruptRequested;
 
+
+/*
+ * DecodeQueue --
+ *
+ *    Decodes and prints log records on a separate thread, so formatting
+ *    output never holds up the USB loop.
+ */
+
+class Listen::DecodeQueue : public LogRecordQueue
+{
+public:
+    DecodeQueue(Listen &listen, FILE *f) : listen(listen), file(f) {}
+
+    ~DecodeQueue() {
+        finish();
+    }
+
+protected:
+    bool consume(const LogRecord &r) {
+        return listen.writeRecord(file, r);
+    }
+
+private:
+    Listen &listen;
+    FILE *file;
+};
+
+
 int Listen::run(int argc, char **argv, IODevice &_dev)
 {
     if (argc < 2) {
@@ -48,6 +79,8 @@ int Listen::run(int argc, char **argv, IODevice &_dev)
 
     // optional out file, defaults to stdout
     char *outpath = NULL;
+    char *capturepath = NULL;
+    char *decodepath = NULL;
     bool flush = false;
     for (int i = 2; i < argc; ++i) {
 
@@ -60,9 +93,25 @@ int Listen::run(int argc, char **argv, IODevice &_dev)
             i++;
         }
 
+        if (i + 1 < argc && !strcmp(argv[i], "--capture")) {
+            capturepath = argv[i + 1];
+            i++;
+        }
+
+        if (i + 1 < argc && !strcmp(argv[i], "--decode")) {
+            decodepath = argv[i + 1];
+            i++;
+        }
     }
 
     Listen listener(_dev);
+
+    if (capturepath)
+        return listener.capture(capturepath);
+
+    if (decodepath)
+        return listener.decode(elfpath, decodepath, outpath);
+
     return listener.listen(elfpath, outpath, flush);
 }
 
@@ -113,42 +162,173 @@ int Listen::listen(const char *elfpath, const char * outpath, bool flushLogs)
 
     logDecoder.init(flushLogs);
 
+    DecodeQueue queue(*this, fout);
+    queue.start();
+
+    bool success = receive(queue);
+    queue.finish();
+
+    if (queue.numDropped()) {
+        fprintf(stderr, "listen: %llu of %llu log records dropped\n",
+            (unsigned long long) queue.numDropped(),
+            (unsigned long long) (queue.numRecords() + queue.numDropped()));
+    }
+
+    fclose(fout);
+    return success ? EOK : EIO;
+}
+
+int Listen::capture(const char *capturepath)
+{
+    /*
+     * Record raw log packets without decoding them. Decoding happens
+     * later, with --decode, so nothing slows down reception.
+     */
+
+    if (!dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID)) {
+        return ENODEV;
+    }
+
+    FILE *f = fopen(capturepath, "wb");
+    if (!f) {
+        fprintf(stderr, "can't open %s (%s)\n", capturepath, strerror(errno));
+        return ENOENT;
+    }
+
+    static char fileBuffer[1024 * 1024];
+    setvbuf(f, fileBuffer, _IOFBF, sizeof fileBuffer);
+
+    if (!LogCaptureFile::writeHeader(f)) {
+        fprintf(stderr, "listen: error writing %s\n", capturepath);
+        fclose(f);
+        return EIO;
+    }
+
+    LogCaptureWriter writer(f);
+    writer.start();
+
+    bool success = receive(writer);
+    if (!writer.finish()) {
+        fprintf(stderr, "listen: error writing %s\n", capturepath);
+        success = false;
+    }
+
+    fprintf(stderr, "listen: captured %llu log records, %llu dropped\n",
+        (unsigned long long) writer.numRecords(),
+        (unsigned long long) writer.numDropped());
+
+    if (fclose(f)) {
+        fprintf(stderr, "listen: error writing %s\n", capturepath);
+        success = false;
+    }
+
+    return success ? EOK : EIO;
+}
+
+int Listen::decode(const char *elfpath, const char *capturepath, const char *outpath)
+{
+    if (!dbgInfo.init(elfpath)) {
+        fprintf(stderr, "listen: couldn't initialize elf: %s\n", elfpath);
+        return ENOENT;
+    }
+
+    FILE *fin = fopen(capturepath, "rb");
+    if (!fin) {
+        fprintf(stderr, "can't open %s (%s)\n", capturepath, strerror(errno));
+        return ENOENT;
+    }
+
+    if (!LogCaptureFile::readHeader(fin)) {
+        fprintf(stderr, "listen: %s is not a log capture\n", capturepath);
+        fclose(fin);
+        return EINVAL;
+    }
+
+    FILE *fout;
+    if (!getFileOrStdout(&fout, outpath)) {
+        fclose(fin);
+        return ENOENT;
+    }
+
+    logDecoder.init(false);
+
+    uint64_t numRecords = 0;
+    uint64_t numDropped = 0;
+    LogRecord r;
+
+    while (LogCaptureFile::readRecord(fin, r)) {
+        numRecords++;
+        numDropped += r.dropped;
+        writeRecord(fout, r);
+    }
+
+    int result = EOK;
+    if (!feof(fin)) {
+        fprintf(stderr, "listen: %s is truncated or corrupt\n", capturepath);
+        result = EIO;
+    }
+
+    fprintf(stderr, "listen: decoded %llu log records, %llu dropped\n",
+        (unsigned long long) numRecords, (unsigned long long) numDropped);
+
+    fclose(fin);
+    fclose(fout);
+    return result;
+}
+
+bool Listen::receive(LogRecordQueue &queue)
+{
+    /*
+     * Pass log packets to 'queue' until interrupted.
+     *
+     * We keep handling USB events while packets are waiting, rather than
+     * only when we've run dry, so IN transfers are always resubmitted
+     * promptly and the base never sees us stop listening.
+     */
+
+    double startTime = Util::now();
+
     while (!interruptRequested) {
 
-        if (dev.numPendingINPackets() == 0) {
-            if (dev.processEvents(10) < 0) {
-                fprintf(stderr, "listen: error in processEvents()\n");
-                return EIO;
-            }
+        // Wait a little if there's nothing to do, so we can check for an interrupt
+        unsigned timeout = dev.numPendingINPackets() ? 0 : 10;
+        if (dev.processEvents(timeout) < 0) {
+            fprintf(stderr, "listen: error in processEvents()\n");
+            return false;
+        }
+
+        while (dev.numPendingINPackets()) {
+            LogRecord r;
+            int status = dev.readPacket(r.msg.bytes, r.msg.MAX_LEN, r.msg.len);
 
-            // yield so we can check again for an interrupt request
-            if (dev.numPendingINPackets() == 0) {
+            if (status == LIBUSB_TRANSFER_ERROR || status == LIBUSB_TRANSFER_OVERFLOW) {
+                fprintf(stderr, "listen: io error: %d\n", status);
+                queue.addDropped(1);
                 continue;
             }
-        }
-
-        USBProtocolMsg m;
-        int r = dev.readPacket(m.bytes, m.MAX_LEN, m.len);
-        if (r != LIBUSB_TRANSFER_COMPLETED) {
-            if (r == LIBUSB_TRANSFER_ERROR || r == LIBUSB_TRANSFER_OVERFLOW) {
-                fprintf(stderr, "listen: io error: %d\n", r);
+            if (status != LIBUSB_TRANSFER_COMPLETED) {
+                return false;
             }
-            break;
-        }
 
-        if (m.subsystem() == USBProtocol::Logger) {
-            if (!writeRecord(fout, m)) {
-                break;
+            if (r.msg.len && r.msg.subsystem() == USBProtocol::Logger) {
+                r.timestamp = uint64_t((Util::now() - startTime) * 1e6);
+                queue.push(r);
             }
         }
     }
 
-    fclose(fout);
-    return EOK;
+    return true;
 }
 
-bool Listen::writeRecord(FILE *f, const USBProtocolMsg & m)
+bool Listen::writeRecord(FILE *f, const LogRecord &r)
 {
+    if (r.dropped) {
+        fprintf(stderr, "listen: %u log records dropped at %.6f s\n",
+            r.dropped, r.timestamp * 1e-6);
+    }
+
+    const USBProtocolMsg &m = r.msg;
+
     // mask off high 4 bits which specify the USBProtocolMsg subsystem
     SvmLogTag tag(m.header & 0xfffffff);
     size_t sz = logDecoder.decode(f, dbgInfo, tag, reinterpret_cast<const uint32_t*>(&m.payload[0]));
@@ -29,6 +29,7 @@
 #include "iodevice.h"
 #include "elfdebuginfo.h"
 #include "logdecoder.h"
+#include "logcapture.h"
 
 #include <signal.h>
 
@@ -40,8 +41,14 @@ public:
 private:
     Listen(IODevice &_dev);
 
+    class DecodeQueue;
+
     int listen(const char *elfpath, const char *outpath, bool flushLogs=false);
-    bool writeRecord(FILE *f, const USBProtocolMsg &m);
+    int capture(const char *capturepath);
+    int decode(const char *elfpath, const char *capturepath, const char *outpath);
+
+    bool receive(LogRecordQueue &queue);
+    bool writeRecord(FILE *f, const LogRecord &r);
 
     IODevice &dev;
     ELFDebugInfo dbgInfo;
@@ -0,0 +1,164 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "logcapture.h"
+
+#include <string.h>
+
+
+LogRecordQueue::LogRecordQueue()
+    : thread(0), failed(false), finished(false),
+      pendingDrops(0), mRecords(0), mDropped(0)
+{
+}
+
+LogRecordQueue::~LogRecordQueue()
+{
+    finish();
+}
+
+void LogRecordQueue::start()
+{
+    // Not in the constructor: the thread calls our subclass's consume()
+    if (!thread)
+        thread = new tthread::thread(threadFn, this);
+}
+
+void LogRecordQueue::push(const LogRecord &r)
+{
+    tthread::lock_guard<tthread::mutex> guard(lock);
+
+    if (failed || queue.size() >= MAX_QUEUED_RECORDS) {
+        pendingDrops++;
+        mDropped++;
+        return;
+    }
+
+    queue.push_back(r);
+    queue.back().dropped += pendingDrops;
+    pendingDrops = 0;
+    mRecords++;
+    cond.notify_all();
+}
+
+void LogRecordQueue::addDropped(unsigned count)
+{
+    tthread::lock_guard<tthread::mutex> guard(lock);
+    pendingDrops += count;
+    mDropped += count;
+}
+
+bool LogRecordQueue::finish()
+{
+    if (!thread)
+        return !failed;
+
+    lock.lock();
+    finished = true;
+    cond.notify_all();
+    lock.unlock();
+
+    thread->join();
+    delete thread;
+    thread = 0;
+
+    return !failed;
+}
+
+void LogRecordQueue::threadFn(void *param)
+{
+    static_cast<LogRecordQueue*>(param)->run();
+}
+
+void LogRecordQueue::run()
+{
+    // Take everything queued at once, so the producer rarely waits on us
+
+    std::vector<LogRecord> batch;
+
+    for (;;) {
+        {
+            tthread::lock_guard<tthread::mutex> guard(lock);
+            while (queue.empty() && !finished)
+                cond.wait(lock);
+            if (queue.empty())
+                return;
+            batch.swap(queue);
+        }
+
+        for (std::vector<LogRecord>::const_iterator i = batch.begin();
+             i != batch.end(); ++i) {
+            if (!consume(*i)) {
+                tthread::lock_guard<tthread::mutex> guard(lock);
+                failed = true;
+                queue.clear();
+                return;
+            }
+        }
+        batch.clear();
+    }
+}
+
+
+bool LogCaptureFile::writeHeader(FILE *f)
+{
+    FileHeader hdr;
+    hdr.magic = MAGIC;
+    hdr.version = VERSION;
+    return fwrite(&hdr, sizeof hdr, 1, f) == 1;
+}
+
+bool LogCaptureFile::writeRecord(FILE *f, const LogRecord &r)
+{
+    RecordHeader hdr;
+    hdr.timestamp = r.timestamp;
+    hdr.dropped = r.dropped;
+    hdr.length = r.msg.len;
+
+    return fwrite(&hdr, sizeof hdr, 1, f) == 1 &&
+           (!hdr.length || fwrite(r.msg.bytes, hdr.length, 1, f) == 1);
+}
+
+bool LogCaptureFile::readHeader(FILE *f)
+{
+    FileHeader hdr;
+    return fread(&hdr, sizeof hdr, 1, f) == 1 &&
+           hdr.magic == MAGIC && hdr.version == VERSION;
+}
+
+bool LogCaptureFile::readRecord(FILE *f, LogRecord &r)
+{
+    RecordHeader hdr;
+    if (fread(&hdr, sizeof hdr, 1, f) != 1)
+        return false;
+
+    if (hdr.length > USBProtocolMsg::MAX_LEN)
+        return false;
+
+    r.timestamp = hdr.timestamp;
+    r.dropped = hdr.dropped;
+    r.msg.len = hdr.length;
+    return !hdr.length || fread(r.msg.bytes, hdr.length, 1, f) == 1;
+}
@@ -0,0 +1,168 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LOG_CAPTURE_H
+#define LOG_CAPTURE_H
+
+#include "usbprotocol.h"
+#include "tinythread.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * A log packet from the base, with the host time it arrived.
+ */
+
+struct LogRecord {
+    uint64_t timestamp;     // Microseconds since the capture began
+    uint32_t dropped;       // Records lost just before this one
+    USBProtocolMsg msg;
+
+    LogRecord() : timestamp(0), dropped(0) {}
+};
+
+
+/*
+ * LogRecordQueue --
+ *
+ *    Hands log records from the USB loop to a consumer on another thread.
+ *
+ *    push() never blocks. If the consumer falls too far behind, new
+ *    records are dropped and counted, and the count is passed along with
+ *    the next record that does make it through. Blocking instead would
+ *    stop us from servicing the IN endpoint, and the base gives up on
+ *    sending logs to a host that isn't reading them.
+ */
+
+class LogRecordQueue
+{
+public:
+    static const unsigned MAX_QUEUED_RECORDS = 256 * 1024;
+
+    LogRecordQueue();
+
+    // Subclasses must finish() before they're destroyed
+    virtual ~LogRecordQueue();
+
+    // Start the consumer thread
+    void start();
+
+    void push(const LogRecord &r);
+
+    // Count records that were lost before they reached the queue
+    void addDropped(unsigned count);
+
+    // Consume everything queued, then stop. Returns false if consume() failed.
+    bool finish();
+
+    uint64_t numRecords() const {
+        return mRecords;
+    }
+
+    uint64_t numDropped() const {
+        return mDropped;
+    }
+
+protected:
+    // Called on the consumer thread, in order. Returning false stops the queue.
+    virtual bool consume(const LogRecord &r) = 0;
+
+private:
+    tthread::mutex lock;
+    tthread::condition_variable cond;
+    tthread::thread *thread;
+    std::vector<LogRecord> queue;
+    bool failed, finished;
+
+    // Producer-side state
+    uint32_t pendingDrops;
+    uint64_t mRecords;
+    uint64_t mDropped;
+
+    static void threadFn(void *param);
+    void run();
+};
+
+
+/*
+ * LogCaptureFile --
+ *
+ *    Raw log captures, for decoding later with "listen --decode". A capture
+ *    is a FileHeader followed by records, each a RecordHeader and then the
+ *    complete USB packet, exactly as it arrived.
+ */
+
+class LogCaptureFile
+{
+public:
+    static const uint32_t MAGIC = 0x474c5753;   // "SWLG"
+    static const uint32_t VERSION = 1;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+    };
+
+    struct RecordHeader {
+        uint64_t timestamp;
+        uint32_t dropped;
+        uint32_t length;
+    };
+
+    static bool writeHeader(FILE *f);
+    static bool writeRecord(FILE *f, const LogRecord &r);
+
+    static bool readHeader(FILE *f);
+
+    // Returns false at the end of the file, or if the record is corrupt
+    static bool readRecord(FILE *f, LogRecord &r);
+};
+
+
+/*
+ * Writes every record it's given to a capture file, on its own thread.
+ */
+
+class LogCaptureWriter : public LogRecordQueue
+{
+public:
+    LogCaptureWriter(FILE *f) : file(f) {}
+
+    ~LogCaptureWriter() {
+        finish();
+    }
+
+protected:
+    bool consume(const LogRecord &r) {
+        return LogCaptureFile::writeRecord(file, r);
+    }
+
+private:
+    FILE *file;
+};
+
+#endif // LOG_CAPTURE_H
@@ -38,6 +38,17 @@ void LogDecoder::init(bool aFlushLogs)
     scriptType = _SYS_SCRIPT_NONE;
     scriptBuffer.clear();
     handlers.clear();
+    formatStrings.clear();
+}
+
+const std::string &LogDecoder::formatString(ELFDebugInfo &DI, uint32_t offset)
+{
+    // A busy game logs the same few messages over and over
+    std::map<uint32_t, std::string>::iterator I = formatStrings.find(offset);
+    if (I != formatStrings.end())
+        return I->second;
+
+    return formatStrings[offset] = DI.readString(".debug_logstr", offset);
 }
 
 void LogDecoder::formatLog(ELFDebugInfo &DI,
@@ -217,7 +228,8 @@ size_t LogDecoder::decode(FILE *f, ELFDebugInfo &DI, SvmLogTag tag, const uint32
         // Stow all arguments, plus the log tag. The post-processor
         // will do some printf()-like formatting on the stored arguments.
         case _SYS_LOGTYPE_FMT: {
-            std::string fmt = DI.readString(".debug_logstr", tag.getParam());
+            // A copy, since formatLog() edits the string as it goes
+            std::string fmt = formatString(DI, tag.getParam());
             if (fmt.empty()) {
                 LOG(("SVMLOG: No symbol table found. Raw data:\n"
                      "\t[%08x] %08x %08x %08x %08x %08x %08x %08x\n",
@@ -54,12 +54,16 @@ private:
     void formatLog(ELFDebugInfo &DI, char *out, size_t outSize,
         char *fmt, const uint32_t *args, size_t argCount);
 
+    const std::string &formatString(ELFDebugInfo &DI, uint32_t offset);
     void writeLog(FILE *f, const char *str);
     void runScript();
 
     unsigned scriptType;
     std::string scriptBuffer;
     std::map<unsigned, ScriptHandler> handlers;
+
+    // Format strings we've already read out of .debug_logstr, by offset
+    std::map<uint32_t, std::string> formatStrings;
     bool flushLogs;
 };
 
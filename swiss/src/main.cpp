@@ -32,22 +32,30 @@
 #include "delete.h"
 #include "paircube.h"
 #include "usbdevice.h"
+#include "tcpdevice.h"
 #include "reboot.h"
 #include "macros.h"
 #include "backup.h"
+#include "restore.h"
 #include "savedata.h"
 #include "listen.h"
+#include "transferengine.h"
 
 #include <stdio.h>
 #include <string.h>
 
+// Set with '--siftulator', '--link-latency' and '--link-bandwidth'
+static unsigned siftulatorPort;
+static unsigned linkLatencyMillis;
+static unsigned linkBytesPerSecond;
+
 static const Command commands[] = {
     // Keeping this list in alphabetical order, for lack of a better ordering...
 
     {
         "backup",
         "create a full backup of a Sifteo Base filesystem",
-        "backup <filesystem.bin>",
+        "backup [--raw] <filesystem.bin>",
         Backup::run
     },
     {
@@ -65,13 +73,13 @@ static const Command commands[] = {
     {
         "install",
         "install a new game to the Sifteo Base",
-        "install [-l] <app.elf>",
+        "install [-l] [--full] <app.elf>",
         Installer::run
     },
     {
         "listen",
         "listen for and decode log activity from the Sifteo base",
-        "listen <app.elf> [--fout <file.txt> | --flush-logs]",
+        "listen <app.elf> [--fout <file.txt>] [--flush-logs] [--capture|--decode <file.bin>]",
         Listen::run
     },
     {
@@ -89,7 +97,7 @@ static const Command commands[] = {
     {
         "profile",
         "capture profiling data from an app",
-        "profile <app.elf> <output.txt>",
+        "profile (<app.elf> <output.txt> [--folded] [--window <seconds>] | --syscalls [--interval <seconds>])",
         Profiler::run
     },
     {
@@ -98,10 +106,16 @@ static const Command commands[] = {
         "reboot",
         Reboot::run
     },
+    {
+        "restore",
+        "restore a full backup to a Sifteo Base, resuming if interrupted",
+        "restore <filesystem.bin>",
+        Restore::run
+    },
     {
         "savedata",
         "extract or restore an application's save data",
-        "savedata (extract <package> <fout> [--raw] | restore <fin> | delete <pkg>)",
+        "savedata (extract (<package> <fout> [--raw] | --all <dir>) | restore <fin> | delete <pkg>)",
         SaveData::run
     },
     {
@@ -140,7 +154,7 @@ static void version()
 #endif
 }
 
-static int run(int argc, char **argv, UsbDevice &usbdev)
+static int run(int argc, char **argv, IODevice &dev)
 {
     const unsigned numCommands = sizeof(commands) / sizeof(commands[0]);
 
@@ -149,7 +163,7 @@ static int run(int argc, char **argv, UsbDevice &usbdev)
 
     for (unsigned i = 0; i < numCommands; ++i) {
         if (!strcmp(commandName, commands[i].name))
-            return commands[i].run(argc, argv, usbdev);
+            return commands[i].run(argc, argv, dev);
     }
 
     fprintf(stderr, "no command named %s\n", commandName);
@@ -180,6 +194,47 @@ static unsigned handleGlobalArgs(int argc, char **argv)
             continue;
         }
 
+        if (!strcmp(argv[i], "--usb-window") && i + 1 < argc) {
+
+            // Number of USB transfers to keep in flight during bulk transfers
+            unsigned long window = strtoul(argv[i + 1], NULL, 0);
+            TransferEngine::defaultWindow = window;
+
+            consumed += 2;
+            i++;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--siftulator") && i + 1 < argc) {
+
+            // Talk to Siftulator's '--usb-port' instead of a real base
+            siftulatorPort = strtoul(argv[i + 1], NULL, 0);
+
+            consumed += 2;
+            i++;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--link-latency") && i + 1 < argc) {
+
+            // Simulated one-way latency for '--siftulator', in milliseconds
+            linkLatencyMillis = strtoul(argv[i + 1], NULL, 0);
+
+            consumed += 2;
+            i++;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "--link-bandwidth") && i + 1 < argc) {
+
+            // Simulated bandwidth for '--siftulator', in kB/s
+            linkBytesPerSecond = strtoul(argv[i + 1], NULL, 0) * 1000;
+
+            consumed += 2;
+            i++;
+            continue;
+        }
+
     }
 
     return consumed;
@@ -197,9 +252,6 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    /*
-     * TODO: add support for specifying a TCP connection to siftulator.
-     */
     Usb::init();
 
     unsigned consumed = handleGlobalArgs(argc, argv);
@@ -212,12 +264,16 @@ int main(int argc, char **argv)
     }
 
     UsbDevice usbdev;
-    int rv = run(argc, argv, usbdev);
+    TcpDevice tcpdev(siftulatorPort);
+    tcpdev.setLink(linkLatencyMillis, linkBytesPerSecond);
+
+    IODevice &dev = siftulatorPort ? static_cast<IODevice&>(tcpdev) : usbdev;
+    int rv = run(argc, argv, dev);
 
-    if (usbdev.isOpen()) {
-        usbdev.close();
-        while (usbdev.isOpen()) {
-            usbdev.processEvents(1);
+    if (dev.isOpen()) {
+        dev.close();
+        while (dev.isOpen()) {
+            dev.processEvents(1);
         }
     }
 
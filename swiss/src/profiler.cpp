@@ -24,20 +24,51 @@
  */
 
 #include "profiler.h"
+#include "syscallprofiler.h"
 #include "elfdebuginfo.h"
 #include "usbprotocol.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <set>
+#include <vector>
+#include <algorithm>
 
 sig_atomic_t Profiler::interruptRequested;
 ELFDebugInfo Profiler::dbgInfo;
 
 int Profiler::run(int argc, char **argv, IODevice &_dev)
 {
-    if (argc < 3) {
+    const char *elfPath = NULL;
+    const char *outPath = NULL;
+    Format format = Text;
+    unsigned windowSeconds = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--syscalls"))
+            return SyscallProfiler::run(argc, argv, _dev);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--folded")) {
+            format = Folded;
+        } else if (i + 1 < argc && !strcmp(argv[i], "--window")) {
+            windowSeconds = strtoul(argv[i + 1], NULL, 0);
+            i++;
+        } else if (!elfPath) {
+            elfPath = argv[i];
+        } else if (!outPath) {
+            outPath = argv[i];
+        } else {
+            fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!outPath) {
         fprintf(stderr, "not enough args\n");
         return 1;
     }
@@ -48,13 +79,13 @@ int Profiler::run(int argc, char **argv, IODevice &_dev)
     }
 
     Profiler profiler(_dev);
-    bool success = profiler.profile(argv[1], argv[2]);
+    bool success = profiler.profile(elfPath, outPath, format, windowSeconds);
 
     return success ? 0 : 1;
 }
 
 Profiler::Profiler(IODevice &_dev) :
-    dev(_dev)
+    windowIndex(0), dev(_dev)
 {
 }
 
@@ -64,9 +95,8 @@ void Profiler::onSignal(int sig) {
     }
 }
 
-static bool myfunction (uint64_t i,uint64_t j) { return (i<j); }
-
-bool Profiler::profile(const char *elfPath, const char *outPath)
+bool Profiler::profile(const char *elfPath, const char *outPath,
+                       Format format, unsigned windowSeconds)
 {
     dbgInfo.clear();
     if (!dbgInfo.init(elfPath)) {
@@ -74,17 +104,18 @@ bool Profiler::profile(const char *elfPath, const char *outPath)
         return false;
     }
 
-    FILE *fout;
+    window.clear();
+    totals.clear();
+    windowIndex = 0;
+
+    FILE *stream = NULL;
     if (!strcmp(outPath, "stderr")) {
-        fout = stderr;
+        stream = stderr;
     } else if (!strcmp(outPath, "stdout")) {
-        fout = stderr;
-    }
-    else {
-        if (!(fout = fopen(outPath, "w"))) {
-            fprintf(stderr, "could not open %s: %s\n", outPath, strerror(errno));
-            return false;
-        }
+        stream = stdout;
+    } else if (!writeReport(outPath, totals, format)) {
+        // Find out now, rather than after a long session, if we can't write
+        return false;
     }
 
     if (!dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID))
@@ -97,26 +128,35 @@ bool Profiler::profile(const char *elfPath, const char *outPath)
         dev.writePacket(m.bytes, m.len);
     }
 
-    std::map<Addr, Count> addresses;
     interruptRequested = false;
-    uint64_t totalSamples = 0;
+    bool success = true;
+    time_t windowStart = time(NULL);
 
-    while (!interruptRequested) {
+    while (!interruptRequested && success) {
+
+        if (windowSeconds) {
+            time_t t = time(NULL);
+            if (t - windowStart >= (time_t) windowSeconds) {
+                success = flushWindow(outPath, stream, format, t - windowStart);
+                windowStart = t;
+            }
+        }
 
-        while (!dev.numPendingINPackets())
+        if (!dev.numPendingINPackets()) {
             dev.processEvents(1);
+            continue;
+        }
 
         USBProtocolMsg m;
         dev.readPacket(m.bytes, m.MAX_LEN, m.len);
-        if (!m.len)
+        if (!m.len || m.subsystem() != USBProtocol::Profiler)
             continue;
 
         unsigned numSamples = m.payloadLen() / sizeof(uint32_t);
         const uint32_t *address = reinterpret_cast<uint32_t*>(m.payload);
 
         for (unsigned i = 0; i < numSamples; ++i) {
-            addresses[*address]++;
-            totalSamples++;
+            addSample(*address);
             address++;
         }
     }
@@ -131,76 +171,189 @@ bool Profiler::profile(const char *elfPath, const char *outPath)
             dev.processEvents(1);
     }
 
+    if (!success)
+        return false;
+
     fprintf(stderr, "interrupt received, writing sample data...");
-    prettyPrintSamples(addresses, totalSamples, fout);
+
+    if (windowSeconds) {
+        // The last, partial, window. This also updates the totals file.
+        success = flushWindow(outPath, stream, format, time(NULL) - windowStart);
+    } else if (stream) {
+        writeReport(stream, window, format);
+    } else {
+        success = writeReport(outPath, window, format);
+    }
+
     fprintf(stderr, "done\n");
+    return success;
+}
 
-    return true;
+void Profiler::addSample(uint32_t sample)
+{
+    /*
+     * Count a raw sample against the function containing it. Lookups go
+     * through the debug info's symbol index, the same one used for every
+     * other address we format, so there's no per-address state here.
+     */
+
+    Addr subsystem = sample & 0xf0000000;
+    const Elf::Symbol *sym = dbgInfo.lookupSymbol(sample & 0x0fffffff);
+    Addr function = sym ? (sym->st_value & 0x0fffffff) : UNKNOWN_FUNCTION;
+
+    window.functions[subsystem | function]++;
+    window.total++;
 }
 
-void Profiler::prettyPrintSamples(const std::map<Addr, Count> &addresses, uint64_t total, FILE *f)
+bool Profiler::flushWindow(const char *outPath, FILE *stream, Format format,
+                           unsigned seconds)
 {
     /*
-     * Collapse multiple samples from different offsets within the same
-     * function into a single representation for that function.
+     * Report the samples since the last flush, then fold them into the
+     * running totals.
      *
-     * Split the function name by the + on the end that specifies an
-     * offset into the function.
+     * When writing to a file, each window gets its own numbered file next
+     * to 'outPath', and 'outPath' itself is rewritten with the totals so far.
+     * A session that ends abruptly loses at most one window.
      *
-     * Right now, only capturing the lowest address we see for a given function.
-     * Could split this back out if it proves useful in the future.
+     * When writing to stdout or stderr, windows are written one after
+     * another. Flame graph tools sum repeated stacks, so the folded output
+     * of a whole session can be piped straight into one.
      */
 
-    // not crazy about this code, but didn't want to spend much longer investigating
-    // a better solution...
+    windowIndex++;
+    fprintf(stderr, "window %u: %u samples in %u seconds\n",
+        windowIndex, (unsigned) window.total, seconds);
+
+    for (FuncCounts::const_iterator i = window.functions.begin();
+         i != window.functions.end(); ++i)
+        totals.functions[i->first] += i->second;
+    totals.total += window.total;
+
+    bool success = true;
+    if (stream) {
+        if (format == Text)
+            fprintf(stream, "\n######## Window %u, %u seconds ########\n",
+                windowIndex, seconds);
+        writeReport(stream, window, format);
+    } else {
+        success = writeReport(windowPath(outPath, windowIndex).c_str(), window, format)
+               && writeReport(outPath, totals, format);
+    }
 
-    std::map<std::string, FuncInfo> samples;
-    for (std::map<Addr, Count>::const_iterator i = addresses.begin();
-         i != addresses.end(); ++i)
-    {
-        Addr a = i->first;
-        std::string s = dbgInfo.formatAddress(a & 0xfffffff);
-        std::string base = s.substr(0, s.find('+'));
+    window.clear();
+    return success;
+}
 
-        if (a < samples[base].address || samples[base].address == 0) {
-            samples[base].address = a;
-        }
-        samples[base].count += i->second;
+bool Profiler::writeReport(const char *path, const Counts &counts, Format format)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+        return false;
     }
 
-    /*
-     * Sort them by count.
-     *
-     * XXX: shortcoming: if a sample shows up in more than one subsystem,
-     *      I'm not currently taking this into account.
-     */
+    writeReport(f, counts, format);
+
+    if (fclose(f)) {
+        fprintf(stderr, "could not write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Profiler::writeReport(FILE *f, const Counts &counts, Format format)
+{
+    if (format == Folded)
+        writeFolded(f, counts);
+    else
+        writeText(f, counts);
+    fflush(f);
+}
+
+void Profiler::writeText(FILE *f, const Counts &counts)
+{
+    // Sort by count, within each subsystem
     std::set<Entry, Entry> samplesets[NumSubsystems];
-    for (std::map<std::string, FuncInfo>::const_iterator i = samples.begin();
-         i != samples.end(); ++i)
+    for (FuncCounts::const_iterator i = counts.functions.begin();
+         i != counts.functions.end(); ++i)
     {
-        unsigned subsystem = i->second.address >> 28;
-        samplesets[subsystem].insert(Entry(i->first, i->second.address, i->second.count));
+        unsigned subsystem = i->first >> 28;
+        if (subsystem >= NumSubsystems)
+            subsystem = None;
+        samplesets[subsystem].insert(Entry(i->first, i->second));
     }
 
     // And print them.
     for (unsigned s = 0; s < arraysize(samplesets); ++s) {
         fprintf(f, "\n******** SubSystem %s ********\n\n", subSystemName((SubSystem)s));
         for (std::set<Entry>::const_iterator i = samplesets[s].begin(); i != samplesets[s].end(); ++i) {
-            float percent = (float(i->count) / float(total)) * 100;
-            fprintf(f, "0x%x, %d, %.2f%%, %s\n", i->address, i->count, percent, i->name.c_str());
+            float percent = (float(i->count) / float(counts.total)) * 100;
+            fprintf(f, "0x%x, %d, %.2f%%, %s\n", i->key & 0x0fffffff, i->count,
+                percent, functionName(i->key).c_str());
         }
     }
+}
 
-    fflush(f);
+void Profiler::writeFolded(FILE *f, const Counts &counts)
+{
+    /*
+     * One line per (subsystem, function) pair, in the "collapsed stack"
+     * format read by flamegraph.pl and similar tools. Samples are bare PCs,
+     * so each stack is just the subsystem with the sampled function on top.
+     */
+
+    std::vector<Addr> keys;
+    keys.reserve(counts.functions.size());
+    for (FuncCounts::const_iterator i = counts.functions.begin();
+         i != counts.functions.end(); ++i)
+        keys.push_back(i->first);
+    std::sort(keys.begin(), keys.end());
+
+    for (std::vector<Addr>::const_iterator i = keys.begin(); i != keys.end(); ++i) {
+        unsigned subsystem = *i >> 28;
+        if (subsystem >= NumSubsystems)
+            subsystem = None;
+        fprintf(f, "%s;%s %u\n", subSystemName((SubSystem)subsystem),
+            functionName(*i).c_str(), counts.functions.find(*i)->second);
+    }
+}
+
+std::string Profiler::functionName(Addr key)
+{
+    Addr function = key & 0x0fffffff;
+    const Elf::Symbol *sym = NULL;
+
+    if (function != UNKNOWN_FUNCTION)
+        sym = dbgInfo.lookupSymbol(function);
+
+    return sym ? dbgInfo.symbolName(*sym) : "(unknown)";
+}
+
+std::string Profiler::windowPath(const char *outPath, unsigned index)
+{
+    // "profile.txt" becomes "profile-0001.txt" for the first window
+
+    std::string path(outPath);
+    std::string::size_type dot = path.rfind('.');
+    std::string::size_type slash = path.find_last_of("/\\");
+
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = path.size();
+
+    char suffix[16];
+    snprintf(suffix, sizeof suffix, "-%04u", index);
+    return path.insert(dot, suffix);
 }
 
 const char *Profiler::subSystemName(SubSystem s)
 {
     switch (s) {
-    case FlashDMA:  return "FlashDMA";
-    case AudioPull: return "AudioPull";
-    case SVCISR:    return "SVCISR";
-    case RFISR:     return "RFISR";
-    default:        return "Uncategorized";
+    case FlashDMA:      return "FlashDMA";
+    case AudioPull:     return "AudioPull";
+    case SVCISR:        return "SVCISR";
+    case RFISR:         return "RFISR";
+    case BluetoothISR:  return "BluetoothISR";
+    default:            return "Uncategorized";
     }
 }
@@ -31,55 +31,99 @@
 
 #include <signal.h>
 #include <stdio.h>
-#include <map>
+#include <string>
+#include <tr1/unordered_map>
 
 class Profiler
 {
 public:
+    enum Format {
+        Text,       // per-subsystem tables, sorted by sample count
+        Folded      // "subsystem;function count" lines, for flame graphs
+    };
+
     Profiler(IODevice &_dev);
 
     // entry point for the 'profile' command
     static int run(int argc, char **argv, IODevice &_dev);
 
-    bool profile(const char *elfPath, const char *outPath);
+    /*
+     * Profile until interrupted. If 'windowSeconds' is nonzero, a report
+     * for each window of that length is written as we go; see flushWindow().
+     */
+    bool profile(const char *elfPath, const char *outPath,
+                 Format format, unsigned windowSeconds);
 
 private:
     typedef uint32_t Addr;
     typedef unsigned Count;
 
+    // Must match SampleProfiler::SubSystem in the firmware
     enum SubSystem {
         None,
         FlashDMA,
         AudioPull,
         SVCISR,
         RFISR,
+        BluetoothISR,
         NumSubsystems   // must be last
     };
 
-    struct FuncInfo {
-        Addr address;
-        Count count;
-    };
+    /*
+     * Sample counts, keyed by function. A key has the subsystem in its
+     * high 4 bits, like the raw samples, and the function's start address
+     * below that. There is at most one key per (subsystem, function), so
+     * the size of these tables doesn't grow with the length of a session.
+     */
+    typedef std::tr1::unordered_map<Addr, Count> FuncCounts;
+
+    // Low bits of a key for samples which don't fall inside any symbol
+    static const Addr UNKNOWN_FUNCTION = 0x0fffffff;
 
     struct Entry {
-        std::string name;
-        Addr address;
+        Addr key;
         Count count;
 
         Entry() {}
-        Entry(const std::string &n, Addr a, Count c):
-            name(n), address(a), count(c) {}
+        Entry(Addr k, Count c):
+            key(k), count(c) {}
 
         // sort in descending order
         bool operator() (const Entry& a, const Entry& b) const {
-            return b.count < a.count;
+            return b.count < a.count || (b.count == a.count && a.key < b.key);
         }
     };
 
+    struct Counts {
+        FuncCounts functions;
+        uint64_t total;
+
+        Counts() : total(0) {}
+
+        void clear() {
+            functions.clear();
+            total = 0;
+        }
+    };
+
+    Counts window;
+    Counts totals;
+    unsigned windowIndex;
+
     static void onSignal(int sig);
-    static void prettyPrintSamples(const std::map<Addr, Count> &addresses, uint64_t total, FILE *f);
     static const char *subSystemName(SubSystem s);
 
+    void addSample(uint32_t sample);
+    bool flushWindow(const char *outPath, FILE *stream, Format format,
+                     unsigned seconds);
+    bool writeReport(const char *path, const Counts &counts, Format format);
+    void writeReport(FILE *f, const Counts &counts, Format format);
+
+    static void writeText(FILE *f, const Counts &counts);
+    static void writeFolded(FILE *f, const Counts &counts);
+    static std::string functionName(Addr key);
+    static std::string windowPath(const char *outPath, unsigned index);
+
     static sig_atomic_t interruptRequested;
     static ELFDebugInfo dbgInfo;
     IODevice &dev;
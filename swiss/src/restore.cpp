@@ -0,0 +1,261 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "restore.h"
+#include "basedevice.h"
+#include "progressbar.h"
+#include "swisserror.h"
+#include "transferengine.h"
+#include "tinythread.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   define unlink(x) _unlink(x)
+#else
+#   include <unistd.h>
+#endif
+
+namespace {
+
+struct Checkpoint {
+    uint32_t magic;
+    uint32_t imageID;
+    uint32_t nextBlock;
+
+    static const uint32_t MAGIC = 0x50434b53;   // "SKCP"
+};
+
+} // namespace
+
+
+int Restore::run(int argc, char **argv, IODevice &_dev)
+{
+    if (argc != 2) {
+        fprintf(stderr, "incorrect args\n");
+        return EINVAL;
+    }
+
+    Restore m(_dev);
+    return m.restore(argv[1]);
+}
+
+Restore::Restore(IODevice &_dev) :
+    dev(_dev), imageID(0), blocksWritten(0), blocksErased(0)
+{}
+
+int Restore::restore(const char *path)
+{
+    if (!loadImage(path))
+        return EINVAL;
+
+    checkpointPath = std::string(path) + ".checkpoint";
+    unsigned nextBlock = loadCheckpoint();
+    if (nextBlock)
+        fprintf(stdout, "resuming at flash address 0x%06x\n",
+            nextBlock * FlashImage::BLOCK_SIZE);
+
+    if (!dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID))
+        return ENODEV;
+
+    for (;;) {
+        Status s = restoreBlocks(nextBlock);
+        if (s == Done)
+            break;
+        if (s == Failed || !reconnect())
+            return EIO;
+    }
+
+    unlink(checkpointPath.c_str());
+
+    fprintf(stdout, "restore complete, wrote %u blocks (%u erased first)\n",
+        blocksWritten, blocksErased);
+
+    // Restart, so the base picks up its new filesystem from scratch
+    BaseDevice base(dev);
+    if (!base.requestReboot()) {
+        fprintf(stderr, "couldn't reboot the base, please reinsert its batteries\n");
+        return EIO;
+    }
+
+    return EOK;
+}
+
+bool Restore::loadImage(const char *path)
+{
+    FlashImage image;
+    if (!image.open(path)) {
+        fprintf(stderr, "%s is not a readable flash backup\n", path);
+        return false;
+    }
+
+    blocks.resize(FlashImage::NUM_BLOCKS);
+    for (unsigned b = 0; b < FlashImage::NUM_BLOCKS; ++b) {
+        if (!image.readBlock(blocks[b])) {
+            fprintf(stderr, "%s is truncated or damaged\n", path);
+            return false;
+        }
+    }
+    image.close();
+
+    // Identify the image by its checksums, so checkpoints can't get mixed up
+
+    std::vector<uint32_t> sums;
+    for (unsigned b = 0; b < FlashImage::NUM_BLOCKS; ++b) {
+        sums.push_back(blocks[b].erasedMask);
+        sums.insert(sums.end(), blocks[b].crc, blocks[b].crc + FlashImage::CHUNKS_PER_BLOCK);
+    }
+    imageID = Util::baseCrc32(reinterpret_cast<const uint8_t*>(&sums[0]),
+        sums.size() * sizeof sums[0]);
+
+    return true;
+}
+
+unsigned Restore::loadCheckpoint()
+{
+    Checkpoint cp;
+    FILE *f = fopen(checkpointPath.c_str(), "rb");
+    if (!f)
+        return 0;
+
+    bool valid = fread(&cp, sizeof cp, 1, f) == 1
+        && cp.magic == Checkpoint::MAGIC
+        && cp.imageID == imageID
+        && cp.nextBlock <= FlashImage::NUM_BLOCKS;
+    fclose(f);
+
+    return valid ? cp.nextBlock : 0;
+}
+
+bool Restore::saveCheckpoint(unsigned nextBlock)
+{
+    Checkpoint cp = { Checkpoint::MAGIC, imageID, nextBlock };
+
+    FILE *f = fopen(checkpointPath.c_str(), "wb");
+    if (!f)
+        return false;
+
+    bool success = fwrite(&cp, sizeof cp, 1, f) == 1;
+    return (fclose(f) == 0) && success;
+}
+
+Restore::Status Restore::restoreBlocks(unsigned &nextBlock)
+{
+    TransferEngine engine(dev);
+    if (!engine.supportsFlashChecksums()) {
+        fprintf(stderr, "the base's firmware can't restore backups, please update it first\n");
+        return Failed;
+    }
+
+    ScopedProgressBar pb(FlashImage::NUM_BLOCKS);
+    pb.update(nextBlock);
+
+    while (nextBlock < FlashImage::NUM_BLOCKS) {
+        Status s = restoreBlock(engine, blocks[nextBlock]);
+        if (s != Done)
+            return s;
+
+        nextBlock++;
+        if (!saveCheckpoint(nextBlock))
+            fprintf(stderr, "\ncouldn't save progress to %s\n", checkpointPath.c_str());
+        pb.update(nextBlock);
+    }
+
+    return Done;
+}
+
+Restore::Status Restore::restoreBlock(TransferEngine &engine, const FlashImage::Block &block)
+{
+    /*
+     * Compare the base's checksums with the image's, and only touch chunks
+     * that differ. Programming can only clear bits, so if any chunk that
+     * differs has data in it, the whole block must be erased and rewritten.
+     *
+     * Checking again afterwards verifies what we wrote.
+     */
+
+    std::vector<uint32_t> crcs;
+    std::vector<bool> erased;
+    bool changed = false;
+
+    for (unsigned attempt = 0;; ++attempt) {
+        if (!engine.readFlashChecksums(block.address, FlashImage::CHUNKS_PER_BLOCK, crcs, erased))
+            return Disconnected;
+
+        std::vector<bool> differs(FlashImage::CHUNKS_PER_BLOCK);
+        bool anyDiffer = false;
+        bool needErase = false;
+
+        for (unsigned i = 0; i < FlashImage::CHUNKS_PER_BLOCK; ++i) {
+            differs[i] = crcs[i] != block.crc[i] || erased[i] != block.isChunkErased(i);
+            anyDiffer |= differs[i];
+            needErase |= differs[i] && !erased[i];
+        }
+
+        if (!anyDiffer) {
+            if (changed)
+                blocksWritten++;
+            return Done;
+        }
+
+        if (attempt == MAX_RETRIES) {
+            fprintf(stderr, "\nflash block at 0x%06x failed verification\n", block.address);
+            return Failed;
+        }
+
+        changed = true;
+
+        if (needErase) {
+            if (!engine.eraseFlashBlock(block.address))
+                return Disconnected;
+            blocksErased++;
+        }
+
+        for (unsigned i = 0; i < FlashImage::CHUNKS_PER_BLOCK; ++i) {
+            if (block.isChunkErased(i) || !(needErase || differs[i]))
+                continue;
+            if (!engine.writeFlash(block.address + i * FlashImage::CHUNK_SIZE,
+                                   block.chunk(i), FlashImage::CHUNK_SIZE))
+                return Disconnected;
+        }
+    }
+}
+
+bool Restore::reconnect()
+{
+    dev.close();
+    fprintf(stderr, "\nlost contact with the base, waiting for it to come back...\n");
+
+    for (unsigned i = 0; i < RECONNECT_SECONDS; ++i) {
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(1000));
+        if (dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID))
+            return true;
+    }
+
+    fprintf(stderr, "giving up, run 'swiss restore' again to resume\n");
+    return false;
+}
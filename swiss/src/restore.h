@@ -0,0 +1,85 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef RESTORE_H
+#define RESTORE_H
+
+#include "iodevice.h"
+#include "flashimage.h"
+
+#include <string>
+#include <vector>
+
+class TransferEngine;
+
+/*
+ * Write a backup made with 'swiss backup' back to the base.
+ *
+ * Blocks that already match the image are left alone, and only chunks
+ * with data in them are written. Progress is saved to a checkpoint file
+ * next to the image after each block, so if the base goes away we can
+ * pick up where we left off, either after reconnecting or on a later run.
+ */
+
+class Restore
+{
+public:
+    Restore(IODevice &_dev);
+
+    static int run(int argc, char **argv, IODevice &_dev);
+
+    int restore(const char *path);
+
+private:
+    enum Status {
+        Done,
+        Disconnected,
+        Failed
+    };
+
+    // How long to wait for the base to come back
+    static const unsigned RECONNECT_SECONDS = 60;
+
+    // How many times to rewrite a block that fails verification
+    static const unsigned MAX_RETRIES = 2;
+
+    IODevice &dev;
+    std::vector<FlashImage::Block> blocks;
+    uint32_t imageID;
+    std::string checkpointPath;
+
+    unsigned blocksWritten;
+    unsigned blocksErased;
+
+    bool loadImage(const char *path);
+    unsigned loadCheckpoint();
+    bool saveCheckpoint(unsigned nextBlock);
+
+    Status restoreBlocks(unsigned &nextBlock);
+    Status restoreBlock(TransferEngine &engine, const FlashImage::Block &block);
+    bool reconnect();
+};
+
+#endif // RESTORE_H
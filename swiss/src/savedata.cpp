@@ -31,6 +31,7 @@
 #include "metadata.h"
 #include "progressbar.h"
 #include "swisserror.h"
+#include "transferengine.h"
 
 #include <string>
 #include <sstream>
@@ -55,12 +56,17 @@ int SaveData::run(int argc, char **argv, IODevice &_dev)
         char *pkgStr = 0;
         bool raw = false;
         bool rpc = false;
+        bool all = false;
 
         for (int i = 2; i < argc; ++i) {
             if (!strcmp(argv[i], "--rpc")) {
                 rpc = true;
             } else if (!strcmp(argv[i], "--raw")) {
                 raw = true;
+            } else if (!strcmp(argv[i], "--all")) {
+                all = true;
+            } else if (all && !path) {
+                path = argv[i];
             } else if (!pkgStr) {
                 pkgStr = argv[i];
             } else {
@@ -68,7 +74,11 @@ int SaveData::run(int argc, char **argv, IODevice &_dev)
             }
         }
 
-        if (!path || !pkgStr) {
+        if (all && path && !pkgStr && !raw) {
+            return saveData.extractAll(path);
+        }
+
+        if (!path || !pkgStr || all) {
             fprintf(stderr, "incorrect args\n");
             return EINVAL;
         }
@@ -169,6 +179,65 @@ int SaveData::extract(const char *pkgStr, const char *filepath, bool raw, bool r
 }
 
 
+int SaveData::extractAll(const char *dirpath)
+{
+    /*
+     * Extract save data for every installed app, in one session,
+     * into <dirpath>/<package>.bin.
+     */
+
+    BaseDevice base(dev);
+    Metadata metadata(dev);
+
+    USBProtocolMsg m;
+    UsbVolumeManager::VolumeOverviewReply *overview = base.getVolumeOverview(m);
+    if (!overview) {
+        return EIO;
+    }
+
+    BitVector<256> volumes = overview->bits;
+    unsigned volume;
+    unsigned numExtracted = 0;
+
+    while (volumes.clearFirst(volume)) {
+
+        std::string pkg = metadata.getString(volume, _SYS_METADATA_PACKAGE_STR);
+        if (pkg.empty()) {
+            continue;
+        }
+
+        Records records;
+        bool supported;
+        if (!retrieveLatestRecords(volume, records, supported)) {
+            return EIO;
+        }
+
+        if (!supported) {
+            fprintf(stderr, "this base's firmware can't extract all save data at once, "
+                            "please update it or extract one package at a time\n");
+            return EIO;
+        }
+
+        if (records.empty()) {
+            continue;
+        }
+
+        std::string path = std::string(dirpath) + "/" + pkg + ".bin";
+        int rv = writeNormalizedFile(volume, records, path.c_str());
+        if (rv != EOK) {
+            return rv;
+        }
+
+        printf("%s: %u objects\n", path.c_str(), unsigned(records.size()));
+        numExtracted++;
+    }
+
+    printf("extracted save data for %u apps - see tools/savedata.py within your SDK "
+           "installation to interpret it\n", numExtracted);
+    return EOK;
+}
+
+
 int SaveData::restore(const char *filepath)
 {
     /*
@@ -284,6 +353,107 @@ int SaveData::del(const char *pkgStr)
  ********************************************************/
 
 
+bool SaveData::retrieveLatestRecords(unsigned volBlockCode, Records &records, bool &supported)
+{
+    /*
+     * List the newest valid copy of each object, a batch at a time, then
+     * read all of their data in one pipelined pass. The base has already
+     * CRC'd each object; we check them again in case they moved or
+     * changed in between.
+     *
+     * 'supported' is false if the base doesn't know how to list objects.
+     */
+
+    BaseDevice base(dev);
+    BitVector<256> excluded;
+    excluded.clear();
+
+    std::vector<UsbVolumeManager::LFSObjectListEntry> objects;
+    supported = true;
+
+    for (;;) {
+        USBProtocolMsg m;
+        UsbVolumeManager::LFSObjectListReply *reply =
+            base.listLFSObjects(m, volBlockCode, excluded);
+
+        if (!reply) {
+            // Only the very first request tells us whether the base understands
+            supported = false;
+            return objects.empty();
+        }
+
+        for (unsigned i = 0; i < reply->count; ++i) {
+            objects.push_back(reply->objects[i]);
+            excluded.mark(reply->objects[i].key);
+        }
+
+        if (reply->count < UsbVolumeManager::MAX_LFS_OBJECTS_PER_REPLY) {
+            break;
+        }
+    }
+
+    std::vector<TransferEngine::Extent> extents(objects.size());
+    unsigned total = 0;
+
+    for (unsigned i = 0; i < objects.size(); ++i) {
+        extents[i].address = objects[i].address;
+        extents[i].length = objects[i].sizeInUnits << SwissLFS::SIZE_SHIFT;
+        total += extents[i].length;
+    }
+
+    if (total == 0) {
+        return true;
+    }
+
+    std::vector<uint8_t> data(total);
+    TransferEngine engine(dev);
+    if (!engine.readFlash(extents, &data[0])) {
+        return false;
+    }
+
+    const uint8_t *p = &data[0];
+    for (unsigned i = 0; i < objects.size(); ++i) {
+        const UsbVolumeManager::LFSObjectListEntry &obj = objects[i];
+        unsigned size = extents[i].length;
+
+        if ((Util::baseCrc32(p, size) & 0xFFFF) != obj.crc) {
+            fprintf(stderr, "object %u changed while it was being read, please try again\n", obj.key);
+            return false;
+        }
+
+        std::vector<uint8_t> payload(p, p + size);
+        records[obj.key].push_back(Record(obj.key, obj.crc, size, payload));
+        p += size;
+    }
+
+    return true;
+}
+
+
+int SaveData::writeNormalizedFile(unsigned volBlockCode, Records &records, const char *filepath)
+{
+    HeaderCommon hdr;
+    uint32_t baseHwRevision;
+    if (!getHeader(volBlockCode, hdr, baseHwRevision)) {
+        return EIO;
+    }
+
+    FILE *fout = fopen(filepath, "wb");
+    if (!fout) {
+        fprintf(stderr, "couldn't open %s: %s\n", filepath, strerror(errno));
+        return ENOENT;
+    }
+
+    bool success = writeNormalizedRecords(records, hdr, fout);
+    if (fclose(fout) != 0 || !success) {
+        fprintf(stderr, "error writing %s\n", filepath);
+        return EIO;
+    }
+
+    return EOK;
+}
+
+
 bool SaveData::restoreRecords(unsigned vol, const Records &records)
 {
     ScopedProgressBar pb(records.size());
@@ -323,26 +493,12 @@ bool SaveData::restoreItem(unsigned parentVol, const Record & record)
         return false;
     }
 
-    unsigned progress = 0;
-
-    while (progress < record.payload.size()) {
-        m.init(USBProtocol::Installer);
-        m.header |= UsbVolumeManager::WriteLFSObjectPayload;
-
-        unsigned chunk = std::min(unsigned(record.payload.size() - progress), m.bytesFree());
-        ASSERT(chunk != 0);
-
-        m.append(&record.payload[progress], chunk);
-        progress += chunk;
-
-        if (dev.writePacket(m.bytes, m.len) < 0) {
-            return false;
-        }
-        while (dev.numPendingOUTPackets() > IODevice::MAX_OUTSTANDING_OUT_TRANSFERS)
-            dev.processEvents(1);
-    }
+    if (record.payload.empty())
+        return true;
 
-    return true;
+    TransferEngine engine(dev);
+    return engine.writeBuffer(&record.payload[0], record.payload.size(),
+        UsbVolumeManager::WriteLFSObjectPayload);
 }
 
 
@@ -518,20 +674,15 @@ bool SaveData::writeNormalizedRecords(Records &records, const HeaderCommon &deta
 }
 
 
-bool SaveData::writeFileHeader(FILE *f, unsigned volBlockCode, unsigned numVolumes)
+bool SaveData::getHeader(unsigned volBlockCode, HeaderCommon &h, uint32_t &baseHwRevision)
 {
     /*
-     * Simple header that describes the contents of our savedata file.
-     * Subset of the info specified in a Backup.
+     * Collect what we know about the base and the app whose data this is.
      */
 
-    HeaderV2 hdr = {
-        MAGIC,          // magic
-        VERSION,        // version
-        numVolumes,     // numVolumes
-        PAGE_SIZE,      // mc_pageSize
-        BLOCK_SIZE,     // mc_blockSize,
-    };
+    h.mc_pageSize = PAGE_SIZE;
+    h.mc_blockSize = BLOCK_SIZE;
+    h.numBlocks = 0;
 
     BaseDevice base(dev);
     USBProtocolMsg m;
@@ -540,125 +691,89 @@ bool SaveData::writeFileHeader(FILE *f, unsigned volBlockCode, unsigned numVolum
         return false;
     }
 
-    memcpy(hdr.baseUniqueID, sysinfo->baseUniqueID, sizeof(hdr.baseUniqueID));
-    hdr.baseHwRevision = sysinfo->baseHwRevision;
+    memcpy(h.baseUniqueID, sysinfo->baseUniqueID, sizeof(h.baseUniqueID));
+    baseHwRevision = sysinfo->baseHwRevision;
 
     USBProtocolMsg mFWV;
     const char *fwv = base.getFirmwareVersion(mFWV);
     if (!fwv) {
         return false;
     }
-    string baseFWVersion(fwv);
+    h.baseFirmwareVersionStr = fwv;
 
     Metadata metadata(dev);
-    std::string packageID = metadata.getString(volBlockCode, _SYS_METADATA_PACKAGE_STR);
-    std::string version = metadata.getString(volBlockCode, _SYS_METADATA_VERSION_STR);
-    int uuidLen = metadata.getBytes(volBlockCode, _SYS_METADATA_UUID, hdr.appUUID.bytes, sizeof hdr.appUUID.bytes);
+    h.packageStr = metadata.getString(volBlockCode, _SYS_METADATA_PACKAGE_STR);
+    h.versionStr = metadata.getString(volBlockCode, _SYS_METADATA_VERSION_STR);
+    memset(h.appUUID.bytes, 0, sizeof h.appUUID.bytes);
+    int uuidLen = metadata.getBytes(volBlockCode, _SYS_METADATA_UUID, h.appUUID.bytes, sizeof h.appUUID.bytes);
 
     if (volBlockCode == SYSLFS_VOLUME_BLOCK_CODE) {
-        packageID = SYSLFS_PACKAGE_STR;
+        h.packageStr = SYSLFS_PACKAGE_STR;
     } else {
-        if (packageID.empty() || version.empty() || uuidLen <= 0) {
+        if (h.packageStr.empty() || h.versionStr.empty() || uuidLen <= 0) {
             return false;
         }
     }
 
-    if (fwrite(&hdr, sizeof hdr, 1, f) != 1)
-        return false;
-
-    return writeStr(baseFWVersion, f) && writeStr(packageID, f) && writeStr(version, f);
-}
-
-
-bool SaveData::writeVolumes(UsbVolumeManager::LFSDetailReply *reply, FILE *f, bool rpc)
-{
-    ScopedProgressBar pb(reply->count * BLOCK_SIZE);
-    unsigned progTotal = reply->count * BLOCK_SIZE;
-    unsigned overallProgress = 0;
-
-    /*
-     * For each block, request all of its data, and write it out to our file.
-     */
-
-    for (unsigned i = 0; i < reply->count; ++i) {
-
-        unsigned baseAddress = reply->records[i].address;
-        unsigned requestProgress = 0, replyProgress = 0;
-
-        // Queue up the first few reads, respond as results arrive
-        for (unsigned b = 0; b < 3; ++b) {
-            sendRequest(baseAddress, requestProgress);
-        }
-
-        while (replyProgress < BLOCK_SIZE) {
-            dev.processEvents(1);
-
-            while (dev.numPendingINPackets() != 0) {
-                if (!writeReply(f, replyProgress)) {
-                    return false;
-                }
-
-                pb.update(overallProgress + replyProgress);
-                if (rpc) {
-                    fprintf(stdout, "::progress:%u:%u\n", overallProgress + replyProgress, progTotal); fflush(stdout);
-                }
-                sendRequest(baseAddress, requestProgress);
-            }
-        }
-        overallProgress += BLOCK_SIZE;
-    }
-
     return true;
 }
 
 
-bool SaveData::sendRequest(unsigned baseAddr, unsigned & progress)
+bool SaveData::writeFileHeader(FILE *f, unsigned volBlockCode, unsigned numVolumes)
 {
     /*
-     * Request another chunk of data, maintaining progress within
-     * the current block.
+     * Simple header that describes the contents of our savedata file.
+     * Subset of the info specified in a Backup.
      */
 
-    unsigned offset = progress;
-    if (offset >= BLOCK_SIZE) {
+    HeaderV2 hdr = {
+        MAGIC,          // magic
+        VERSION,        // version
+        numVolumes,     // numVolumes
+        PAGE_SIZE,      // mc_pageSize
+        BLOCK_SIZE,     // mc_blockSize,
+    };
+
+    HeaderCommon details;
+    uint32_t baseHwRevision;
+    if (!getHeader(volBlockCode, details, baseHwRevision)) {
         return false;
     }
 
-    USBProtocolMsg m(USBProtocol::Installer);
-    m.header |= UsbVolumeManager::FlashDeviceRead;
-    UsbVolumeManager::FlashDeviceReadRequest *req =
-        m.zeroCopyAppend<UsbVolumeManager::FlashDeviceReadRequest>();
-
-    req->address = baseAddr + offset;
-    req->length = std::min(BLOCK_SIZE - offset,
-        USBProtocolMsg::MAX_LEN - USBProtocolMsg::HEADER_BYTES);
-
-    progress = offset + req->length;
+    memcpy(hdr.baseUniqueID, details.baseUniqueID, sizeof(hdr.baseUniqueID));
+    memcpy(hdr.appUUID.bytes, details.appUUID.bytes, sizeof(hdr.appUUID.bytes));
+    hdr.baseHwRevision = baseHwRevision;
 
-    dev.writePacket(m.bytes, m.len);
+    if (fwrite(&hdr, sizeof hdr, 1, f) != 1)
+        return false;
 
-    return true;
+    return writeStr(details.baseFirmwareVersionStr, f) &&
+           writeStr(details.packageStr, f) &&
+           writeStr(details.versionStr, f);
 }
 
 
-bool SaveData::writeReply(FILE *f, unsigned & progress)
+bool SaveData::writeVolumes(UsbVolumeManager::LFSDetailReply *reply, FILE *f, bool rpc)
 {
+    unsigned progTotal = reply->count * BLOCK_SIZE;
+    TransferEngine engine(dev);
+
     /*
-     * Read the pending reply from the device and write it out to our file.
+     * For each block, request all of its data, and write it out to our file.
      */
 
-    USBProtocolMsg m(USBProtocol::Installer);
-    BaseDevice base(dev);
+    {
+        ScopedProgressBar pb(progTotal);
 
-    uint32_t header = m.header | UsbVolumeManager::FlashDeviceRead;
-    if (!base.waitForReply(header, m)) {
-        return false;
+        for (unsigned i = 0; i < reply->count; ++i) {
+            engine.setProgress(&pb, i * BLOCK_SIZE, rpc ? progTotal : 0);
+            if (!engine.readFlash(reply->records[i].address, BLOCK_SIZE, f))
+                return false;
+        }
     }
 
-    unsigned len = m.payloadLen();
-    progress += len;
-
-    return fwrite(m.castPayload<uint8_t>(), len, 1, f) == 1;
+    engine.printThroughput();
+    return true;
 }
 
 
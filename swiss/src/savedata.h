@@ -80,6 +80,7 @@ public:
     static int run(int argc, char **argv, IODevice &_dev);
 
     int extract(const char *pkgStr, const char *filepath, bool raw, bool rpc);
+    int extractAll(const char *dirpath);
     int restore(const char *filepath);
     int normalize(const char *inpath, const char *outpath);
     int del(const char *pkgStr);
@@ -121,11 +122,13 @@ private:
     };
 
     UsbVolumeManager::LFSDetailReply *getLFSDetail(USBProtocolMsg &buffer, unsigned volBlockCode);
+    bool getHeader(unsigned volBlockCode, HeaderCommon &h, uint32_t &baseHwRevision);
     bool writeFileHeader(FILE *f, unsigned volBlockCode, unsigned numVolumes);
 
     bool writeVolumes(UsbVolumeManager::LFSDetailReply *reply, FILE *f, bool rpc=false);
-    bool sendRequest(unsigned baseAddr, unsigned &progress);
-    bool writeReply(FILE *f, unsigned &progress);
+
+    bool retrieveLatestRecords(unsigned volBlockCode, Records &records, bool &supported);
+    int writeNormalizedFile(unsigned volBlockCode, Records &records, const char *filepath);
 
     bool getValidFileVersion(FILE *f, int &version);
     bool readHeader(int version, HeaderCommon &h, FILE *f);
@@ -0,0 +1,241 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "syscallprofiler.h"
+#include "tabularlist.h"
+#include "usbprotocol.h"
+#include "util.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iomanip>
+#include <set>
+
+// Generated from the SDK's syscall ABI at build time
+#include "syscall-names.def"
+
+sig_atomic_t SyscallProfiler::interruptRequested;
+
+int SyscallProfiler::run(int argc, char **argv, IODevice &_dev)
+{
+    double intervalSeconds = 1.0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--syscalls")) {
+            continue;
+        } else if (i + 1 < argc && !strcmp(argv[i], "--interval")) {
+            intervalSeconds = strtod(argv[i + 1], NULL);
+            i++;
+        } else {
+            fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!(intervalSeconds > 0)) {
+        fprintf(stderr, "interval must be greater than zero\n");
+        return 1;
+    }
+
+    if (signal(SIGINT, onSignal) == SIG_ERR) {
+        fputs("An error occurred while setting a signal handler.\n", stderr);
+        return 1;
+    }
+
+    SyscallProfiler profiler(_dev);
+    return profiler.profile(intervalSeconds) ? 0 : 1;
+}
+
+SyscallProfiler::SyscallProfiler(IODevice &_dev) :
+    dev(_dev)
+{
+}
+
+void SyscallProfiler::onSignal(int sig)
+{
+    if (sig == SIGINT) {
+        interruptRequested = true;
+    }
+}
+
+bool SyscallProfiler::profile(double intervalSeconds)
+{
+    if (!dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID))
+        return false;
+
+    /*
+     * The base applies a reset at the start of its next frame, so each
+     * report covers whole frames. Whatever runs between reading the
+     * counters and that frame boundary goes uncounted.
+     */
+
+    sendReset();
+    double start = Util::now();
+    interruptRequested = false;
+
+    while (!interruptRequested) {
+        double t = Util::now();
+        if (t - start < intervalSeconds) {
+            dev.processEvents(10);
+            continue;
+        }
+
+        std::vector<Entry> entries;
+        uint32_t frames;
+        if (!readCounters(entries, frames))
+            return false;
+        sendReset();
+
+        writeReport(entries, frames, t - start);
+        start = t;
+    }
+
+    while (dev.numPendingOUTPackets())
+        dev.processEvents(1);
+
+    return true;
+}
+
+void SyscallProfiler::sendReset()
+{
+    USBProtocolMsg m(USBProtocol::Profiler);
+    uint32_t command = SyscallCounters::ResetSyscallCounters;
+    m.append((uint8_t*) &command, sizeof command);
+    dev.writePacket(m.bytes, m.len);
+}
+
+bool SyscallProfiler::readCounters(std::vector<Entry> &entries, uint32_t &frames)
+{
+    /*
+     * Only a few counters fit in each reply, so walk the table one
+     * request at a time. Replies skip syscalls that were never called.
+     */
+
+    uint32_t first = 0;
+    frames = 0;
+
+    while (first < SyscallCounters::NUM_SYSCALLS) {
+        USBProtocolMsg m(USBProtocol::Profiler);
+        uint32_t command = SyscallCounters::GetSyscallCounters;
+        SyscallCounters::CountersRequest req = { first };
+        m.append((uint8_t*) &command, sizeof command);
+        m.append((uint8_t*) &req, sizeof req);
+        dev.writePacket(m.bytes, m.len);
+
+        double deadline = Util::now() + REPLY_TIMEOUT_MS / 1000.0;
+        for (;;) {
+            while (dev.numPendingINPackets() == 0) {
+                if (Util::now() > deadline) {
+                    fprintf(stderr, "no reply from the base. Syscall counters "
+                        "need a recent firmware; try 'swiss update'.\n");
+                    return false;
+                }
+                dev.processEvents(1);
+            }
+
+            if (dev.readPacket(m.bytes, m.MAX_LEN, m.len) < 0)
+                return false;
+
+            // Skip leftover samples from the sampling profiler, and other subsystems
+            if (m.subsystem() == USBProtocol::Profiler &&
+                (m.header & 0xff) == SyscallCounters::GetSyscallCounters)
+                break;
+        }
+
+        const unsigned headerBytes = offsetof(SyscallCounters::CountersReply, entries);
+        const SyscallCounters::CountersReply *reply =
+            m.castPayload<SyscallCounters::CountersReply>();
+
+        if (m.payloadLen() < headerBytes ||
+            reply->count > SyscallCounters::MAX_ENTRIES_PER_REPLY ||
+            m.payloadLen() < headerBytes + reply->count * sizeof(Entry) ||
+            reply->next <= first) {
+            fprintf(stderr, "bad syscall counter reply from the base\n");
+            return false;
+        }
+
+        frames = reply->frames;
+        entries.insert(entries.end(), reply->entries, reply->entries + reply->count);
+        first = reply->next;
+    }
+
+    return true;
+}
+
+void SyscallProfiler::writeReport(const std::vector<Entry> &entries,
+    uint32_t frames, double seconds)
+{
+    std::set<Entry, EntryOrder> sorted(entries.begin(), entries.end());
+
+    // Share of the CPU, at 72 MHz
+    const double cyclesPerSecond = 72e6;
+
+    fprintf(stdout, "\n%u frames in %.1f seconds (%.1f FPS)\n\n",
+        frames, seconds, frames / seconds);
+
+    TabularList table;
+
+    table.cell() << "SYSCALL";
+    table.cell(table.RIGHT) << "CALLS";
+    table.cell(table.RIGHT) << "CALLS/FRAME";
+    table.cell(table.RIGHT) << "CYCLES/FRAME";
+    table.cell(table.RIGHT) << "AVG";
+    table.cell(table.RIGHT) << "MAX";
+    table.cell(table.RIGHT) << "CPU";
+    table.endRow();
+
+    for (std::set<Entry, EntryOrder>::const_iterator i = sorted.begin();
+         i != sorted.end(); ++i) {
+        const SyscallCounters::Counter &c = i->counter;
+
+        table.cell() << syscallName(i->number);
+        table.cell(table.RIGHT) << c.calls;
+        if (frames) {
+            table.cell(table.RIGHT) << std::fixed << std::setprecision(1)
+                << double(c.calls) / frames;
+            table.cell(table.RIGHT) << c.cycles / frames;
+        } else {
+            table.cell(table.RIGHT) << "-";
+            table.cell(table.RIGHT) << "-";
+        }
+        table.cell(table.RIGHT) << c.cycles / c.calls;
+        table.cell(table.RIGHT) << c.maxCycles;
+        table.cell(table.RIGHT) << std::fixed << std::setprecision(1)
+            << (c.cycles * 100.0 / (seconds * cyclesPerSecond)) << "%";
+        table.endRow();
+    }
+
+    table.end();
+    fflush(stdout);
+}
+
+const char *SyscallProfiler::syscallName(unsigned num)
+{
+    if (num < arraysize(SyscallNames) && SyscallNames[num])
+        return SyscallNames[num];
+    return "(unknown)";
+}
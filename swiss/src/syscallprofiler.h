@@ -0,0 +1,78 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SYSCALL_PROFILER_H
+#define SYSCALL_PROFILER_H
+
+#include "iodevice.h"
+#include "syscallcounters.h"
+
+#include <signal.h>
+#include <vector>
+
+/*
+ * Periodic reports of the base's always-on syscall counters: how often
+ * each syscall ran, and how many CPU cycles it took, per frame.
+ *
+ * Unlike the sampling profiler, this doesn't need the app's ELF, and it
+ * has no effect on the app's performance.
+ */
+
+class SyscallProfiler
+{
+public:
+    SyscallProfiler(IODevice &_dev);
+
+    // entry point for 'profile --syscalls'
+    static int run(int argc, char **argv, IODevice &_dev);
+
+    bool profile(double intervalSeconds);
+
+private:
+    typedef SyscallCounters::CountersEntry Entry;
+
+    // Sort by total cycles, highest first
+    struct EntryOrder {
+        bool operator() (const Entry &a, const Entry &b) const {
+            return b.counter.cycles < a.counter.cycles ||
+                (b.counter.cycles == a.counter.cycles && a.number < b.number);
+        }
+    };
+
+    static const unsigned REPLY_TIMEOUT_MS = 2000;
+
+    static sig_atomic_t interruptRequested;
+    IODevice &dev;
+
+    static void onSignal(int sig);
+    static const char *syscallName(unsigned num);
+
+    void sendReset();
+    bool readCounters(std::vector<Entry> &entries, uint32_t &frames);
+    void writeReport(const std::vector<Entry> &entries, uint32_t frames,
+        double seconds);
+};
+
+#endif // SYSCALL_PROFILER_H
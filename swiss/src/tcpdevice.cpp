@@ -0,0 +1,323 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Must be before other headers
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   include <windows.h>
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/select.h>
+#   include <netinet/tcp.h>
+#   include <netinet/in.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   define closesocket(_s) ::close(_s)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif
+
+#include "tcpdevice.h"
+#include "libusb.h"
+#include "util.h"
+#include "macros.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+double TcpDevice::Link::schedule(double now, unsigned bytes)
+{
+    /*
+     * Returns when a packet of 'bytes' sent at 'now' arrives at the other end.
+     */
+
+    double start = MAX(now, busyUntil);
+    busyUntil = bytesPerSecond ? start + bytes / bytesPerSecond : start;
+    return busyUntil + latency;
+}
+
+TcpDevice::TcpDevice(unsigned port) :
+    mPort(port), mSocket(-1), mOutOffset(0)
+{
+    setLink(0, 0);
+}
+
+void TcpDevice::setLink(unsigned latencyMillis, unsigned bytesPerSecond)
+{
+    mOutLink.latency = mINLink.latency = latencyMillis * 1e-3;
+    mOutLink.bytesPerSecond = mINLink.bytesPerSecond = bytesPerSecond;
+    mOutLink.busyUntil = mINLink.busyUntil = 0;
+}
+
+bool TcpDevice::open(uint16_t vendorId, uint16_t productId, uint8_t interface)
+{
+    /*
+     * Siftulator only emulates the base's application firmware, not its
+     * bootloader, so there's nothing to connect to for firmware updates.
+     */
+
+    if (vendorId != SIFTEO_VID || productId != BASE_PID) {
+        fprintf(stderr, "siftulator: only the base's application firmware is emulated\n");
+        return false;
+    }
+
+    #ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+    #endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    addr.sin_port = htons(mPort);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        fprintf(stderr, "siftulator: can't connect to port %u\n", mPort);
+        closesocket(fd);
+        return false;
+    }
+
+    unsigned long arg;
+    #ifdef SO_NOSIGPIPE
+        arg = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &arg, sizeof arg);
+    #endif
+    arg = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&arg, sizeof arg);
+
+    #ifdef _WIN32
+        arg = 1;
+        ioctlsocket(fd, FIONBIO, &arg);
+    #else
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    #endif
+
+    mSocket = fd;
+    mOutLink.busyUntil = mINLink.busyUntil = 0;
+    return true;
+}
+
+void TcpDevice::close()
+{
+    if (mSocket >= 0) {
+        closesocket(mSocket);
+        mSocket = -1;
+    }
+
+    mOutQueue.clear();
+    mOutOffset = 0;
+    mINQueue.clear();
+    mReceived.clear();
+    mRxBuffer.clear();
+}
+
+bool TcpDevice::isOpen() const
+{
+    return mSocket >= 0;
+}
+
+int TcpDevice::writePacket(const uint8_t *buf, unsigned len)
+{
+    if (!isOpen())
+        return -1;
+
+    unsigned size = MIN(len, MAX_EP_SIZE);
+
+    Packet p;
+    p.due = mOutLink.schedule(Util::now(), size);
+    p.frame.resize(size + 1);
+    p.frame[0] = size;
+    memcpy(&p.frame[1], buf, size);
+    mOutQueue.push_back(p);
+
+    return size;
+}
+
+int TcpDevice::readPacket(uint8_t *buf, unsigned maxlen, unsigned &rxlen)
+{
+    /*
+     * Dequeue a packet that has already been received.
+     */
+
+    ASSERT(!mReceived.empty());
+
+    const Packet &p = mReceived.front();
+    rxlen = MIN(maxlen, unsigned(p.frame.size()));
+    memcpy(buf, &p.frame[0], rxlen);
+    mReceived.pop_front();
+
+    return LIBUSB_TRANSFER_COMPLETED;
+}
+
+int TcpDevice::processEvents(unsigned timeoutMillis)
+{
+    /*
+     * Move packets along, and wait up to 'timeoutMillis' for something
+     * to arrive. Like a USB device, we return early once there's a packet
+     * ready to read.
+     */
+
+    if (!isOpen())
+        return -1;
+
+    double deadline = Util::now() + timeoutMillis * 1e-3;
+
+    for (;;) {
+        double now = Util::now();
+        if (!pump(now)) {
+            close();
+            return -1;
+        }
+
+        if (!mReceived.empty() || now >= deadline)
+            return 0;
+
+        // Sleep until the socket is ready, or something is due
+
+        double wakeup = MIN(deadline, nextDeadline());
+        double wait = MAX(0.0, wakeup - now);
+        struct timeval tv = { long(wait), long((wait - long(wait)) * 1e6) };
+
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(mSocket, &rfds);
+        if (!mOutQueue.empty() && mOutQueue.front().due <= now)
+            FD_SET(mSocket, &wfds);
+
+        if (select(mSocket + 1, &rfds, &wfds, NULL, &tv) < 0) {
+            close();
+            return -1;
+        }
+    }
+}
+
+double TcpDevice::nextDeadline() const
+{
+    double t = 1e100;
+    if (!mOutQueue.empty())
+        t = MIN(t, mOutQueue.front().due);
+    if (!mINQueue.empty())
+        t = MIN(t, mINQueue.front().due);
+    return t;
+}
+
+bool TcpDevice::pump(double now)
+{
+    /*
+     * Send every OUT packet whose time has come, as far as the socket
+     * will take them, and release IN packets that have finished their
+     * trip across the link. Returns false if the connection is lost.
+     */
+
+    while (!mOutQueue.empty() && mOutQueue.front().due <= now) {
+        const std::vector<uint8_t> &frame = mOutQueue.front().frame;
+        int ret = send(mSocket, (const char *) &frame[mOutOffset],
+                       frame.size() - mOutOffset, MSG_NOSIGNAL);
+
+        if (ret < 0) {
+            #ifdef _WIN32
+                if (WSAGetLastError() == WSAEWOULDBLOCK)
+                    break;
+            #else
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+            #endif
+            return false;
+        }
+
+        mOutOffset += ret;
+        if (mOutOffset < frame.size())
+            break;
+
+        mOutOffset = 0;
+        mOutQueue.pop_front();
+    }
+
+    if (!receive(now))
+        return false;
+
+    while (!mINQueue.empty() && mINQueue.front().due <= now) {
+        mReceived.push_back(mINQueue.front());
+        mINQueue.pop_front();
+    }
+
+    return true;
+}
+
+bool TcpDevice::receive(double now)
+{
+    /*
+     * Read whatever the socket has for us, and start each complete frame
+     * across the simulated link.
+     */
+
+    for (;;) {
+        uint8_t buf[4096];
+        int ret = recv(mSocket, (char *) buf, sizeof buf, 0);
+
+        if (ret == 0)
+            return false;
+        if (ret < 0) {
+            #ifdef _WIN32
+                if (WSAGetLastError() == WSAEWOULDBLOCK)
+                    break;
+            #else
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+            #endif
+            return false;
+        }
+
+        mRxBuffer.insert(mRxBuffer.end(), buf, buf + ret);
+    }
+
+    unsigned offset = 0;
+    while (offset < mRxBuffer.size() && offset + 1 + mRxBuffer[offset] <= mRxBuffer.size()) {
+        unsigned len = mRxBuffer[offset];
+
+        Packet p;
+        p.due = mINLink.schedule(now, len);
+        p.frame.assign(mRxBuffer.begin() + offset + 1, mRxBuffer.begin() + offset + 1 + len);
+        mINQueue.push_back(p);
+
+        offset += 1 + len;
+    }
+    mRxBuffer.erase(mRxBuffer.begin(), mRxBuffer.begin() + offset);
+
+    return true;
+}
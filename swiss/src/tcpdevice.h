@@ -0,0 +1,113 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TCP_DEVICE_H
+#define TCP_DEVICE_H
+
+#include "iodevice.h"
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Talks to a Siftulator instance started with '--usb-port', instead of a
+ * real base. Each packet is framed on the TCP stream as a length byte
+ * followed by the packet data.
+ *
+ * The link can optionally be slowed down to resemble real hardware, so
+ * transfer performance can be measured without a base attached. Packets
+ * in each direction are held back by a fixed latency, plus the time they
+ * would take to send at the given bandwidth.
+ */
+
+class TcpDevice : public IODevice {
+public:
+    TcpDevice(unsigned port);
+
+    // One-way latency, and bandwidth in bytes per second. Zero disables each.
+    void setLink(unsigned latencyMillis, unsigned bytesPerSecond);
+
+    bool open(uint16_t vendorId, uint16_t productId, uint8_t interface = 0);
+    void close();
+    bool isOpen() const;
+    int  processEvents(unsigned timeoutMillis = 0);
+
+    unsigned maxINPacketSize() const {
+        return MAX_EP_SIZE;
+    }
+
+    unsigned numPendingINPackets() const {
+        return mReceived.size();
+    }
+
+    int readPacket(uint8_t *buf, unsigned maxlen, unsigned &rxlen);
+
+    unsigned maxOUTPacketSize() const {
+        return MAX_EP_SIZE;
+    }
+
+    unsigned numPendingOUTPackets() const {
+        return mOutQueue.size();
+    }
+
+    int writePacket(const uint8_t *buf, unsigned len);
+
+private:
+    struct Packet {
+        double due;
+        std::vector<uint8_t> frame;
+    };
+
+    /*
+     * One direction of the simulated link. Packets queue up behind each
+     * other for bandwidth, and then all take the same latency.
+     */
+    struct Link {
+        double latency;
+        double bytesPerSecond;
+        double busyUntil;
+
+        double schedule(double now, unsigned bytes);
+    };
+
+    unsigned mPort;
+    int mSocket;
+
+    Link mOutLink;
+    Link mINLink;
+
+    std::deque<Packet> mOutQueue;   // Waiting to be sent to the socket
+    unsigned mOutOffset;            // Bytes of the first frame already sent
+    std::deque<Packet> mINQueue;    // Received, but still in transit
+    std::deque<Packet> mReceived;   // Ready for readPacket()
+    std::vector<uint8_t> mRxBuffer;
+
+    bool pump(double now);
+    bool receive(double now);
+    double nextDeadline() const;
+};
+
+#endif // TCP_DEVICE_H
@@ -0,0 +1,638 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "transferengine.h"
+#include "usbvolumemanager.h"
+#include "progressbar.h"
+#include "tinythread.h"
+#include "util.h"
+
+#include <string.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+
+unsigned TransferEngine::defaultWindow = TransferEngine::DEFAULT_WINDOW;
+
+// File I/O happens in blocks of this size, with a few blocks buffered.
+static const unsigned FILE_BLOCK_SIZE = 64 * 1024;
+static const unsigned FILE_QUEUE_DEPTH = 4;
+
+
+/*
+ * FileReader --
+ *
+ *    Reads a fixed number of bytes from a file on a separate thread,
+ *    staying a few blocks ahead of the consumer.
+ */
+
+class TransferEngine::FileReader
+{
+public:
+    FileReader(FILE *f, unsigned length)
+        : file(f), remaining(length), failed(false),
+          finished(false), cancelled(false), offset(0)
+    {
+        thread = new tthread::thread(threadFn, this);
+    }
+
+    ~FileReader()
+    {
+        lock.lock();
+        cancelled = true;
+        cond.notify_all();
+        lock.unlock();
+
+        thread->join();
+        delete thread;
+    }
+
+    bool read(uint8_t *dest, unsigned count)
+    {
+        while (count) {
+            if (offset == current.size()) {
+                tthread::lock_guard<tthread::mutex> guard(lock);
+                while (queue.empty() && !finished && !failed)
+                    cond.wait(lock);
+                if (queue.empty())
+                    return false;
+
+                current.swap(queue.front());
+                queue.pop_front();
+                offset = 0;
+                cond.notify_all();
+            }
+
+            unsigned chunk = std::min<unsigned>(count, current.size() - offset);
+            memcpy(dest, &current[offset], chunk);
+            dest += chunk;
+            offset += chunk;
+            count -= chunk;
+        }
+        return true;
+    }
+
+private:
+    FILE *file;
+    unsigned remaining;
+
+    tthread::mutex lock;
+    tthread::condition_variable cond;
+    tthread::thread *thread;
+    std::list< std::vector<uint8_t> > queue;
+    bool failed, finished, cancelled;
+
+    // Consumer-side state
+    std::vector<uint8_t> current;
+    unsigned offset;
+
+    static void threadFn(void *param)
+    {
+        static_cast<FileReader*>(param)->run();
+    }
+
+    void run()
+    {
+        while (remaining) {
+            std::vector<uint8_t> block(std::min(remaining, FILE_BLOCK_SIZE));
+            bool ok = fread(&block[0], block.size(), 1, file) == 1;
+            remaining -= block.size();
+
+            tthread::lock_guard<tthread::mutex> guard(lock);
+            if (!ok) {
+                failed = true;
+                cond.notify_all();
+                return;
+            }
+
+            while (queue.size() >= FILE_QUEUE_DEPTH && !cancelled)
+                cond.wait(lock);
+            if (cancelled)
+                return;
+
+            queue.push_back(std::vector<uint8_t>());
+            queue.back().swap(block);
+            cond.notify_all();
+        }
+
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        finished = true;
+        cond.notify_all();
+    }
+};
+
+
+/*
+ * FileWriter --
+ *
+ *    Collects data into blocks, which are written to the file
+ *    on a separate thread.
+ */
+
+class TransferEngine::FileWriter
+{
+public:
+    FileWriter(FILE *f)
+        : file(f), failed(false), finished(false)
+    {
+        thread = new tthread::thread(threadFn, this);
+    }
+
+    ~FileWriter()
+    {
+        finish();
+    }
+
+    bool write(const uint8_t *data, unsigned count)
+    {
+        current.insert(current.end(), data, data + count);
+        return current.size() < FILE_BLOCK_SIZE || submit();
+    }
+
+    bool finish()
+    {
+        // Write out anything left over, and wait for the thread to catch up
+
+        if (!thread)
+            return !failed;
+
+        bool ok = current.empty() || submit();
+
+        lock.lock();
+        finished = true;
+        cond.notify_all();
+        lock.unlock();
+
+        thread->join();
+        delete thread;
+        thread = 0;
+
+        return ok && !failed;
+    }
+
+private:
+    FILE *file;
+
+    tthread::mutex lock;
+    tthread::condition_variable cond;
+    tthread::thread *thread;
+    std::list< std::vector<uint8_t> > queue;
+    bool failed, finished;
+
+    // Producer-side state
+    std::vector<uint8_t> current;
+
+    bool submit()
+    {
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        while (queue.size() >= FILE_QUEUE_DEPTH && !failed)
+            cond.wait(lock);
+        if (failed)
+            return false;
+
+        queue.push_back(std::vector<uint8_t>());
+        queue.back().swap(current);
+        cond.notify_all();
+        return true;
+    }
+
+    static void threadFn(void *param)
+    {
+        static_cast<FileWriter*>(param)->run();
+    }
+
+    void run()
+    {
+        for (;;) {
+            std::vector<uint8_t> block;
+            {
+                tthread::lock_guard<tthread::mutex> guard(lock);
+                while (queue.empty() && !finished)
+                    cond.wait(lock);
+                if (queue.empty())
+                    return;
+
+                block.swap(queue.front());
+                queue.pop_front();
+                cond.notify_all();
+            }
+
+            if (fwrite(&block[0], block.size(), 1, file) != 1) {
+                tthread::lock_guard<tthread::mutex> guard(lock);
+                failed = true;
+                cond.notify_all();
+                return;
+            }
+        }
+    }
+};
+
+
+TransferEngine::TransferEngine(IODevice &dev, unsigned window)
+    : dev(dev), mWindow(std::max(1U, std::min(window, unsigned(MAX_WINDOW)))),
+      mProgressBar(0), mProgressBase(0), mRpcTotal(0),
+      mBytes(0), mSeconds(0)
+{
+    // Make sure the device can buffer a full window of replies
+    dev.setINWindow(mWindow);
+}
+
+void TransferEngine::setProgress(ProgressBar *bar, unsigned base, unsigned rpcTotal)
+{
+    mProgressBar = bar;
+    mProgressBase = base;
+    mRpcTotal = rpcTotal;
+}
+
+void TransferEngine::updateProgress(unsigned progress)
+{
+    progress += mProgressBase;
+
+    if (mProgressBar)
+        mProgressBar->update(progress);
+
+    if (mRpcTotal) {
+        fprintf(stdout, "::progress:%u:%u\n", progress, mRpcTotal);
+        fflush(stdout);
+    }
+}
+
+bool TransferEngine::writeFile(FILE *f, unsigned length, uint32_t command)
+{
+    FileReader reader(f, length);
+    if (!writePayload(&reader, 0, length, command)) {
+        fprintf(stderr, "read error\n");
+        return false;
+    }
+    return true;
+}
+
+bool TransferEngine::writeBuffer(const uint8_t *data, unsigned length, uint32_t command)
+{
+    return writePayload(0, data, length, command);
+}
+
+bool TransferEngine::writePayload(FileReader *reader, const uint8_t *data,
+    unsigned length, uint32_t command)
+{
+    /*
+     * There are no restrictions on the format of the payload - just fit
+     * as much into each packet as we can, and keep the OUT window full.
+     */
+
+    double startTime = Util::now();
+    unsigned progress = 0;
+
+    while (progress < length) {
+        USBProtocolMsg m(USBProtocol::Installer);
+        m.header |= command;
+
+        unsigned chunk = std::min(length - progress, m.bytesFree());
+        if (reader) {
+            if (!reader->read(m.payload, chunk))
+                return false;
+        } else {
+            memcpy(m.payload, data + progress, chunk);
+        }
+        m.len += chunk;
+
+        while (dev.numPendingOUTPackets() >= mWindow)
+            dev.processEvents(1);
+
+        if (dev.writePacket(m.bytes, m.len) < 0)
+            return false;
+
+        progress += chunk;
+        updateProgress(progress);
+    }
+
+    flush();
+
+    mBytes += length;
+    mSeconds += Util::now() - startTime;
+    return true;
+}
+
+bool TransferEngine::readFlash(unsigned address, unsigned length, FILE *f)
+{
+    std::vector<Extent> extents(1);
+    extents[0].address = address;
+    extents[0].length = length;
+
+    FileWriter writer(f);
+    bool success = readPayload(extents, &writer, 0);
+    if (!writer.finish()) {
+        fprintf(stderr, "\nwrite error\n");
+        return false;
+    }
+    return success;
+}
+
+bool TransferEngine::readFlash(unsigned address, unsigned length, uint8_t *buffer)
+{
+    std::vector<Extent> extents(1);
+    extents[0].address = address;
+    extents[0].length = length;
+
+    return readPayload(extents, 0, buffer);
+}
+
+bool TransferEngine::readFlash(const std::vector<Extent> &extents, uint8_t *buffer)
+{
+    return readPayload(extents, 0, buffer);
+}
+
+bool TransferEngine::readPayload(const std::vector<Extent> &extents,
+    FileWriter *writer, uint8_t *buffer)
+{
+    /*
+     * Keep up to a full window of read requests outstanding. The base
+     * answers them in order, one packet per request, so we walk the
+     * extents twice: once sending requests, and once matching replies.
+     */
+
+    const unsigned maxChunk = USBProtocolMsg::MAX_PAYLOAD_BYTES;
+    double startTime = Util::now();
+
+    unsigned length = 0;
+    for (unsigned i = 0; i < extents.size(); ++i)
+        length += extents[i].length;
+
+    unsigned reqExtent = 0, reqOffset = 0;
+    unsigned rxExtent = 0, rxOffset = 0;
+    unsigned received = 0;
+    unsigned outstanding = 0;
+
+    while (received < length) {
+        while (outstanding < mWindow && reqExtent < extents.size()) {
+            const Extent &e = extents[reqExtent];
+            unsigned chunk = std::min(e.length - reqOffset, maxChunk);
+            if (chunk) {
+                sendReadRequest(e.address + reqOffset, chunk);
+                reqOffset += chunk;
+                outstanding++;
+            }
+            if (reqOffset == e.length) {
+                reqExtent++;
+                reqOffset = 0;
+            }
+        }
+
+        // Skip empty extents, so the next reply lines up with a request
+        while (rxOffset == extents[rxExtent].length) {
+            rxExtent++;
+            rxOffset = 0;
+        }
+
+        USBProtocolMsg m;
+        if (!receiveReply(m, UsbVolumeManager::FlashDeviceRead))
+            return false;
+        outstanding--;
+
+        unsigned len = m.payloadLen();
+        if (len != std::min(extents[rxExtent].length - rxOffset, maxChunk)) {
+            fprintf(stderr, "\nunexpected response length\n");
+            return false;
+        }
+
+        if (writer) {
+            if (!writer->write(m.castPayload<uint8_t>(), len))
+                return false;
+        } else {
+            memcpy(buffer + received, m.castPayload<uint8_t>(), len);
+        }
+
+        rxOffset += len;
+        received += len;
+        updateProgress(received);
+    }
+
+    mBytes += length;
+    mSeconds += Util::now() - startTime;
+    return true;
+}
+
+void TransferEngine::sendReadRequest(unsigned address, unsigned length)
+{
+    USBProtocolMsg m(USBProtocol::Installer);
+    m.header |= UsbVolumeManager::FlashDeviceRead;
+    UsbVolumeManager::FlashDeviceReadRequest *req =
+        m.zeroCopyAppend<UsbVolumeManager::FlashDeviceReadRequest>();
+
+    req->address = address;
+    req->length = length;
+
+    dev.writePacket(m.bytes, m.len);
+}
+
+void TransferEngine::sendChecksumRequest(unsigned address, unsigned count)
+{
+    USBProtocolMsg m(USBProtocol::Installer);
+    m.header |= UsbVolumeManager::FlashDeviceChecksums;
+    UsbVolumeManager::FlashChecksumRequest *req =
+        m.zeroCopyAppend<UsbVolumeManager::FlashChecksumRequest>();
+
+    req->address = address;
+    req->count = count;
+
+    dev.writePacket(m.bytes, m.len);
+}
+
+bool TransferEngine::receiveReply(USBProtocolMsg &m, uint32_t command)
+{
+    // Wait for the next Installer reply, skipping other subsystems
+
+    double deadline = Util::now() + REPLY_TIMEOUT_MS / 1000.0;
+
+    for (;;) {
+        while (dev.numPendingINPackets() == 0) {
+            if (Util::now() > deadline) {
+                fprintf(stderr, "\ntimed out waiting for the base\n");
+                return false;
+            }
+            dev.processEvents(1);
+        }
+
+        if (dev.readPacket(m.bytes, m.MAX_LEN, m.len) != 0)
+            return false;
+
+        if (m.subsystem() != USBProtocol::Installer)
+            continue;
+
+        USBProtocolMsg expected(USBProtocol::Installer);
+        if (m.header != (expected.header | command)) {
+            fprintf(stderr, "\nunexpected response\n");
+            return false;
+        }
+
+        return true;
+    }
+}
+
+bool TransferEngine::supportsFlashChecksums()
+{
+    /*
+     * Older firmware answers unknown requests with an empty reply, so
+     * ask for a single checksum and look at what comes back.
+     */
+
+    sendChecksumRequest(0, 1);
+
+    double deadline = Util::now() + REPLY_TIMEOUT_MS / 1000.0;
+    USBProtocolMsg m;
+
+    for (;;) {
+        while (dev.numPendingINPackets() == 0) {
+            if (Util::now() > deadline)
+                return false;
+            dev.processEvents(1);
+        }
+
+        if (dev.readPacket(m.bytes, m.MAX_LEN, m.len) != 0)
+            return false;
+
+        if (m.subsystem() == USBProtocol::Installer)
+            return (m.header & 0xff) == UsbVolumeManager::FlashDeviceChecksums;
+    }
+}
+
+bool TransferEngine::readFlashChecksums(unsigned address, unsigned count,
+    std::vector<uint32_t> &crcs, std::vector<bool> &erased)
+{
+    /*
+     * Same pipelining as readPayload(): keep a window of requests
+     * outstanding, and the base answers them in order.
+     */
+
+    const unsigned chunkSize = UsbVolumeManager::FLASH_CHECKSUM_CHUNK;
+    const unsigned maxCount = UsbVolumeManager::MAX_FLASH_CHECKSUMS;
+
+    crcs.resize(count);
+    erased.resize(count);
+
+    unsigned requested = 0;
+    unsigned received = 0;
+    unsigned outstanding = 0;
+
+    while (received < count) {
+        while (outstanding < mWindow && requested < count) {
+            unsigned n = std::min(count - requested, maxCount);
+            sendChecksumRequest(address + requested * chunkSize, n);
+            requested += n;
+            outstanding++;
+        }
+
+        USBProtocolMsg m;
+        if (!receiveReply(m, UsbVolumeManager::FlashDeviceChecksums))
+            return false;
+        outstanding--;
+
+        unsigned n = std::min(count - received, maxCount);
+        const UsbVolumeManager::FlashChecksumReply *r =
+            m.castPayload<UsbVolumeManager::FlashChecksumReply>();
+
+        if (m.payloadLen() != sizeof r->erasedMask + n * sizeof r->crc[0]) {
+            fprintf(stderr, "\nunexpected response length\n");
+            return false;
+        }
+
+        for (unsigned i = 0; i < n; ++i) {
+            crcs[received + i] = r->crc[i];
+            erased[received + i] = (r->erasedMask >> i) & 1;
+        }
+        received += n;
+    }
+
+    return true;
+}
+
+bool TransferEngine::eraseFlashBlock(unsigned address)
+{
+    // Outstanding writes must land before the erase, which has to finish before any more
+
+    flush();
+
+    USBProtocolMsg m(USBProtocol::Installer);
+    m.header |= UsbVolumeManager::FlashDeviceErase;
+    m.zeroCopyAppend<UsbVolumeManager::FlashEraseRequest>()->address = address;
+
+    if (dev.writePacket(m.bytes, m.len) < 0)
+        return false;
+
+    return receiveReply(m, UsbVolumeManager::FlashDeviceErase);
+}
+
+bool TransferEngine::writeFlash(unsigned address, const uint8_t *data, unsigned length)
+{
+    /*
+     * Flash programming can only clear bits, so there's no need to send
+     * any packets which are entirely 0xFF.
+     */
+
+    double startTime = Util::now();
+    unsigned progress = 0;
+
+    while (progress < length) {
+        USBProtocolMsg m(USBProtocol::Installer);
+        m.header |= UsbVolumeManager::FlashDeviceWrite;
+        m.zeroCopyAppend<UsbVolumeManager::FlashWriteHeader>()->address = address + progress;
+
+        unsigned chunk = std::min(length - progress, m.bytesFree());
+        const uint8_t *src = data + progress;
+        progress += chunk;
+
+        unsigned i = 0;
+        while (i < chunk && src[i] == 0xFF)
+            i++;
+        if (i == chunk)
+            continue;
+
+        m.append(src, chunk);
+
+        while (dev.numPendingOUTPackets() >= mWindow)
+            dev.processEvents(1);
+
+        if (dev.writePacket(m.bytes, m.len) < 0)
+            return false;
+    }
+
+    mBytes += length;
+    mSeconds += Util::now() - startTime;
+    return true;
+}
+
+void TransferEngine::flush()
+{
+    while (dev.numPendingOUTPackets())
+        dev.processEvents(1);
+}
+
+void TransferEngine::printThroughput(FILE *out) const
+{
+    if (mSeconds > 0) {
+        fprintf(out, "transferred %llu bytes in %.2f seconds (%.1f kB/s)\n",
+            (unsigned long long) mBytes, mSeconds, mBytes / mSeconds / 1024.0);
+    }
+}
@@ -0,0 +1,148 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * swiss - your Sifteo utility knife
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TRANSFER_ENGINE_H
+#define TRANSFER_ENGINE_H
+
+#include "iodevice.h"
+#include "usbprotocol.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+class ProgressBar;
+
+/*
+ * Bulk data transfers with the base.
+ *
+ * Payload writes are packed into full packets and kept flowing with up to
+ * 'window' OUT transfers in flight. Flash reads keep up to 'window'
+ * FlashDeviceRead requests outstanding, rather than waiting on each reply.
+ * File data is read ahead, or written behind, on a separate thread so the
+ * disk never stalls the USB link.
+ */
+
+class TransferEngine
+{
+public:
+    static const unsigned DEFAULT_WINDOW = 32;
+    static const unsigned MAX_WINDOW = 256;
+
+    // Give up on a reply after this long. Erasing a block can take a while.
+    static const unsigned REPLY_TIMEOUT_MS = 10000;
+
+    // Window used by new engines. Set with the '--usb-window' option.
+    static unsigned defaultWindow;
+
+    TransferEngine(IODevice &dev, unsigned window = defaultWindow);
+
+    unsigned window() const {
+        return mWindow;
+    }
+
+    /*
+     * Optional progress reporting: 'base' is added to the number of bytes
+     * transferred so far. If 'rpcTotal' is nonzero, we also print
+     * "::progress" lines for RPC clients.
+     */
+    void setProgress(ProgressBar *bar, unsigned base = 0, unsigned rpcTotal = 0);
+
+    /*
+     * Send 'length' bytes as payload messages for the Installer subsystem,
+     * with the given command in each header. Returns once everything has
+     * been handed to the device.
+     */
+    bool writeFile(FILE *f, unsigned length, uint32_t command);
+    bool writeBuffer(const uint8_t *data, unsigned length, uint32_t command);
+
+    // Read a range of the base's flash device into a file, or a buffer.
+    bool readFlash(unsigned address, unsigned length, FILE *f);
+    bool readFlash(unsigned address, unsigned length, uint8_t *buffer);
+
+    /*
+     * Read several ranges back to back, into consecutive parts of 'buffer',
+     * without waiting for the window to drain between them.
+     */
+    struct Extent {
+        unsigned address;
+        unsigned length;
+    };
+
+    bool readFlash(const std::vector<Extent> &extents, uint8_t *buffer);
+
+    /*
+     * Raw flash access, for whole-device backup and restore. Checksums
+     * cover UsbVolumeManager::FLASH_CHECKSUM_CHUNK bytes each, starting at
+     * a chunk-aligned address. These need firmware that supports them;
+     * see supportsFlashChecksums().
+     */
+    bool supportsFlashChecksums();
+    bool readFlashChecksums(unsigned address, unsigned count,
+        std::vector<uint32_t> &crcs, std::vector<bool> &erased);
+    bool eraseFlashBlock(unsigned address);
+    bool writeFlash(unsigned address, const uint8_t *data, unsigned length);
+
+    // Wait for all pending OUT transfers to complete
+    void flush();
+
+    // Total bytes and time spent in transfers by this engine
+    uint64_t bytesTransferred() const {
+        return mBytes;
+    }
+
+    double secondsElapsed() const {
+        return mSeconds;
+    }
+
+    void printThroughput(FILE *out = stdout) const;
+
+private:
+    class FileReader;
+    class FileWriter;
+
+    IODevice &dev;
+    unsigned mWindow;
+
+    ProgressBar *mProgressBar;
+    unsigned mProgressBase;
+    unsigned mRpcTotal;
+
+    uint64_t mBytes;
+    double mSeconds;
+
+    bool writePayload(FileReader *reader, const uint8_t *data,
+        unsigned length, uint32_t command);
+    bool readPayload(const std::vector<Extent> &extents,
+        FileWriter *writer, uint8_t *buffer);
+
+    void sendReadRequest(unsigned address, unsigned length);
+    void sendChecksumRequest(unsigned address, unsigned count);
+    bool receiveReply(USBProtocolMsg &m, uint32_t command);
+
+    void updateProgress(unsigned progress);
+};
+
+#endif // TRANSFER_ENGINE_H
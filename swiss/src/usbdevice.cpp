@@ -36,6 +36,7 @@
 
 UsbDevice::UsbDevice() :
     mInterface(-1),
+    mNumINTransfers(DEFAULT_IN_TRANSFERS),
     mHandle(0)
 {
 }
@@ -120,7 +121,7 @@ bool UsbDevice::open(uint16_t vendorId, uint16_t productId, uint8_t interface)
      * incoming packets while we're handling recent arrivals in user space.
      */
     USB_TRACE(("USB: Submitting initial IN transfers\n"));
-    for (unsigned i = 0; i < NUM_CONCURRENT_IN_TRANSFERS; ++i)
+    for (unsigned i = 0; i < mNumINTransfers; ++i)
         submitINTransfer();
 
     USB_TRACE(("USB: Finished open()\n"));
@@ -236,7 +237,7 @@ int UsbDevice::readPacket(uint8_t *buf, unsigned maxlen, unsigned & rxlen)
     rxlen = MIN(maxlen, pkt.len);
     memcpy(buf, pkt.buf, rxlen);
 
-    delete pkt.buf;
+    free(pkt.buf);
     mBufferedINPackets.pop_front();
 
     USB_TRACE(("USB: Read %d bytes, %02x%02x%02x%02x %02x%02x%02x%02x ...\n",
@@ -245,6 +246,26 @@ int UsbDevice::readPacket(uint8_t *buf, unsigned maxlen, unsigned & rxlen)
     return pkt.status;
 }
 
+void UsbDevice::setINWindow(unsigned numTransfers)
+{
+    /*
+     * Keep at least this many IN transfers submitted. Pipelined requests
+     * can have a reply in flight for each one, and this lets libusb keep
+     * receiving them back-to-back. The pool only grows.
+     */
+
+    if (numTransfers <= mNumINTransfers)
+        return;
+    mNumINTransfers = numTransfers;
+
+    if (isOpen()) {
+        while (mInEndpoint.pendingTransfers.size() < mNumINTransfers) {
+            if (!submitINTransfer())
+                break;
+        }
+    }
+}
+
 int UsbDevice::readPacketSync(uint8_t *buf, int maxlen, int *transferred, unsigned timeout)
 {
     return libusb_bulk_transfer(mHandle, mInEndpoint.address, buf, maxlen, transferred, timeout);
@@ -87,6 +87,7 @@ public:
         return mBufferedINPackets.size();
     }
     int readPacket(uint8_t *buf, unsigned maxlen, unsigned &rxlen);
+    void setINWindow(unsigned numTransfers);
     int readPacketSync(uint8_t *buf, int maxlen, int *transferred, unsigned timeout = -1);
 
     unsigned numPendingOUTPackets() const {
@@ -96,7 +97,7 @@ public:
     int writePacketSync(const uint8_t *buf, int maxlen, int *transferred, unsigned timeout = -1);
 
 private:
-    static const unsigned NUM_CONCURRENT_IN_TRANSFERS = 16;
+    static const unsigned DEFAULT_IN_TRANSFERS = 16;
 
     bool populateDeviceInfo(libusb_config_descriptor *cfg);
     bool submitINTransfer();
@@ -120,6 +121,7 @@ private:
     void releaseTransfers(Endpoint &ep);
 
     int mInterface;
+    unsigned mNumINTransfers;
     libusb_device_handle *mHandle;
 
     struct RxPacket {
@@ -28,6 +28,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#endif
+
 namespace Util {
 
 bool parseVolumeCode(const char *str, unsigned &code)
@@ -70,4 +76,42 @@ const char *filepathBase(const char *path)
     return p + 1;
 }
 
+double now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return count.QuadPart / (double) freq.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+uint32_t baseCrc32(const uint8_t *data, unsigned length)
+{
+    // Table-driven, a byte at a time, most significant byte of each word first
+
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (unsigned i = 0; i < 256; ++i) {
+            uint32_t c = i << 24;
+            for (unsigned bit = 0; bit < 8; ++bit)
+                c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : (c << 1);
+            table[i] = c;
+        }
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (unsigned i = 0; i + 4 <= length; i += 4) {
+        for (int byte = 3; byte >= 0; --byte)
+            crc = (crc << 8) ^ table[(crc >> 24) ^ data[i + byte]];
+    }
+
+    return crc;
+}
+
 } // namespace Util
@@ -26,12 +26,24 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdint.h>
+
 namespace Util {
 
 bool parseVolumeCode(const char *str, unsigned &code);
 
 const char *filepathBase(const char *path);
 
+// Wall clock time, in seconds
+double now();
+
+/*
+ * CRC-32 as computed by the base's CRC hardware: no bit reflection,
+ * over little-endian 32-bit words, starting from 0xFFFFFFFF.
+ * 'length' must be a multiple of 4.
+ */
+uint32_t baseCrc32(const uint8_t *data, unsigned length);
+
 } // namespace Util
 
 #endif // UTIL_H
@@ -0,0 +1,157 @@
+/*
+ * Checks Elf::SymbolIndex against the linear .symtab scan it replaced,
+ * using a large synthetic symbol table, and reports how long each takes.
+ */
+
+#include "elfsymbolindex.h"
+#include "macros.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <string>
+
+static const unsigned NUM_SYMBOLS = 100000;
+static const unsigned NUM_LOOKUPS = 5000;
+static const uint32_t ADDRESS_SPACE = 0x1000000;
+
+static uint32_t rngState = 12345;
+
+static uint32_t rand32()
+{
+    // Deterministic, so any failure is reproducible
+    rngState = rngState * 1103515245 + 12345;
+    return rngState >> 8;
+}
+
+static double seconds()
+{
+    return clock() / (double) CLOCKS_PER_SEC;
+}
+
+static void buildTables(std::vector<uint8_t> &symtab, std::vector<uint8_t> &strtab)
+{
+    // Roughly what a large game looks like: mostly small functions and
+    // data objects, some zero-sized labels, and a few huge sections that
+    // contain everything else.
+
+    strtab.push_back('\0');
+    symtab.resize(NUM_SYMBOLS * sizeof(Elf::Symbol));
+
+    for (unsigned i = 0; i < NUM_SYMBOLS; ++i) {
+        Elf::Symbol sym;
+        memset(&sym, 0, sizeof sym);
+
+        char ident[32], name[64];
+        snprintf(ident, sizeof ident, "Module%u", i);
+        snprintf(name, sizeof name, "_ZN4Game%u%sEv", (unsigned) strlen(ident), ident);
+        sym.st_name = strtab.size();
+        strtab.insert(strtab.end(), name, name + strlen(name) + 1);
+
+        uint32_t kind = rand32() % 100;
+        sym.st_value = rand32() % ADDRESS_SPACE;
+
+        if (kind < 5) {
+            sym.st_size = 0;
+        } else if (kind < 6) {
+            sym.st_size = rand32() % (ADDRESS_SPACE / 4);
+        } else {
+            sym.st_size = 1 + rand32() % 512;
+        }
+
+        if (kind & 1) {
+            sym.st_info = Elf::STT_FUNC;
+            sym.st_value |= 1;
+        } else {
+            sym.st_info = Elf::STT_OBJECT;
+        }
+
+        memcpy(&symtab[i * sizeof sym], &sym, sizeof sym);
+    }
+}
+
+static const Elf::Symbol *linearFind(const std::vector<uint8_t> &symtab,
+    uint32_t address, Elf::Symbol &best)
+{
+    // The original lookup, for reference.
+
+    bool found = false;
+
+    for (unsigned offset = 0; offset + sizeof best <= symtab.size(); offset += sizeof best) {
+        Elf::Symbol sym;
+        memcpy(&sym, &symtab[offset], sizeof sym);
+
+        if ((sym.st_info & 0xF) == Elf::STT_FUNC)
+            sym.st_value &= ~1;
+
+        if (address - sym.st_value < sym.st_size
+            && (!found || sym.st_value > best.st_value)) {
+            best = sym;
+            found = true;
+        }
+    }
+
+    return found ? &best : 0;
+}
+
+int main()
+{
+    std::vector<uint8_t> symtab, strtab;
+    buildTables(symtab, strtab);
+
+    std::vector<uint32_t> addresses;
+    for (unsigned i = 0; i < NUM_LOOKUPS; ++i)
+        addresses.push_back(rand32() % (ADDRESS_SPACE + 0x1000));
+
+    double t0 = seconds();
+
+    Elf::SymbolIndex index;
+    index.load(&symtab[0], symtab.size(), &strtab[0], strtab.size());
+
+    double t1 = seconds();
+
+    std::vector<const Elf::Symbol *> results;
+    for (unsigned i = 0; i < NUM_LOOKUPS; ++i)
+        results.push_back(index.find(addresses[i]));
+
+    double t2 = seconds();
+
+    unsigned hits = 0;
+    for (unsigned i = 0; i < NUM_LOOKUPS; ++i) {
+        Elf::Symbol expected;
+        const Elf::Symbol *ref = linearFind(symtab, addresses[i], expected);
+        const Elf::Symbol *sym = results[i];
+
+        ASSERT(!ref == !sym);
+        if (sym) {
+            ASSERT(memcmp(ref, sym, sizeof *sym) == 0);
+            hits++;
+        }
+    }
+
+    double t3 = seconds();
+
+    // Names come straight from the string table, and demangle once
+    ASSERT(index.size() < NUM_SYMBOLS);
+    ASSERT(results[0] == 0 || strncmp(index.name(*results[0]), "_ZN4Game", 8) == 0);
+    for (unsigned i = 0; i < NUM_LOOKUPS; ++i)
+        if (results[i]) {
+            const std::string &name = index.demangledName(*results[i]);
+            ASSERT(name.compare(0, 12, "Game::Module") == 0);
+            ASSERT(&name == &index.demangledName(*results[i]));
+        }
+
+    // An empty table finds nothing
+    Elf::SymbolIndex empty;
+    empty.load(0, 0, 0, 0);
+    ASSERT(empty.isLoaded());
+    ASSERT(empty.find(0x1234) == 0);
+
+    LOG(("elfsymbols: %u symbols, %u lookups, %u hits\n",
+        NUM_SYMBOLS, NUM_LOOKUPS, hits));
+    LOG(("elfsymbols: index %.3f sec to build, %.3f sec to search; "
+        "linear scan %.3f sec\n", t1 - t0, t2 - t1, t3 - t2));
+    LOG(("elfsymbols: Success.\n"));
+    return 0;
+}
@@ -0,0 +1,612 @@
+/*
+ * Differential test for Siftulator's --svm-translate mode. Random SVM code
+ * runs once through the plain interpreter and once through the translation
+ * cache and SvmJit, and both runs must behave identically.
+ *
+ * SvmCpu (emulator/src/mc_svmcpu.cpp) and the host code generator are
+ * linked in unchanged. Everything they call is stubbed out below: the
+ * flash block cache, user RAM, SvmRuntime's SVC and fault handlers, and
+ * the MC clock.
+ *
+ * Each case is a run of random instructions in the flash cache, ending in
+ * an SVC that finishes the pass. Every case runs several passes from
+ * different starting registers. In translate mode, the first pass decodes
+ * each instruction, the second runs from the decode cache and compiles
+ * host code, and later passes run that code. Every SVC, fault, and
+ * SystemMC::elapseTicks() call is logged with the registers, CPSR, a hash
+ * of RAM, and the cycle count. The two logs must match exactly.
+ *
+ * SvmCpu::run() never returns and keeps its state in statics, so each run
+ * happens in a child process forked from the same starting state.
+ *
+ * Usage: svmcpu [cases] [seed]
+ */
+
+#include "svmcpu.h"
+#include "svmruntime.h"
+#include "svmmemory.h"
+#include "flash_blockcache.h"
+#include "flash_map.h"
+#include "system.h"
+#include "system_mc.h"
+#include "mc_svmprofiler.h"
+#include "macros.h"
+
+#include <algorithm>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+using namespace Svm;
+
+static const unsigned DEFAULT_CASES = 2000;
+static const unsigned NUM_PASSES = 4;
+static const unsigned MAX_INSTRS = 80;
+static const unsigned MAX_CODE_BYTES = 1024;
+static const unsigned MAX_EVENTS = 1024;
+static const unsigned CACHE_SIZE = FlashBlock::NUM_CACHE_BLOCKS * FlashBlock::BLOCK_SIZE;
+static const unsigned RAM_SIZE = SvmMemory::RAM_SIZE_IN_BYTES;
+static const unsigned STACK_OFFSET = RAM_SIZE / 2;
+
+// Ends a pass. Any other SVC is an ordinary system call.
+static const uint8_t STOP_SVC = 0xFF;
+
+enum EventKind {
+    EV_SVC = 1,
+    EV_FAULT,
+    EV_TICKS,
+};
+
+struct Event {
+    uint32_t kind;
+    uint32_t code;          // SVC number, fault code, or ticks elapsed
+    uint32_t ramHash;
+    uint64_t ticks;
+    uint64_t cycles;
+    reg_t regs[NUM_REGS];   // Not available for EV_TICKS
+};
+
+struct Log {
+    unsigned count;
+    bool overflow;
+    bool codeModified;
+    Event events[MAX_EVENTS];
+};
+
+struct Case {
+    unsigned offset;        // Of the first instruction, in the cache
+    unsigned length;        // In halfwords
+    uint16_t code[MAX_CODE_BYTES / 2];
+    reg_t regs[NUM_PASSES][NUM_REGS];
+};
+
+static Case currentCase;
+static uint8_t ramImage[RAM_SIZE];
+static uint8_t cacheImage[CACHE_SIZE];
+static uint8_t *ram;
+
+static Log *eventLog;
+static unsigned pass;
+static jmp_buf runDone;
+
+
+/***************************************************************************
+ * Simulator stubs
+ ***************************************************************************/
+
+static uint8_t blockCache[CACHE_SIZE] BLOCK_ALIGN;
+
+uint8_t SvmMemory::userRAM[SvmMemory::RAM_SIZE_IN_BYTES];
+FlashMapSpan SvmMemory::flashSeg[SvmMemory::NUM_FLASH_SEGMENTS];
+FlashBlockRef SvmRuntime::codeBlock;
+FlashBlock::FlashStats FlashBlock::stats;
+SystemMC *SystemMC::instance;
+
+/*
+ * SvmCpu reads a few System options and the MC tick count. The real
+ * objects would bring in the rest of the simulator, so they are zeroed
+ * storage here, and only those fields are ever used.
+ */
+static uint64_t systemStorage[sizeof(System) / sizeof(uint64_t) + 1];
+static uint64_t systemMCStorage[sizeof(SystemMC) / sizeof(uint64_t) + 1];
+
+static void logEvent(unsigned kind, unsigned code);
+static uintptr_t tr[16]; static unsigned trn;
+void testTracePC(uintptr_t pc) { tr[trn++ & 15] = pc; }
+static void nextPass();
+
+bool FlashBlock::isAddrValid(uintptr_t pa)
+{
+    return cacheOffset(pa) < sizeof blockCache;
+}
+
+uintptr_t FlashBlock::cacheOffset(uintptr_t pa)
+{
+    return reinterpret_cast<uint8_t*>(pa) - blockCache;
+}
+
+bool SvmMemory::mapRAM(VirtAddr va, uint32_t length, PhysAddr &pa)
+{
+    // Virtual RAM addresses only; that's all SvmCpu asks for
+    uint32_t offset = (uint32_t)va - VIRTUAL_RAM_BASE;
+    if (offset > RAM_SIZE_IN_BYTES || length > RAM_SIZE_IN_BYTES - offset)
+        return false;
+
+    pa = userRAM + offset;
+    return true;
+}
+
+bool SvmMemory::mapROCode(FlashBlockRef &ref, VirtAddr va, PhysAddr &pa)
+{
+    // Every bundle in the cache counts as valid code
+    return true;
+}
+
+unsigned SvmMemory::reconstructCodeAddr(const FlashBlockRef &ref, uint32_t pc)
+{
+    return 0;
+}
+
+bool FlashMapSpan::flashAddrToOffset(FlashAddr flashAddr, ByteOffset &byteOffset) const
+{
+    return false;
+}
+
+bool SystemMC::init(System *sys)
+{
+    this->sys = sys;
+    ticks = 0;
+    instance = this;
+    return true;
+}
+
+void SystemMC::elapseTicks(unsigned n)
+{
+    instance->ticks += n;
+    logEvent(EV_TICKS, n);
+}
+
+void SvmRuntime::svc(uint8_t imm8)
+{
+    logEvent(EV_SVC, imm8);
+
+    if (imm8 == STOP_SVC) {
+        nextPass();
+    } else {
+        // Like a real syscall, return a value and change the flags
+        SvmCpu::setReg(0, uint32_t(SvmCpu::reg(0) * 2654435761u + imm8));
+        SvmCpu::setReg(REG_CPSR, SvmCpu::reg(REG_CPSR) ^ (imm8 << 24 & 0xF0000000));
+    }
+}
+
+void SvmRuntime::fault(FaultCode code)
+{
+    // The faulting instruction is abandoned, and we start the next pass
+    logEvent(EV_FAULT, code);
+    if (code == 9) { static int n; if (n++ < 3) { for (unsigned k = 0; k < 16; k++) { uintptr_t p = tr[(trn + k) & 15]; fprintf(stderr, "  %lx %04x\n", (unsigned long)(p - (uintptr_t)blockCache), FlashBlock::isAddrValid(p) ? *(uint16_t*)p : 0); } fprintf(stderr, "--\n"); } }
+    nextPass();
+}
+
+
+/***************************************************************************
+ * Running a case
+ ***************************************************************************/
+
+static uint32_t hashRAM()
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (unsigned i = 0; i < RAM_SIZE; ++i)
+        hash = (hash ^ ram[i]) * 16777619u;
+    return hash;
+}
+
+static void logEvent(unsigned kind, unsigned code)
+{
+    if (eventLog->count == MAX_EVENTS) {
+        eventLog->overflow = true;
+        return;
+    }
+
+    Event &e = eventLog->events[eventLog->count++];
+    memset(&e, 0, sizeof e);
+    e.kind = kind;
+    e.code = code;
+    e.ticks = SystemMC::getTicks();
+    e.cycles = SvmProfiler::cycles();
+
+    // Registers are only visible to SvmRuntime while handling an exception
+    if (kind != EV_TICKS) {
+        e.ramHash = hashRAM();
+        for (unsigned r = 0; r < NUM_REGS; ++r)
+            e.regs[r] = SvmCpu::reg(r);
+    }
+}
+
+static void nextPass()
+{
+    /*
+     * Called from inside an SVC or fault. Reset RAM and the registers,
+     * and return to the start of the case. After the last pass, leave
+     * SvmCpu::run() for good.
+     */
+
+    if (pass == NUM_PASSES)
+        longjmp(runDone, 1);
+
+    memcpy(ram, ramImage, RAM_SIZE);
+    for (unsigned r = 0; r < NUM_REGS; ++r)
+        if (r != REG_SP)
+            SvmCpu::setReg(r, currentCase.regs[pass][r]);
+
+    pass++;
+}
+
+static void runChild(bool translate, Log *out)
+{
+    // Nothing here can loop, but don't hang the build if that breaks
+    alarm(30);
+
+    eventLog = out;
+    SystemMC::getSystem()->opt_svmTranslate = translate;
+
+    // Cache offset 0 holds the STOP_SVC that starts the first pass
+    if (!setjmp(runDone))
+        SvmCpu::run(reinterpret_cast<reg_t>(ram + STACK_OFFSET),
+                    reinterpret_cast<reg_t>(blockCache));
+
+    eventLog->codeModified = memcmp(blockCache, cacheImage, CACHE_SIZE) != 0;
+    _exit(0);
+}
+
+static bool runInChild(bool translate, Log *out)
+{
+    memset(out, 0, sizeof *out);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0)
+        runChild(translate, out);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+        perror("waitpid");
+        return false;
+    }
+
+    if (WIFSIGNALED(status)) {
+        printf("%s run killed by signal %d\n",
+            translate ? "Translated" : "Interpreted", WTERMSIG(status));
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/***************************************************************************
+ * Random code
+ ***************************************************************************/
+
+static uint32_t rngState;
+
+static uint32_t rand32()
+{
+    // Deterministic, so any failure is reproducible from its seed
+    rngState = rngState * 1103515245 + 12345;
+    return rngState >> 8;
+}
+
+static uint32_t randomWord()
+{
+    return rand32() << 16 ^ rand32();
+}
+
+static reg_t randomValue()
+{
+    static const uint32_t edges[] = {
+        0, 1, 2, 31, 32, 33, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, 0xFFFF8000,
+    };
+
+    switch (rand32() % 8) {
+    case 0:
+    case 1:
+    case 2: {
+        // Physical RAM pointer, usually aligned
+        reg_t p = reinterpret_cast<reg_t>(ram + rand32() % RAM_SIZE);
+        return rand32() % 4 ? p & ~(reg_t)3 : p;
+    }
+    case 3:
+        return SvmMemory::VIRTUAL_RAM_BASE + rand32() % RAM_SIZE;
+    case 4:
+        return edges[rand32() % arraysize(edges)];
+    case 5:
+        return rand32() % 64;
+    default:
+        return randomWord();
+    }
+}
+
+enum SlotKind {
+    PLAIN,
+    WIDE,                   // 32-bit instruction
+    BRANCH_B,
+    BRANCH_COND,
+    BRANCH_CBZ,
+};
+
+struct Slot {
+    unsigned offset;        // Within the cache
+    unsigned kind;
+};
+
+static uint32_t randomInstr32()
+{
+    // Any encoding that matches one of the interpreter's masks
+    static const uint32_t forms[][2] = {
+        { StrMask, StrTest },
+        { StrBhMask, StrBhTest },
+        { LdrBhMask, LdrBhTest },
+        { LdrMask, LdrTest },
+        { MovWtMask, MovWtTest },
+        { DivMask, DivTest },
+        { ClzMask, ClzTest },
+    };
+    static const unsigned weights[] = { 4, 3, 4, 4, 4, 2, 1 };
+
+    unsigned pick = rand32() % 22;
+    unsigned i = 0;
+    while (pick >= weights[i])
+        pick -= weights[i++];
+
+    return forms[i][1] | (randomWord() & ~forms[i][0]);
+}
+
+static uint16_t randomInstr16(unsigned &kind)
+{
+    kind = PLAIN;
+
+    switch (rand32() % 20) {
+    case 0:  return rand32() % 0x1800;                      // LSL, LSR, ASR imm
+    case 1:  return 0x1800 | (rand32() & 0x7FF);            // ADD, SUB reg/imm3
+    case 2:
+    case 3:  return 0x2000 | (rand32() & 0x1FFF);           // MOV, CMP, ADD, SUB imm8
+    case 4:
+    case 5:
+    case 6:  return DataProcTest | (rand32() & 0x3FF);
+    case 7:  return MovTest | (rand32() & 0x3F);
+    case 8:  return MiscTest | (rand32() & 0xFF);           // SXTH, SXTB, UXTH, UXTB
+    case 9:  return PcRelLdrTest | (rand32() & 0x7FF);
+    case 10: return SpRelLdrStrTest | (rand32() & 0xFFF);
+    case 11: return SpRelAddTest | (rand32() & 0x7FF);
+    case 12: return rand32() % 4 ? Nop : uint16_t(SvcTest | rand32() % STOP_SVC);
+    case 13: kind = BRANCH_B; return Nop;
+    case 14:
+    case 15: kind = BRANCH_COND; return Nop;
+    case 16: kind = BRANCH_CBZ; return Nop;
+    default: kind = WIDE; return Nop;
+    }
+}
+
+static uint16_t encodeBranch(const Slot &s, unsigned target)
+{
+    // Branches are relative to the instruction address plus 4
+    int offset = int(target) - int(s.offset) - 4;
+
+    switch (s.kind) {
+    case BRANCH_B:
+        return UncondBranchTest | ((offset >> 1) & 0x7FF);
+    case BRANCH_COND:
+        return CondBranchTest | (rand32() % (NoneAL + 1)) << 8 | ((offset >> 1) & 0xFF);
+    default:
+        return CompareBranchTest | (rand32() & 1) << 11 | ((offset >> 6) & 1) << 9 |
+            ((offset >> 1) & 0x1F) << 3 | (rand32() & 7);
+    }
+}
+
+static bool branchReaches(const Slot &s, unsigned target)
+{
+    int offset = int(target) - int(s.offset) - 4;
+
+    switch (s.kind) {
+    case BRANCH_B:      return offset <= 2046;
+    case BRANCH_COND:   return offset <= 254;
+    default:            return offset >= 0 && offset <= 126;
+    }
+}
+
+static void generateCase(Case &c)
+{
+    /*
+     * Forward branches only, so every pass ends. SP and PC are never
+     * written except by branches, which holds for all the encodings we
+     * pick. 32-bit instructions are kept bundle-aligned, as the
+     * validator requires.
+     */
+
+    Slot slots[MAX_CODE_BYTES / 2];
+    unsigned numSlots = 0;
+    unsigned numInstrs = 1 + rand32() % MAX_INSTRS;
+
+    c.offset = 4 + 2 * (rand32() % ((CACHE_SIZE - MAX_CODE_BYTES - 4) / 2));
+    c.length = 0;
+
+    for (unsigned n = 0; n < numInstrs; ++n) {
+        unsigned kind;
+        uint16_t instr = randomInstr16(kind);
+
+        if (kind != WIDE) {
+            Slot s = { c.offset + c.length * 2, kind };
+            slots[numSlots++] = s;
+            c.code[c.length++] = instr;
+            continue;
+        }
+
+        if ((c.offset + c.length * 2) & 2)
+            c.code[c.length++] = Nop;
+
+        uint32_t instr32 = randomInstr32();
+        Slot s = { c.offset + c.length * 2, WIDE };
+        slots[numSlots++] = s;
+        c.code[c.length++] = instr32 >> 16;
+        c.code[c.length++] = instr32;
+    }
+
+    Slot stop = { c.offset + c.length * 2, PLAIN };
+    slots[numSlots++] = stop;
+    c.code[c.length++] = SvcTest | STOP_SVC;
+
+    // Point each branch at a random later instruction it can reach
+    for (unsigned n = 0; n < numSlots; ++n) {
+        const Slot &s = slots[n];
+        if (s.kind == PLAIN || s.kind == WIDE)
+            continue;
+
+        unsigned candidates[MAX_CODE_BYTES / 2];
+        unsigned numCandidates = 0;
+        for (unsigned t = n + 1; t < numSlots; ++t)
+            if (branchReaches(s, slots[t].offset))
+                candidates[numCandidates++] = slots[t].offset;
+
+        unsigned index = (s.offset - c.offset) / 2;
+        if (numCandidates)
+            c.code[index] = encodeBranch(s, candidates[rand32() % numCandidates]);
+    }
+
+    for (unsigned p = 0; p < NUM_PASSES; ++p) {
+        for (unsigned r = 0; r < NUM_REGS; ++r)
+            c.regs[p][r] = randomValue();
+        c.regs[p][REG_PC] = reinterpret_cast<reg_t>(blockCache + c.offset);
+        c.regs[p][REG_CPSR] = randomWord() & 0xF0000000;
+    }
+}
+
+
+/***************************************************************************
+ * Comparing results
+ ***************************************************************************/
+
+static void printEvent(const char *label, const Log &l, unsigned i)
+{
+    if (i >= l.count) {
+        printf("  %s: (no event)\n", label);
+        return;
+    }
+
+    const Event &e = l.events[i];
+    static const char *kinds[] = { "?", "SVC", "FAULT", "TICKS" };
+
+    printf("  %s: %s %u, ticks=%llu cycles=%llu ram=%08x\n    ", label,
+        kinds[e.kind < arraysize(kinds) ? e.kind : 0], e.code,
+        (unsigned long long) e.ticks, (unsigned long long) e.cycles, e.ramHash);
+    for (unsigned r = 0; r < NUM_REGS; ++r)
+        printf(" r%u=%llx", r, (unsigned long long) e.regs[r]);
+    printf("\n");
+}
+
+static void printCase(unsigned index, uint32_t seed)
+{
+    const Case &c = currentCase;
+
+    printf("Case %u (seed %u), cache offset 0x%x:\n", index, seed, c.offset);
+    for (unsigned i = 0; i < c.length; ++i)
+        printf("%s%04x", i % 16 ? " " : "\n  ", c.code[i]);
+    printf("\n");
+}
+
+static bool compareLogs(const Log &interp, const Log &trans)
+{
+    unsigned count = std::max(interp.count, trans.count);
+
+    for (unsigned i = 0; i < count; ++i) {
+        if (i < interp.count && i < trans.count &&
+            !memcmp(&interp.events[i], &trans.events[i], sizeof(Event)))
+            continue;
+
+        printf("Event %u differs:\n", i);
+        printEvent("interpreted", interp, i);
+        printEvent("translated ", trans, i);
+        return false;
+    }
+
+    if (interp.overflow || trans.overflow) {
+        printf("Event log overflow\n");
+        return false;
+    }
+    if (trans.codeModified) {
+        printf("Translated run wrote to code, but interpreted run didn't\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned numCases = argc > 1 ? strtoul(argv[1], 0, 0) : DEFAULT_CASES;
+    uint32_t baseSeed = argc > 2 ? strtoul(argv[2], 0, 0) : 1;
+
+    System *sys = reinterpret_cast<System*>(systemStorage);
+    reinterpret_cast<SystemMC*>(systemMCStorage)->init(sys);
+
+    SvmMemory::VirtAddr va = SvmMemory::VIRTUAL_RAM_BASE;
+    SvmMemory::PhysAddr pa;
+    SvmMemory::mapRAM(va, RAM_SIZE, pa);
+    ram = pa;
+
+    // Shared with the child processes, one log each
+    void *shared = mmap(0, 2 * sizeof(Log), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANON, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    Log *interp = static_cast<Log*>(shared);
+    Log *trans = interp + 1;
+
+    unsigned skipped = 0;
+
+    for (unsigned i = 0; i < numCases; ++i) {
+        uint32_t seed = baseSeed + i;
+        rngState = seed;
+
+        for (unsigned j = 0; j < RAM_SIZE; ++j)
+            ramImage[j] = rand32();
+        memcpy(ram, ramImage, RAM_SIZE);
+
+        Case &c = currentCase;
+        generateCase(c);
+
+        memset(blockCache, 0, CACHE_SIZE);
+        reinterpret_cast<uint16_t*>(blockCache)[0] = SvcTest | STOP_SVC;
+        memcpy(blockCache + c.offset, c.code, c.length * sizeof(uint16_t));
+        memcpy(cacheImage, blockCache, CACHE_SIZE);
+
+        if (!runInChild(false, interp) || !runInChild(true, trans)) {
+            printCase(i, seed);
+            return 1;
+        }
+
+        // Code that stores into itself isn't something we translate correctly
+        if (interp->codeModified) {
+            skipped++;
+            continue;
+        }
+
+        if (!compareLogs(*interp, *trans)) {
+            printCase(i, seed);
+            return 1;
+        }
+    }
+
+    printf("%u cases passed, %u skipped for writing to their own code\n",
+        numCases - skipped, skipped);
+    return 0;
+}
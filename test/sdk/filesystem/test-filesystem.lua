@@ -248,6 +248,71 @@ function testHierarchy(verbose)
     end
 end
 
+function testDeltaVolumes()
+    -- Build volumes partly out of another volume's payload, like a delta install
+
+    print "Testing delta volume copies"
+
+    assertVolumes{}
+
+    local source = fs:newVolume(TEST_VOL_TYPE, string.rep("a", 4096))
+
+    -- Copy the ends, replace the middle
+    local vol = fs:newDeltaVolume(TEST_VOL_TYPE, source, {1000, string.rep("b", 1000), 2096})
+    assert(vol, "Delta volume should have committed")
+    assertEquals(string.sub(fs:volumePayload(vol), 1, 4096),
+        string.rep("a", 1000) .. string.rep("b", 1000) .. string.rep("a", 2096))
+
+    -- The last run is longer than the source. The total size still comes
+    -- out exactly right, but the volume must not commit.
+    assertEquals(fs:newDeltaVolume(TEST_VOL_TYPE, source, {string.rep("c", 4000), 2000}), nil)
+
+    -- Same with a source that doesn't exist at all
+    assertEquals(fs:newDeltaVolume(TEST_VOL_TYPE, 0, {string.rep("c", 100), 100}), nil)
+
+    assertVolumes{source, vol}
+
+    fs:deleteVolume(source)
+    fs:deleteVolume(vol)
+    assertVolumes{}
+end
+
+function testCheckpoints()
+    -- Save flash checkpoints, change things, and roll back
+
+    print "Testing flash checkpoints"
+
+    assertVolumes{}
+    fs:checkpoint("empty")
+
+    local a = fs:newVolume(TEST_VOL_TYPE, string.rep("a", 4096))
+    assert(fs:checkpoint("one") > 0, "New volume should dirty some blocks")
+    assertEquals(fs:checkpoint("one"), 0)
+
+    local b = fs:newVolume(TEST_VOL_TYPE, string.rep("b", 4096))
+    assertVolumes{a, b}
+
+    -- Only blocks written since the checkpoint come back
+    assert(fs:rollback("one") > 0, "Rollback should rewrite some blocks")
+    assertVolumes{a}
+    assertEquals(string.sub(fs:volumePayload(a), 1, 4096), string.rep("a", 4096))
+    assertEquals(fs:rollback("one"), 0)
+
+    -- Checkpoints survive rollback, and we can go either direction
+    fs:rollback("empty")
+    assertVolumes{}
+    fs:rollback("one")
+    assertVolumes{a}
+    fs:rollback("empty")
+    assertVolumes{}
+
+    assertEquals(pcall(fs.rollback, fs, "bogus"), false)
+
+    assertEquals(fs:deleteCheckpoint("one"), true)
+    assertEquals(fs:deleteCheckpoint("one"), false)
+    assertEquals(fs:deleteCheckpoint("empty"), true)
+end
+
 function measureVolumeSize(payloadSize, hdrDataSize)
     -- Creates a volume, measures its size (in map blocks), and deletes it.
 
@@ -367,6 +432,8 @@ function testFilesystem()
     -- Individual filesystem exercises
     testStoredObjects()
     testHierarchy()
+    testDeltaVolumes()
+    testCheckpoints()
     testAllocFail()
     testVolumeSizes()
     testRandomVolumes()
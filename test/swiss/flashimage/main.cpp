@@ -0,0 +1,132 @@
+/*
+ * Round-trips flash images through swiss's FlashImage, in both the raw
+ * and compressed formats, and checks that damaged images are rejected.
+ */
+
+#include "flashimage.h"
+#include "macros.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char *PATH = "flashimage-test.bin";
+
+static void makeBlock(FlashImage::Block &b, unsigned index)
+{
+    // Mostly erased, with a few blocks of varied content
+
+    b.erase(index * FlashImage::BLOCK_SIZE);
+
+    if (index % 7 == 1) {
+        uint32_t x = index;
+        for (unsigned i = 0; i < FlashImage::BLOCK_SIZE; ++i) {
+            x = x * 1103515245 + 12345;
+            b.data[i] = (i / FlashImage::CHUNK_SIZE) % 3 ? x >> 24 : 0xFF;
+        }
+    } else if (index % 11 == 2) {
+        memset(b.chunk(5), 0, 100);
+    }
+
+    b.computeChecksums();
+}
+
+static long fileSize()
+{
+    FILE *f = fopen(PATH, "rb");
+    ASSERT(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void roundTrip(FlashImage::Format format)
+{
+    FlashImage out;
+    ASSERT(out.create(PATH, format));
+
+    FlashImage::Block b;
+    for (unsigned i = 0; i < FlashImage::NUM_BLOCKS; ++i) {
+        makeBlock(b, i);
+        ASSERT(out.writeBlock(b));
+    }
+    ASSERT(out.finish());
+    out.close();
+
+    long size = fileSize();
+    if (format == FlashImage::Raw)
+        ASSERT(size == FlashImage::DEVICE_SIZE + FlashImage::PAGE_SIZE);
+    else
+        ASSERT(size < FlashImage::DEVICE_SIZE / 8);
+
+    FlashImage in;
+    ASSERT(in.open(PATH));
+    ASSERT(in.format() == format);
+
+    FlashImage::Block expected, actual;
+    for (unsigned i = 0; i < FlashImage::NUM_BLOCKS; ++i) {
+        makeBlock(expected, i);
+        ASSERT(in.readBlock(actual));
+        ASSERT(actual.address == expected.address);
+        ASSERT(actual.erasedMask == expected.erasedMask);
+        ASSERT(!memcmp(actual.crc, expected.crc, sizeof actual.crc));
+        ASSERT(actual.data == expected.data);
+    }
+    in.close();
+
+    printf("flashimage: format %d, %ld bytes\n", format, size);
+}
+
+static bool readsCleanly()
+{
+    FlashImage in;
+    if (!in.open(PATH))
+        return false;
+
+    FlashImage::Block b;
+    for (unsigned i = 0; i < FlashImage::NUM_BLOCKS; ++i)
+        if (!in.readBlock(b))
+            return false;
+    return true;
+}
+
+static void damagedImage()
+{
+    roundTrip(FlashImage::Compressed);
+    long size = fileSize();
+
+    // Flip a byte in the middle of the compressed data
+
+    FILE *f = fopen(PATH, "r+b");
+    ASSERT(f);
+    fseek(f, size / 2, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, size / 2, SEEK_SET);
+    fputc(c ^ 0x55, f);
+    fclose(f);
+    ASSERT(!readsCleanly());
+
+    // Cut off the end-of-image marker
+
+    roundTrip(FlashImage::Compressed);
+    std::vector<uint8_t> data(size);
+    f = fopen(PATH, "rb");
+    ASSERT(f && fread(&data[0], size, 1, f) == 1);
+    fclose(f);
+    f = fopen(PATH, "wb");
+    ASSERT(f && fwrite(&data[0], size - 4, 1, f) == 1);
+    fclose(f);
+    ASSERT(!readsCleanly());
+}
+
+int main()
+{
+    roundTrip(FlashImage::Raw);
+    roundTrip(FlashImage::Compressed);
+    damagedImage();
+
+    remove(PATH);
+    printf("flashimage: Success.\n");
+    return 0;
+}
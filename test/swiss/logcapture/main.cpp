@@ -0,0 +1,150 @@
+/*
+ * Checks swiss's raw log capture: records survive a round trip through
+ * a capture file in order, and a consumer that falls behind costs us
+ * counted drops rather than blocking the producer.
+ */
+
+#include "logcapture.h"
+#include "macros.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static LogRecord makeRecord(unsigned i)
+{
+    LogRecord r;
+    r.timestamp = i * 1000ULL + 7;
+    r.msg.init(USBProtocol::Logger);
+    r.msg.header |= i & 0xffff;
+    for (unsigned j = 0; j < i % 40; ++j)
+        r.msg.append(uint8_t(i + j));
+    return r;
+}
+
+static bool sameRecord(const LogRecord &a, const LogRecord &b)
+{
+    return a.timestamp == b.timestamp && a.dropped == b.dropped &&
+           a.msg.len == b.msg.len && !memcmp(a.msg.bytes, b.msg.bytes, a.msg.len);
+}
+
+static void roundTrip()
+{
+    const unsigned count = 100000;
+
+    FILE *f = tmpfile();
+    ASSERT(f);
+    ASSERT(LogCaptureFile::writeHeader(f));
+
+    LogCaptureWriter writer(f);
+    writer.start();
+    for (unsigned i = 0; i < count; ++i)
+        writer.push(makeRecord(i));
+    writer.addDropped(3);
+    writer.push(makeRecord(count));
+    ASSERT(writer.finish());
+    ASSERT(writer.numRecords() == count + 1);
+    ASSERT(writer.numDropped() == 3);
+
+    rewind(f);
+    ASSERT(LogCaptureFile::readHeader(f));
+
+    LogRecord r;
+    for (unsigned i = 0; i <= count; ++i) {
+        LogRecord expected = makeRecord(i);
+        if (i == count)
+            expected.dropped = 3;
+        ASSERT(LogCaptureFile::readRecord(f, r));
+        ASSERT(sameRecord(r, expected));
+    }
+    ASSERT(!LogCaptureFile::readRecord(f, r));
+    ASSERT(feof(f));
+    fclose(f);
+}
+
+class StalledQueue : public LogRecordQueue
+{
+public:
+    // Blocks the consumer until released, like a stuck disk or terminal
+
+    StalledQueue() : stalled(false), released(false) {}
+
+    ~StalledQueue() {
+        finish();
+    }
+
+    void waitUntilStalled() {
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        while (!stalled)
+            cond.wait(lock);
+    }
+
+    void waitForConsumed(unsigned count) {
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        while (consumed.size() < count)
+            cond.wait(lock);
+    }
+
+    void release() {
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        released = true;
+        cond.notify_all();
+    }
+
+    std::vector<LogRecord> consumed;
+
+protected:
+    bool consume(const LogRecord &r) {
+        tthread::lock_guard<tthread::mutex> guard(lock);
+        stalled = true;
+        cond.notify_all();
+        while (!released)
+            cond.wait(lock);
+        consumed.push_back(r);
+        cond.notify_all();
+        return true;
+    }
+
+private:
+    tthread::mutex lock;
+    tthread::condition_variable cond;
+    bool stalled, released;
+};
+
+static void overflow()
+{
+    // One record is stuck in the consumer, and the queue fills behind it
+
+    const unsigned dropped = 1000;
+    const unsigned total = 1 + LogRecordQueue::MAX_QUEUED_RECORDS + dropped;
+
+    StalledQueue queue;
+    queue.start();
+    queue.push(makeRecord(0));
+    queue.waitUntilStalled();
+
+    for (unsigned i = 1; i < total; ++i)
+        queue.push(makeRecord(i));
+    ASSERT(queue.numDropped() == dropped);
+
+    queue.release();
+    queue.waitForConsumed(total - dropped);
+    queue.push(makeRecord(total));
+    ASSERT(queue.finish());
+
+    ASSERT(queue.consumed.size() == total - dropped + 1);
+    ASSERT(queue.consumed.back().dropped == dropped);
+    for (unsigned i = 0; i + 1 < queue.consumed.size(); ++i) {
+        ASSERT(queue.consumed[i].dropped == 0);
+        ASSERT(queue.consumed[i].timestamp == i * 1000ULL + 7);
+    }
+}
+
+int main()
+{
+    roundTrip();
+    overflow();
+
+    printf("logcapture: Success.\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Runs swiss's TcpDevice against a loopback server that echoes every
+ * frame back, and checks that the simulated link's latency and bandwidth
+ * limits are honored.
+ */
+
+#include "tcpdevice.h"
+#include "tinythread.h"
+#include "util.h"
+#include "macros.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+static int listenFD;
+
+static unsigned startEchoServer()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+
+    listenFD = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(listenFD >= 0);
+    ASSERT(bind(listenFD, (struct sockaddr *) &addr, sizeof addr) == 0);
+    ASSERT(listen(listenFD, 1) == 0);
+
+    socklen_t size = sizeof addr;
+    ASSERT(getsockname(listenFD, (struct sockaddr *) &addr, &size) == 0);
+    return ntohs(addr.sin_port);
+}
+
+static void echoThread(void *)
+{
+    // One client per test; echo until it hangs up
+
+    for (;;) {
+        int fd = accept(listenFD, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        char buf[4096];
+        int len;
+        while ((len = recv(fd, buf, sizeof buf, 0)) > 0)
+            ASSERT(send(fd, buf, len, 0) == len);
+        close(fd);
+    }
+}
+
+static double roundTrip(TcpDevice &dev, unsigned count, unsigned size)
+{
+    // Send 'count' packets back to back, and wait for all the echoes
+
+    ASSERT(dev.open(IODevice::SIFTEO_VID, IODevice::BASE_PID));
+    double start = Util::now();
+
+    uint8_t packet[IODevice::MAX_EP_SIZE];
+    for (unsigned i = 0; i < count; ++i) {
+        memset(packet, i, size);
+        ASSERT(dev.writePacket(packet, size) == int(size));
+    }
+
+    for (unsigned i = 0; i < count;) {
+        ASSERT(dev.processEvents(10) == 0);
+        while (dev.numPendingINPackets()) {
+            unsigned len;
+            ASSERT(dev.readPacket(packet, sizeof packet, len) == 0);
+            ASSERT(len == size);
+            ASSERT(packet[0] == uint8_t(i) && packet[size - 1] == uint8_t(i));
+            i++;
+        }
+        ASSERT(Util::now() - start < 10.0);
+    }
+
+    double elapsed = Util::now() - start;
+    ASSERT(dev.numPendingOUTPackets() == 0);
+    dev.close();
+    ASSERT(!dev.isOpen());
+    return elapsed;
+}
+
+int main()
+{
+    unsigned port = startEchoServer();
+    tthread::thread server(echoThread, 0);
+
+    TcpDevice dev(port);
+
+    // There's no emulated bootloader
+    ASSERT(!dev.open(IODevice::SIFTEO_VID, IODevice::BOOTLOADER_PID));
+
+    // Unshaped, this is only as slow as the loopback interface
+    double t = roundTrip(dev, 200, 64);
+    printf("tcpdevice: unshaped, %.3f s\n", t);
+    ASSERT(t < 1.0);
+
+    // Latency applies in both directions
+    dev.setLink(50, 0);
+    t = roundTrip(dev, 10, 64);
+    printf("tcpdevice: 50 ms latency, %.3f s\n", t);
+    ASSERT(t >= 0.1 && t < 1.0);
+
+    // 64 packets of 64 bytes at 32 kB/s take 128 ms each way, pipelined
+    dev.setLink(0, 32000);
+    t = roundTrip(dev, 64, 64);
+    printf("tcpdevice: 32 kB/s, %.3f s\n", t);
+    ASSERT(t >= 0.128 && t < 1.0);
+
+    shutdown(listenFD, SHUT_RDWR);
+    close(listenFD);
+    server.join();
+
+    printf("tcpdevice: Success.\n");
+    return 0;
+}
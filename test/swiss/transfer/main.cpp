@@ -0,0 +1,363 @@
+/*
+ * Exercises swiss's TransferEngine against a simulated base on a loopback
+ * IODevice. The link moves a limited number of packets per 1 ms USB frame
+ * and replies take a frame to come back, so throughput depends on how many
+ * transfers the engine keeps in flight.
+ */
+
+#include "transferengine.h"
+#include "usbvolumemanager.h"
+#include "util.h"
+#include "macros.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+
+class LoopbackDevice : public IODevice {
+public:
+    static const unsigned FLASH_SIZE = 1024 * 1024;
+    static const unsigned PACKETS_PER_FRAME = 19;
+    static const unsigned REPLY_LATENCY_FRAMES = 1;
+    static const unsigned BLOCK_SIZE = 64 * 1024;
+
+    std::vector<uint8_t> flash;
+    std::vector<uint8_t> written;
+    uint32_t writeCommand;
+    unsigned frame;
+    unsigned inWindow;
+    bool oldFirmware;
+    unsigned packetsWritten;
+
+    LoopbackDevice() : flash(FLASH_SIZE), writeCommand(0), frame(0), inWindow(16),
+        oldFirmware(false), packetsWritten(0)
+    {
+        uint32_t x = 1;
+        for (unsigned i = 0; i < FLASH_SIZE; ++i) {
+            x = x * 1103515245 + 12345;
+            flash[i] = x >> 24;
+        }
+    }
+
+    bool open(uint16_t, uint16_t, uint8_t) { return true; }
+    void close() {}
+    bool isOpen() const { return true; }
+
+    int processEvents(unsigned)
+    {
+        // One USB frame: the base handles what arrived, replies go out
+
+        frame++;
+
+        for (unsigned i = 0; i < PACKETS_PER_FRAME && !outQueue.empty(); ++i) {
+            handlePacket(outQueue.front());
+            outQueue.pop_front();
+        }
+
+        while (!replies.empty() && replies.front().frame <= frame
+            && received.size() < inWindow) {
+            received.push_back(replies.front().msg);
+            replies.pop_front();
+        }
+
+        return 0;
+    }
+
+    unsigned maxINPacketSize() const { return MAX_EP_SIZE; }
+    unsigned numPendingINPackets() const { return received.size(); }
+
+    int readPacket(uint8_t *buf, unsigned maxlen, unsigned &rxlen)
+    {
+        ASSERT(!received.empty());
+        USBProtocolMsg &m = received.front();
+        rxlen = MIN(maxlen, m.len);
+        memcpy(buf, m.bytes, rxlen);
+        received.pop_front();
+        return 0;
+    }
+
+    void setINWindow(unsigned numTransfers) {
+        inWindow = MAX(inWindow, numTransfers);
+    }
+
+    unsigned maxOUTPacketSize() const { return MAX_EP_SIZE; }
+    unsigned numPendingOUTPackets() const { return outQueue.size(); }
+
+    int writePacket(const uint8_t *buf, unsigned len)
+    {
+        USBProtocolMsg m;
+        memcpy(m.bytes, buf, len);
+        m.len = len;
+        outQueue.push_back(m);
+        return len;
+    }
+
+private:
+    struct Reply {
+        unsigned frame;
+        USBProtocolMsg msg;
+    };
+
+    std::deque<USBProtocolMsg> outQueue;
+    std::deque<Reply> replies;
+    std::deque<USBProtocolMsg> received;
+
+    void handlePacket(const USBProtocolMsg &m)
+    {
+        ASSERT(m.subsystem() == USBProtocol::Installer);
+        unsigned command = m.header & 0xff;
+
+        if (command == UsbVolumeManager::FlashDeviceRead) {
+            const UsbVolumeManager::FlashDeviceReadRequest *req =
+                m.castPayload<UsbVolumeManager::FlashDeviceReadRequest>();
+
+            // Interleave some log traffic, which the engine must skip
+            if ((req->address / USBProtocolMsg::MAX_PAYLOAD_BYTES) % 97 == 0)
+                queueReply(USBProtocolMsg(USBProtocol::Logger));
+
+            USBProtocolMsg reply(USBProtocol::Installer);
+            reply.header |= UsbVolumeManager::FlashDeviceRead;
+            unsigned length = MIN(req->length, reply.bytesFree());
+            ASSERT(req->address + length <= flash.size());
+            reply.append(&flash[req->address], length);
+            queueReply(reply);
+
+        } else if (oldFirmware) {
+            // Doesn't know about raw flash commands, sends an empty reply
+            queueReply(USBProtocolMsg(USBProtocol::Installer));
+
+        } else if (command == UsbVolumeManager::FlashDeviceChecksums) {
+            const UsbVolumeManager::FlashChecksumRequest *req =
+                m.castPayload<UsbVolumeManager::FlashChecksumRequest>();
+            const unsigned chunkSize = UsbVolumeManager::FLASH_CHECKSUM_CHUNK;
+
+            USBProtocolMsg reply(USBProtocol::Installer);
+            reply.header |= UsbVolumeManager::FlashDeviceChecksums;
+            UsbVolumeManager::FlashChecksumReply *r =
+                reply.zeroCopyAppend<UsbVolumeManager::FlashChecksumReply>();
+            ASSERT(req->count <= UsbVolumeManager::MAX_FLASH_CHECKSUMS);
+            reply.len -= sizeof r->crc[0] * (UsbVolumeManager::MAX_FLASH_CHECKSUMS - req->count);
+
+            r->erasedMask = 0;
+            for (unsigned i = 0; i < req->count; ++i) {
+                const uint8_t *chunk = &flash[req->address + i * chunkSize];
+                ASSERT(req->address + (i + 1) * chunkSize <= flash.size());
+                r->crc[i] = Util::baseCrc32(chunk, chunkSize);
+
+                unsigned j = 0;
+                while (j < chunkSize && chunk[j] == 0xFF)
+                    j++;
+                if (j == chunkSize)
+                    r->erasedMask |= 1 << i;
+            }
+            queueReply(reply);
+
+        } else if (command == UsbVolumeManager::FlashDeviceErase) {
+            const UsbVolumeManager::FlashEraseRequest *req =
+                m.castPayload<UsbVolumeManager::FlashEraseRequest>();
+            ASSERT(req->address % BLOCK_SIZE == 0);
+            memset(&flash[req->address], 0xFF, BLOCK_SIZE);
+
+            USBProtocolMsg reply(USBProtocol::Installer);
+            reply.header |= UsbVolumeManager::FlashDeviceErase;
+            queueReply(reply);
+
+        } else if (command == UsbVolumeManager::FlashDeviceWrite) {
+            const UsbVolumeManager::FlashWriteHeader *hdr =
+                m.castPayload<UsbVolumeManager::FlashWriteHeader>();
+            unsigned length = m.payloadLen() - sizeof *hdr;
+            const uint8_t *data = m.payload + sizeof *hdr;
+
+            // Programming can only clear bits
+            ASSERT(hdr->address + length <= flash.size());
+            for (unsigned i = 0; i < length; ++i)
+                flash[hdr->address + i] &= data[i];
+            packetsWritten++;
+
+        } else {
+            ASSERT(command == writeCommand);
+            written.insert(written.end(), m.payload, m.payload + m.payloadLen());
+        }
+    }
+
+    void queueReply(const USBProtocolMsg &m)
+    {
+        Reply r;
+        r.frame = frame + REPLY_LATENCY_FRAMES;
+        r.msg = m;
+        replies.push_back(r);
+    }
+};
+
+static unsigned readTest(unsigned window, bool toFile)
+{
+    // Returns the number of simulated frames it took
+
+    LoopbackDevice dev;
+    TransferEngine engine(dev, window);
+
+    const unsigned address = 12345;
+    const unsigned length = 256 * 1024 + 7;
+    std::vector<uint8_t> result(length);
+
+    if (toFile) {
+        FILE *f = tmpfile();
+        ASSERT(f);
+        ASSERT(engine.readFlash(address, length, f));
+        rewind(f);
+        ASSERT(fread(&result[0], length, 1, f) == 1);
+        fclose(f);
+    } else {
+        ASSERT(engine.readFlash(address, length, &result[0]));
+    }
+
+    ASSERT(memcmp(&result[0], &dev.flash[address], length) == 0);
+    ASSERT(engine.bytesTransferred() == length);
+
+    printf("transfer: read, window %3u: %5u frames, %6.1f kB/s simulated\n",
+        window, dev.frame, length / 1024.0 / (dev.frame / 1000.0));
+    return dev.frame;
+}
+
+static unsigned writeTest(unsigned window, bool fromFile)
+{
+    LoopbackDevice dev;
+    dev.writeCommand = UsbVolumeManager::WritePayload;
+    TransferEngine engine(dev, window);
+
+    const unsigned length = 300 * 1024 + 3;
+    const uint8_t *data = &dev.flash[777];
+
+    if (fromFile) {
+        FILE *f = tmpfile();
+        ASSERT(f);
+        ASSERT(fwrite(data, length, 1, f) == 1);
+        rewind(f);
+        ASSERT(engine.writeFile(f, length, dev.writeCommand));
+        fclose(f);
+    } else {
+        ASSERT(engine.writeBuffer(data, length, dev.writeCommand));
+    }
+
+    ASSERT(dev.numPendingOUTPackets() == 0);
+    ASSERT(dev.written.size() == length);
+    ASSERT(memcmp(&dev.written[0], data, length) == 0);
+
+    printf("transfer: write, window %3u: %5u frames, %6.1f kB/s simulated\n",
+        window, dev.frame, length / 1024.0 / (dev.frame / 1000.0));
+    return dev.frame;
+}
+
+static void truncatedFile()
+{
+    // A file that's shorter than promised fails cleanly
+
+    LoopbackDevice dev;
+    dev.writeCommand = UsbVolumeManager::WritePayload;
+    TransferEngine engine(dev);
+
+    FILE *f = tmpfile();
+    ASSERT(f);
+    ASSERT(fwrite(&dev.flash[0], 1000, 1, f) == 1);
+    rewind(f);
+    ASSERT(!engine.writeFile(f, 200 * 1024, dev.writeCommand));
+    fclose(f);
+}
+
+static void extentsTest()
+{
+    // Scattered reads, including empty and unaligned ranges, land back to back
+
+    LoopbackDevice dev;
+    TransferEngine engine(dev);
+
+    static const unsigned ranges[][2] = {
+        { 100, 16 }, { 50000, 4080 }, { 7, 0 }, { 900000, 61 }, { 1, 1 }, { 300000, 120 },
+    };
+
+    std::vector<TransferEngine::Extent> extents;
+    std::vector<uint8_t> expected;
+
+    for (unsigned i = 0; i < arraysize(ranges); ++i) {
+        TransferEngine::Extent e = { ranges[i][0], ranges[i][1] };
+        extents.push_back(e);
+        expected.insert(expected.end(), &dev.flash[e.address], &dev.flash[e.address] + e.length);
+    }
+
+    std::vector<uint8_t> result(expected.size());
+    ASSERT(engine.readFlash(extents, &result[0]));
+    ASSERT(result == expected);
+}
+
+static void flashTest()
+{
+    /*
+     * Rewrite one block of flash the way 'swiss restore' does: erase,
+     * program only the parts with data, then verify with checksums.
+     */
+
+    const unsigned chunkSize = UsbVolumeManager::FLASH_CHECKSUM_CHUNK;
+    const unsigned numChunks = LoopbackDevice::BLOCK_SIZE / chunkSize;
+    const unsigned address = 3 * LoopbackDevice::BLOCK_SIZE;
+
+    LoopbackDevice dev;
+    TransferEngine engine(dev);
+    ASSERT(engine.supportsFlashChecksums());
+
+    // New contents: copied from elsewhere, with a few erased chunks
+    std::vector<uint8_t> image(&dev.flash[5], &dev.flash[5] + LoopbackDevice::BLOCK_SIZE);
+    memset(&image[2 * chunkSize], 0xFF, 3 * chunkSize);
+    memset(&image[numChunks * chunkSize - chunkSize], 0xFF, chunkSize);
+
+    std::vector<uint32_t> crcs;
+    std::vector<bool> erased;
+    ASSERT(engine.readFlashChecksums(address, numChunks, crcs, erased));
+    for (unsigned i = 0; i < numChunks; ++i) {
+        ASSERT(!erased[i]);
+        ASSERT(crcs[i] == Util::baseCrc32(&dev.flash[address + i * chunkSize], chunkSize));
+    }
+
+    ASSERT(engine.eraseFlashBlock(address));
+    ASSERT(engine.writeFlash(address, &image[0], image.size()));
+
+    ASSERT(engine.readFlashChecksums(address, numChunks, crcs, erased));
+    for (unsigned i = 0; i < numChunks; ++i) {
+        ASSERT(erased[i] == (i == 2 || i == 3 || i == 4 || i == numChunks - 1));
+        ASSERT(crcs[i] == Util::baseCrc32(&image[i * chunkSize], chunkSize));
+    }
+    ASSERT(memcmp(&dev.flash[address], &image[0], image.size()) == 0);
+
+    // Erased packets never went over the wire
+    const unsigned perPacket = USBProtocolMsg::MAX_PAYLOAD_BYTES
+        - sizeof(UsbVolumeManager::FlashWriteHeader);
+    ASSERT(dev.packetsWritten < (image.size() - 4 * chunkSize) / perPacket + 8);
+
+    // Old firmware is detected, not misread
+    LoopbackDevice oldDev;
+    oldDev.oldFirmware = true;
+    TransferEngine oldEngine(oldDev);
+    ASSERT(!oldEngine.supportsFlashChecksums());
+}
+
+int main()
+{
+    // Window of 3 matches the old fixed request pipelining
+    unsigned slowRead = readTest(3, false);
+    unsigned fastRead = readTest(TransferEngine::DEFAULT_WINDOW, false);
+    readTest(TransferEngine::DEFAULT_WINDOW, true);
+    readTest(1, true);
+    ASSERT(fastRead * 3 < slowRead);
+
+    unsigned slowWrite = writeTest(1, false);
+    unsigned fastWrite = writeTest(TransferEngine::DEFAULT_WINDOW, true);
+    writeTest(TransferEngine::DEFAULT_WINDOW, false);
+    ASSERT(fastWrite < slowWrite);
+
+    truncatedFile();
+    extentsTest();
+    flashTest();
+
+    printf("transfer: Success.\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+
+#
+# Corpus benchmark for stir's DUB image codec.
+#
+# Runs stir over one or more asset scripts (by default, every SDK example)
+# once per encoder configuration, and totals the compressed size and the
+# number of codes the firmware's ImageDecoder must read per tile. Codes per
+# tile is the best host-side proxy we have for decode time, since each code
+# costs one trip through the decompressDUB() loop.
+#
+# usage: dub-benchmark.py [-s path/to/stir] [-d depth] [assets.lua ...]
+#
+
+import sys, os, re, glob, subprocess, getopt
+
+STATS = re.compile(r'^\s*(\S+):\s+(\d+) tiles,\s+(\d+) words,.*,\s+([\d.]+) codes/tile')
+
+def runStir(stir, script, variables):
+    args = [stir, '-v'] + ['%s=%s' % kv for kv in variables]
+    args.append(os.path.basename(script))
+
+    p = subprocess.Popen(args, cwd=os.path.dirname(script) or '.',
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    output = p.communicate()[0]
+    if p.returncode:
+        raise RuntimeError("stir failed on %s:\n%s" % (script, output))
+
+    results = {}
+    for line in output.splitlines():
+        m = STATS.match(line)
+        if m:
+            tiles, words, cpt = int(m.group(2)), int(m.group(3)), float(m.group(4))
+            results[m.group(1)] = (tiles, words, cpt * tiles)
+    return results
+
+def main():
+    tcDir = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
+    stir = os.path.join(tcDir, 'sdk', 'bin', 'stir')
+    depth = None
+
+    opts, scripts = getopt.getopt(sys.argv[1:], 's:d:')
+    for opt, value in opts:
+        if opt == '-s':
+            stir = os.path.abspath(value)
+        elif opt == '-d':
+            depth = value
+
+    if not scripts:
+        scripts = sorted(glob.glob(os.path.join(tcDir, 'sdk', 'examples', '*', 'assets.lua')))
+
+    configs = [ ('greedy', [('dub', 'greedy')]),
+                ('optimal', [('dub', 'optimal')]) ]
+    if depth:
+        for name, variables in configs:
+            variables.append(('dub_depth', depth))
+
+    totals = dict((name, [0, 0, 0.0]) for name, variables in configs)
+
+    print "%-40s %8s %10s %10s %8s" % ("Script", "Tiles", "Greedy", "Optimal", "Saved")
+
+    for script in scripts:
+        results = {}
+        for name, variables in configs:
+            results[name] = runStir(stir, os.path.abspath(script), variables)
+            for tiles, words, codes in results[name].values():
+                totals[name][0] += tiles
+                totals[name][1] += words
+                totals[name][2] += codes
+
+        tiles = sum(r[0] for r in results['greedy'].values())
+        greedy = sum(r[1] for r in results['greedy'].values())
+        optimal = sum(r[1] for r in results['optimal'].values())
+        if tiles:
+            print "%-40s %8d %10d %10d %7.02f%%" % (os.path.relpath(script, tcDir),
+                tiles, greedy, optimal, 100.0 - optimal * 100.0 / greedy)
+
+    print
+    for name, variables in configs:
+        tiles, words, codes = totals[name]
+        if tiles:
+            print "%-8s %8d words, %6.03f words/tile, %6.03f codes/tile" % (
+                name, words, words / float(tiles), codes / tiles)
+
+if __name__ == '__main__':
+    main()
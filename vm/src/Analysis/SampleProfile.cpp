@@ -0,0 +1,169 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cxxabi.h>
+#include "SampleProfile.h"
+#include "Target/SVMTargetMachine.h"
+#include "llvm/Function.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <stdlib.h>
+using namespace llvm;
+
+char SampleProfile::ID = 0;
+INITIALIZE_PASS(SampleProfile, "sample-profile",
+                "Sample profile", false, true)
+
+cl::opt<std::string> ProfileFilename("profile",
+    cl::desc("Lay out code using samples from 'swiss profile --folded' or Siftulator"),
+    cl::value_desc("filename"));
+
+
+void SampleProfile::initializePass()
+{
+    if (!ProfileFilename.empty())
+        load(ProfileFilename);
+}
+
+void SampleProfile::load(const std::string &Filename)
+{
+    std::ifstream In(Filename.c_str());
+    if (!In)
+        report_fatal_error("Can't open profile \"" + Twine(Filename) + "\"");
+
+    std::string Line;
+    unsigned LineNumber = 0;
+
+    while (std::getline(In, Line)) {
+        LineNumber++;
+
+        size_t End = Line.find_last_not_of(" \t\r");
+        if (End == std::string::npos || Line[0] == '#')
+            continue;
+        Line.erase(End + 1);
+
+        // Count is the last word. Names can have spaces, like "f(int, int)"
+        size_t Space = Line.find_last_of(" \t");
+        char *CountEnd;
+        uint64_t Count = Space == std::string::npos ? 0 :
+            strtoull(Line.c_str() + Space + 1, &CountEnd, 10);
+
+        if (Space == std::string::npos || *CountEnd)
+            report_fatal_error("Profile \"" + Twine(Filename) + "\", line " +
+                Twine(LineNumber) + ": expected \"[subsystem;]function count\"");
+
+        // Samples belong to the innermost frame of a folded stack
+        std::string Name = Line.substr(0, Space);
+        size_t Semicolon = Name.find_last_of(';');
+        if (Semicolon != std::string::npos)
+            Name.erase(0, Semicolon + 1);
+
+        Counts[Name] += Count;
+        Total += Count;
+    }
+}
+
+std::string SampleProfile::demangle(const std::string &Name)
+{
+    // Same demangler as our error reporter, and as swiss uses for profiles
+
+    int status;
+    char *result = abi::__cxa_demangle(Name.c_str(), 0, 0, &status);
+    if (status != 0)
+        return Name;
+
+    std::string Demangled = result;
+    free(result);
+    return Demangled;
+}
+
+uint64_t SampleProfile::getCount(const Function *F) const
+{
+    if (Counts.empty())
+        return 0;
+
+    CountMap_t::const_iterator I = Counts.find(F->getName().str());
+    if (I == Counts.end())
+        I = Counts.find(demangle(F->getName().str()));
+
+    return I == Counts.end() ? 0 : I->second;
+}
+
+void SampleProfile::recordPlacement(const Function *F,
+    unsigned FirstBlock, unsigned LastBlock)
+{
+    uint64_t Count = getCount(F);
+    if (!Count)
+        return;
+
+    Placement P = { Count, FirstBlock, LastBlock };
+    Placements.push_back(P);
+    Matched += Count;
+}
+
+void SampleProfile::printWorkingSet(raw_ostream &OS) const
+{
+    /*
+     * Predict the block cache working set: walk functions from hottest to
+     * coldest, and count the distinct flash blocks needed to cover each
+     * fraction of the samples. Samples for functions we didn't find in
+     * this program are left out of the percentages.
+     */
+
+    if (Counts.empty())
+        return;
+
+    std::vector<Placement> Sorted(Placements);
+    std::stable_sort(Sorted.begin(), Sorted.end());
+
+    static const unsigned Percentiles[] = { 50, 90, 99, 100 };
+    const unsigned NumPercentiles = sizeof Percentiles / sizeof Percentiles[0];
+
+    OS << "Profile: " << Sorted.size() << " functions sampled, "
+       << (Total ? Matched * 100 / Total : 0) << "% of samples matched\n";
+
+    std::set<unsigned> Blocks;
+    uint64_t Covered = 0;
+    unsigned P = 0;
+
+    for (unsigned i = 0; i < Sorted.size() && P < NumPercentiles; ++i) {
+        for (unsigned b = Sorted[i].FirstBlock; b <= Sorted[i].LastBlock; ++b)
+            Blocks.insert(b);
+        Covered += Sorted[i].Count;
+
+        while (P < NumPercentiles && Covered * 100 >= Matched * Percentiles[P]) {
+            OS << "Profile: " << Percentiles[P] << "% of samples in "
+               << Blocks.size() << " flash blocks\n";
+            P++;
+        }
+    }
+
+    OS << "Profile: the block cache holds "
+       << SVMTargetMachine::getBlockCacheSize() << " blocks\n";
+}
@@ -0,0 +1,105 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Sample counts for each function, read from the file given with
+ * '-profile'. This is the folded format written by 'swiss profile --folded'
+ * and by Siftulator: one "[subsystem;]function count" line per function.
+ * Names may be mangled or demangled.
+ *
+ * With no profile, this is empty and code layout is unchanged. Code
+ * generation records where each function ended up, so we can report how
+ * many flash blocks the hot code occupies.
+ */
+
+#ifndef SAMPLE_PROFILE_H
+#define SAMPLE_PROFILE_H
+
+#include "llvm/Pass.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/raw_ostream.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+using namespace llvm;
+
+namespace llvm {
+
+class Function;
+
+void initializeSampleProfilePass(PassRegistry&);
+
+class SampleProfile : public ImmutablePass {
+public:
+    static char ID;
+    SampleProfile() : ImmutablePass(ID), Total(0), Matched(0) {
+        initializeSampleProfilePass(*PassRegistry::getPassRegistry());
+    }
+
+    virtual void initializePass();
+
+    virtual const char *getPassName() const {
+        return "Sample profile";
+    }
+
+    bool empty() const {
+        return Counts.empty();
+    }
+
+    uint64_t getCount(const Function *F) const;
+
+    // Code generation reports the flash blocks each function occupies
+    void recordPlacement(const Function *F, unsigned FirstBlock, unsigned LastBlock);
+
+    // How many blocks hold the code behind various fractions of the samples
+    void printWorkingSet(raw_ostream &OS) const;
+
+    static std::string demangle(const std::string &Name);
+
+private:
+    typedef std::map<std::string, uint64_t> CountMap_t;
+
+    struct Placement {
+        uint64_t Count;
+        unsigned FirstBlock;
+        unsigned LastBlock;
+
+        bool operator< (const Placement &other) const {
+            return Count > other.Count;
+        }
+    };
+
+    CountMap_t Counts;
+    std::vector<Placement> Placements;
+    uint64_t Total;
+    uint64_t Matched;
+
+    void load(const std::string &Filename);
+};
+
+}  // end namespace llvm
+
+#endif
@@ -0,0 +1,122 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Micah Elizabeth Scott <micah@misc.name>
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LinkCache.h"
+#include "ErrorReporter.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/system_error.h"
+#include <unistd.h>
+using namespace llvm;
+
+// 64-bit FNV-1a
+static const uint64_t FNVOffsetBasis = 0xcbf29ce484222325ULL;
+static const uint64_t FNVPrime = 0x100000001b3ULL;
+
+
+LinkCache::LinkCache(StringRef Dir)
+    : Dir(Dir), Hash(FNVOffsetBasis) {}
+
+void LinkCache::addBytes(const char *Data, size_t Length)
+{
+    for (size_t i = 0; i < Length; ++i) {
+        Hash ^= (uint8_t) Data[i];
+        Hash *= FNVPrime;
+    }
+}
+
+void LinkCache::addString(StringRef S)
+{
+    // Include the length, so adjacent strings can't run together
+    uint64_t Length = S.size();
+    addBytes(reinterpret_cast<const char*>(&Length), sizeof Length);
+    addBytes(S.data(), S.size());
+}
+
+bool LinkCache::addFile(StringRef Filename)
+{
+    OwningPtr<MemoryBuffer> Buffer;
+    if (MemoryBuffer::getFile(Filename, Buffer))
+        return false;
+
+    addString(Filename);
+    addString(Buffer->getBuffer());
+    return true;
+}
+
+std::string LinkCache::getPath() const
+{
+    SmallString<256> Path(Dir);
+    sys::path::append(Path, utohexstr(Hash) + ".out");
+    return Path.str();
+}
+
+bool LinkCache::fetch(StringRef Output)
+{
+    std::string Path = getPath();
+    if (!sys::fs::exists(Path))
+        return false;
+
+    return !sys::fs::copy_file(Path, Output,
+        sys::fs::copy_option::overwrite_if_exists);
+}
+
+void LinkCache::store(StringRef Output)
+{
+    /*
+     * Copy to a temporary name first and rename it into place, so that
+     * another slinky sharing this cache never sees a partial file.
+     */
+
+    bool Existed;
+    if (sys::fs::create_directories(Dir, Existed)) {
+        report_warning("Can't create link cache directory \"" + Twine(Dir) + "\"");
+        return;
+    }
+
+    int FD;
+    SmallString<256> Temp;
+    SmallString<256> Model(Dir);
+    sys::path::append(Model, "%%%%%%%%.tmp");
+    if (sys::fs::unique_file(Model.str(), FD, Temp, false)) {
+        report_warning("Can't write to link cache \"" + Twine(Dir) + "\"");
+        return;
+    }
+    close(FD);
+
+    if (sys::fs::copy_file(Output, Temp.str(),
+            sys::fs::copy_option::overwrite_if_exists) ||
+        sys::fs::rename(Temp.str(), getPath())) {
+        bool Removed;
+        sys::fs::remove(Temp.str(), Removed);
+        report_warning("Can't write to link cache \"" + Twine(Dir) + "\"");
+    }
+}
@@ -0,0 +1,77 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Micah Elizabeth Scott <micah@misc.name>
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A directory of previously linked programs, given with '-cache'.
+ *
+ * The key is a hash of everything that can change slinky's output: its
+ * own executable, the command line, and the contents of each input file.
+ * If we've linked exactly the same thing before, the cached output is
+ * copied into place and we skip optimization and code generation.
+ *
+ * This only caches whole links. It doesn't make incremental links any
+ * faster: if any input changes, the link misses, and runs in full just as
+ * it would without a cache. Code generation isn't partitioned, and no
+ * per-function machine code is kept.
+ *
+ * slinky doesn't use the cache when it is asked for reports that are
+ * written during code generation, such as '-layout-report'.
+ */
+
+#ifndef SVM_LINKCACHE_H
+#define SVM_LINKCACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include <stdint.h>
+#include <string>
+
+namespace llvm {
+
+class LinkCache {
+public:
+    LinkCache(StringRef Dir);
+
+    void addString(StringRef S);
+    bool addFile(StringRef Filename);
+
+    // Copy a cached output to 'Output'. Returns false on a cache miss.
+    bool fetch(StringRef Output);
+
+    // Save a freshly linked output. Failures are only warnings.
+    void store(StringRef Output);
+
+    std::string getPath() const;
+
+private:
+    std::string Dir;
+    uint64_t Hash;
+
+    void addBytes(const char *Data, size_t Length);
+};
+
+}  // end namespace llvm
+
+#endif
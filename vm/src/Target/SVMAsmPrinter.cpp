@@ -53,12 +53,14 @@
 #include "SVMAsmPrinter.h"
 #include "SVMConstantPoolValue.h"
 #include "SVMSymbolDecoration.h"
+#include "Analysis/SampleProfile.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCSymbol.h"
 #include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCInst.h"
 #include "llvm/CodeGen/MachineConstantPool.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/TargetRegistry.h"
 using namespace llvm;
 
@@ -97,8 +99,13 @@ void SVMAsmPrinter::EmitInstruction(const MachineInstr *MI)
     if (MBB != CurrentMBB) {
         CurrentMBB = MBB;
         BSA.InstrAlign(MBB->getAlignment());
+        if (Report)
+            Report->addBasicBlock(MBB);
     }
 
+    if (Report)
+        Report->addInstr(MI);
+
     BSA.AddInstr(MI);
     emitBlockOffsetComment();
     OutStreamer.EmitInstruction(MCI);
@@ -108,12 +115,58 @@ void SVMAsmPrinter::EmitFunctionEntryLabel()
 {
     OutStreamer.ForceCodeRegion();
 
-    // XXX: For now, all functions start in new blocks
-    emitBlockBegin();
+    /*
+     * Functions normally start in new blocks. With a profile, we've been
+     * ordered so that functions which run together are adjacent, and
+     * a function that fits entirely in what's left of the current block
+     * goes there. Multi-block functions always start a new block, as
+     * SVMLateFunctionSplitPass assumed they would.
+     */
+
+    if (!Profile)
+        Profile = getAnalysisIfAvailable<SampleProfile>();
+
+    unsigned BlockSize = SVMTargetMachine::getBlockSize();
+    unsigned Offset = RoundUpToAlignment(BlockOffset, 1 << MF->getAlignment());
+    unsigned Size = measureFunction();
+
+    if (Profile && !Profile->empty() && Offset && Offset < BlockSize
+        && Size <= BlockSize - Offset) {
+        BlockConstPool.clear();
+        BSA.clear();
+        BSA.AddInstrPadding(Offset);
+    } else {
+        emitBlockBegin();
+    }
 
+    FunctionFirstBlock = BlockCount - 1;
+    if (Report)
+        Report->beginFunction(MF->getFunction(), BSA.getByteCount());
     emitFunctionLabelImpl(CurrentFnSym);
 }
 
+unsigned SVMAsmPrinter::measureFunction() const
+{
+    // Bytes this function needs in one block, or ~0 if it has been split
+
+    SVMBlockSizeAccumulator FnBSA;
+    FnBSA.clear();
+
+    for (MachineFunction::const_iterator MBB = MF->begin(), E = MF->end();
+        MBB != E; ++MBB) {
+        FnBSA.InstrAlign(MBB->getAlignment());
+
+        for (MachineBasicBlock::const_iterator I = MBB->begin(), IE = MBB->end();
+            I != IE; ++I) {
+            if (I->getOpcode() == SVM::SPLIT)
+                return ~0u;
+            FnBSA.AddInstr(I);
+        }
+    }
+
+    return RoundUpToAlignment(FnBSA.getByteCount(), sizeof(uint32_t));
+}
+
 void SVMAsmPrinter::EmitConstantPool()
 {
     /*
@@ -125,8 +178,29 @@ void SVMAsmPrinter::EmitConstantPool()
 
 void SVMAsmPrinter::EmitFunctionBodyEnd()
 {
-    // XXX: For now, all functions end a block
+    // Finish this function's code and constants. The next function may
+    // continue in the same block; see EmitFunctionEntryLabel().
     emitBlockEnd();
+    BlockOffset = RoundUpToAlignment(BSA.getByteCount(), sizeof(uint32_t));
+
+    if (Profile)
+        Profile->recordPlacement(MF->getFunction(), FunctionFirstBlock, BlockCount - 1);
+    if (Report)
+        Report->endFunction();
+}
+
+bool SVMAsmPrinter::doFinalization(Module &M)
+{
+    if (Profile)
+        Profile->printWorkingSet(errs());
+
+    // This finishes the object file, which gives the report its addresses
+    bool Result = AsmPrinter::doFinalization(M);
+
+    if (Report)
+        Report->write();
+
+    return Result;
 }
 
 void SVMAsmPrinter::emitFunctionLabelImpl(MCSymbol *Sym)
@@ -140,14 +214,22 @@ void SVMAsmPrinter::emitFunctionLabelImpl(MCSymbol *Sym)
     OutStreamer.EmitSymbolAttribute(Sym, MCSA_ELF_TypeFunction);    
 }
 
-void SVMAsmPrinter::emitBlockBegin()
+void SVMAsmPrinter::emitBlockBegin(bool isSplit)
 {
     BlockConstPool.clear();
     BSA.clear();
+    BlockCount++;
 
     OutStreamer.EmitValueToAlignment(
         SVMTargetMachine::getBlockSize(),
         SVMTargetMachine::getPaddingByte());
+
+    if (Report) {
+        // Label the block, so we can find its address after layout
+        MCSymbol *Label = OutContext.CreateTempSymbol();
+        OutStreamer.EmitLabel(Label);
+        Report->beginBlock(Label, isSplit);
+    }
 }
 
 void SVMAsmPrinter::emitBlockEnd()
@@ -156,12 +238,15 @@ void SVMAsmPrinter::emitBlockEnd()
         SVMTargetMachine::getPaddingByte());    
 
     emitBlockConstPool();
+
+    if (Report)
+        Report->endBlock(BSA);
 }
 
 void SVMAsmPrinter::emitBlockSplit(const MachineInstr *MI)
 {
     emitBlockEnd();
-    emitBlockBegin();
+    emitBlockBegin(true);
 }
 
 void SVMAsmPrinter::EmitMachineConstantPoolValue(MachineConstantPoolValue *MCPV)
@@ -29,16 +29,22 @@
 
 #include "SVMMCInstLower.h"
 #include "SVMBlockSizeAccumulator.h"
+#include "SVMLayoutReport.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/CodeGen/MachineInstr.h"
 
 namespace llvm {
 
+    class SampleProfile;
+    class SVMLayoutReport;
+
     class SVMAsmPrinter : public AsmPrinter {
     public:
         explicit SVMAsmPrinter(TargetMachine &TM, MCStreamer &Streamer)
-            : AsmPrinter(TM, Streamer), CurrentMBB(0) {}
+            : AsmPrinter(TM, Streamer), CurrentMBB(0), Profile(0),
+              BlockCount(0), BlockOffset(0), FunctionFirstBlock(0),
+              Report(SVMLayoutReport::get()) {}
 
         const char *getPassName() const {
             return "SVM Assembly Printer";
@@ -49,6 +55,7 @@ namespace llvm {
         void EmitConstantPool();
         void EmitFunctionBodyEnd();
         void EmitMachineConstantPoolValue(MachineConstantPoolValue *MCPV);
+        bool doFinalization(Module &M);
 
     private:
         struct CPEInfo {
@@ -65,10 +72,20 @@ namespace llvm {
         SVMBlockSizeAccumulator BSA;
         const MachineBasicBlock *CurrentMBB;
 
-        void emitBlockBegin();
+        // With a profile, small functions may share a block
+        SampleProfile *Profile;
+        unsigned BlockCount;
+        unsigned BlockOffset;
+        unsigned FunctionFirstBlock;
+
+        // Optional '-layout-report' output
+        SVMLayoutReport *Report;
+
+        void emitBlockBegin(bool isSplit = false);
         void emitBlockEnd();
         void emitBlockSplit(const MachineInstr *MI);
         void emitFunctionLabelImpl(MCSymbol *Sym);
+        unsigned measureFunction() const;
         void emitBlockOffsetComment();
 
         void emitBlockConstPool();
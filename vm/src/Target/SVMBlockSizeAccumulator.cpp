@@ -78,6 +78,14 @@ void SVMBlockSizeAccumulator::AddInstr(unsigned bytes)
     InstrSizeTotal += bytes;
 }
 
+void SVMBlockSizeAccumulator::AddInstrPadding(unsigned bytes)
+{
+    // Space at the start of the block that's already in use, such as
+    // another function sharing this block.
+    assert((bytes & 3) == 0);
+    InstrSizeTotal += bytes;
+}
+
 void SVMBlockSizeAccumulator::AddInstrPrefix(unsigned bytes)
 {
     InstrPrefixTotal += bytes;
@@ -49,6 +49,10 @@ namespace llvm {
     public:
         void clear();
         unsigned getByteCount() const;
+
+        unsigned getConstByteCount() const {
+            return ConstSizeTotal;
+        }
         
         void describe(raw_ostream &OS);
 
@@ -56,6 +60,7 @@ namespace llvm {
         void AddInstr(unsigned bytes);
         void AddInstrPrefix(unsigned bytes);
         void AddInstrSuffix(unsigned bytes);
+        void AddInstrPadding(unsigned bytes);
         void AddConstantsForInstr(const MachineInstr *MI);
         void AddConstant(const TargetData &TD, const MachineConstantPoolEntry &CPE);
         void AddConstant(unsigned bytes, unsigned align=1);
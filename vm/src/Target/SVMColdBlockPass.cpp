@@ -0,0 +1,290 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Flash blocks are our unit of caching, so code that almost never runs
+ * still takes up cache space when it shares a block with code that runs
+ * all the time. Error paths are the usual culprit: ASSERT failures,
+ * aborts, and branches that the programmer has marked as unlikely.
+ *
+ * This pass finds those cold basic blocks and moves them to the end of
+ * the function. SVMLateFunctionSplitPass then starts a new flash block at
+ * the first cold MBB, and rewrites branches between hot and cold code into
+ * long branches exactly as it would for any other split.
+ *
+ * An MBB is cold if:
+ *
+ *  1) It calls _SYS_abort(). On debug builds, ASSERT logs and then aborts.
+ *
+ *  2) It begins an IR basic block, and every edge into it is marked
+ *     unlikely by branch weight metadata, as from __builtin_expect().
+ *
+ *  3) All of its predecessors are cold, or all of its successors are.
+ *
+ * We only do this for functions that need more than one flash block
+ * anyway. A smaller function gets loaded all at once regardless, so
+ * splitting it would only add long branches. With a sample profile, we
+ * also leave alone any function that was never sampled; ProfileLayout has
+ * already placed it with the rest of the cold code.
+ *
+ * This changes the layout of every large function, and it hasn't yet been
+ * measured against real games, so it only runs with -cold-blocks.
+ */
+
+#include "SVM.h"
+#include "SVMTargetMachine.h"
+#include "SVMMachineFunctionInfo.h"
+#include "SVMBlockSizeAccumulator.h"
+#include "Analysis/SampleProfile.h"
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/InstrTypes.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Metadata.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/Support/CommandLine.h"
+#include <vector>
+using namespace llvm;
+
+static cl::opt<bool> EnableColdBlocks("cold-blocks",
+    cl::desc("Move rarely executed code into separate flash blocks"));
+
+namespace {
+
+    class SVMColdBlockPass : public MachineFunctionPass {
+        SVMTargetMachine& TM;
+
+    public:
+        static char ID;
+        explicit SVMColdBlockPass(SVMTargetMachine &tm)
+            : MachineFunctionPass(ID), TM(tm) {}
+
+        bool runOnMachineFunction(MachineFunction &MF);
+
+        const char *getPassName() const {
+            return "SVM cold block pass";
+        }
+
+    private:
+        typedef SmallPtrSet<const MachineBasicBlock*, 32> MBBSet_t;
+
+        // Edges taken less than 1/UnlikelyRatio of the time are cold
+        static const unsigned UnlikelyRatio = 16;
+
+        // Less cold code than this isn't worth the extra long branches
+        static const unsigned MinColdBytes = 32;
+
+        void findColdBlocks(MachineFunction &MF, MBBSet_t &Cold) const;
+        bool isAbortBlock(const MachineBasicBlock *MBB) const;
+        bool isUnlikelyBlock(const MachineBasicBlock *MBB) const;
+        bool isUnlikelyEdge(const MachineBasicBlock *Pred,
+            const MachineBasicBlock *MBB) const;
+        unsigned measure(MachineFunction &MF, const MBBSet_t *Only) const;
+    };
+
+    char SVMColdBlockPass::ID = 0;
+}
+
+FunctionPass *llvm::createSVMColdBlockPass(SVMTargetMachine &TM)
+{
+    return new SVMColdBlockPass(TM);
+}
+
+template <typename IterT>
+static bool allInSet(IterT I, IterT E,
+    const SmallPtrSet<const MachineBasicBlock*, 32> &Set)
+{
+    if (I == E)
+        return false;
+
+    for (; I != E; ++I)
+        if (!Set.count(*I))
+            return false;
+
+    return true;
+}
+
+bool SVMColdBlockPass::runOnMachineFunction(MachineFunction &MF)
+{
+    if (!EnableColdBlocks)
+        return false;
+
+    // Fits in one block? Then it's cached as a unit, nothing to gain.
+    if (measure(MF, 0) <= TM.getBlockSize())
+        return false;
+
+    // Never sampled? Then the whole function is already cold.
+    SampleProfile *Profile = getAnalysisIfAvailable<SampleProfile>();
+    if (Profile && !Profile->empty() && !Profile->getCount(MF.getFunction()))
+        return false;
+
+    MBBSet_t Cold;
+    findColdBlocks(MF, Cold);
+    if (Cold.empty() || measure(MF, &Cold) < MinColdBytes)
+        return false;
+
+    /*
+     * Move cold blocks to the end, keeping their relative order. Then fix
+     * up terminators wherever we broke a fall-through. updateTerminator()
+     * works from each MBB's successor list, so it's safe to wait until
+     * all blocks have been moved.
+     */
+
+    std::vector<MachineBasicBlock*> ColdList;
+    for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I)
+        if (Cold.count(I))
+            ColdList.push_back(I);
+
+    for (unsigned i = 0, e = ColdList.size(); i != e; ++i)
+        ColdList[i]->moveAfter(&MF.back());
+
+    for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I)
+        I->updateTerminator();
+
+    MF.getInfo<SVMMachineFunctionInfo>()->setFirstColdMBB(ColdList.front());
+    return true;
+}
+
+void SVMColdBlockPass::findColdBlocks(MachineFunction &MF, MBBSet_t &Cold) const
+{
+    const MachineBasicBlock *Entry = &MF.front();
+
+    for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I)
+        if (&*I != Entry && (isAbortBlock(I) || isUnlikelyBlock(I)))
+            Cold.insert(I);
+
+    // Grow the cold region until it stops changing
+
+    bool Changed = !Cold.empty();
+    while (Changed) {
+        Changed = false;
+
+        for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I) {
+            if (&*I == Entry || Cold.count(I))
+                continue;
+
+            if (allInSet(I->pred_begin(), I->pred_end(), Cold) ||
+                allInSet(I->succ_begin(), I->succ_end(), Cold)) {
+                Cold.insert(I);
+                Changed = true;
+            }
+        }
+    }
+}
+
+bool SVMColdBlockPass::isAbortBlock(const MachineBasicBlock *MBB) const
+{
+    // _SYS_abort() is inline syscall #0. This is also what llvm.trap becomes.
+
+    for (MachineBasicBlock::const_iterator I = MBB->begin(), E = MBB->end();
+        I != E; ++I)
+        if (I->getOpcode() == SVM::SYS64_CALL && I->getOperand(0).isImm()
+            && I->getOperand(0).getImm() == 0)
+            return true;
+
+    return false;
+}
+
+bool SVMColdBlockPass::isUnlikelyBlock(const MachineBasicBlock *MBB) const
+{
+    if (MBB->pred_empty())
+        return false;
+
+    for (MachineBasicBlock::const_pred_iterator I = MBB->pred_begin(),
+        E = MBB->pred_end(); I != E; ++I)
+        if (!isUnlikelyEdge(*I, MBB))
+            return false;
+
+    return true;
+}
+
+bool SVMColdBlockPass::isUnlikelyEdge(const MachineBasicBlock *Pred,
+    const MachineBasicBlock *MBB) const
+{
+    /*
+     * Look for branch weights on the IR terminator that this edge came
+     * from. Edges within one IR block, like those ISel creates for selects,
+     * don't have any weights of their own.
+     */
+
+    const BasicBlock *BB = MBB->getBasicBlock();
+    const BasicBlock *PredBB = Pred->getBasicBlock();
+    if (!BB || !PredBB || BB == PredBB)
+        return false;
+
+    const TerminatorInst *TI = PredBB->getTerminator();
+    MDNode *Weights = TI ? TI->getMetadata(LLVMContext::MD_prof) : 0;
+    if (!Weights || Weights->getNumOperands() != TI->getNumSuccessors() + 1)
+        return false;
+
+    MDString *Kind = dyn_cast<MDString>(Weights->getOperand(0));
+    if (!Kind || Kind->getString() != "branch_weights")
+        return false;
+
+    uint64_t Total = 0;
+    uint64_t Taken = 0;
+    bool Found = false;
+
+    for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i) {
+        ConstantInt *Weight = dyn_cast<ConstantInt>(Weights->getOperand(i + 1));
+        if (!Weight)
+            return false;
+
+        Total += Weight->getZExtValue();
+        if (TI->getSuccessor(i) == BB) {
+            Taken += Weight->getZExtValue();
+            Found = true;
+        }
+    }
+
+    return Found && Taken * UnlikelyRatio < Total;
+}
+
+unsigned SVMColdBlockPass::measure(MachineFunction &MF, const MBBSet_t *Only) const
+{
+    /*
+     * Estimate the size of this function's code and constants, optionally
+     * only counting a subset of its MBBs. We run before AlignPass, so this
+     * doesn't include any alignment padding.
+     */
+
+    SVMBlockSizeAccumulator BSA;
+    BSA.clear();
+
+    for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E; ++MBB) {
+        if (Only && !Only->count(MBB))
+            continue;
+
+        for (MachineBasicBlock::iterator I = MBB->begin(), IE = MBB->end();
+            I != IE; ++I)
+            BSA.AddInstr(I);
+    }
+
+    return BSA.getByteCount();
+}
@@ -27,6 +27,7 @@
 #include "SVMELFProgramWriter.h"
 #include "SVMMCAsmBackend.h"
 #include "SVMTargetMachine.h"
+#include "SVMLayoutReport.h"
 #include "llvm/Support/CommandLine.h"
 #include "fastlz.h"
 using namespace llvm;
@@ -58,6 +59,9 @@ void SVMELFProgramWriter::WriteObject(MCAssembler &Asm,
         ML.AllocateSections(Asm, Layout);
     }
 
+    if (SVMLayoutReport *Report = SVMLayoutReport::get())
+        Report->resolveAddresses(Asm, Layout, ML);
+
     // Write header blocks
     writeELFHeader(Asm, Layout);
     for (int S = 0; S < SPS_DEBUG; ++S)
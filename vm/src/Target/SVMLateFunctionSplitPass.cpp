@@ -44,6 +44,9 @@
  * kinds of data, this pass adds a SPLIT pseudo-instruction. By adding the
  * SPLITs and converting near branches to long branches, it becomes trivial
  * for later passes to allocate these functions into multiple blocks.
+ *
+ * We also split before any cold code that SVMColdBlockPass moved to the
+ * end of the function, so that it gets flash blocks of its own.
  */
 
 #include "SVM.h"
@@ -51,6 +54,7 @@
 #include "SVMConstantPoolValue.h"
 #include "SVMBlockSizeAccumulator.h"
 #include "SVMInstrInfo.h"
+#include "SVMMachineFunctionInfo.h"
 #include "llvm/Module.h"
 #include "llvm/MC/MCSymbol.h"
 #include "llvm/MC/MCExpr.h"
@@ -160,6 +164,14 @@ bool SVMLateFunctionSplitPass::visitBasicBlock(MachineFunction::iterator &MBB)
 {
     unsigned bundleSize = TM.getBundleSize();
 
+    // Cold code starts a new block, unless we're already at the start of one
+    SVMMachineFunctionInfo *MFI = MBB->getParent()->getInfo<SVMMachineFunctionInfo>();
+    if (&*MBB == MFI->getFirstColdMBB() && (unsigned)MBB->getNumber() != FirstLocalBB) {
+        MachineBasicBlock::iterator FirstI = MBB->begin();
+        splitBeforeInstruction(MBB, FirstI);
+        return true;
+    }
+
     // All basic blocks must align to a bundle boundary
     BSA.InstrAlign(bundleSize);
 
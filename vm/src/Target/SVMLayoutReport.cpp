@@ -0,0 +1,322 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Micah Elizabeth Scott <micah@misc.name>
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SVM.h"
+#include "SVMInstrInfo.h"
+#include "SVMLayoutReport.h"
+#include "SVMBlockSizeAccumulator.h"
+#include "SVMConstantPoolValue.h"
+#include "SVMMemoryLayout.h"
+#include "SVMSymbolDecoration.h"
+#include "SVMTargetMachine.h"
+#include "Analysis/SampleProfile.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalValue.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineConstantPool.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/MC/MCSymbol.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+using namespace llvm;
+
+cl::opt<std::string> LayoutReportFilename("layout-report",
+    cl::desc("Write a JSON description of each flash block to this file"),
+    cl::value_desc("filename"));
+
+
+SVMLayoutReport *SVMLayoutReport::get()
+{
+    static SVMLayoutReport *Instance;
+
+    if (LayoutReportFilename.empty())
+        return 0;
+    if (!Instance)
+        Instance = new SVMLayoutReport();
+    return Instance;
+}
+
+void SVMLayoutReport::beginBlock(MCSymbol *Label, bool isSplit)
+{
+    Block B;
+    B.Label = Label;
+    B.Address = 0;
+    B.isSplit = isSplit;
+    B.Bytes = 0;
+    B.ConstBytes = 0;
+    B.LongBranches = 0;
+    B.IndirectCalls = 0;
+    Blocks.push_back(B);
+
+    // A split block continues the current function
+    if (inFunction) {
+        FunctionPart P = { unsigned(Functions.size() - 1), 0 };
+        Blocks.back().Parts.push_back(P);
+    }
+}
+
+void SVMLayoutReport::endBlock(const SVMBlockSizeAccumulator &BSA)
+{
+    /*
+     * The accumulator covers everything in this block so far, including
+     * earlier functions that share it. Constants are only counted for
+     * the current function, since each one emits its own pool.
+     */
+
+    Block &B = Blocks.back();
+    B.Bytes = BSA.getByteCount();
+    B.ConstBytes += BSA.getConstByteCount();
+}
+
+void SVMLayoutReport::beginFunction(const Function *F, unsigned Offset)
+{
+    assert(!Blocks.empty());
+
+    FunctionInfo FI;
+    FI.Name = SampleProfile::demangle(F->getName().str());
+    FI.FirstBlock = currentBlock();
+    FI.LastBlock = currentBlock();
+    Functions.push_back(FI);
+
+    FunctionBlocks[F->getName().str()] = currentBlock();
+    inFunction = true;
+
+    FunctionPart P = { unsigned(Functions.size() - 1), Offset };
+    Blocks.back().Parts.push_back(P);
+}
+
+void SVMLayoutReport::endFunction()
+{
+    Functions.back().LastBlock = currentBlock();
+    inFunction = false;
+}
+
+void SVMLayoutReport::addBasicBlock(const MachineBasicBlock *MBB)
+{
+    LabelBlocks[MBB->getSymbol()] = currentBlock();
+}
+
+void SVMLayoutReport::addInstr(const MachineInstr *MI)
+{
+    switch (MI->getOpcode()) {
+
+    case SVM::SYS64_CALL:
+        Blocks.back().Syscalls.push_back(MI->getOperand(0).getImm());
+        break;
+
+    case SVM::CALL:
+    case SVM::TAIL_CALL:
+        addCall(MI);
+        break;
+
+    case SVM::CALLr:
+    case SVM::TAIL_CALLr:
+        Blocks.back().IndirectCalls++;
+        break;
+
+    case SVM::LB:
+        addLongBranch(MI);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void SVMLayoutReport::addCall(const MachineInstr *MI)
+{
+    /*
+     * Calls go through the constant pool, to a decorated alias of the
+     * callee. Syscalls above #63 look like calls too.
+     */
+
+    const MachineOperand &MO = MI->getOperand(0);
+    if (!MO.isCPI())
+        return;
+
+    const MachineConstantPoolEntry &CPE =
+        MI->getParent()->getParent()->getConstantPool()->getConstants()[MO.getIndex()];
+    if (CPE.isMachineConstantPoolEntry())
+        return;
+
+    const GlobalValue *GV = dyn_cast<GlobalValue>(CPE.Val.ConstVal);
+    if (!GV)
+        return;
+
+    SVMDecorations Deco;
+    StringRef Name = Deco.Decode(GV->getName());
+
+    if (Deco.isSys) {
+        Blocks.back().Syscalls.push_back(Deco.sysNumber);
+    } else {
+        Edge E = { currentBlock(), 0, Name.str() };
+        Edges.push_back(E);
+    }
+}
+
+void SVMLayoutReport::addLongBranch(const MachineInstr *MI)
+{
+    Blocks.back().LongBranches++;
+
+    const MachineOperand &MO = MI->getOperand(0);
+    if (!MO.isCPI())
+        return;
+
+    const MachineConstantPoolEntry &CPE =
+        MI->getParent()->getParent()->getConstantPool()->getConstants()[MO.getIndex()];
+    if (!CPE.isMachineConstantPoolEntry())
+        return;
+
+    const SVMConstantPoolValue *SCPV =
+        static_cast<const SVMConstantPoolValue*>(CPE.Val.MachineCPVal);
+    if (!SCPV->isMachineBasicBlock())
+        return;
+
+    const MachineBasicBlock *MBB = cast<SVMConstantPoolMBB>(SCPV)->getMBB();
+    Edge E = { currentBlock(), MBB->getSymbol(), "" };
+    Edges.push_back(E);
+}
+
+void SVMLayoutReport::resolveEdges()
+{
+    for (unsigned i = 0; i < Edges.size(); ++i) {
+        const Edge &E = Edges[i];
+        unsigned To;
+
+        if (E.Label) {
+            std::map<const MCSymbol*, unsigned>::const_iterator I = LabelBlocks.find(E.Label);
+            if (I == LabelBlocks.end())
+                continue;
+            To = I->second;
+        } else {
+            // Calls to functions we didn't generate code for are ignored
+            std::map<std::string, unsigned>::const_iterator I = FunctionBlocks.find(E.Callee);
+            if (I == FunctionBlocks.end())
+                continue;
+            To = I->second;
+        }
+
+        if (To != E.From) {
+            Blocks[E.From].Outbound.insert(To);
+            Blocks[To].Inbound.insert(E.From);
+        }
+    }
+}
+
+void SVMLayoutReport::resolveAddresses(const MCAssembler &Asm,
+    const MCAsmLayout &Layout, const SVMMemoryLayout &ML)
+{
+    for (unsigned i = 0; i < Blocks.size(); ++i)
+        Blocks[i].Address = ML.getSymbol(Asm, Layout, Blocks[i].Label, false).Value;
+    hasAddresses = true;
+}
+
+void SVMLayoutReport::writeString(raw_ostream &OS, const std::string &S)
+{
+    OS << '"';
+    for (unsigned i = 0; i < S.size(); ++i) {
+        char c = S[i];
+        if (c == '"' || c == '\\')
+            OS << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+            OS << "\\u00" << hexdigit(c >> 4) << hexdigit(c & 0xF);
+        else
+            OS << c;
+    }
+    OS << '"';
+}
+
+void SVMLayoutReport::writeList(raw_ostream &OS, const std::set<unsigned> &L)
+{
+    OS << '[';
+    for (std::set<unsigned>::const_iterator I = L.begin(), E = L.end(); I != E; ++I)
+        OS << (I == L.begin() ? "" : ", ") << *I;
+    OS << ']';
+}
+
+void SVMLayoutReport::write()
+{
+    resolveEdges();
+
+    std::string Error;
+    raw_fd_ostream OS(LayoutReportFilename.c_str(), Error);
+    if (!Error.empty())
+        report_fatal_error("Can't write layout report \"" +
+            Twine(LayoutReportFilename) + "\": " + Error);
+
+    const unsigned BlockSize = SVMTargetMachine::getBlockSize();
+
+    OS << "{\n  \"blockSize\": " << BlockSize << ",\n  \"blocks\": [";
+
+    for (unsigned i = 0; i < Blocks.size(); ++i) {
+        const Block &B = Blocks[i];
+
+        OS << (i ? "," : "") << "\n    {\"index\": " << i;
+        if (hasAddresses)
+            OS << ", \"address\": \"0x" << Twine::utohexstr(B.Address) << "\"";
+        OS << ", \"split\": " << (B.isSplit ? "true" : "false")
+           << ", \"bytes\": " << B.Bytes
+           << ", \"codeBytes\": " << (B.Bytes - B.ConstBytes)
+           << ", \"constBytes\": " << B.ConstBytes
+           << ", \"freeBytes\": " << (BlockSize - B.Bytes)
+           << ", \"utilization\": " << (B.Bytes * 100 / BlockSize)
+           << ",\n     \"functions\": [";
+
+        for (unsigned j = 0; j < B.Parts.size(); ++j) {
+            OS << (j ? ", " : "") << "{\"name\": ";
+            writeString(OS, Functions[B.Parts[j].Function].Name);
+            OS << ", \"offset\": " << B.Parts[j].Offset << "}";
+        }
+
+        OS << "],\n     \"longBranches\": " << B.LongBranches
+           << ", \"indirectCalls\": " << B.IndirectCalls
+           << ", \"syscalls\": [";
+        for (unsigned j = 0; j < B.Syscalls.size(); ++j)
+            OS << (j ? ", " : "") << B.Syscalls[j];
+
+        OS << "],\n     \"inbound\": ";
+        writeList(OS, B.Inbound);
+        OS << ", \"outbound\": ";
+        writeList(OS, B.Outbound);
+        OS << "}";
+    }
+
+    OS << "\n  ],\n  \"functions\": [";
+
+    for (unsigned i = 0; i < Functions.size(); ++i) {
+        const FunctionInfo &FI = Functions[i];
+        OS << (i ? "," : "") << "\n    {\"name\": ";
+        writeString(OS, FI.Name);
+        OS << ", \"firstBlock\": " << FI.FirstBlock
+           << ", \"lastBlock\": " << FI.LastBlock
+           << ", \"blocks\": " << (FI.LastBlock - FI.FirstBlock + 1) << "}";
+    }
+
+    OS << "\n  ]\n}\n";
+}
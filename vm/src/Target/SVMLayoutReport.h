@@ -0,0 +1,135 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Micah Elizabeth Scott <micah@misc.name>
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The SVMLayoutReport describes how code was packed into flash blocks,
+ * for the '-layout-report' option. SVMAsmPrinter tells us about each
+ * block, function, and interesting instruction as it emits them. After
+ * layout, SVMELFProgramWriter fills in the final block addresses.
+ *
+ * The report is a JSON file listing every block with its functions,
+ * space used by code and literal pools, long branches, syscall sites,
+ * and the other blocks it calls or branches to and from.
+ */
+
+#ifndef SVM_LAYOUTREPORT_H
+#define SVM_LAYOUTREPORT_H
+
+#include "llvm/Support/raw_ostream.h"
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+    class Function;
+    class MachineInstr;
+    class MachineBasicBlock;
+    class MCAssembler;
+    class MCAsmLayout;
+    class MCSymbol;
+    class SVMBlockSizeAccumulator;
+    class SVMMemoryLayout;
+
+    class SVMLayoutReport {
+    public:
+        // Returns the report, or 0 if none was requested
+        static SVMLayoutReport *get();
+
+        void beginBlock(MCSymbol *Label, bool isSplit);
+        void endBlock(const SVMBlockSizeAccumulator &BSA);
+
+        void beginFunction(const Function *F, unsigned Offset);
+        void endFunction();
+
+        void addBasicBlock(const MachineBasicBlock *MBB);
+        void addInstr(const MachineInstr *MI);
+
+        void resolveAddresses(const MCAssembler &Asm,
+            const MCAsmLayout &Layout, const SVMMemoryLayout &ML);
+
+        void write();
+
+    private:
+        struct FunctionInfo {
+            std::string Name;
+            unsigned FirstBlock;
+            unsigned LastBlock;
+        };
+
+        struct FunctionPart {
+            unsigned Function;      // Index in Functions
+            unsigned Offset;
+        };
+
+        struct Block {
+            MCSymbol *Label;
+            uint32_t Address;
+            bool isSplit;
+            unsigned Bytes;
+            unsigned ConstBytes;
+            unsigned LongBranches;
+            unsigned IndirectCalls;
+            std::vector<FunctionPart> Parts;
+            std::vector<unsigned> Syscalls;
+            std::set<unsigned> Inbound;
+            std::set<unsigned> Outbound;
+        };
+
+        // A call or long branch, resolved once we know where everything went
+        struct Edge {
+            unsigned From;
+            const MCSymbol *Label;  // Long branch target
+            std::string Callee;     // Call target
+        };
+
+        std::vector<Block> Blocks;
+        std::vector<FunctionInfo> Functions;
+        std::vector<Edge> Edges;
+        std::map<const MCSymbol*, unsigned> LabelBlocks;
+        std::map<std::string, unsigned> FunctionBlocks;
+        bool hasAddresses;
+        bool inFunction;
+
+        SVMLayoutReport() : hasAddresses(false), inFunction(false) {}
+
+        unsigned currentBlock() const {
+            return Blocks.size() - 1;
+        }
+
+        void addCall(const MachineInstr *MI);
+        void addLongBranch(const MachineInstr *MI);
+        void resolveEdges();
+
+        static void writeString(raw_ostream &OS, const std::string &S);
+        static void writeList(raw_ostream &OS, const std::set<unsigned> &L);
+    };
+
+}  // end namespace
+
+#endif
@@ -33,9 +33,19 @@ namespace llvm {
 
     class SVMMachineFunctionInfo : public MachineFunctionInfo {
     public:
-        SVMMachineFunctionInfo() {}
-        explicit SVMMachineFunctionInfo(MachineFunction &MF) {}
+        SVMMachineFunctionInfo() : FirstColdMBB(0) {}
+        explicit SVMMachineFunctionInfo(MachineFunction &MF) : FirstColdMBB(0) {}
 
+        /*
+         * Set by SVMColdBlockPass if it moved rarely-executed code to the
+         * end of this function. SVMLateFunctionSplitPass starts a new flash
+         * block here, so the cold code never shares a block with hot code.
+         */
+        MachineBasicBlock *getFirstColdMBB() const { return FirstColdMBB; }
+        void setFirstColdMBB(MachineBasicBlock *MBB) { FirstColdMBB = MBB; }
+
+    private:
+        MachineBasicBlock *FirstColdMBB;
     };
 
 }
@@ -52,6 +52,10 @@ bool SVMTargetMachine::addInstSelector(PassManagerBase &PM, CodeGenOpt::Level Op
 
 bool SVMTargetMachine::addPreEmitPass(PassManagerBase &PM, CodeGenOpt::Level OptLevel)
 {
+    // Move cold code out of the way before we start measuring and
+    // splitting. This adds branches, so it comes before AlignPass too.
+    PM.add(createSVMColdBlockPass(*this));
+
     // The Alignment pass may change the size of functions by inserting no-ops,
     // so it must come before the LateFunctionSplitPass.
     PM.add(createSVMAlignPass(*this));
@@ -67,6 +71,12 @@ uint32_t SVMTargetMachine::getBlockSize()
     return 256;
 }
 
+uint32_t SVMTargetMachine::getBlockCacheSize()
+{
+    // Number of flash blocks the base's runtime can keep cached at once
+    return 64;
+}
+
 uint32_t SVMTargetMachine::getBundleSize()
 {
     return 4;
@@ -53,6 +53,7 @@ public:
                      Reloc::Model RM, CodeModel::Model CM);
 
     static uint32_t getBlockSize();
+    static uint32_t getBlockCacheSize();
     static uint32_t getBundleSize();
     static uint32_t getFlashBase();
     static uint32_t getRAMBase();
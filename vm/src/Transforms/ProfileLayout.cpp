@@ -0,0 +1,252 @@
+/* -*- mode: C; c-basic-offset: 4; intent-tabs-mode: nil -*-
+ *
+ * Sifteo VM (SVM) Target for LLVM
+ *
+ * Copyright <c> 2012 Sifteo, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Profile-guided function ordering. Code runs out of a small cache of
+ * flash blocks, so we want the functions that run most to sit in as few
+ * blocks as possible, and functions that call each other to sit next to
+ * each other where code generation can pack them into the same block.
+ *
+ * This is a simplified form of Pettis and Hansen's procedure ordering.
+ * Call edges from the module's static call graph, between two sampled
+ * functions, are weighted by the smaller of their sample counts, and we
+ * merge chains of functions along the heaviest edges first. Unsampled
+ * callees never join a hot chain, even if a hot function calls them. Chains with samples are then sorted by
+ * samples per instruction, and go first. Everything else keeps its
+ * original order.
+ *
+ * Functions are emitted in module order, so reordering the module's
+ * function list is all it takes. Without a profile, this does nothing.
+ */
+
+#include "Analysis/SampleProfile.h"
+#include "llvm/Pass.h"
+#include "llvm/Module.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Support/CallSite.h"
+#include <algorithm>
+#include <vector>
+#include <map>
+using namespace llvm;
+
+namespace llvm {
+    ModulePass *createProfileLayoutPass();
+}
+
+namespace {
+    class ProfileLayoutPass : public ModulePass {
+    public:
+        static char ID;
+        ProfileLayoutPass()
+            : ModulePass(ID) {}
+
+        virtual bool runOnModule(Module &M);
+
+        virtual const char *getPassName() const {
+            return "Profile-guided function layout";
+        }
+
+        void getAnalysisUsage(AnalysisUsage &AU) const {
+            AU.addRequired<SampleProfile>();
+            AU.setPreservesAll();
+        }
+
+    private:
+        struct Node {
+            Function *F;
+            uint64_t Count;
+            unsigned Size;
+            unsigned Chain;
+        };
+
+        struct Chain {
+            std::vector<unsigned> Members;
+            uint64_t Count;
+            unsigned Size;
+        };
+
+        struct Edge {
+            uint64_t Weight;
+            unsigned Caller;
+            unsigned Callee;
+
+            bool operator< (const Edge &other) const {
+                return Weight > other.Weight;
+            }
+        };
+
+        struct ChainDensityOrder {
+            const std::vector<Chain> &Chains;
+            ChainDensityOrder(const std::vector<Chain> &C) : Chains(C) {}
+
+            bool operator() (unsigned a, unsigned b) const {
+                // Compare Count/Size without dividing
+                return Chains[a].Count * Chains[b].Size > Chains[b].Count * Chains[a].Size;
+            }
+        };
+
+        std::vector<Node> Nodes;
+        std::vector<Chain> Chains;
+
+        void collectEdges(std::vector<Edge> &Edges);
+        void mergeChains(unsigned a, unsigned b);
+    };
+}
+
+char ProfileLayoutPass::ID = 0;
+
+ModulePass *llvm::createProfileLayoutPass()
+{
+    return new ProfileLayoutPass();
+}
+
+bool ProfileLayoutPass::runOnModule(Module &M)
+{
+    SampleProfile &Profile = getAnalysis<SampleProfile>();
+    if (Profile.empty())
+        return false;
+
+    Nodes.clear();
+    Chains.clear();
+
+    // One node and one chain per defined function, in program order
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+        if (F->isDeclaration())
+            continue;
+
+        Node N;
+        N.F = F;
+        N.Count = Profile.getCount(F);
+        N.Size = 0;
+        N.Chain = Chains.size();
+        for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+            N.Size += BB->size();
+
+        Chain C;
+        C.Members.push_back(Nodes.size());
+        C.Count = N.Count;
+        C.Size = std::max(1u, N.Size);
+
+        Nodes.push_back(N);
+        Chains.push_back(C);
+    }
+
+    // Join chains along the heaviest call edges first
+    std::vector<Edge> Edges;
+    collectEdges(Edges);
+    std::stable_sort(Edges.begin(), Edges.end());
+
+    for (std::vector<Edge>::iterator I = Edges.begin(), E = Edges.end(); I != E; ++I)
+        mergeChains(Nodes[I->Caller].Chain, Nodes[I->Callee].Chain);
+
+    // Hottest chains first, by samples per instruction
+    std::vector<unsigned> HotChains;
+    for (unsigned i = 0; i < Chains.size(); ++i)
+        if (Chains[i].Count)
+            HotChains.push_back(i);
+    std::stable_sort(HotChains.begin(), HotChains.end(), ChainDensityOrder(Chains));
+
+    // Move functions to the end of the list in their new order
+    Module::FunctionListType &FL = M.getFunctionList();
+    std::vector<bool> Placed(Nodes.size());
+
+    for (unsigned i = 0; i < HotChains.size(); ++i) {
+        const std::vector<unsigned> &Members = Chains[HotChains[i]].Members;
+        for (unsigned j = 0; j < Members.size(); ++j) {
+            FL.splice(FL.end(), FL, Nodes[Members[j]].F);
+            Placed[Members[j]] = true;
+        }
+    }
+
+    for (unsigned i = 0; i < Nodes.size(); ++i)
+        if (!Placed[i])
+            FL.splice(FL.end(), FL, Nodes[i].F);
+
+    return !HotChains.empty();
+}
+
+void ProfileLayoutPass::collectEdges(std::vector<Edge> &Edges)
+{
+    /*
+     * Static call sites between sampled functions. An edge is only as
+     * hot as its colder end, so a hot caller can't drag one-time init or
+     * error handling into its chain.
+     */
+
+    std::map<Function*, unsigned> Index;
+    for (unsigned i = 0; i < Nodes.size(); ++i)
+        Index[Nodes[i].F] = i;
+
+    std::map<std::pair<unsigned, unsigned>, uint64_t> Weights;
+
+    for (unsigned i = 0; i < Nodes.size(); ++i) {
+        Function *F = Nodes[i].F;
+        for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+            for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+                CallSite CS(cast<Value>(I));
+                if (!CS)
+                    continue;
+
+                std::map<Function*, unsigned>::iterator Callee =
+                    Index.find(CS.getCalledFunction());
+                if (Callee == Index.end() || Callee->second == i)
+                    continue;
+
+                uint64_t W = std::min(Nodes[i].Count, Nodes[Callee->second].Count);
+                if (W)
+                    Weights[std::make_pair(i, Callee->second)] += W;
+            }
+    }
+
+    for (std::map<std::pair<unsigned, unsigned>, uint64_t>::iterator
+        I = Weights.begin(), E = Weights.end(); I != E; ++I) {
+        Edge Ed = { I->second, I->first.first, I->first.second };
+        Edges.push_back(Ed);
+    }
+}
+
+void ProfileLayoutPass::mergeChains(unsigned a, unsigned b)
+{
+    // Append chain 'b' to chain 'a', callee after caller
+
+    if (a == b)
+        return;
+
+    Chain &A = Chains[a];
+    Chain &B = Chains[b];
+
+    for (unsigned i = 0; i < B.Members.size(); ++i) {
+        Nodes[B.Members[i]].Chain = a;
+        A.Members.push_back(B.Members[i]);
+    }
+
+    A.Count += B.Count;
+    A.Size += B.Size;
+
+    B.Members.clear();
+    B.Count = 0;
+    B.Size = 0;
+}
@@ -61,6 +61,8 @@
 #include "llvm/Transforms/IPO.h"
 #include "Analysis/CounterAnalysis.h"
 #include "Analysis/UUIDGenerator.h"
+#include "Analysis/SampleProfile.h"
+#include "Support/LinkCache.h"
 #include "Target/SVMTargetMachine.h"
 #include <memory>
 using namespace llvm;
@@ -76,6 +78,7 @@ extern "C" void LLVMInitializeSVMTargetInfo();
 namespace llvm {
     ModulePass *createInlineGlobalCtorsPass();
     ModulePass *createMetadataCollectorPass();
+    ModulePass *createProfileLayoutPass();
     BasicBlockPass *createEarlyLTIPass();
     BasicBlockPass *createLateLTIPass();
     BasicBlockPass *createMisalignStackPass();
@@ -167,6 +170,13 @@ cl::opt<bool> AsmOutput("asm",
 cl::opt<bool> NoVerify("disable-verify", cl::Hidden,
     cl::desc("Do not verify input module"));
 
+static cl::opt<std::string>
+CacheDir("cache", cl::desc("Reuse output from earlier links with identical inputs"),
+    cl::value_desc("directory"));
+
+extern cl::opt<std::string> ProfileFilename;
+extern cl::opt<std::string> LayoutReportFilename;
+
 
 static void PrepareModule(LLVMContext& Context, Module *M)
 {
@@ -248,11 +258,36 @@ static std::auto_ptr<Module> LoadInputs(const char *argv0, LLVMContext &Context)
     return Composite;
 }
 
-static tool_output_file *GetOutputStream()
+static LinkCache *OpenLinkCache(const char *argv0, int argc, char **argv)
 {
-    if (OutputFilename.empty())
-        OutputFilename = AsmOutput ? "program.s" : "program.elf";
+    /*
+     * Hash everything that could affect our output. If anything can't
+     * be read, skip the cache and let the normal link report the error.
+     */
+
+    LinkCache *Cache = new LinkCache(CacheDir);
+    bool OK = true;
+
+    sys::Path Exe = sys::Path::GetMainExecutable(argv0, (void*) &OpenLinkCache);
+    OK = OK && !Exe.isEmpty() && Cache->addFile(Exe.str());
+    Cache->addString(TOSTRING(SDK_VERSION));
+
+    for (int i = 0; i < argc; ++i)
+        Cache->addString(argv[i]);
+
+    for (unsigned i = 0; i < InputFilenames.size(); ++i)
+        OK = OK && Cache->addFile(InputFilenames[i]);
+
+    if (!OK) {
+        delete Cache;
+        return 0;
+    }
 
+    return Cache;
+}
+
+static tool_output_file *GetOutputStream()
+{
     std::string error;
     unsigned OpenFlags = AsmOutput ? 0 : raw_fd_ostream::F_Binary;
     tool_output_file *FDOut =
@@ -336,6 +371,10 @@ static void AddPasses(PassManagerBase &PM,
 
     // Just before code generation, make all stack allocations static.
     PM.add(createStaticAllocaPass());
+
+    // If we have a '-profile', put hot functions together. This must be
+    // last, since functions are generated in the order it leaves them.
+    PM.add(createProfileLayoutPass());
 }
 
 int main(int argc, char **argv)
@@ -361,6 +400,7 @@ int main(int argc, char **argv)
     initializeTarget(Registry);
     initializeCounterAnalysisPass(Registry);
     initializeUUIDGeneratorPass(Registry);
+    initializeSampleProfilePass(Registry);
 
     // Initialize targets first, so that --version shows registered targets.
     LLVMInitializeSVMAsmPrinter();
@@ -369,6 +409,25 @@ int main(int argc, char **argv)
     LLVMInitializeSVMTargetInfo();
 
     cl::ParseCommandLineOptions(argc, argv, HelpText);
+
+    if (OutputFilename.empty())
+        OutputFilename = AsmOutput ? "program.s" : "program.elf";
+
+    /*
+     * Skip the whole link if we've already done this one. The profile's
+     * working set report and the layout report are written during code
+     * generation, so a cached link can't produce them; link in full.
+     */
+    OwningPtr<LinkCache> Cache;
+    bool HasSideOutputs = !ProfileFilename.empty() || !LayoutReportFilename.empty();
+    if (!CacheDir.empty() && !HasSideOutputs) {
+        Cache.reset(OpenLinkCache(argv[0], argc, argv));
+        if (Cache && Cache->fetch(OutputFilename)) {
+            if (Verbose)
+                errs() << "Using cached output '" << Cache->getPath() << "'\n";
+            return 0;
+        }
+    }
     
     // Load and link the input modules
     std::auto_ptr<Module> Composite = LoadInputs(argv[0], Context);
@@ -441,5 +500,11 @@ int main(int argc, char **argv)
     // Success!
     Out->keep();
 
+    if (Cache) {
+        FOS.flush();
+        Out->os().close();
+        Cache->store(OutputFilename);
+    }
+
     return 0;
 }